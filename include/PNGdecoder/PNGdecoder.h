@@ -1,14 +1,25 @@
 #ifndef PNGdecoder_H
 #define PNGdecoder_H
 
+//The library builds with hidden symbols, only the declarations below are exported
+#ifdef __GNUC__
+    #define PNGdecoder_EXPORT __attribute__((visibility("default")))
+#else
+    #define PNGdecoder_EXPORT
+#endif // __GNUC__
+
 #ifdef PNGdecoder_IMPORT
-    #define EXTERN
+    #define EXTERN PNGdecoder_EXPORT
 #else
-    #define EXTERN extern
+    #define EXTERN extern PNGdecoder_EXPORT
 #endif // PNGdecoder_IMPORT
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
 /*      COMMON CONSTANTS        */
 
 
@@ -25,6 +36,14 @@ typedef enum _PNGdecoder_result {
     PNGDECODER_INVALID_IHDR,
     PNGDECODER_INVALID_PLTE,
     PNGDECODER_ZLIB_ERROR,
+    PNGDECODER_INVALID_FILTER,
+    PNGDECODER_INVALID_APNG,
+    PNGDECODER_ANIMATION_END,
+    PNGDECODER_IN_PROGRESS,
+    PNGDECODER_IMAGE_TOO_LARGE,
+    PNGDECODER_LIMIT_EXCEEDED,          //One of the decode limits of the options
+    PNGDECODER_BUDGET_EXCEEDED,         //The process memory budget, see PNGdecoder_set_memory_budget
+    PNGDECODER_MEMORY_ERROR,            //An allocation failed
     PNGDECODER_RESULTS_COUNT
 } PNGdecoder_result;
 
@@ -40,6 +59,59 @@ typedef enum _PNGdecoder_raster_types {
     PNGDECODER_RASTER_RGBA_16
 } PNGdecoder_raster_types;
 
+typedef enum _PNGdecoder_inflate_backends {
+    PNGDECODER_INFLATE_ZLIB,        //System zlib, reference implementation
+    PNGDECODER_INFLATE_BUILTIN,     //Self-contained inflater tuned for PNG row consumption
+    PNGDECODER_INFLATE_BACKENDS_COUNT
+} PNGdecoder_inflate_backends;
+
+typedef enum _PNGdecoder_cpu_levels {
+    PNGDECODER_CPU_SCALAR,          //Portable C kernels
+    PNGDECODER_CPU_SSE2,            //x86-64 baseline
+    PNGDECODER_CPU_SSE4,            //SSSE3, SSE4.1 and PCLMUL
+    PNGDECODER_CPU_AVX2,
+    PNGDECODER_CPU_LEVELS_COUNT
+} PNGdecoder_cpu_levels;
+
+typedef enum _PNGdecoder_strip16_modes {
+    PNGDECODER_STRIP16_NONE,        //16 bit images decode to 16 bit rasters
+    PNGDECODER_STRIP16_HIGH_BYTE,   //Keep the most significant byte of each sample
+    PNGDECODER_STRIP16_ROUND        //Nearest 8 bit value, round(sample * 255 / 65535)
+} PNGdecoder_strip16_modes;
+
+typedef enum _PNGdecoder_tensor_types {
+    PNGDECODER_TENSOR_U8,           //Samples as they are, 16 bit ones rounded to 8 bits
+    PNGDECODER_TENSOR_F32,          //Normalized, (sample / max - mean) / std
+    PNGDECODER_TENSOR_F16           //Idem, IEEE 754 half precision stored as uint16_t
+} PNGdecoder_tensor_types;
+
+typedef enum _PNGdecoder_filter_strategies {
+    PNGDECODER_FILTER_NONE,         //Every row with the same filter type
+    PNGDECODER_FILTER_SUB,
+    PNGDECODER_FILTER_UP,
+    PNGDECODER_FILTER_AVERAGE,
+    PNGDECODER_FILTER_PAETH,
+    PNGDECODER_FILTER_ADAPTIVE,     //Per row, the filter type whose output has the smallest sum of absolute values
+    PNGDECODER_FILTER_FAST          //Idem between None and Up only, the fastest to unfilter
+} PNGdecoder_filter_strategies;
+
+typedef enum _PNGdecoder_io_modes {
+    PNGDECODER_IO_AUTO,             //io_uring when the kernel has it, blocking reads on a thread pool otherwise
+    PNGDECODER_IO_URING,
+    PNGDECODER_IO_THREADS
+} PNGdecoder_io_modes;
+
+typedef enum _PNGdecoder_dispose_ops {
+    PNGDECODER_DISPOSE_NONE,        //Frame region left as is for the next frame
+    PNGDECODER_DISPOSE_BACKGROUND,  //Cleared to transparent black
+    PNGDECODER_DISPOSE_PREVIOUS     //Restored to its content before the frame
+} PNGdecoder_dispose_ops;
+
+typedef enum _PNGdecoder_blend_ops {
+    PNGDECODER_BLEND_SOURCE,        //Frame pixels replace the canvas ones
+    PNGDECODER_BLEND_OVER           //Alpha composited over the canvas
+} PNGdecoder_blend_ops;
+
 
 /*      MAIN DATA TYPES     */
 
@@ -47,6 +119,159 @@ typedef enum _PNGdecoder_raster_types {
 //      Main structure handled by the module
 typedef struct _PNGdecoder_PNG PNGdecoder_PNG;
 
+//      Caller owned tensor the decoder writes samples into, initialize with PNGdecoder_tensor_init
+typedef struct _PNGdecoder_tensor {
+    void * data;                    //channels * height * width elements
+    PNGdecoder_tensor_types type;
+    uint8_t planar;                 //1: one plane per channel(CHW), 0: interleaved(HWC)
+    uint8_t channels;               //1 or 2(grayscale sources only), 3 or 4; 0 for the channels of the image
+    uint32_t width;                 //Expected image size, 0 to accept any; both required by PNGdecoder_decode_tensor_batch
+    uint32_t height;
+    uint32_t row_stride;            //Elements from a row to the next, 0 for width * channels(width when planar, planes
+                                    //then take height * row_stride), larger to write into a window of a wider tensor
+    float mean[4];                  //Per output channel normalization, float types only
+    float std[4];
+} PNGdecoder_tensor;
+
+//      Receives the decoded rows in order, laid out as in the raster type of the image
+//      Argument 1: user pointer, Argument 2: row index, Argument 3: row pixels, valid during the call
+typedef void (*PNGdecoder_row_callback)(void *, uint32_t, const void *);
+
+//      Receives the tiles of a tiled decode in tile-major order, each one as soon as it is complete
+//      Argument 1: user pointer, Arguments 2 and 3: tile column and row, Argument 4: tile pixels, valid during the call
+typedef void (*PNGdecoder_tile_callback)(void *, uint32_t, uint32_t, const void *);
+
+//      budget_timeout of a decode waiting as long as it takes
+#define PNGDECODER_WAIT_FOREVER 0xffffffff
+
+//      Decode options, initialize with PNGdecoder_options_init before changing single fields
+typedef struct _PNGdecoder_options {
+    PNGdecoder_strip16_modes strip16;   //16 bit images decode straight to the 8 bit raster type, never allocating the 16 bit one
+    PNGdecoder_tensor * tensor;         //If set, samples go straight into the tensor and no raster is allocated
+    uint8_t premultiply;                //1: color samples of images with alpha(including palette + tRNS) come out multiplied by alpha
+    const char * raster_file;           //If set, the raster is decoded into this file, mapped shared instead of allocated; the
+                                        //file is then an uncompressed sidecar(see PNGdecoder_openPNG_sidecar)
+    PNGdecoder_row_callback row_callback;   //If set, rows go to the callback as they are decoded and no raster is kept unless
+                                        //raster_file is set too; interlaced images still need a whole raster until the last pass
+    void * row_user;                    //Given to the row callback
+    uint32_t tile_width;                //If both set(at most 65536), the raster is laid out in tiles instead of rows, see
+    uint32_t tile_height;               //PNGdecoder_get_tile; not with a tensor, raster file or row callback
+    PNGdecoder_tile_callback tile_callback; //If set, tiles go to the callback and no raster is kept; without interlacing
+                                        //only one band of tiles is held
+    void * tile_user;                   //Given to the tile callback
+    uint32_t band_threads;              //Threads inflating the bands of images with a restart index(iDOT or prIX chunk),
+                                        //0 for one per online CPU, 1 to always decode serially
+    uint64_t max_pixels;                //Decode limits, 0 for none, checked once the chunks are read and before anything
+    uint64_t max_decoded_bytes;         //large is allocated, failing with PNGDECODER_LIMIT_EXCEEDED: width * height, bytes
+    uint32_t max_ratio;                 //of the raster whatever the output, inflated image data bytes per compressed byte
+    uint64_t max_memory;                //(decompression bombs), predicted peak heap(see PNGdecoder_predict_memory)
+    uint32_t budget_timeout;            //Milliseconds to wait for the process memory budget before failing with
+                                        //PNGDECODER_BUDGET_EXCEEDED, 0 to fail at once; PNGDECODER_WAIT_FOREVER by default
+    uint8_t pixel_hash;                 //1: each row is hashed as it is decoded, while still in cache, into a hash of the
+                                        //pixels whatever the output, see PNGdecoder_get_pixel_hash
+    uint8_t analyze;                    //1: the rows are analysed as they are decoded, whatever the output, see
+                                        //PNGdecoder_get_analysis
+    uint8_t auto_compact;               //1: analyze, then shrink the raster to the narrowest raster type holding exactly
+                                        //the same pixels(no alpha if opaque, grayscale if gray, 8 bit if depth8); only
+                                        //for plain rasters, not with a tensor, tiles, raster file or row callback
+} PNGdecoder_options;
+
+//      Encoder settings, initialize with PNGdecoder_encode_options_init
+typedef struct _PNGdecoder_encode_options {
+    PNGdecoder_filter_strategies filter;
+    uint8_t level;                  //zlib compression level 1 to 9, 0 for stored(uncompressed) blocks, the fastest to inflate
+    uint32_t band_rows;             //If set, rows are compressed in independent bands of this many rows(at most 1024 bands)
+                                    //recorded in a prIX restart index, so that decoders can inflate them concurrently
+    uint32_t IDAT_size;             //Largest IDAT chunk data, 0 for 1 MiB
+} PNGdecoder_encode_options;
+
+//      Thread-safe cache of decoded images under a memory budget
+typedef struct _PNGdecoder_cache PNGdecoder_cache;
+
+//      Cache counters, since its creation
+typedef struct _PNGdecoder_cache_stats {
+    uint64_t hits;
+    uint64_t misses;                //Each one is a decode
+    uint64_t coalesced;             //Requests which waited for a decode of the same image already in progress
+    uint64_t evictions;
+    uint64_t failures;              //Decodes which failed, never cached
+    uint64_t bytes;                 //Held by the cached images, rasters plus their files
+} PNGdecoder_cache_stats;
+
+//      Heap accounting of the library, in the usable sizes of the allocated blocks
+typedef struct _PNGdecoder_memory_stats {
+    int64_t current;                //Allocated and not freed yet; per thread, negative when freeing blocks of other threads
+    int64_t peak;                   //Highest current
+    uint64_t total;                 //Bytes allocated
+    uint64_t allocations;
+} PNGdecoder_memory_stats;
+
+//      What a decode saw of the pixels, in the raster type of the image before any auto_compact
+typedef struct _PNGdecoder_analysis {
+    uint8_t opaque;                 //1: every alpha sample at its maximum, also for types without alpha
+    uint8_t partial_alpha;          //1: some alpha sample neither 0 nor its maximum
+    uint8_t gray;                   //1: R == G == B in every pixel, also for grayscale types
+    uint8_t depth8;                 //1: every 16 bit sample is an 8 bit one times 257, also for 8 bit types
+    uint8_t channels;               //Of the raster type: gray or R, G, B, then alpha
+    uint16_t min[4];                //Per channel
+    uint16_t max[4];
+    uint32_t colors;                //Unique pixels if at most 256, 0 if more
+} PNGdecoder_analysis;
+
+//      Batch loader settings, initialize with PNGdecoder_loader_config_init
+typedef struct _PNGdecoder_loader_config {
+    uint32_t queue_depth;           //Files being read at once(io_uring slots or reader threads)
+    uint32_t decode_threads;        //Files being decoded at once, 0 for one per online CPU
+    PNGdecoder_io_modes io_mode;
+} PNGdecoder_loader_config;
+
+//      Sprite atlas settings, initialize with PNGdecoder_atlas_config_init
+typedef struct _PNGdecoder_atlas_config {
+    uint32_t max_width;             //Largest atlas, PNGdecoder_decode_atlas fails with PNGDECODER_IMAGE_TOO_LARGE
+    uint32_t max_height;            //when the images do not fit
+    uint32_t padding;               //Transparent pixels between the images and around the atlas
+    uint32_t extrude;               //Edge pixels of each image repeated outwards, against bleeding under filtering
+    uint8_t power_of_two;           //1: both sides of the atlas are powers of two
+    uint32_t threads;               //Files read and decoded at once, 0 for one per online CPU
+} PNGdecoder_atlas_config;
+
+//      Place of an image in an atlas, without its extrusion
+typedef struct _PNGdecoder_atlas_rect {
+    uint32_t x;                     //In pixels
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    float u0;                       //The same rectangle in texture coordinates, [0, 1] across the atlas
+    float v0;
+    float u1;
+    float v1;
+} PNGdecoder_atlas_rect;
+
+//      Called once per file of a batch, from a decode thread, in completion order
+//      Argument 1: user pointer, Argument 2: file index, Argument 3: result, Argument 4: png(NULL on failure), owned
+//      by the callback
+typedef void (*PNGdecoder_batch_callback)(void *, uint32_t, PNGdecoder_result, PNGdecoder_PNG *);
+
+//      Animation(APNG) frame iterator over a PNGdecoder_PNG, which must outlive it
+typedef struct _PNGdecoder_animation PNGdecoder_animation;
+
+//      Animation frame control(fcTL)
+typedef struct _PNGdecoder_frame_info {
+    uint32_t index;
+    uint32_t width;                 //Frame region on the canvas
+    uint32_t height;
+    uint32_t x_offset;
+    uint32_t y_offset;
+    uint16_t delay_num;             //Delay in seconds, delay_num / delay_den; a 0 denominator means 100
+    uint16_t delay_den;
+    PNGdecoder_dispose_ops dispose_op;
+    PNGdecoder_blend_ops blend_op;
+    uint8_t keyframe;               //1 if the frame composites without any earlier frame, cheap to seek to
+} PNGdecoder_frame_info;
+
+//      Resumable decode of one file, stepped under a budget of rows or time
+typedef struct _PNGdecoder_decoder PNGdecoder_decoder;
+
 
 /*      RASTER PIXEL TYPES        */
 
@@ -144,6 +369,24 @@ typedef struct _PNGdecoder_raster_RGBA16_t {
 
 
 EXTERN PNGdecoder_result PNGdecoder_openPNG(const char *, PNGdecoder_PNG **);
+EXTERN void PNGdecoder_options_init(PNGdecoder_options *);
+//As PNGdecoder_openPNG, with the given options(NULL for the defaults)
+EXTERN PNGdecoder_result PNGdecoder_openPNG_ex(const char *, const PNGdecoder_options *, PNGdecoder_PNG **);
+//As PNGdecoder_openPNG_ex, from a whole file already in memory(copied)
+//Argument 1: file bytes, Argument 2: size
+EXTERN PNGdecoder_result PNGdecoder_openPNG_memory(const void *, uint64_t, const PNGdecoder_options *, PNGdecoder_PNG **);
+//As PNGdecoder_openPNG_ex, backed by a decoded raster sidecar file: if the sidecar matches the PNG file(checksum) and
+//the options, its raster is mapped read-only instead of decoding; otherwise the PNG is decoded and the sidecar
+//(re)written, LZ4 compressed by bands of rows if asked, which then opens through a copy instead of a mapping
+//Argument 2: sidecar file name, NULL for the PNG file name followed by .pngd, Argument 3: 1 to compress the sidecar
+EXTERN PNGdecoder_result PNGdecoder_openPNG_sidecar(const char *, const char *, uint8_t, const PNGdecoder_options *, PNGdecoder_PNG **);
+
+//Planar float32, mean 0 and std 1(samples in [0, 1]), image channels, any size
+EXTERN void PNGdecoder_tensor_init(PNGdecoder_tensor *);
+//Decodes images of the same size into consecutive slices of the options tensor(NCHW when planar), which must have its
+//data, channels, width and height set; stops at the first failure and writes its index in the last argument(optional)
+//Argument 1: file names, Argument 2: number of files
+EXTERN PNGdecoder_result PNGdecoder_decode_tensor_batch(const char **, uint32_t, const PNGdecoder_options *, uint32_t *);
 EXTERN void PNGdecoder_free(PNGdecoder_PNG *);
 EXTERN const char * PNGdecoder_strerror(PNGdecoder_result);
 
@@ -152,12 +395,172 @@ EXTERN const void * PNGdecoder_get_raster(PNGdecoder_PNG *);
 EXTERN const uint8_t PNGdecoder_get_depth(PNGdecoder_PNG *);
 EXTERN const uint32_t PNGdecoder_get_width(PNGdecoder_PNG *);
 EXTERN const uint32_t PNGdecoder_get_height(PNGdecoder_PNG *);
-
+//Hash of the decoded pixels, as PNGdecoder_hash_raster gives for the raster of the image: computed during the decode when
+//the options ask for it, also with a row callback or tiles; not for interlaced images decoded into a tensor or tiles,
+//whose rows are never whole, then failing with PNGDECODER_INVALID_ARGUMENT
+//Argument 2: result
+EXTERN PNGdecoder_result PNGdecoder_get_pixel_hash(PNGdecoder_PNG *, uint64_t *);
+//Analysis of the decoded pixels, when the options ask for it(analyze or auto_compact), PNGDECODER_INVALID_ARGUMENT
+//otherwise
+//Argument 2: result
+EXTERN PNGdecoder_result PNGdecoder_get_analysis(PNGdecoder_PNG *, PNGdecoder_analysis *);
+//Bands of the restart index inflated concurrently(see band_threads), 0 when the image data was inflated serially, also
+//after the bands failed and the serial path decoded the image instead
+EXTERN uint32_t PNGdecoder_get_bands_decoded(PNGdecoder_PNG *);
+
+//Tiled rasters: the given tile, tile_width * tile_height pixels row by row, edge tiles padded with zeros; tiles follow
+//each other in tile-major order, each one starting on a 64 byte boundary; NULL if the raster is not tiled or the tile
+//is out of range
+//Arguments 2 and 3: tile column and row
+EXTERN const void * PNGdecoder_get_tile(PNGdecoder_PNG *, uint32_t, uint32_t);
+//16 bit rasters are rounded to the nearest 8 bit value; NULL for tiled rasters
 EXTERN PNGdecoder_raster_RGBA8_t * PNGdecoder_as_RGBA8(PNGdecoder_PNG *);
 EXTERN PNGdecoder_raster_RGBA16_t * PNGdecoder_as_RGBA16(PNGdecoder_PNG *);
+//Frees rasters returned by PNGdecoder_as_RGBA8, PNGdecoder_as_RGBA16 and PNGdecoder_detach_raster
 EXTERN void PNGdecoder_raster_free(void *, PNGdecoder_raster_types);
-
+//Hands the raster(as returned by PNGdecoder_get_raster, of PNGdecoder_get_raster_type) over to the caller, who frees it
+//with PNGdecoder_raster_free; the png has no raster afterwards; mapped(sidecar) rasters are copied; NULL without a raster
+EXTERN void * PNGdecoder_detach_raster(PNGdecoder_PNG *);
+//Converts the raster of the png to RGBA8 in place, as PNGdecoder_as_RGBA8 would, reallocating it instead of holding
+//two rasters; fails with PNGDECODER_INVALID_ARGUMENT for mapped or tiled rasters; the raster is left as it was on failure
+EXTERN PNGdecoder_result PNGdecoder_convert_RGBA8(PNGdecoder_PNG *);
+
+//Selects the inflate implementation used by subsequent decodes, fails if it was not compiled in
+EXTERN PNGdecoder_result PNGdecoder_set_inflate_backend(PNGdecoder_inflate_backends);
+EXTERN PNGdecoder_inflate_backends PNGdecoder_get_inflate_backend(void);
+
+//Returns the instruction set level of the kernels bound for this process: the best one the CPU supports, unless the
+//PNGDECODER_CPU environment variable(scalar, sse2, sse4, avx2) asks for a lower one
+EXTERN PNGdecoder_cpu_levels PNGdecoder_get_cpu_level(void);
+
+//Queue depth 32, one decode thread per CPU, io_uring if available
+EXTERN void PNGdecoder_loader_config_init(PNGdecoder_loader_config *);
+//Reads the files through io_uring(or a pool of reader threads) and decodes each one as soon as it is read, on a pool
+//of decode threads; returns once every file went through the callback; fails with PNGDECODER_INVALID_ARGUMENT for
+//tensor options or when io_uring is asked for and unavailable, PNGDECODER_MEMORY_ERROR when the job queue cannot be
+//allocated or no decode thread starts
+//Argument 1: file names, Argument 2: number of files, Argument 4: settings(NULL for the defaults), Argument 6: user
+//pointer given to the callback
+EXTERN PNGdecoder_result PNGdecoder_load_batch(const char **, uint32_t, const PNGdecoder_options *, const PNGdecoder_loader_config *,
+                                               PNGdecoder_batch_callback, void *);
+
+//4096 x 4096 atlas at most, no padding nor extrusion, any sides, one thread per CPU
+EXTERN void PNGdecoder_atlas_config_init(PNGdecoder_atlas_config *);
+//Packs small images into one RGBA8 atlas: reads every file for its size, places the images(skyline, tallest first,
+//widening the atlas while it is too tall) and decodes each one straight into its place on a pool of threads, without
+//a raster of its own; the options(NULL for the defaults) cannot ask for a tensor; stops at the first failed file and
+//writes its index(optional). The atlas is freed with PNGdecoder_raster_free(atlas, PNGDECODER_RASTER_RGBA_8)
+//Argument 1: file names, Argument 2: number of files, Argument 4: settings(NULL for the defaults), Argument 5: result
+//atlas, Argument 6: result places, one per file, Argument 7: failed file
+EXTERN PNGdecoder_result PNGdecoder_decode_atlas(const char **, uint32_t, const PNGdecoder_options *, const PNGdecoder_atlas_config *,
+                                                 PNGdecoder_raster_RGBA8_t **, PNGdecoder_atlas_rect *, uint32_t *);
+
+//Creates a cache evicting least recently used images(CLOCK) once they take more than the given bytes; images are
+//decoded with the given options(NULL for the defaults), which cannot ask for a tensor, raster file or callback
+//Argument 1: budget in bytes
+EXTERN PNGdecoder_result PNGdecoder_cache_new(uint64_t, const PNGdecoder_options *, PNGdecoder_cache **);
+//As PNGdecoder_openPNG, through the cache: keyed by path, size and modification time, concurrent requests for an image
+//not cached yet share a single decode; the png is read-only, shared, and must be released with
+//PNGdecoder_cache_release instead of PNGdecoder_free
+EXTERN PNGdecoder_result PNGdecoder_cache_open(PNGdecoder_cache *, const char *, PNGdecoder_PNG **);
+//As PNGdecoder_cache_open for a file in memory, keyed by a hash of its content
+//Argument 2: file bytes, Argument 3: size
+EXTERN PNGdecoder_result PNGdecoder_cache_open_memory(PNGdecoder_cache *, const void *, uint64_t, PNGdecoder_PNG **);
+//Takes one more reference on a png returned by the cache, released by one more PNGdecoder_cache_release
+EXTERN void PNGdecoder_cache_retain(PNGdecoder_cache *, PNGdecoder_PNG *);
+//Images stay cached after their last release, until evicted
+EXTERN void PNGdecoder_cache_release(PNGdecoder_cache *, PNGdecoder_PNG *);
+EXTERN void PNGdecoder_cache_get_stats(PNGdecoder_cache *, PNGdecoder_cache_stats *);
+//Frees every cached image, no png of the cache may be in use
+EXTERN void PNGdecoder_cache_free(PNGdecoder_cache *);
+
+//Animated PNG: 1 if the png has an animation control(acTL) chunk; the raster of the png is its default image
+EXTERN uint8_t PNGdecoder_is_animated(PNGdecoder_PNG *);
+//Checks the frame chunks and prepares the canvas, an RGBA8 raster of the image size; fails with
+//PNGDECODER_INVALID_ARGUMENT if the png is not animated
+EXTERN PNGdecoder_result PNGdecoder_animation_open(PNGdecoder_PNG *, PNGdecoder_animation **);
+EXTERN uint32_t PNGdecoder_animation_get_frame_count(PNGdecoder_animation *);
+//Number of times to play the animation, 0 for forever
+EXTERN uint32_t PNGdecoder_animation_get_plays(PNGdecoder_animation *);
+//Argument 2: frame index, Argument 3: result
+EXTERN PNGdecoder_result PNGdecoder_animation_get_frame_info(PNGdecoder_animation *, uint32_t, PNGdecoder_frame_info *);
+//Composites the next frame into the canvas(straight alpha, 16 bit samples rounded) and returns it with the frame info
+//(optional); the canvas stays owned by the animation and changes with the next call; PNGDECODER_ANIMATION_END after the
+//last frame
+EXTERN PNGdecoder_result PNGdecoder_animation_next(PNGdecoder_animation *, const PNGdecoder_raster_RGBA8_t **, PNGdecoder_frame_info *);
+//Makes the given frame the next one, recompositing from the closest keyframe before it
+EXTERN PNGdecoder_result PNGdecoder_animation_seek(PNGdecoder_animation *, uint32_t);
+EXTERN void PNGdecoder_animation_free(PNGdecoder_animation *);
+
+//Prepares the decode of the given file with the given options(NULL for the defaults, any tensor must outlive the
+//decoder); nothing is read before the first step
+EXTERN PNGdecoder_result PNGdecoder_decoder_new(const char *, const PNGdecoder_options *, PNGdecoder_decoder **);
+//Does at most the given number of rows or microseconds of work(0 for no limit), at least one row or block per call: the
+//first steps read the file, a block per step under a row limit, then one step checks every chunk(a CRC pass over the
+//whole file, not bounded by the limits) and allocates the raster; returns PNGDECODER_IN_PROGRESS while rows are left,
+//then PNGDECODER_OK or the error, which every later step returns again
+//Argument 2: rows, Argument 3: microseconds
+EXTERN PNGdecoder_result PNGdecoder_decoder_step(PNGdecoder_decoder *, uint32_t, uint32_t);
+//Hands over the png of a complete decode, once; the result of the last step otherwise
+EXTERN PNGdecoder_result PNGdecoder_decoder_take(PNGdecoder_decoder *, PNGdecoder_PNG **);
+//Rows decoded so far over all the Adam7 passes, and their total(0 until the file is parsed)
+EXTERN void PNGdecoder_decoder_get_progress(PNGdecoder_decoder *, uint64_t *, uint64_t *);
+//Stops the decode where it stands; frees the png unless taken
+EXTERN void PNGdecoder_decoder_free(PNGdecoder_decoder *);
+
+//Checks that the file is a well formed PNG without decoding it: chunk order and CRCs, no unknown critical chunk, IHDR
+//and PLTE, image data inflating to exactly the rows of the image with none past the end of the stream, filter bytes;
+//streams through the file in constant memory, no raster;
+//on failure writes the file offset of the first error(optional): the chunk or field at fault, or how far the image
+//data had been read for inflate and filter errors
+//Argument 2: error offset
+EXTERN PNGdecoder_result PNGdecoder_validate(const char *, uint64_t *);
+//As PNGdecoder_validate, for a file in memory
+//Argument 2: size
+EXTERN PNGdecoder_result PNGdecoder_validate_memory(const void *, uint64_t, uint64_t *);
+//Decodes a file only for the hash of its pixels(see PNGdecoder_get_pixel_hash), keeping no raster unless interlaced;
+//options NULL for the defaults, which only the output ones are ignored of
+//Argument 3: result
+EXTERN PNGdecoder_result PNGdecoder_hash_pixels(const char *, const PNGdecoder_options *, uint64_t *);
+//Hash of the pixels of a raster(as returned by PNGdecoder_get_raster, of the given type, rows not tiles): XXH64 of the
+//sequence of the XXH64 of each row, seed 0, as native 64 bit integers
+//Argument 1: raster, Argument 2: raster type
+EXTERN uint64_t PNGdecoder_hash_raster(const void *, PNGdecoder_raster_types);
+
+
+//Adaptive filtering, zlib level 6, a single band
+EXTERN void PNGdecoder_encode_options_init(PNGdecoder_encode_options *);
+//Writes a raster(as returned by PNGdecoder_get_raster, of the given type, straight alpha) as a non interlaced PNG of
+//the matching color type and bit depth; options NULL for the defaults
+//Argument 1: file name, Argument 2: raster, Argument 3: raster type
+EXTERN PNGdecoder_result PNGdecoder_encode(const char *, const void *, PNGdecoder_raster_types, const PNGdecoder_encode_options *);
+
+//Heap used by the decode that produced the png, from the file bytes to the last row, its band threads included:
+//current is what the png held when the decode returned(raster, chunks of animated pngs)
+EXTERN void PNGdecoder_get_memory_stats(PNGdecoder_PNG *, PNGdecoder_memory_stats *);
+//Allocations and frees of the library on the calling thread, since it started or since the last reset, which keeps
+//current and restarts peak from it
+EXTERN void PNGdecoder_get_thread_memory_stats(PNGdecoder_memory_stats *);
+EXTERN void PNGdecoder_reset_thread_memory_stats(void);
+//Process-wide budget of heap bytes for the decodes in progress, 0(the default) for none: each decode reserves its
+//predicted peak(see PNGdecoder_predict_memory) before allocating its output and releases it once done, waiting(see
+//budget_timeout) while others hold too much of it; decodes predicted above the whole budget fail at once
+EXTERN void PNGdecoder_set_memory_budget(uint64_t);
+//Argument 1: budget, Argument 2: bytes reserved by the decodes in progress(optional)
+EXTERN void PNGdecoder_get_memory_budget(uint64_t *, uint64_t *);
+//Predicts the peak heap bytes of decoding a file with the given options(NULL for the defaults) before reading it
+//whole, from its IHDR, for every band thread busy at once; more of the file refines it: the chunks before the first
+//IDAT(palette, transparency, restart index), the number of chunks for a whole file. An upper bound unless the chunks
+//past the given bytes hold less than 8 KiB, or the given bytes stop before the restart index of an image having one
+//Argument 1: start of the file, at least its signature and IHDR(33 bytes), Argument 2: bytes available, Argument 3:
+//file size, Argument 5: result
+EXTERN PNGdecoder_result PNGdecoder_predict_memory(const void *, uint64_t, uint64_t, const PNGdecoder_options *, uint64_t *);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
 
 #undef PNGdecoder_IMPORT
+#undef PNGdecoder_EXPORT
 #undef EXTERN
 #endif // PNGdecoder_H
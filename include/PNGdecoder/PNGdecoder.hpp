@@ -0,0 +1,517 @@
+#ifndef PNGdecoder_HPP
+#define PNGdecoder_HPP
+
+#include <PNGdecoder/PNGdecoder.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+//C++17 layer over the C interface, header only: move-only owners of the library handles, typed views over the rasters
+//they hold(never copied), pixel types resolved at compile time
+namespace PNGdecoder {
+
+
+/*      ERRORS      */
+
+
+//      Thrown by the throwing factories, carries the library result
+class error : public std::runtime_error {
+public:
+    explicit error(PNGdecoder_result code) : std::runtime_error(message(code)), code_(code) {}
+    PNGdecoder_result code() const noexcept { return code_; }
+
+private:
+    PNGdecoder_result code_;
+
+    //PNGdecoder_strerror gives NULL for codes it does not know
+    static const char * message(PNGdecoder_result code) noexcept {
+        const char * text = PNGdecoder_strerror(code);
+        return (text != nullptr) ? text : "unknown PNGdecoder error";
+    }
+};
+
+inline void check(PNGdecoder_result code){
+    if(code != PNGDECODER_OK)
+        throw error(code);
+}
+
+
+/*      PIXEL TYPES     */
+
+
+//      Raster type and raster struct of each pixel type, the key of every typed accessor
+template <typename PixelT> struct pixel_traits;
+
+#define PNGDECODER_PIXEL_TRAITS(PIXEL, TYPE, RASTER, WIDE)                                 \
+    template <> struct pixel_traits<PIXEL> {                                                \
+        static constexpr PNGdecoder_raster_types type = TYPE;                               \
+        static constexpr bool wide = WIDE;              /* 16 bit samples */                \
+        using raster = RASTER;                                                              \
+    }
+
+PNGDECODER_PIXEL_TRAITS(uint8_t, PNGDECODER_RASTER_GRAYSCALE_8, PNGdecoder_raster_grayscale8_t, false);
+PNGDECODER_PIXEL_TRAITS(uint16_t, PNGDECODER_RASTER_GRAYSCALE_16, PNGdecoder_raster_grayscale16_t, true);
+PNGDECODER_PIXEL_TRAITS(PNGdecoder_RGB8_t, PNGDECODER_RASTER_RGB_8, PNGdecoder_raster_RGB8_t, false);
+PNGDECODER_PIXEL_TRAITS(PNGdecoder_RGB16_t, PNGDECODER_RASTER_RGB_16, PNGdecoder_raster_RGB16_t, true);
+PNGDECODER_PIXEL_TRAITS(PNGdecoder_grayscale8a_t, PNGDECODER_RASTER_GRAYSCALE_8A, PNGdecoder_raster_grayscale8a_t, false);
+PNGDECODER_PIXEL_TRAITS(PNGdecoder_grayscale16a_t, PNGDECODER_RASTER_GRAYSCALE_16A, PNGdecoder_raster_grayscale16a_t, true);
+PNGDECODER_PIXEL_TRAITS(PNGdecoder_RGBA8_t, PNGDECODER_RASTER_RGBA_8, PNGdecoder_raster_RGBA8_t, false);
+PNGDECODER_PIXEL_TRAITS(PNGdecoder_RGBA16_t, PNGDECODER_RASTER_RGBA_16, PNGdecoder_raster_RGBA16_t, true);
+
+#undef PNGDECODER_PIXEL_TRAITS
+
+template <typename PixelT>
+inline constexpr PNGdecoder_raster_types raster_type_of = pixel_traits<std::remove_const_t<PixelT>>::type;
+
+
+/*      VIEWS       */
+
+
+//      Non owning span over width * height contiguous pixels, row after row; the image it views must outlive it
+template <typename PixelT>
+class view {
+public:
+    using element_type = PixelT;
+    using value_type = std::remove_cv_t<PixelT>;
+    using size_type = std::size_t;
+    using pointer = PixelT *;
+    using reference = PixelT &;
+    using iterator = PixelT *;
+
+    constexpr view() noexcept = default;
+    constexpr view(PixelT * data, uint32_t width, uint32_t height) noexcept : data_(data), width_(width), height_(height) {}
+    //Views of mutable pixels convert to views of const ones
+    template <typename OtherT, typename = std::enable_if_t<std::is_convertible_v<OtherT (*)[], PixelT (*)[]>>>
+    constexpr view(const view<OtherT> & other) noexcept : data_(other.data()), width_(other.width()), height_(other.height()) {}
+
+    constexpr pointer data() const noexcept { return data_; }
+    constexpr uint32_t width() const noexcept { return width_; }
+    constexpr uint32_t height() const noexcept { return height_; }
+    constexpr size_type size() const noexcept { return static_cast<size_type>(width_) * height_; }
+    constexpr size_type size_bytes() const noexcept { return size() * sizeof(PixelT); }
+    constexpr bool empty() const noexcept { return data_ == nullptr; }
+
+    constexpr iterator begin() const noexcept { return data_; }
+    constexpr iterator end() const noexcept { return data_ + size(); }
+    constexpr reference operator[](size_type i) const noexcept { return data_[i]; }
+    constexpr reference operator()(uint32_t x, uint32_t y) const noexcept { return data_[(static_cast<size_type>(y) * width_) + x]; }
+    //A single row, as a view of height 1
+    constexpr view row(uint32_t y) const noexcept { return view(data_ + (static_cast<size_type>(y) * width_), width_, 1); }
+
+private:
+    PixelT * data_ = nullptr;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+};
+
+
+/*      OWNED RASTERS       */
+
+
+//      Move-only owner of a raster returned by the library(PNGdecoder_as_RGBA8, PNGdecoder_detach_raster, the atlas),
+//      freed with the raster type of its pixel type
+template <typename PixelT>
+class raster {
+public:
+    using raster_type = typename pixel_traits<PixelT>::raster;
+
+    raster() noexcept = default;
+    //Takes ownership of the given raster, which must hold PixelT pixels
+    explicit raster(raster_type * owned) noexcept : raster_(owned) {}
+    raster(raster && other) noexcept : raster_(std::exchange(other.raster_, nullptr)) {}
+    raster & operator=(raster && other) noexcept {
+        if(this != &other)
+            reset(std::exchange(other.raster_, nullptr));
+        return *this;
+    }
+    raster(const raster &) = delete;
+    raster & operator=(const raster &) = delete;
+    ~raster() { reset(); }
+
+    explicit operator bool() const noexcept { return raster_ != nullptr; }
+    raster_type * get() const noexcept { return raster_; }
+    //Gives the raster back to the caller, who frees it with PNGdecoder_raster_free
+    raster_type * release() noexcept { return std::exchange(raster_, nullptr); }
+    void reset(raster_type * owned = nullptr) noexcept {
+        if(raster_ != nullptr)
+            PNGdecoder_raster_free(raster_, raster_type_of<PixelT>);
+        raster_ = owned;
+    }
+
+    view<PixelT> pixels() noexcept { return raster_ ? view<PixelT>(raster_->raster, raster_->width, raster_->height) : view<PixelT>(); }
+    view<const PixelT> pixels() const noexcept {
+        return raster_ ? view<const PixelT>(raster_->raster, raster_->width, raster_->height) : view<const PixelT>();
+    }
+
+private:
+    raster_type * raster_ = nullptr;
+};
+
+//      Pixels decoded into storage of the given allocator, see decode_into
+template <typename PixelT, typename Allocator = std::allocator<PixelT>>
+class pixel_buffer {
+    using alloc_traits = std::allocator_traits<Allocator>;
+
+public:
+    using allocator_type = Allocator;
+
+    explicit pixel_buffer(const Allocator & allocator = Allocator()) noexcept(noexcept(Allocator(allocator))) : allocator_(allocator) {}
+    pixel_buffer(uint32_t width, uint32_t height, const Allocator & allocator = Allocator()) : allocator_(allocator) {
+        assign(width, height);
+    }
+    pixel_buffer(pixel_buffer && other) noexcept
+        : allocator_(std::move(other.allocator_)), data_(std::exchange(other.data_, nullptr)),
+          width_(std::exchange(other.width_, 0)), height_(std::exchange(other.height_, 0)) {}
+    //As the standard containers: the pixels are copied when the allocators differ and do not propagate
+    pixel_buffer & operator=(pixel_buffer && other) noexcept(alloc_traits::propagate_on_container_move_assignment::value ||
+                                                             alloc_traits::is_always_equal::value) {
+        if(this == &other)
+            return *this;
+
+        if constexpr(!alloc_traits::propagate_on_container_move_assignment::value && !alloc_traits::is_always_equal::value){
+            if(!(allocator_ == other.allocator_)){
+                assign(other.width_, other.height_);
+                std::copy(other.data_, other.data_ + other.pixels().size(), data_);
+                other.clear();
+                return *this;
+            }
+        }
+        clear();
+        if constexpr(alloc_traits::propagate_on_container_move_assignment::value)
+            allocator_ = std::move(other.allocator_);
+        data_ = std::exchange(other.data_, nullptr);
+        width_ = std::exchange(other.width_, 0);
+        height_ = std::exchange(other.height_, 0);
+        return *this;
+    }
+    pixel_buffer(const pixel_buffer &) = delete;
+    pixel_buffer & operator=(const pixel_buffer &) = delete;
+    ~pixel_buffer() { clear(); }
+
+    allocator_type get_allocator() const noexcept { return allocator_; }
+    //Frees the pixels and allocates width * height new ones, uninitialized
+    void assign(uint32_t width, uint32_t height){
+        clear();
+        if((width != 0) && (height != 0))
+            data_ = alloc_traits::allocate(allocator_, static_cast<std::size_t>(width) * height);
+        width_ = width;
+        height_ = height;
+    }
+    view<PixelT> pixels() noexcept { return view<PixelT>(data_, width_, height_); }
+    view<const PixelT> pixels() const noexcept { return view<const PixelT>(data_, width_, height_); }
+
+private:
+    void clear() noexcept {
+        if(data_ != nullptr)
+            alloc_traits::deallocate(allocator_, data_, static_cast<std::size_t>(width_) * height_);
+        data_ = nullptr;
+        width_ = height_ = 0;
+    }
+
+    Allocator allocator_;
+    PixelT * data_ = nullptr;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+};
+
+
+/*      IMAGES      */
+
+
+//      Move-only owner of a PNGdecoder_PNG
+class image {
+public:
+    image() noexcept = default;
+    //Takes ownership of the given png
+    explicit image(PNGdecoder_PNG * owned) noexcept : png_(owned) {}
+    image(image && other) noexcept : png_(std::exchange(other.png_, nullptr)) {}
+    image & operator=(image && other) noexcept {
+        if(this != &other)
+            reset(std::exchange(other.png_, nullptr));
+        return *this;
+    }
+    image(const image &) = delete;
+    image & operator=(const image &) = delete;
+    ~image() { reset(); }
+
+    //Throwing factories, see PNGdecoder_openPNG_ex and PNGdecoder_openPNG_memory(options NULL for the defaults)
+    static image open(const char * file_name, const PNGdecoder_options * options = nullptr){
+        image result;
+        check(open(file_name, result, options));
+        return result;
+    }
+    static image open_memory(const void * data, uint64_t size, const PNGdecoder_options * options = nullptr){
+        image result;
+        check(open_memory(data, size, result, options));
+        return result;
+    }
+    //Non throwing ones, the image is left empty on failure
+    static PNGdecoder_result open(const char * file_name, image & result, const PNGdecoder_options * options = nullptr) noexcept {
+        PNGdecoder_PNG * png = nullptr;
+        PNGdecoder_result status = PNGdecoder_openPNG_ex(file_name, options, &png);
+
+        result.reset((status == PNGDECODER_OK) ? png : nullptr);
+        return status;
+    }
+    static PNGdecoder_result open_memory(const void * data, uint64_t size, image & result, const PNGdecoder_options * options = nullptr) noexcept {
+        PNGdecoder_PNG * png = nullptr;
+        PNGdecoder_result status = PNGdecoder_openPNG_memory(data, size, options, &png);
+
+        result.reset((status == PNGDECODER_OK) ? png : nullptr);
+        return status;
+    }
+
+    explicit operator bool() const noexcept { return png_ != nullptr; }
+    PNGdecoder_PNG * get() const noexcept { return png_; }
+    PNGdecoder_PNG * release() noexcept { return std::exchange(png_, nullptr); }
+    void reset(PNGdecoder_PNG * owned = nullptr) noexcept {
+        if(png_ != nullptr)
+            PNGdecoder_free(png_);
+        png_ = owned;
+    }
+
+    uint32_t width() const noexcept { return PNGdecoder_get_width(png_); }
+    uint32_t height() const noexcept { return PNGdecoder_get_height(png_); }
+    uint8_t depth() const noexcept { return PNGdecoder_get_depth(png_); }
+    PNGdecoder_raster_types raster_type() const noexcept {
+        return (png_ != nullptr) ? PNGdecoder_get_raster_type(png_) : PNGDECODER_RASTER_INVALID;
+    }
+    bool animated() const noexcept { return (png_ != nullptr) && PNGdecoder_is_animated(png_); }
+    PNGdecoder_memory_stats memory_stats() const noexcept {
+        PNGdecoder_memory_stats stats = {};
+        PNGdecoder_get_memory_stats(png_, &stats);
+        return stats;
+    }
+    //Hash of the pixels, computed during the decode when the options ask for it(see PNGdecoder_get_pixel_hash)
+    std::optional<uint64_t> pixel_hash() const noexcept {
+        uint64_t hash;
+        if(PNGdecoder_get_pixel_hash(png_, &hash) != PNGDECODER_OK)
+            return std::nullopt;
+        return hash;
+    }
+    //What the decode saw of the pixels, when the options ask for it(see PNGdecoder_get_analysis)
+    std::optional<PNGdecoder_analysis> analysis() const noexcept {
+        PNGdecoder_analysis analysis;
+        if(PNGdecoder_get_analysis(png_, &analysis) != PNGDECODER_OK)
+            return std::nullopt;
+        return analysis;
+    }
+    //Bands inflated concurrently, 0 for a serial decode(see PNGdecoder_get_bands_decoded)
+    uint32_t bands_decoded() const noexcept { return PNGdecoder_get_bands_decoded(png_); }
+
+    //Whether the raster holds PixelT pixels
+    template <typename PixelT>
+    bool is() const noexcept {
+        return (png_ != nullptr) && (PNGdecoder_get_raster(png_) != nullptr) && (PNGdecoder_get_raster_type(png_) == raster_type_of<PixelT>);
+    }
+    //The raster in place, an empty view unless it holds PixelT pixels(see is); tiled rasters are not contiguous, see tile
+    template <typename PixelT>
+    view<const PixelT> as() const noexcept {
+        if(!is<PixelT>() || tiled())
+            return view<const PixelT>();
+
+        auto raster = static_cast<const typename pixel_traits<PixelT>::raster *>(PNGdecoder_get_raster(png_));
+        return view<const PixelT>(raster->raster, raster->width, raster->height);
+    }
+    //A tile of a tiled raster(see PNGdecoder_get_tile), empty if out of range or not of PixelT pixels
+    template <typename PixelT>
+    view<const PixelT> tile(uint32_t tile_x, uint32_t tile_y, uint32_t tile_width, uint32_t tile_height) const noexcept {
+        if(!is<PixelT>())
+            return view<const PixelT>();
+
+        return view<const PixelT>(static_cast<const PixelT *>(PNGdecoder_get_tile(png_, tile_x, tile_y)), tile_width, tile_height);
+    }
+    //Calls the given function with the view of the raster as its actual pixel type, the one switch over the raster
+    //types; returns false without a raster
+    template <typename Function>
+    bool visit(Function && function) const {
+        switch(raster_type()){
+            case PNGDECODER_RASTER_GRAYSCALE_8: return visit_as<uint8_t>(function);
+            case PNGDECODER_RASTER_GRAYSCALE_16: return visit_as<uint16_t>(function);
+            case PNGDECODER_RASTER_RGB_8: return visit_as<PNGdecoder_RGB8_t>(function);
+            case PNGDECODER_RASTER_RGB_16: return visit_as<PNGdecoder_RGB16_t>(function);
+            case PNGDECODER_RASTER_GRAYSCALE_8A: return visit_as<PNGdecoder_grayscale8a_t>(function);
+            case PNGDECODER_RASTER_GRAYSCALE_16A: return visit_as<PNGdecoder_grayscale16a_t>(function);
+            case PNGDECODER_RASTER_RGBA_8: return visit_as<PNGdecoder_RGBA8_t>(function);
+            case PNGDECODER_RASTER_RGBA_16: return visit_as<PNGdecoder_RGBA16_t>(function);
+            default: return false;
+        }
+    }
+
+    //Converted copies(PNGdecoder_as_RGBA8, PNGdecoder_as_RGBA16), empty for tiled rasters
+    raster<PNGdecoder_RGBA8_t> to_RGBA8() const noexcept { return raster<PNGdecoder_RGBA8_t>(PNGdecoder_as_RGBA8(png_)); }
+    raster<PNGdecoder_RGBA16_t> to_RGBA16() const noexcept { return raster<PNGdecoder_RGBA16_t>(PNGdecoder_as_RGBA16(png_)); }
+    //In place, see PNGdecoder_convert_RGBA8; as<PNGdecoder_RGBA8_t>() views the result
+    PNGdecoder_result convert_RGBA8() noexcept { return PNGdecoder_convert_RGBA8(png_); }
+    //Takes the raster out of the image without copying it, empty unless it holds PixelT pixels
+    template <typename PixelT>
+    raster<PixelT> detach() noexcept {
+        if(!is<PixelT>() || tiled())
+            return raster<PixelT>();
+        return raster<PixelT>(static_cast<typename pixel_traits<PixelT>::raster *>(PNGdecoder_detach_raster(png_)));
+    }
+
+private:
+    bool tiled() const noexcept { return PNGdecoder_get_tile(png_, 0, 0) != nullptr; }
+
+    template <typename PixelT, typename Function>
+    bool visit_as(Function & function) const {
+        view<const PixelT> pixels = as<PixelT>();
+        if(pixels.empty())
+            return false;
+        function(pixels);
+        return true;
+    }
+
+    PNGdecoder_PNG * png_ = nullptr;
+};
+
+//Decodes a file straight into storage of the allocator of the buffer, through the U8 tensor output(interleaved, the
+//channels of the pixel type; 16 bit samples rounded, missing alpha opaque): no raster is allocated by the library. The
+//file is read twice, first for its signature and IHDR, which go through the checks of the decode(PNGdecoder_predict_memory)
+//along with max_pixels and max_decoded_bytes(against the buffer) before the buffer is allocated. The options(NULL for
+//the defaults) cannot ask for another output; the buffer is left empty on failure, PNGDECODER_MEMORY_ERROR when the
+//allocator throws std::bad_alloc
+template <typename PixelT, typename Allocator>
+PNGdecoder_result decode_into(const char * file_name, pixel_buffer<PixelT, Allocator> & result, const PNGdecoder_options * options = nullptr){
+    static_assert(!pixel_traits<PixelT>::wide, "the tensor output holds 8 bit samples");
+
+    uint8_t header[33];             //Signature and IHDR
+    uint32_t width, height;
+    uint64_t pixels, peak;
+    long file_size;
+    PNGdecoder_options slot_options;
+    PNGdecoder_tensor slot;
+    PNGdecoder_PNG * png = nullptr;
+    PNGdecoder_result status;
+    std::FILE * file;
+
+    result.assign(0, 0);
+    if((file_name == nullptr) || ((options != nullptr) && (options->tensor != nullptr)))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(options != nullptr)
+        slot_options = *options;
+    else
+        PNGdecoder_options_init(&slot_options);
+
+    file = std::fopen(file_name, "rb");
+    if(file == nullptr)
+        return PNGDECODER_FILE_OPEN_ERROR;
+    if((std::fread(header, 1, sizeof(header), file) != sizeof(header)) || std::fseek(file, 0, SEEK_END) ||
+       ((file_size = std::ftell(file)) < static_cast<long>(sizeof(header)))){
+        std::fclose(file);
+        return PNGDECODER_BAD_PNG;
+    }
+    std::fclose(file);
+    status = PNGdecoder_predict_memory(header, sizeof(header), static_cast<uint64_t>(file_size), &slot_options, &peak);
+    if(status != PNGDECODER_OK)
+        return status;
+
+    width = (static_cast<uint32_t>(header[16]) << 24) | (static_cast<uint32_t>(header[17]) << 16) | (static_cast<uint32_t>(header[18]) << 8) | header[19];
+    height = (static_cast<uint32_t>(header[20]) << 24) | (static_cast<uint32_t>(header[21]) << 16) | (static_cast<uint32_t>(header[22]) << 8) | header[23];
+    pixels = static_cast<uint64_t>(width) * height;
+    if((slot_options.max_pixels && (pixels > slot_options.max_pixels)) ||
+       (slot_options.max_decoded_bytes && (pixels * sizeof(PixelT) > slot_options.max_decoded_bytes)))
+        return PNGDECODER_LIMIT_EXCEEDED;
+
+    try {
+        result.assign(width, height);
+    } catch(const std::bad_alloc &) {
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    PNGdecoder_tensor_init(&slot);
+    slot.data = result.pixels().data();
+    slot.type = PNGDECODER_TENSOR_U8;
+    slot.planar = 0;
+    slot.channels = sizeof(PixelT);
+    slot.width = width;             //The decode checks them against the IHDR
+    slot.height = height;
+    slot_options.tensor = &slot;
+
+    status = PNGdecoder_openPNG_ex(file_name, &slot_options, &png);
+    if(status != PNGDECODER_OK){
+        result.assign(0, 0);
+        return status;
+    }
+    PNGdecoder_free(png);
+
+    return PNGDECODER_OK;
+}
+
+//Throwing form
+template <typename PixelT, typename Allocator = std::allocator<PixelT>>
+pixel_buffer<PixelT, Allocator> decode_into(const char * file_name, const PNGdecoder_options * options = nullptr,
+                                            const Allocator & allocator = Allocator()){
+    pixel_buffer<PixelT, Allocator> result(allocator);
+    check(decode_into(file_name, result, options));
+    return result;
+}
+
+
+/*      DECODER CONTEXTS        */
+
+
+//      Move-only owner of a stepped decode(PNGdecoder_decoder)
+class decoder {
+public:
+    decoder() noexcept = default;
+    explicit decoder(PNGdecoder_decoder * owned) noexcept : decoder_(owned) {}
+    decoder(decoder && other) noexcept : decoder_(std::exchange(other.decoder_, nullptr)) {}
+    decoder & operator=(decoder && other) noexcept {
+        if(this != &other)
+            reset(std::exchange(other.decoder_, nullptr));
+        return *this;
+    }
+    decoder(const decoder &) = delete;
+    decoder & operator=(const decoder &) = delete;
+    ~decoder() { reset(); }
+
+    //See PNGdecoder_decoder_new
+    static decoder create(const char * file_name, const PNGdecoder_options * options = nullptr){
+        PNGdecoder_decoder * owned = nullptr;
+
+        check(PNGdecoder_decoder_new(file_name, options, &owned));
+        return decoder(owned);
+    }
+
+    explicit operator bool() const noexcept { return decoder_ != nullptr; }
+    PNGdecoder_decoder * get() const noexcept { return decoder_; }
+    PNGdecoder_decoder * release() noexcept { return std::exchange(decoder_, nullptr); }
+    void reset(PNGdecoder_decoder * owned = nullptr) noexcept {
+        if(decoder_ != nullptr)
+            PNGdecoder_decoder_free(decoder_);
+        decoder_ = owned;
+    }
+
+    //PNGDECODER_IN_PROGRESS until the image is complete, see PNGdecoder_decoder_step
+    //Argument 1: rows, Argument 2: microseconds, 0 for no limit
+    PNGdecoder_result step(uint32_t rows, uint32_t microseconds = 0) noexcept { return PNGdecoder_decoder_step(decoder_, rows, microseconds); }
+    //Rows done and total
+    std::pair<uint64_t, uint64_t> progress() const noexcept {
+        uint64_t done = 0, total = 0;
+        PNGdecoder_decoder_get_progress(decoder_, &done, &total);
+        return { done, total };
+    }
+    //The decoded image, once complete
+    image take(){
+        PNGdecoder_PNG * png = nullptr;
+
+        check(PNGdecoder_decoder_take(decoder_, &png));
+        return image(png);
+    }
+
+private:
+    PNGdecoder_decoder * decoder_ = nullptr;
+};
+
+}
+
+#endif // PNGdecoder_HPP
@@ -4,11 +4,22 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
-#include <zlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define PNGdecoder_IMPORT
 #include <PNGdecoder/PNGdecoder.h>
 
+#include "inflate.h"
+#include "kernels.h"
+#include "tensor.h"
+#include "hash.h"
+#include "analysis.h"
+#include "sidecar.h"
+#include "memory.h"
+#include "decoder.h"
+
 
 
 
@@ -82,44 +93,246 @@ typedef struct _chunk_tRNS {
     uint8_t * entries;
 } chunk_tRNS;           //Simple transparency chunk, ancillary
 
+typedef struct _restart_band {
+    uint32_t first_row;
+    uint32_t rows;
+    uint32_t first_chunk;   //IDAT chunk the deflate data of the band restarts at
+} restart_band;
+
+typedef struct _chunk_index {
+    uint32_t bands_n;
+    restart_band * bands;
+} chunk_index;      //Restart index(iDOT or prIX), ancillary, splits the image data in bands inflated concurrently
+
 typedef struct _PNGdecoder_PNG{
-    uint32_t file_size;
+    uint64_t file_size;
     uint8_t * raw_file;
 
-    uint8_t chunk_n;
+    uint32_t chunk_n;
     chunk ** chunks;
     chunk_IHDR * IHDR;
 
-    uint8_t * rawIDATs;
-    uint32_t rawIDATs_size;
-
     //uint8_t * pixel_data;
     //uint32_t pixel_data_size;
 
     chunk_PLTE * PLTE;
     chunk_tRNS * tRNS;
+    chunk_index * index;
 
     void * raster_struct;
     void * raster;
     PNGdecoder_raster_types raster_type;
-} PNGdecoder_PNG;           //Main type for this module, contains all necessary information to produce a raster
 
+    PNGdecoder_options options;     //Given to PNGdecoder_openPNG_ex
+    sidecar_mapping * mapping;      //Holds the raster when it comes from a sidecar file, NULL otherwise
+    PNGdecoder_memory_stats memory; //Of the decode that produced the png
+    uint64_t budget;                //Reserved from the process memory budget while the image data decodes
+    uint64_t pixel_hash;            //Valid if pixel_hashed, see PNGdecoder_get_pixel_hash
+    bool pixel_hashed;
+    PNGdecoder_analysis analysis;   //Valid if analyzed, see PNGdecoder_get_analysis
+    bool analyzed;
+    uint32_t bands_decoded;         //See PNGdecoder_get_bands_decoded
+} PNGdecoder_PNG;           //Main type for this module, contains all necessary information to produce a raster
 
-/*      LIBPNG UTILS        */
 
-//Standard routines to produce CRC code from the given vectors
-extern unsigned long update_crc(unsigned long, unsigned char *, int);
-extern unsigned long crc(unsigned char *, int);
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
 
-//Filter type 04
-extern uint8_t paeth_predictor(uint8_t, uint8_t, uint8_t);
+#ifndef PNGDECODER_DEFAULT_INFLATE
+#define PNGDECODER_DEFAULT_INFLATE PNGDECODER_INFLATE_BUILTIN
+#endif // PNGDECODER_DEFAULT_INFLATE
 
+typedef struct _raster_any {
+    uint32_t width;
+    uint32_t height;
+    void * raster;
+} raster_any;               //Common layout of every PNGdecoder_raster_*_t
 
-/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+typedef struct _IDAT_input {
+    chunk ** chunks;
+    uint32_t chunk_n;       //Index past the last chunk to walk
+    uint32_t next_chunk;    //Index of the first chunk not yet handed to the inflater
+    const char * type;      //IDAT, or fdAT for APNG frames
+    uint8_t skip;           //Bytes ahead of the data in each chunk, the fdAT sequence number
+} IDAT_input;               //Feeds the IDAT(or fdAT) chunks of a png to the inflate backend, in place
+
+typedef struct _memory_shape {
+    chunk_IHDR IHDR;
+    uint64_t file_size;
+    uint64_t chunk_n;           //Chunks of the file, past the known ones estimated
+    uint32_t PLTE_entries;
+    uint32_t tRNS_entries;      //0 without a tRNS chunk
+    uint32_t bands_n;           //Bands of the restart index, 0 or 1 when the image decodes serially
+    uint32_t band_rows_max;     //Rows of the tallest band
+} memory_shape;             //What the heap of a decode depends on, from a parsed png or the first bytes of a file
+
+typedef struct _row_format {
+    uint8_t pixel_bitsize;                  //Size of a filtered pixel
+    PNGdecoder_raster_types raster_type;    //Type of the expanded rows
+    PNGdecoder_strip16_modes strip16;
+    bool premultiply;
+    RGBA8 palette[256];     //PLTE plus tRNS alpha, every index maps to an entry so corrupt indices stay in bounds
+} row_format;               //How rows are expanded, fixed for an image
+
+typedef struct _row_buffers {
+    uint8_t * rows;             //Previous and current unfiltered rows
+    uint8_t * indices;          //Unpacked sub-byte palette indices
+    uint8_t * pixels;           //Expanded row
+    uint32_t row_capacity;      //Bytes of each unfiltered row
+    uint32_t pixel_capacity;    //Pixels of indices and pixels
+    uint64_t pixels_size;
+} row_buffers;              //Scratch rows, kept between decodes of the same size or smaller(APNG frames)
+
+typedef struct _row_sink {
+    //Returns where the given row of a non interlaced image can be expanded in place, NULL for a temporary row; optional
+    uint8_t * (*target)(void *, uint32_t);
+    //Consumes an expanded row, not called for rows expanded in place
+    //Argument 2: pixels, Argument 3: number of pixels, Argument 4: first column, Argument 5: column step, Argument 6: row
+    void (*write)(void *, const uint8_t *, uint32_t, uint32_t, uint8_t, uint32_t);
+    void * user;            //Argument 1 of both
+} row_sink;                 //Destination of the decoded rows: raster, tensor, APNG canvas
+
+typedef struct _raster_sink_state {
+    uint8_t * raster;
+    uint32_t width;
+    uint8_t pixel_size;
+} raster_sink_state;
+
+typedef struct _callback_sink_state {
+    raster_sink_state raster;       //Also copied into, if there is a raster file
+    PNGdecoder_row_callback callback;
+    void * user;
+} callback_sink_state;
+
+typedef struct _tile_sink_state {
+    uint8_t * tiles;                //Whole tiled raster, or a single band of tiles
+    bool band_only;                 //Tiles are reused band after band, emitted as each band completes
+    uint32_t width;
+    uint32_t height;
+    uint8_t pixel_size;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_across;
+    uint64_t tile_bytes;            //Padded to tile_alignment
+    PNGdecoder_tile_callback callback;
+    void * user;
+} tile_sink_state;
+
+typedef struct _row_decoder {
+    PNGdecoder_PNG * png;
+    IDAT_input input;               //Read by the inflate stream
+    uint32_t width;
+    uint32_t height;
+    bool interlaced;
+    const row_format * format;
+    row_buffers * buffers;
+    const row_sink * sink;
+    const inflate_backend * backend;
+    inflate_stream * stream;
+    uint32_t row_size_max;          //Widest row, the one of a non interlaced image
+    uint32_t row_size;              //Row size without the filter byte, varies with the Adam7 step
+    uint8_t a7_step;                //Current step, in [1, 7], 1 only when not interlaced; 0 before the first row
+    uint32_t a7_ncols;              //For current step, number of pixels in each row, number of rows
+    uint32_t a7_nrows;
+    uint32_t row_n;                 //Next row of the current step
+    uint8_t * previous_row;         //Unfiltered rows, swapped after each row
+    uint8_t * current_row;
+    uint64_t rows_done;             //Over all the steps
+    uint64_t rows_total;
+    uint64_t * row_hashes;          //Hash of each expanded row of a non interlaced image, NULL unless asked for
+    pixel_analysis * analysis;      //Fed every expanded row, NULL unless asked for
+} row_decoder;                      //Where a decode stands between two rows
+
+typedef struct _image_decode {
+    row_format format;
+    row_buffers buffers;
+    row_sink sink;
+    raster_sink_state raster_state;
+    callback_sink_state callback_state;
+    tile_sink_state tile_state;
+    uint8_t * band;                 //Tiles of the band being decoded, when only the tile callback gets them
+    tensor_writer * writer;         //Replaces the raster when the options ask for a tensor
+    sidecar_mapping * mapping;      //Holds the raster when the options ask for a raster file
+    raster_any * raster_struct;     //NULL without a raster
+    void * raster;
+    uint64_t * row_hashes;          //One per row, when the options ask for the pixel hash and the rows can be hashed
+    pixel_analysis * analysis;      //When the options ask for it
+    row_decoder rows;
+} image_decode;                     //Decode of the image data of a png into its raster or tensor
+
+typedef struct _band_decode {
+    row_decoder rows;
+    row_buffers buffers;            //Kept until every band is done, the next band may need the last row
+    uint8_t * filtered;             //Rows of a band whose first row filters against the previous band, held until it is done
+    pixel_analysis * analysis;      //Of the rows of the band, merged into the one of the image once every band is done
+    PNGdecoder_result result;
+    bool done;
+} band_decode;
+
+typedef struct _bands_decode {
+    PNGdecoder_PNG * png;
+    image_decode * image;
+    band_decode * bands;            //One per band of the restart index
+    uint32_t next_band;             //First band not taken by a worker
+    pthread_mutex_t lock;
+    pthread_cond_t band_done;       //Broadcast whenever a band completes
+    PNGdecoder_memory_stats * memory;   //Scope of the decode, entered by every worker
+} bands_decode;                     //Concurrent decode of the bands of an image with a restart index
+
+typedef struct _validate_state {
+    FILE * file;                    //NULL when validating memory
+    uint8_t * buffer;               //File window
+    const uint8_t * data;           //Bytes available: the buffer, or the whole memory
+    uint64_t data_n;
+    uint64_t data_pos;
+    uint64_t data_offset;           //File offset of data[0]
+    uint8_t type[4];                //Current chunk
+    uint32_t remaining;             //Data bytes left in the current chunk
+    uint32_t crc;                   //Running CRC of the current chunk type and data
+    bool pending;                   //The inflate input read the header of the chunk following the IDATs
+    PNGdecoder_result result;       //First error found by the inflate input
+    uint64_t error_offset;
+} validate_state;                   //Streaming validation, never more than one file window in memory
+
+struct _PNGdecoder_decoder {
+    char * file_name;
+    PNGdecoder_options options;
+    FILE * file;                    //While the file is read, a block per step
+    uint8_t * bytes;
+    uint64_t file_size;
+    uint64_t bytes_read;
+    PNGdecoder_PNG * png;           //Once parsed, until taken
+    image_decode * image;           //While rows are left
+    PNGdecoder_result result;       //PNGDECODER_IN_PROGRESS until done or failed
+    uint64_t rows_done;
+    uint64_t rows_total;
+    PNGdecoder_memory_stats memory; //Scope of the decode, entered by every step
+};
+
+typedef struct _apng_frame {
+    PNGdecoder_frame_info info;
+    uint32_t first_chunk;       //First chunk holding the frame data
+    uint32_t end_chunk;         //Past the last one
+    bool default_image;         //Data in the IDAT chunks rather than fdAT ones
+} apng_frame;
+
+typedef struct _PNGdecoder_animation {
+    PNGdecoder_PNG * png;
+    uint32_t frame_n;
+    uint32_t plays;
+    apng_frame * frames;
+    uint32_t next_frame;
+    const apng_frame * last;        //Last composited frame, disposed of before the next one, NULL on a clear canvas
+    const apng_frame * current;     //Frame being composited
+    RASTER_RGBA8 canvas;            //Straight alpha
+    RGBA8 * saved;                  //Canvas region under the current frame for PREVIOUS disposal, NULL if no frame needs it
+    RGBA8 * row;                    //Frame row converted to RGBA8
+    row_format format;
+    row_buffers buffers;            //Sized for the largest frame, shared by all of them
+} PNGdecoder_animation;
 
 
 static const uint8_t PNG_magic[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};   //Must have initial 8 bytes
-static const uint8_t chunk_block_size = 5;      //Number of initial chunks allocated, total is unknown, more are allocated as necessary
+static const uint8_t chunk_block_size = 5;      //Number of initial chunks allocated, total is unknown, doubled as necessary
 static const char * chunk_types_essential[4] = {
     "IHDR",
     "PLTE",
@@ -129,8 +342,17 @@ static const char * chunk_types_essential[4] = {
 static const char * chunk_types_ancillary[1] = {
     "tRNS"
 };          //Ancillary chunks handled by the module
-
-static const char * result_strings[12] = {
+static const char * chunk_types_index[2] = {
+    "iDOT",
+    "prIX"
+};          //Restart index chunks, Apple's and ours, same layout(see check_chunk_index)
+static const char * chunk_types_APNG[3] = {
+    "acTL",
+    "fcTL",
+    "fdAT"
+};          //Animation control, frame control, frame data
+
+static const char * result_strings[20] = {
     "Consistent PNG",
     "Invalid argument",
     "Error opening file",
@@ -142,7 +364,15 @@ static const char * result_strings[12] = {
     "Missing critical IEND chunk",
     "Invalid IHDR",
     "Invalid PLTE",
-    "ZLib deflate error"
+    "ZLib deflate error",
+    "Invalid filter type",
+    "Invalid APNG frame chunks",
+    "No more animation frames",
+    "Decode in progress",
+    "Image too large",
+    "Decode limit exceeded",
+    "Memory budget exceeded",
+    "Out of memory"
 };  //Human readable error strings
 
 static const uint8_t Adam7[7*4] = {     //Offset x, offset y, step x, step y
@@ -155,6 +385,24 @@ static const uint8_t Adam7[7*4] = {     //Offset x, offset y, step x, step y
     0, 1, 1, 2
 };              //Handles Adam7 interlacing, each row is a step 1 to 7 containing the necessary information
 
+static const uint64_t tile_alignment = 64;          //Start of every tile, a cache line
+static const uint32_t tile_size_max = 65536;        //Tile width or height
+static const uint64_t convert_block = 4096;         //Pixels converted at a time by PNGdecoder_convert_RGBA8
+static const uint64_t row_bytes_max = 0x7fffffff;      //Longest row the decoder handles, filtered or expanded
+static const uint8_t color_type_channels[7] = { 1, 0, 3, 1, 2, 0, 4 };   //Samples per pixel of each color type
+static const uint32_t validate_buffer_size = 65536;     //File window of the validator
+static const uint32_t validate_span_max = 4096;         //Largest inflated span, longer rows are read in pieces
+static const uint32_t index_bands_max = 1024;           //Larger restart indices are ignored
+static const uint64_t predict_chunk_size = 8192;        //Chunk data assumed past the bytes given to PNGdecoder_predict_memory
+static const uint64_t predict_chunks_extra = 8;        //Small chunks assumed on top of those, IEND and ancillary ones
+static const uint64_t step_read_block = 256 * 1024;     //File bytes read at a time by the step decoder
+
+static const uint8_t raster_pixel_sizes[8] = {
+    sizeof(G8), sizeof(G16), sizeof(RGB8), sizeof(RGB16), sizeof(G8A), sizeof(G16A), sizeof(RGBA8), sizeof(RGBA16)
+};              //Pixel size of each raster type, in bytes
+
+static PNGdecoder_inflate_backends selected_inflate_backend = PNGDECODER_DEFAULT_INFLATE;     //Set through PNGdecoder_set_inflate_backend
+
 
 /*      PRIVATE FUNCTIONS DECLARATIONS        */
 
@@ -168,16 +416,25 @@ static PNGdecoder_result check_chunk_PLTE(PNGdecoder_PNG *);
 //Checks whether a tRNS chunk is present, if so, allocate proper structure
 static void check_chunk_tRNS(PNGdecoder_PNG *);
 
+//Checks whether a restart index chunk(iDOT or prIX) is present and matches the IDAT chunks, if so, allocate proper
+//structure; ignored otherwise, the image data is then inflated serially
+static void check_chunk_index(PNGdecoder_PNG *);
+
 //Checks the consistency of the png, such as the presence of critical chunks and their consistency, CRC value; for
 //IHDR chunk checks PNG type consistency, such as bit depth, color type, etc....
 static PNGdecoder_result check_consistency(PNGdecoder_PNG *);
+//The IHDR part of check_consistency: sizes, bit depth for the color type, methods
+static PNGdecoder_result check_IHDR(const chunk_IHDR *);
+//Checks that rows and the raster of the image, at the widest pixel size, fit what the decoder and the address space
+//can hold, before any size derived from the IHDR is computed
+static PNGdecoder_result check_image_size(const chunk_IHDR *);
 
 //Calls functions dealing with the ancillary chunks supported by the module
 static void check_ancillary_chunks(PNGdecoder_PNG *);
 
 //Frees the structures and vectors allocated for each chunk detected and handled by the module
 //Argument 1: chunks pointer, Argument 2: number of chunks
-static void free_chunks(chunk **, uint16_t);
+static void free_chunks(chunk **, uint32_t);
 
 //Allocates a new chunk structure from the data pointed by the first argument(expects a 4 byte integer with the chunk length)
 static chunk * new_chunk(uint8_t *);
@@ -185,14 +442,8 @@ static chunk * new_chunk(uint8_t *);
 //Allocates and handles critical IHDR chunk from a raw chunk with IHDR signature
 static chunk_IHDR * new_chunk_IHDR(chunk *);
 
-//Takes a list of chunks and concatenates IDAT type chunks into a new vector, whose final size is written
-//in the uint32_t pointer provided by the caller; returns concatenated vector
-//Argument 1: chunks pointer, Argument 2: number of chunks, Argument 3: pointer to integer into which final size is written
-static uint8_t * concatenateIDAT(chunk **, uint16_t, uint32_t *);
-
-//Handles ZLib inflation algorithm, takes a vector of compressed data and its size as input(first 2 arguments)
-// and returns the inflated data of size provided by the caller as 4th argument
-static int8_t zlib_inflate(uint8_t *, uint32_t, uint8_t *, uint32_t);
+//Inflate input callback walking the IDAT chunks of an IDAT_input, hands out the data of one chunk per call
+static uint32_t IDAT_input_fn(void *, const uint8_t **);
 
 
 //Computes and returns the number of bytes required to store a series of lines each containing a filter byte plus a multiple
@@ -200,33 +451,147 @@ static int8_t zlib_inflate(uint8_t *, uint32_t, uint8_t *, uint32_t);
 //Argument 1: pixel size in bits, Argument 2: number of columns in each line(minus the filter byte), Argument 3: number of lines
 //Example: to store 3 pixels of 4 bits each over 2 lines we need 3*4 = 12 bits per line, padded to 16 bits aka 2 bytes
 //plus 1 filter byte per row, hence (2 + 1)*2 = 6 bytes total
-static uint32_t padded_size(uint8_t, uint32_t, uint32_t);
-
-//Computes the size of the byte array required to store the inflated IDAT data, similar to the above padded_size function
-//except it handles the more complex interlaced case requiring variable sizes for each step depending on the size of the input image
-//Arguments: same as above plus one byte indicating whether the image is interlaced(1) or not(0)
-static uint32_t calc_decoded_size(uint8_t, uint32_t, uint32_t, uint8_t);
-
-//Computes the vector "coordinates" of the given Adam7 step row and column in the image of given width and height
-//Argument 1: image/raster width, Argument 2: image/raster height, Argument 3: Adam7 step, Argument 4: pixel number for given line
-//Argument 5: line number; note: step is in [1, 7], but column and raw start from 0
-//Example: given an image of 11x9 pixels, for step 3 of Adam7, the first line, third pixel value will be the 9-th column,
-//5-th row pixel, hence (starting from 0)(4 * 11) + 8 will be returned
-static uint32_t adam7_to_raster(uint32_t, uint32_t, uint8_t, uint32_t, uint32_t);
-
-//Performs the required byte operation on the given byte specified by the given filter
-//Argument 1: filter byte, 0 to 4, Argument 2: byte to unfilter, Argument 3: unfiltered byte to the left of the given byte
-//to filter, left by as many bytes as the pixel size e.g for 8 bit RGB, this will be the byte 3 steps before,
-//Argument 4: unfiltered byte from the previous row, Argument 5: same as 3 except from the previous row
-//Filter byte types: 0(no filter operation), 1(raw + left), 2(raw + up), 3(raw + floor(mean(left + up))), 4(raw + Paeth function)
-static uint8_t unfilter(uint8_t, uint8_t, uint16_t, uint16_t, uint16_t);
-
-//Converts the concatenated IDAT data from the given png into the appropriate raster
-static PNGdecoder_raster_types IDATs_to_raster(PNGdecoder_PNG *);
+static uint64_t padded_size(uint8_t, uint32_t, uint32_t);
+
+//Computes the number of pixels in each row and the number of rows of the given Adam7 step, either may be 0 for small images
+//Argument 1: image width, Argument 2: image height, Argument 3: Adam7 step in [1, 7], Arguments 4 and 5: results
+static void adam7_step_size(uint32_t, uint32_t, uint8_t, uint32_t *, uint32_t *);
+
+//Copies a row of expanded pixels into the raster, one pixel every given step
+//Argument 1: raster position of the first pixel, Argument 2: expanded pixels, Argument 3: number of pixels,
+//Argument 4: Adam7 column step, Argument 5: raster pixel size in bytes
+static void scatter_row(uint8_t *, const uint8_t *, uint32_t, uint8_t, uint8_t);
+
+//Row sinks writing into a raster(raster_sink_state) or a tensor(tensor_writer)
+static uint8_t * raster_sink_target(void *, uint32_t);
+static void raster_sink_write(void *, const uint8_t *, uint32_t, uint32_t, uint8_t, uint32_t);
+static void tensor_sink_write(void *, const uint8_t *, uint32_t, uint32_t, uint8_t, uint32_t);
+//Row sink handing the rows of non interlaced images to the options row callback(callback_sink_state)
+static void callback_sink_write(void *, const uint8_t *, uint32_t, uint32_t, uint8_t, uint32_t);
+//Row sink splitting each row across the tiles it crosses(tile_sink_state); with a band buffer, the band goes to the
+//tile callback once its last row is written
+static void tile_sink_write(void *, const uint8_t *, uint32_t, uint32_t, uint8_t, uint32_t);
+//Hands the tiles of the given band(argument 2) to the tile callback, from the given tiles(argument 3)
+static void tile_emit_band(const tile_sink_state *, uint32_t, const uint8_t *);
+//Tiles of tile_width * tile_height pixels in the layout of the png raster, padded to tile_alignment
+static uint64_t tile_bytes(uint32_t, uint32_t, uint8_t);
+
+//Computes how the rows of the given png expand: raster type, 16 bit handling, palette table
+//Argument 1: png, Argument 2: result, Argument 3: requested strip16 mode, Argument 4: premultiply alpha
+static void row_format_init(PNGdecoder_PNG *, row_format *, PNGdecoder_strip16_modes, bool);
+//Raster type of the rows of an image, given its strip16 mode(as in row_format) and whether it has palette transparency
+static PNGdecoder_raster_types raster_type_for(const chunk_IHDR *, PNGdecoder_strip16_modes, bool);
+
+//Grows the scratch rows to fit an image of the given row size in bytes(argument 2), width(argument 3) and expanded
+//pixel size(argument 4); row_buffers_free releases them
+static void row_buffers_reserve(row_buffers *, uint32_t, uint32_t, uint8_t);
+static void row_buffers_free(row_buffers *);
+
+//Resumable row by row decoding of the image of the given size held in the chunks walked by the input: inflates,
+//unfilters and expands every row, handing it to the sink; the decoder must not move once initialized
+//Argument 1: decoder, Argument 2: png, Argument 3: input, Arguments 4 and 5: width and height, Argument 6: format,
+//Argument 7: scratch, Argument 8: sink, Argument 9: the input starts at a restart point(raw deflate, see stream_new_raw)
+static PNGdecoder_result row_decoder_init(row_decoder *, PNGdecoder_PNG *, const IDAT_input *, uint32_t, uint32_t,
+                                          const row_format *, row_buffers *, const row_sink *, bool);
+//Moves to the next non empty Adam7 step(the whole image when not interlaced), false after the last one
+static bool row_decoder_next_pass(row_decoder *);
+static PNGdecoder_result row_decoder_row(row_decoder *);
+//The part of row_decoder_row after the inflater: unfilters the given filtered row(filter byte first), expands it and
+//hands it to the sink
+static PNGdecoder_result row_decoder_expand(row_decoder *, const uint8_t *);
+//Decodes rows until the image is complete(PNGDECODER_OK, once the stream end is checked), an error, or the given
+//number of rows(argument 2) or monotonic_ns deadline(argument 3) is reached(PNGDECODER_IN_PROGRESS); 0 for no limit
+static PNGdecoder_result row_decoder_step(row_decoder *, uint32_t, uint64_t);
+static void row_decoder_free(row_decoder *);
+
+//Whole image through a row decoder
+static PNGdecoder_result decode_rows(PNGdecoder_PNG *, IDAT_input *, uint32_t, uint32_t, const row_format *, row_buffers *, const row_sink *);
+
+//Prepares the decoding of the IDAT data from the given png into the appropriate raster, or into the tensor given in the
+//options; image_decode_end releases everything and, given the final result(argument 3), hands the raster to the png
+static PNGdecoder_result image_decode_begin(PNGdecoder_PNG *, image_decode *);
+static PNGdecoder_result image_decode_end(PNGdecoder_PNG *, image_decode *, PNGdecoder_result);
+//Converts the raster of the png to the given narrower type(see analysis_compact_type), in place, updating its pixel hash
+static void compact_raster(PNGdecoder_PNG *, PNGdecoder_raster_types);
+//Pixel hash(see PNGdecoder_hash_raster) of a raster of rows of the given stride in bytes(argument 2) and height
+static uint64_t raster_rows_hash(const uint8_t *, uint64_t, uint32_t);
+//Row callback of PNGdecoder_hash_pixels, only there so that no raster is kept
+static void discard_row(void *, uint32_t, const void *);
+
+//Tiled output of image_decode_begin: a whole tiled raster, or a single band when the tile callback takes the tiles
+static PNGdecoder_result tiles_begin(PNGdecoder_PNG *, image_decode *);
+
+//Decodes the bands of the restart index of the png on a thread per band, up to band_threads(see the options), into the
+//output prepared by image_decode_begin; fails without a restart index or if the sink needs the rows in order
+static PNGdecoder_result bands_to_raster(PNGdecoder_PNG *, image_decode *);
+//Thread body of bands_to_raster, takes bands in order until none is left
+static void * band_worker(void *);
+static PNGdecoder_result band_decode_rows(bands_decode *, uint32_t);
+
+//Decodes the IDAT data in one go, by bands if the png has a restart index, serially otherwise or if that fails
+static PNGdecoder_result IDATs_to_raster(PNGdecoder_PNG *);
+
+static uint64_t monotonic_ns(void);
+
+//Validation byte source: validate_fill makes bytes available(false at the end of the file), validate_read copies
+//the given number of bytes(false if the file ends first)
+static bool validate_fill(validate_state *);
+static bool validate_read(validate_state *, uint8_t *, uint32_t);
+static uint64_t validate_offset(validate_state *);
+//Reads the next chunk length and type; validate_chunk_data consumes(copies to argument 2 unless NULL) the given
+//number of its data bytes, validate_chunk_end its CRC, which must match
+static PNGdecoder_result validate_chunk_header(validate_state *, uint64_t *);
+static PNGdecoder_result validate_chunk_data(validate_state *, uint8_t *, uint32_t, uint64_t *);
+static PNGdecoder_result validate_chunk_end(validate_state *, uint64_t *);
+//Inflate input callback over consecutive IDAT chunks, checking each one as it goes
+static uint32_t validate_IDAT_input(void *, const uint8_t **);
+//Inflates the image data, from the first IDAT, checking every filter byte and the exact stream size
+//Argument 2: IHDR, Argument 3: error offset
+static PNGdecoder_result validate_image(validate_state *, const chunk_IHDR *, uint64_t *);
+//Walks the whole file, stopping at the first error and writing its offset(argument 2)
+static PNGdecoder_result validate_stream(validate_state *, uint64_t *);
+
+//Converts 8 bit samples to RGBA8 pixels through the conversion kernels
+//Argument 1: kernels, Argument 2: output pixels, Argument 3: samples, Argument 4: number of pixels, Argument 5: samples
+//per pixel(1 grayscale, 2 grayscale + alpha, 3 RGB, 4 RGBA)
+static void RGBA8_from_samples(const kernel_table *, PNGdecoder_RGBA8_t *, const void *, uint32_t, uint8_t);
+
+//APNG: composites the next frame into the canvas, after disposing of the previous one
+static PNGdecoder_result animation_composite(PNGdecoder_animation *);
+//APNG: applies the dispose op of the given frame to its canvas region
+static void animation_dispose(PNGdecoder_animation *, const apng_frame *);
+//APNG: row sink compositing into the canvas region of the current frame
+static void animation_sink_write(void *, const uint8_t *, uint32_t, uint32_t, uint8_t, uint32_t);
+//APNG: straight alpha source over destination, exact rounding
+static void blend_over(RGBA8 *, RGBA8);
+
+//As PNGdecoder_open_bytes, stopping once the chunks are checked, before decoding the image data
+static PNGdecoder_result parse_bytes(uint8_t *, uint64_t, const PNGdecoder_options *, PNGdecoder_PNG **);
+//PNGdecoder_openPNG_sidecar and PNGdecoder_decoder_step, inside the memory scope of the decode
+static PNGdecoder_result open_sidecar(const char *, const char *, uint8_t, const PNGdecoder_options *, PNGdecoder_PNG **);
+static PNGdecoder_result decoder_step(PNGdecoder_decoder *, uint32_t, uint32_t);
+//Reads the file of a step decode: a block per step under a row limit, blocks until the deadline(argument 3, 0 for none)
+//under a time limit, the whole file without limits; PNGDECODER_IN_PROGRESS while bytes are left
+static PNGdecoder_result decoder_read(PNGdecoder_decoder *, uint32_t, uint64_t);
+
+//Frees the file bytes and the chunk structures once the raster is decoded; animated pngs keep them for their frames
+static void release_file(PNGdecoder_PNG *);
+
+//Heap bytes of the scratch rows(row_buffers_reserve) of an image of the given row size in bytes and width
+static uint64_t row_buffers_memory(uint32_t, uint32_t);
+//Peak heap bytes of decoding an image of the given shape with the given options, see PNGdecoder_predict_memory;
+//memory_shape_of takes the shape of a parsed png
+static uint64_t predict_peak(const memory_shape *, const PNGdecoder_options *);
+static void memory_shape_of(PNGdecoder_PNG *, memory_shape *);
+//Checks the decode limits of the options against a parsed png, before anything large is allocated
+static PNGdecoder_result check_limits(PNGdecoder_PNG *);
+//Bytes of the filtered image data, every Adam7 step of interlaced images
+static uint64_t image_data_size(const chunk_IHDR *);
 
 //Functions to free allocated resources, used by PNGdecoder_free
 static void free_chunk_PLTE(chunk_PLTE *);
 static void free_chunk_tRNS(chunk_tRNS *);
+static void free_chunk_index(chunk_index *);
 static void free_raster(void *, void *);
 
 
@@ -234,108 +599,350 @@ static void free_raster(void *, void *);
 
 
 PNGdecoder_result PNGdecoder_openPNG(const char * file_name, PNGdecoder_PNG ** result){
+    return PNGdecoder_openPNG_ex(file_name, NULL, result);
+}
+
+void PNGdecoder_options_init(PNGdecoder_options * options){
+    if(options == NULL)
+        return;
+
+    options->strip16 = PNGDECODER_STRIP16_NONE;
+    options->tensor = NULL;
+    options->premultiply = 0;
+    options->raster_file = NULL;
+    options->row_callback = NULL;
+    options->row_user = NULL;
+    options->tile_width = 0;
+    options->tile_height = 0;
+    options->tile_callback = NULL;
+    options->tile_user = NULL;
+    options->band_threads = 0;
+    options->max_pixels = 0;
+    options->max_decoded_bytes = 0;
+    options->max_ratio = 0;
+    options->max_memory = 0;
+    options->budget_timeout = PNGDECODER_WAIT_FOREVER;
+    options->pixel_hash = 0;
+    options->analyze = 0;
+    options->auto_compact = 0;
+}
+
+void PNGdecoder_tensor_init(PNGdecoder_tensor * tensor){
+    uint8_t c;
+
+    if(tensor == NULL)
+        return;
+
+    memset(tensor, 0, sizeof(PNGdecoder_tensor));
+    tensor->type = PNGDECODER_TENSOR_F32;
+    tensor->planar = 1;
+    for(c = 0; c < 4; c++)
+        tensor->std[c] = 1.0f;
+}
+
+PNGdecoder_result PNGdecoder_decode_tensor_batch(const char ** file_names, uint32_t n, const PNGdecoder_options * options, uint32_t * failed){
+    PNGdecoder_options slice_options;
+    PNGdecoder_tensor slice;
+    PNGdecoder_PNG * png = NULL;
+    PNGdecoder_result result;
+    uint64_t slice_size;
     uint32_t i;
 
-    if(file_name == NULL)
+    if((file_names == NULL) || (options == NULL) || (options->tensor == NULL))
         return PNGDECODER_INVALID_ARGUMENT;
 
-    FILE * png_file = fopen(file_name, "r");
-    if(png_file == NULL)
-        return PNGDECODER_FILE_OPEN_ERROR;
+    slice = *options->tensor;
+    if((slice.data == NULL) || (slice.channels == 0) || (slice.width == 0) || (slice.height == 0))
+        return PNGDECODER_INVALID_ARGUMENT;
+    slice_size = (slice.row_stride != 0) ? (uint64_t) slice.row_stride * slice.height * (slice.planar ? slice.channels : 1) :
+                                           (uint64_t) slice.channels * slice.width * slice.height;
+    slice_size *= tensor_sample_size(slice.type);
+
+    slice_options = *options;
+    slice_options.tensor = &slice;
+    for(i = 0; i < n; i++){
+        slice.data = ((uint8_t *) options->tensor->data) + (i * slice_size);
+        result = PNGdecoder_openPNG_ex(file_names[i], &slice_options, &png);
+        if(result != PNGDECODER_OK){
+            if(failed != NULL)
+                *failed = i;
+            return result;
+        }
+        PNGdecoder_free(png);
+    }
 
-    uint32_t file_size = 0;
-    fseek(png_file, 0, SEEK_END);
-    file_size = ftell(png_file);
-    fseek(png_file, 0, SEEK_SET);
+    return PNGDECODER_OK;
+}
 
-    uint8_t * bytes = calloc(file_size, 1);
-    for(i = 0; i < file_size; i++)
-        bytes[i] = fgetc(png_file);
-    fclose(png_file);
+PNGdecoder_result PNGdecoder_openPNG_ex(const char * file_name, const PNGdecoder_options * options, PNGdecoder_PNG ** result){
+    uint8_t * bytes;
+    uint64_t file_size;
+    PNGdecoder_result read;
 
-    uint8_t * current_byte = bytes;
-    if(memcmp(current_byte, PNG_magic, 8)){
-        free(bytes);
-        return PNGDECODER_BAD_PNG;
-    }
+    if(file_name == NULL)
+        return PNGDECODER_INVALID_ARGUMENT;
 
-    current_byte += 8;
+    read = PNGdecoder_read_file(file_name, &bytes, &file_size);
+    if(read != PNGDECODER_OK)
+        return read;
 
-    chunk ** chunks = (chunk **)malloc(sizeof(chunk *)*chunk_block_size);
-    uint16_t chunk_n = 0;
-    do{
-        if(((chunk_n % chunk_block_size) == 0) && (chunk_n != 0))
-            chunks = (chunk **)realloc(chunks, sizeof(chunk *) * (chunk_n + chunk_block_size));
+    return PNGdecoder_open_bytes(bytes, file_size, options, result);
+}
 
-        chunks[chunk_n] = new_chunk(current_byte);
-        current_byte += (12 + chunks[chunk_n++]->length); //length + type + CRC + length
-    }while((current_byte - bytes) < file_size);
+PNGdecoder_result PNGdecoder_openPNG_sidecar(const char * file_name, const char * sidecar_name, uint8_t compress,
+                                            const PNGdecoder_options * options, PNGdecoder_PNG ** result){
+    PNGdecoder_memory_stats memory = { 0 };
+    PNGdecoder_memory_stats * outer = memory_scope_enter(&memory);
+    PNGdecoder_result status = open_sidecar(file_name, sidecar_name, compress, options, result);
 
-    if(memcmp(chunks[0]->type, chunk_types_essential[0], 4)){
-        free_chunks(chunks, chunk_n);
-        free(bytes);
-        return PNGDECODER_MISSING_IHDR;
+    memory_scope_enter(outer);
+    if(status == PNGDECODER_OK)
+        (*result)->memory = memory;
+    return status;
+}
+
+static PNGdecoder_result open_sidecar(const char * file_name, const char * sidecar_name, uint8_t compress,
+                                      const PNGdecoder_options * options, PNGdecoder_PNG ** result){
+    PNGdecoder_options defaults;
+    PNGdecoder_PNG * png;
+    PNGdecoder_result status;
+    sidecar_mapping mapping;
+    sidecar_key key;
+    row_format format;
+    raster_any * raster_struct;
+    pixel_analysis analysis;
+    char * default_name = NULL;
+    uint8_t * bytes;
+    uint64_t file_size;
+    uint32_t y;
+
+    if((file_name == NULL) || (result == NULL) ||
+       ((options != NULL) && ((options->tensor != NULL) || (options->raster_file != NULL) || (options->row_callback != NULL) ||
+                              (options->tile_width != 0) || (options->tile_height != 0))))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(options == NULL){
+        PNGdecoder_options_init(&defaults);
+        options = &defaults;
     }
-    if(memcmp(chunks[chunk_n - 1]->type, chunk_types_essential[3], 4)){
-        free_chunks(chunks, chunk_n);
-        free(bytes);
-        return PNGDECODER_MISSING_IEND;
+
+    status = PNGdecoder_read_file(file_name, &bytes, &file_size);
+    if(status != PNGDECODER_OK)
+        return status;
+    key.source_size = file_size;
+    key.source_hash = hash64(bytes, file_size, 0);
+    key.options = sidecar_options(options);
+
+    status = parse_bytes(bytes, file_size, options, &png);
+    if(status != PNGDECODER_OK)
+        return status;
+    png->options.auto_compact = 0;     //The sidecar holds the raster type of the image
+
+    if(sidecar_name == NULL){
+        default_name = (char *) mem_malloc(strlen(file_name) + 6);
+        if(default_name == NULL){
+            PNGdecoder_free(png);
+            return PNGDECODER_MEMORY_ERROR;
+        }
+        sprintf(default_name, "%s.pngd", file_name);
+        sidecar_name = default_name;
     }
 
-    chunk_IHDR * IHDR = new_chunk_IHDR(chunks[0]);
+    //The raster must also be the one this library version would decode
+    row_format_init(png, &format, options->strip16, options->premultiply);
+    if(sidecar_open(sidecar_name, &key, &mapping) == PNGDECODER_OK){
+        if((mapping.type == format.raster_type) && (mapping.width == png->IHDR->width) && (mapping.height == png->IHDR->height)){
+            raster_struct = (raster_any *) mem_malloc(sizeof(raster_any));
+            png->mapping = (sidecar_mapping *) mem_malloc(sizeof(sidecar_mapping));
+            if((raster_struct == NULL) || (png->mapping == NULL)){
+                sidecar_close(&mapping);
+                mem_free(raster_struct);
+                mem_free(png->mapping);
+                png->mapping = NULL;
+                mem_free(default_name);
+                PNGdecoder_free(png);
+                return PNGDECODER_MEMORY_ERROR;
+            }
+            raster_struct->width = mapping.width;
+            raster_struct->height = mapping.height;
+            raster_struct->raster = mapping.raster;
+            *png->mapping = mapping;
+            png->raster_struct = raster_struct;
+            png->raster = mapping.raster;
+            png->raster_type = mapping.type;
+            if(options->pixel_hash){
+                png->pixel_hash = raster_rows_hash(mapping.raster, (uint64_t) mapping.width * raster_pixel_sizes[mapping.type], mapping.height);
+                png->pixel_hashed = true;
+            }
+            if(options->analyze || options->auto_compact){
+                analysis_init(&analysis, mapping.type);
+                for(y = 0; y < mapping.height; y++)
+                    analysis_add_row(&analysis, (const uint8_t *) mapping.raster + ((uint64_t) y * mapping.width * raster_pixel_sizes[mapping.type]), mapping.width);
+                analysis_result(&analysis, &png->analysis);
+                png->analyzed = true;
+            }
+            release_file(png);
 
-    PNGdecoder_PNG * png = (PNGdecoder_PNG *) malloc(sizeof(PNGdecoder_PNG));
-    png->file_size = file_size;
-    png->raw_file = bytes;
-    png->chunk_n = chunk_n;
-    png->chunks = chunks;
-    png->IHDR = IHDR;
-    png->rawIDATs = NULL;
-    png->rawIDATs_size = 0;
-    //png->pixel_data = NULL;
-    //png->pixel_data_size = 0;
-    png->PLTE = NULL;
-    png->tRNS = NULL;
-    png->raster_struct = NULL;
-    png->raster = NULL;
-    png->raster_type = PNGDECODER_RASTER_INVALID;
+            mem_free(default_name);
+            *result = png;
+            return PNGDECODER_OK;
+        }
+        sidecar_close(&mapping);
+    }
 
-    PNGdecoder_result consistent = check_consistency(png);
-    if(consistent != PNGDECODER_OK){
+    status = IDATs_to_raster(png);
+    if(status != PNGDECODER_OK){
+        mem_free(default_name);
         PNGdecoder_free(png);
-        return consistent;
+        return status;
     }
+    sidecar_write(sidecar_name, &key, png->raster, png->raster_type, png->IHDR->width, png->IHDR->height, compress);    //Best effort
 
-    check_ancillary_chunks(png);
-    png->rawIDATs = concatenateIDAT(chunks, chunk_n, &png->rawIDATs_size);
-    png->raster_type = IDATs_to_raster(png);
-    //IDATs_to_pixel_data(png);
-    //png->raster_type = call_raster_method(png);
-
+    mem_free(default_name);
     *result = png;
     return PNGDECODER_OK;
 }
 
+PNGdecoder_result PNGdecoder_openPNG_memory(const void * data, uint64_t size, const PNGdecoder_options * options, PNGdecoder_PNG ** result){
+    uint8_t * bytes;
+
+    if((data == NULL) || (size < 8) || (result == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    bytes = (uint8_t *) mem_malloc(size);
+    if(bytes == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    memcpy(bytes, data, size);
+
+    return PNGdecoder_open_bytes(bytes, size, options, result);
+}
+
 void PNGdecoder_free(PNGdecoder_PNG * png){
     if(png == NULL)
         return;
 
     if(png->raw_file != NULL)
-        free(png->raw_file);
+        mem_free(png->raw_file);
     if(png->chunks != NULL)
         free_chunks(png->chunks, png->chunk_n);
     if(png->IHDR != NULL)
-        free(png->IHDR);
-    if(png->rawIDATs != NULL)
-        free(png->rawIDATs);
+        mem_free(png->IHDR);
     //if(png->pixel_data != NULL)
         //free(png->pixel_data);
     if(png->PLTE != NULL)
         free_chunk_PLTE(png->PLTE);
     if(png->tRNS != NULL)
         free_chunk_tRNS(png->tRNS);
-    if(png->raster_struct != NULL)
+    if(png->index != NULL)
+        free_chunk_index(png->index);
+    if(png->mapping != NULL){
+        sidecar_close(png->mapping);
+        mem_free(png->mapping);
+        mem_free(png->raster_struct);
+    } else if(png->raster_struct != NULL){
         free_raster(png->raster_struct, png->raster);
+    }
+    mem_free(png);
+}
+
+void * PNGdecoder_detach_raster(PNGdecoder_PNG * png){
+    raster_any * raster_struct;
+    uint64_t size;
+    void * raster;
+
+    if((png == NULL) || (png->raster_struct == NULL))
+        return NULL;
+    raster_struct = (raster_any *) png->raster_struct;
+
+    //A mapped raster cannot outlive its mapping, the caller gets a copy
+    if(png->mapping != NULL){
+        size = (uint64_t) raster_struct->width * raster_struct->height * raster_pixel_sizes[png->raster_type];
+        raster = mem_malloc(size);
+        if(raster == NULL)
+            return NULL;
+        memcpy(raster, png->raster, size);
+        sidecar_close(png->mapping);
+        mem_free(png->mapping);
+        png->mapping = NULL;
+        raster_struct->raster = raster;
+    }
+
+    png->raster_struct = NULL;
+    png->raster = NULL;
+    return raster_struct;
+}
+
+PNGdecoder_result PNGdecoder_convert_RGBA8(PNGdecoder_PNG * png){
+    const kernel_table * kernels = kernels_get();
+    uint8_t pixel_size, channels;
+    bool wide, backwards;
+    uint64_t n, i, block, start;
+    uint8_t * raster, * bounce, * big_endian = NULL, * samples;
+    void * resized;
+    PNGdecoder_result result = PNGDECODER_OK;
+
+    if((png == NULL) || (png->raster == NULL) || (png->mapping != NULL) || (png->options.tile_width != 0))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(png->raster_type == PNGDECODER_RASTER_RGBA_8)
+        return PNGDECODER_OK;
+
+    pixel_size = raster_pixel_sizes[png->raster_type];
+    wide = (png->raster_type == PNGDECODER_RASTER_GRAYSCALE_16) || (png->raster_type == PNGDECODER_RASTER_RGB_16) ||
+           (png->raster_type == PNGDECODER_RASTER_GRAYSCALE_16A) || (png->raster_type == PNGDECODER_RASTER_RGBA_16);
+    channels = wide ? pixel_size / 2 : pixel_size;
+    n = (uint64_t) png->IHDR->width * png->IHDR->height;
+
+    //Taken before the raster changes, so that a failure leaves the image as it was
+    bounce = (uint8_t *) mem_malloc(convert_block * pixel_size);
+    samples = bounce;
+    if(wide){
+        big_endian = (uint8_t *) mem_malloc(convert_block * pixel_size);
+        samples = (uint8_t *) mem_malloc(convert_block * channels);
+    }
+    if((bounce == NULL) || (wide && ((big_endian == NULL) || (samples == NULL)))){
+        result = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+
+    //Growing rasters convert back to front and shrinking ones front to back, so that every block of pixels is read
+    //into the bounce buffer before any output lands on it
+    backwards = pixel_size < sizeof(RGBA8);
+    if(backwards){
+        resized = mem_realloc(png->raster, n * sizeof(RGBA8));
+        if(resized == NULL){
+            result = PNGDECODER_MEMORY_ERROR;
+            goto end;
+        }
+        png->raster = resized;
+    }
+    raster = (uint8_t *) png->raster;
+
+    for(i = 0; i < n; i += block){
+        block = ((n - i) < convert_block) ? n - i : convert_block;
+        start = backwards ? n - i - block : i;
+        memcpy(bounce, raster + (start * pixel_size), block * pixel_size);
+        if(wide){
+            //Back to big endian(swap16 is its own inverse), then through the strip kernel as in PNGdecoder_as_RGBA8
+            kernels->swap16((uint16_t *) big_endian, bounce, block * channels);
+            kernels->strip16(samples, big_endian, block * channels, PNGDECODER_STRIP16_ROUND);
+        }
+        RGBA8_from_samples(kernels, (RGBA8 *)(raster + (start * sizeof(RGBA8))), samples, block, channels);
+    }
+
+    if(!backwards){
+        resized = mem_realloc(png->raster, n * sizeof(RGBA8));
+        if(resized != NULL)     //Keeping the larger block is harmless
+            png->raster = resized;
+    }
+    ((raster_any *) png->raster_struct)->raster = png->raster;
+    png->raster_type = PNGDECODER_RASTER_RGBA_8;
+
+end:
+    mem_free(bounce);
+    if(wide){
+        mem_free(big_endian);
+        mem_free(samples);
+    }
+    return result;
 }
 
 const char * PNGdecoder_strerror(PNGdecoder_result result){
@@ -380,82 +987,209 @@ const uint32_t PNGdecoder_get_height(PNGdecoder_PNG * png){
     return 0;
 }
 
-PNGdecoder_raster_RGBA8_t * PNGdecoder_as_RGBA8(PNGdecoder_PNG * png){
-    if(png == NULL)
+PNGdecoder_result PNGdecoder_get_pixel_hash(PNGdecoder_PNG * png, uint64_t * hash){
+    if((png == NULL) || (hash == NULL) || !png->pixel_hashed)
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    *hash = png->pixel_hash;
+    return PNGDECODER_OK;
+}
+
+PNGdecoder_result PNGdecoder_get_analysis(PNGdecoder_PNG * png, PNGdecoder_analysis * analysis){
+    if((png == NULL) || (analysis == NULL) || !png->analyzed)
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    *analysis = png->analysis;
+    return PNGDECODER_OK;
+}
+
+uint32_t PNGdecoder_get_bands_decoded(PNGdecoder_PNG * png){
+    if(png != NULL)
+        return png->bands_decoded;
+
+    return 0;
+}
+
+uint64_t PNGdecoder_hash_raster(const void * raster_struct, PNGdecoder_raster_types type){
+    const raster_any * raster = (const raster_any *) raster_struct;
+
+    if(raster == NULL)
+        return 0;
+
+    return raster_rows_hash((const uint8_t *) raster->raster, (uint64_t) raster->width * raster_pixel_sizes[type], raster->height);
+}
+
+void PNGdecoder_get_memory_stats(PNGdecoder_PNG * png, PNGdecoder_memory_stats * stats){
+    if((png == NULL) || (stats == NULL))
+        return;
+
+    *stats = png->memory;
+}
+
+PNGdecoder_result PNGdecoder_predict_memory(const void * data, uint64_t size, uint64_t file_size, const PNGdecoder_options * options,
+                                           uint64_t * result){
+    const uint8_t * bytes = (const uint8_t *) data;
+    PNGdecoder_options defaults;
+    memory_shape shape;
+    const uint8_t * type_bytes;
+    uint64_t offset = 8, length;
+    bool image_data = false, tRNS_found = false;
+    uint32_t k;
+
+    if((data == NULL) || (size < 33) || (size > file_size) || (result == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(options == NULL){
+        PNGdecoder_options_init(&defaults);
+        options = &defaults;
+    }
+    if(memcmp(bytes, PNG_magic, 8))
+        return PNGDECODER_BAD_PNG;
+    if((swapped_uint32((uint8_t *) bytes + 8) != 13) || memcmp(bytes + 12, chunk_types_essential[0], 4))
+        return PNGDECODER_MISSING_IHDR;
+
+    memset(&shape, 0, sizeof(memory_shape));
+    shape.IHDR.width = swapped_uint32((uint8_t *) bytes + 16);
+    shape.IHDR.height = swapped_uint32((uint8_t *) bytes + 20);
+    shape.IHDR.bit_depth = bytes[24];
+    shape.IHDR.color_type = bytes[25];
+    shape.IHDR.compression_method = bytes[26];
+    shape.IHDR.filter_method = bytes[27];
+    shape.IHDR.interlace_method = bytes[28];
+    if(check_IHDR(&shape.IHDR) != PNGDECODER_OK)
+        return PNGDECODER_INVALID_IHDR;
+    if(check_image_size(&shape.IHDR) != PNGDECODER_OK)
+        return PNGDECODER_IMAGE_TOO_LARGE;
+    shape.file_size = file_size;
+    shape.PLTE_entries = 256;
+    shape.tRNS_entries = 256;
+
+    //Whole chunks among the given bytes; the ones the decode keeps a structure for come before the image data
+    while(offset + 12 <= size){
+        length = swapped_uint32((uint8_t *) bytes + offset);
+        if(offset + 12 + length > size)
+            break;
+        type_bytes = bytes + offset + 4;
+        if(!image_data){
+            if(!memcmp(type_bytes, chunk_types_essential[2], 4)){
+                image_data = true;
+                if(!tRNS_found)
+                    shape.tRNS_entries = 0;
+            } else if(!memcmp(type_bytes, chunk_types_essential[1], 4)){
+                shape.PLTE_entries = length / 3;
+            } else if(!memcmp(type_bytes, chunk_types_ancillary[0], 4)){
+                shape.tRNS_entries = length;
+                tRNS_found = true;
+            } else if((!memcmp(type_bytes, chunk_types_index[0], 4) || !memcmp(type_bytes, chunk_types_index[1], 4)) &&
+                      (shape.bands_n == 0) && (length >= 4)){
+                shape.bands_n = swapped_uint32((uint8_t *) bytes + offset + 8);
+                if((shape.bands_n < 2) || (shape.bands_n > index_bands_max) || (length != 4 + ((uint64_t) shape.bands_n * 12)) ||
+                   shape.IHDR.interlace_method)
+                    shape.bands_n = 1;      //Ignored by the decode
+                for(k = 0; (shape.bands_n > 1) && (k < shape.bands_n); k++)
+                    if(swapped_uint32((uint8_t *) bytes + offset + 16 + (k * 12)) > shape.band_rows_max)
+                        shape.band_rows_max = swapped_uint32((uint8_t *) bytes + offset + 16 + (k * 12));
+            }
+        }
+        shape.chunk_n++;
+        offset += 12 + length;
+    }
+    if(offset < file_size)
+        shape.chunk_n += ((file_size - offset) / (predict_chunk_size + 12)) + predict_chunks_extra;
+    if(shape.band_rows_max > shape.IHDR.height)
+        shape.band_rows_max = shape.IHDR.height;
+
+    *result = predict_peak(&shape, options);
+    return PNGDECODER_OK;
+}
+
+const void * PNGdecoder_get_tile(PNGdecoder_PNG * png, uint32_t tile_x, uint32_t tile_y){
+    uint32_t tile_width, tile_height;
+    uint64_t index;
+
+    if((png == NULL) || (png->raster == NULL) || (png->options.tile_width == 0))
         return NULL;
 
-    uint32_t i, j;
-    uint8_t level, alpha;
+    tile_width = png->options.tile_width;
+    tile_height = png->options.tile_height;
+    if((tile_x >= (png->IHDR->width + tile_width - 1) / tile_width) || (tile_y >= (png->IHDR->height + tile_height - 1) / tile_height))
+        return NULL;
+
+    index = ((uint64_t) tile_y * ((png->IHDR->width + tile_width - 1) / tile_width)) + tile_x;
+    return ((uint8_t *) png->raster) + (index * tile_bytes(tile_width, tile_height, raster_pixel_sizes[png->raster_type]));
+}
 
-    if(png->IHDR->bit_depth > 8)
+PNGdecoder_raster_RGBA8_t * PNGdecoder_as_RGBA8(PNGdecoder_PNG * png){
+    if((png == NULL) || (png->raster == NULL) || (png->options.tile_width != 0))
         return NULL;
 
-    PNGdecoder_raster_RGBA8_t * raster_rgba8 = (PNGdecoder_raster_RGBA8_t *) malloc(sizeof(PNGdecoder_raster_RGBA8_t));
+    const kernel_table * kernels = kernels_get();
+    uint64_t i, n;
+    uint8_t channels = raster_pixel_sizes[png->raster_type];
+    bool wide = false;                          //16 bit raster
+    uint8_t * big_endian_row = NULL;
+    uint8_t * row8 = NULL;
+
+    switch(png->raster_type){
+        case PNGDECODER_RASTER_GRAYSCALE_16:
+        case PNGDECODER_RASTER_RGB_16:
+        case PNGDECODER_RASTER_GRAYSCALE_16A:
+        case PNGDECODER_RASTER_RGBA_16:
+            wide = true;
+            channels /= 2;
+            break;
+        default:
+            break;
+    }
+
+    PNGdecoder_raster_RGBA8_t * raster_rgba8 = (PNGdecoder_raster_RGBA8_t *) mem_malloc(sizeof(PNGdecoder_raster_RGBA8_t));
 
     raster_rgba8->width = png->IHDR->width;
     raster_rgba8->height = png->IHDR->height;
-    raster_rgba8->raster = (PNGdecoder_RGBA8_t *) calloc(raster_rgba8->width * raster_rgba8->height, sizeof(PNGdecoder_RGBA8_t));
+    raster_rgba8->raster = (PNGdecoder_RGBA8_t *) mem_calloc((uint64_t) raster_rgba8->width * raster_rgba8->height, sizeof(PNGdecoder_RGBA8_t));
 
-    for(i = 0; i < raster_rgba8->height; i++)
-        for(j = 0; j < raster_rgba8->width; j++){
-            switch(png->raster_type){
-                case PNGDECODER_RASTER_GRAYSCALE_8:
-                    level = ((uint8_t *) png->raster)[(i * raster_rgba8->width) + j];
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].R = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].G = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].B = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].A = 0xFF;
-                    break;
-                case PNGDECODER_RASTER_GRAYSCALE_8A:
-                    level = ((PNGdecoder_grayscale8a_t *) png->raster)[(i * raster_rgba8->width) + j].level;
-                    alpha = ((PNGdecoder_grayscale8a_t *) png->raster)[(i * raster_rgba8->width) + j].alpha;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].R = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].G = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].B = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].A = alpha;
-                    break;
-                case PNGDECODER_RASTER_RGB_8:
-                    level = ((PNGdecoder_RGB8_t *) png->raster)[(i * raster_rgba8->width) + j].R;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].R = level;
-                    level = ((PNGdecoder_RGB8_t *) png->raster)[(i * raster_rgba8->width) + j].G;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].G = level;
-                    level = ((PNGdecoder_RGB8_t *) png->raster)[(i * raster_rgba8->width) + j].B;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].B = level;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].A = 0xFF;
-                    break;
-                case PNGDECODER_RASTER_RGBA_8:
-                    level = ((PNGdecoder_RGBA8_t *) png->raster)[(i * raster_rgba8->width) + j].R;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].R = level;
-                    level = ((PNGdecoder_RGBA8_t *) png->raster)[(i * raster_rgba8->width) + j].G;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].G = level;
-                    level = ((PNGdecoder_RGBA8_t *) png->raster)[(i * raster_rgba8->width) + j].B;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].B = level;
-                    alpha = ((PNGdecoder_RGBA8_t *) png->raster)[(i * raster_rgba8->width) + j].A;
-                    raster_rgba8->raster[(i * raster_rgba8->width) + j].A = alpha;
-                    break;
-                default:
-                    break;
-            }
-        }
+    n = (uint64_t) raster_rgba8->width * raster_rgba8->height;
+    if(!wide && (n <= UINT32_MAX)){
+        RGBA8_from_samples(kernels, raster_rgba8->raster, png->raster, n, channels);   //Rasters are contiguous, convert them as a single row
+        return raster_rgba8;
+    }
+    if(!wide){
+        for(i = 0; i < raster_rgba8->height; i++)
+            RGBA8_from_samples(kernels, raster_rgba8->raster + (i * raster_rgba8->width),
+                               ((uint8_t *) png->raster) + (i * raster_rgba8->width * channels), raster_rgba8->width, channels);
+        return raster_rgba8;
+    }
+
+    //16 bit rasters go back to big endian a row at a time(swap16 is its own inverse), then through the strip kernel
+    n = raster_rgba8->width * channels;
+    big_endian_row = (uint8_t *) mem_malloc(n * sizeof(uint16_t));
+    row8 = (uint8_t *) mem_malloc(n);
+    for(i = 0; i < raster_rgba8->height; i++){
+        kernels->swap16((uint16_t *) big_endian_row, ((uint8_t *) png->raster) + (i * n * sizeof(uint16_t)), n);
+        kernels->strip16(row8, big_endian_row, n, PNGDECODER_STRIP16_ROUND);
+        RGBA8_from_samples(kernels, raster_rgba8->raster + (i * raster_rgba8->width), row8, raster_rgba8->width, channels);
+    }
+    mem_free(big_endian_row);
+    mem_free(row8);
 
     return raster_rgba8;
 }
 
 PNGdecoder_raster_RGBA16_t * PNGdecoder_as_RGBA16(PNGdecoder_PNG * png){
-    if(png == NULL)
+    if((png == NULL) || (png->raster == NULL) || (png->options.tile_width != 0))
         return NULL;
 
-    uint32_t i, j;
+    uint64_t i, j;
     uint16_t level, alpha;
 
-    if(png->IHDR->bit_depth <= 8)
+    if((png->raster_type != PNGDECODER_RASTER_GRAYSCALE_16) && (png->raster_type != PNGDECODER_RASTER_RGB_16) &&
+       (png->raster_type != PNGDECODER_RASTER_GRAYSCALE_16A) && (png->raster_type != PNGDECODER_RASTER_RGBA_16))
         return NULL;
 
-    PNGdecoder_raster_RGBA16_t * raster_rgba16 = (PNGdecoder_raster_RGBA16_t *) malloc(sizeof(PNGdecoder_raster_RGBA16_t));
+    PNGdecoder_raster_RGBA16_t * raster_rgba16 = (PNGdecoder_raster_RGBA16_t *) mem_malloc(sizeof(PNGdecoder_raster_RGBA16_t));
 
     raster_rgba16->width = png->IHDR->width;
     raster_rgba16->height = png->IHDR->height;
-    raster_rgba16->raster = (PNGdecoder_RGBA16_t *) calloc(raster_rgba16->width * raster_rgba16->height, sizeof(PNGdecoder_RGBA16_t));
+    raster_rgba16->raster = (PNGdecoder_RGBA16_t *) mem_calloc((uint64_t) raster_rgba16->width * raster_rgba16->height, sizeof(PNGdecoder_RGBA16_t));
 
     for(i = 0; i < raster_rgba16->height; i++)
         for(j = 0; j < raster_rgba16->width; j++){
@@ -505,693 +1239,2316 @@ PNGdecoder_raster_RGBA16_t * PNGdecoder_as_RGBA16(PNGdecoder_PNG * png){
 void PNGdecoder_raster_free(void * raster_struct, PNGdecoder_raster_types type){
     if(raster_struct == NULL) return;
 
-    if(type == PNGDECODER_RASTER_RGBA_8)
-        free(((PNGdecoder_raster_RGBA8_t *)raster_struct)->raster);
-    else if(type == PNGDECODER_RASTER_RGBA_16)
-        free(((PNGdecoder_raster_RGBA16_t *)raster_struct)->raster);
+    if((type >= PNGDECODER_RASTER_GRAYSCALE_8) && (type <= PNGDECODER_RASTER_RGBA_16))
+        mem_free(((raster_any *)raster_struct)->raster);    //Every raster type shares the raster_any layout
 
-    free(raster_struct);
+    mem_free(raster_struct);
     return;
 }
 
+PNGdecoder_result PNGdecoder_set_inflate_backend(PNGdecoder_inflate_backends backend){
+    if(inflate_get_backend(backend) == NULL)
+        return PNGDECODER_INVALID_ARGUMENT;
 
+    selected_inflate_backend = backend;
+    return PNGDECODER_OK;
+}
 
-/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
-
-
-static uint32_t swapped_uint32(uint8_t * pointer){
-    uint32_t raw = *((uint32_t *)pointer);
-    return ((raw>>24)&0xff) | ((raw<<8)&0xff0000) | ((raw>>8)&0xff00) | ((raw<<24)&0xff000000);
+PNGdecoder_inflate_backends PNGdecoder_get_inflate_backend(void){
+    return selected_inflate_backend;
 }
 
-static PNGdecoder_result check_chunk_PLTE(PNGdecoder_PNG * png){
-    uint16_t i;
-    chunk * rawPLTE = NULL;
+uint8_t PNGdecoder_is_animated(PNGdecoder_PNG * png){
+    uint32_t i;
+
+    if(png == NULL)
+        return 0;
     for(i = 0; i < png->chunk_n; i++)
-        if(!memcmp(png->chunks[i]->type, chunk_types_essential[1], 4)) rawPLTE = png->chunks[i];
+        if(!memcmp(png->chunks[i]->type, chunk_types_APNG[0], 4))
+            return 1;
 
-    if(rawPLTE != NULL){
-        if(rawPLTE->length % 3)
-            return PNGDECODER_INVALID_PLTE;
+    return 0;
+}
 
-        uint16_t entries_n = rawPLTE->length / 3;
-        if(entries_n > (2 << (png->IHDR->bit_depth - 1)))
-            return PNGDECODER_INVALID_PLTE;
+PNGdecoder_result PNGdecoder_animation_open(PNGdecoder_PNG * png, PNGdecoder_animation ** result){
+    PNGdecoder_animation * anim;
+    apng_frame * frame = NULL, * previous;
+    chunk * c, * acTL = NULL;
+    uint8_t * d;
+    uint32_t width, height, declared = 0, plays = 0, fcTL_n = 0, sequence = 0, i;
+    bool IDAT_seen = false, full, previous_full = false, needs_saved = false;
 
-        chunk_PLTE * PLTE = (chunk_PLTE *) malloc(sizeof(chunk_PLTE));
-        PLTE->entries_n = entries_n;
-        PLTE->entries = (uint8_t *) calloc(entries_n * 3, sizeof(uint8_t));
-        for(i = 0; i < entries_n; i++)
-            memcpy(&PLTE->entries[i*3], &rawPLTE->data[i*3], 3);
-        png->PLTE = PLTE;
+    if((png == NULL) || (result == NULL) || !PNGdecoder_is_animated(png) || (png->IHDR == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+    width = png->IHDR->width;
+    height = png->IHDR->height;
+
+    //Counted first so a bogus acTL cannot ask for a huge frame table
+    for(i = 0; i < png->chunk_n; i++){
+        c = png->chunks[i];
+        if(!memcmp(c->type, chunk_types_essential[2], 4)){
+            IDAT_seen = true;
+        } else if(!memcmp(c->type, chunk_types_APNG[0], 4)){
+            if(IDAT_seen || (acTL != NULL) || (c->length != 8))
+                return PNGDECODER_INVALID_APNG;
+            acTL = c;
+        } else if(!memcmp(c->type, chunk_types_APNG[1], 4)){
+            fcTL_n++;
+        }
+    }
+    declared = swapped_uint32(acTL->data);
+    plays = swapped_uint32(acTL->data + 4);
+    if((declared == 0) || (declared != fcTL_n))
+        return PNGDECODER_INVALID_APNG;
+
+    anim = (PNGdecoder_animation *) mem_calloc(1, sizeof(PNGdecoder_animation));
+    if(anim == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    anim->png = png;
+    anim->frame_n = declared;
+    anim->plays = plays;
+    anim->frames = (apng_frame *) mem_calloc(declared, sizeof(apng_frame));
+    if(anim->frames == NULL){
+        mem_free(anim);
+        return PNGDECODER_MEMORY_ERROR;
+    }
 
-        return PNGDECODER_OK;
+    //fcTL and fdAT share one sequence; frames before the first IDAT use it as their data
+    IDAT_seen = false;
+    fcTL_n = 0;
+    for(i = 0; i < png->chunk_n; i++){
+        c = png->chunks[i];
+        d = c->data;
+        if(!memcmp(c->type, chunk_types_essential[2], 4)){
+            IDAT_seen = true;
+        } else if(!memcmp(c->type, chunk_types_APNG[1], 4)){
+            if((c->length != 26) || (swapped_uint32(d) != sequence++))
+                goto invalid;
+            if((frame != NULL) && (frame->end_chunk == 0))
+                goto invalid;       //Previous frame without data
+
+            frame = &anim->frames[fcTL_n];
+            frame->info.index = fcTL_n++;
+            frame->info.width = swapped_uint32(d + 4);
+            frame->info.height = swapped_uint32(d + 8);
+            frame->info.x_offset = swapped_uint32(d + 12);
+            frame->info.y_offset = swapped_uint32(d + 16);
+            frame->info.delay_num = (d[20] << 8) | d[21];
+            frame->info.delay_den = (d[22] << 8) | d[23];
+            if((d[24] > PNGDECODER_DISPOSE_PREVIOUS) || (d[25] > PNGDECODER_BLEND_OVER))
+                goto invalid;
+            frame->info.dispose_op = d[24];
+            frame->info.blend_op = d[25];
+
+            if((frame->info.width == 0) || (frame->info.height == 0) ||
+               (((uint64_t) frame->info.x_offset + frame->info.width) > width) ||
+               (((uint64_t) frame->info.y_offset + frame->info.height) > height))
+                goto invalid;
+
+            if(!IDAT_seen){
+                if((frame->info.width != width) || (frame->info.height != height))
+                    goto invalid;   //Offsets are 0 given the bounds above
+                frame->default_image = true;
+                frame->first_chunk = 0;
+                frame->end_chunk = png->chunk_n;
+            }
+            if(frame->info.dispose_op == PNGDECODER_DISPOSE_PREVIOUS)
+                needs_saved = true;
+        } else if(!memcmp(c->type, chunk_types_APNG[2], 4)){
+            if((c->length < 4) || (swapped_uint32(d) != sequence++))
+                goto invalid;
+            if((frame == NULL) || frame->default_image)
+                goto invalid;
+            if(frame->end_chunk == 0)
+                frame->first_chunk = i;
+            frame->end_chunk = i + 1;
+        }
     }
-    return PNGDECODER_MISSING_PLTE;
+    if(frame->end_chunk == 0)
+        goto invalid;
+
+    //A keyframe does not depend on the canvas before it: the first frame, a frame replacing the whole canvas(unless it
+    //has to restore it later), or one after a whole canvas frame cleared on disposal
+    for(i = 0; i < declared; i++){
+        frame = &anim->frames[i];
+        previous = (i > 0) ? &anim->frames[i - 1] : NULL;
+        full = (frame->info.width == width) && (frame->info.height == height);
+        frame->info.keyframe = (previous == NULL) ||
+                               (full && (frame->info.blend_op == PNGDECODER_BLEND_SOURCE) &&
+                                (frame->info.dispose_op != PNGDECODER_DISPOSE_PREVIOUS)) ||
+                               (previous_full && (previous->info.dispose_op == PNGDECODER_DISPOSE_BACKGROUND));
+        previous_full = full;
+    }
+
+    anim->canvas.width = width;
+    anim->canvas.height = height;
+    anim->canvas.raster = (RGBA8 *) mem_calloc((uint64_t) width * height, sizeof(RGBA8));
+    if(needs_saved)
+        anim->saved = (RGBA8 *) mem_malloc((uint64_t) width * height * sizeof(RGBA8));
+    anim->row = (RGBA8 *) mem_malloc((uint64_t) width * sizeof(RGBA8));
+    if((anim->canvas.raster == NULL) || (needs_saved && (anim->saved == NULL)) || (anim->row == NULL)){
+        mem_free(anim->canvas.raster);
+        mem_free(anim->saved);
+        mem_free(anim->row);
+        mem_free(anim->frames);
+        mem_free(anim);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    row_format_init(png, &anim->format, PNGDECODER_STRIP16_ROUND, false);
+
+    *result = anim;
+    return PNGDECODER_OK;
+
+    invalid:
+    mem_free(anim->frames);
+    mem_free(anim);
+    return PNGDECODER_INVALID_APNG;
 }
 
-static void check_chunk_tRNS(PNGdecoder_PNG * png){
-    uint16_t i;
-    chunk * raw_tRNS = NULL;
-    chunk_PLTE * PLTE = NULL;
-    chunk_tRNS * tRNS = NULL;
+uint32_t PNGdecoder_animation_get_frame_count(PNGdecoder_animation * anim){
+    if(anim != NULL)
+        return anim->frame_n;
 
-    for(i = 0; i < png->chunk_n; i++)
-        if(!memcmp(png->chunks[i]->type, chunk_types_ancillary[0], 4)) raw_tRNS = png->chunks[i];
+    return 0;
+}
 
-    if(raw_tRNS != NULL){
-        switch(png->IHDR->color_type){
-            case 0:
-                break;
-            case 2:
-                break;
-            case 3:
-                PLTE = png->PLTE;
-                if(PLTE == NULL) return;
+uint32_t PNGdecoder_animation_get_plays(PNGdecoder_animation * anim){
+    if(anim != NULL)
+        return anim->plays;
 
-                uint16_t entries_n = raw_tRNS->length;
-                if(entries_n > PLTE->entries_n) return;
+    return 0;
+}
 
-                tRNS = (chunk_tRNS *) malloc(sizeof(chunk_tRNS));
-                tRNS->type = tRNS_INDEXED;
-                tRNS->entries_n = entries_n;
-                tRNS->entries = (uint8_t *) calloc(entries_n, sizeof(uint8_t));
-                memcpy(tRNS->entries, raw_tRNS->data, entries_n);
+PNGdecoder_result PNGdecoder_animation_get_frame_info(PNGdecoder_animation * anim, uint32_t index, PNGdecoder_frame_info * info){
+    if((anim == NULL) || (info == NULL) || (index >= anim->frame_n))
+        return PNGDECODER_INVALID_ARGUMENT;
 
-                png->tRNS = tRNS;
+    *info = anim->frames[index].info;
+    return PNGDECODER_OK;
+}
+
+PNGdecoder_result PNGdecoder_animation_next(PNGdecoder_animation * anim, const PNGdecoder_raster_RGBA8_t ** canvas, PNGdecoder_frame_info * info){
+    PNGdecoder_result result;
+
+    if((anim == NULL) || (canvas == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(anim->next_frame >= anim->frame_n)
+        return PNGDECODER_ANIMATION_END;
+
+    result = animation_composite(anim);
+    if(result != PNGDECODER_OK)
+        return result;
+
+    *canvas = &anim->canvas;
+    if(info != NULL)
+        *info = anim->last->info;
+    return PNGDECODER_OK;
+}
+
+PNGdecoder_result PNGdecoder_animation_seek(PNGdecoder_animation * anim, uint32_t index){
+    PNGdecoder_result result;
+    uint32_t key;
+
+    if((anim == NULL) || (index >= anim->frame_n))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    for(key = index; !anim->frames[key].info.keyframe; key--);
+
+    //Going forward from the current position is cheaper when no keyframe lies in between
+    if((anim->next_frame > index) || (anim->next_frame < key)){
+        memset(anim->canvas.raster, 0, (uint64_t) anim->canvas.width * anim->canvas.height * sizeof(RGBA8));
+        anim->last = NULL;
+        anim->next_frame = key;
+    }
+    while(anim->next_frame < index){
+        result = animation_composite(anim);
+        if(result != PNGDECODER_OK)
+            return result;
+    }
+
+    return PNGDECODER_OK;
+}
+
+void PNGdecoder_animation_free(PNGdecoder_animation * anim){
+    if(anim == NULL)
+        return;
+
+    row_buffers_free(&anim->buffers);
+    mem_free(anim->frames);
+    mem_free(anim->canvas.raster);
+    mem_free(anim->saved);
+    mem_free(anim->row);
+    mem_free(anim);
+}
+
+PNGdecoder_result PNGdecoder_decoder_new(const char * file_name, const PNGdecoder_options * options, PNGdecoder_decoder ** result){
+    PNGdecoder_decoder * dec;
+
+    if((file_name == NULL) || (result == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    dec = (PNGdecoder_decoder *) mem_calloc(1, sizeof(PNGdecoder_decoder));
+    if(dec == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    dec->file_name = (char *) mem_malloc(strlen(file_name) + 1);
+    if(dec->file_name == NULL){
+        mem_free(dec);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    strcpy(dec->file_name, file_name);
+    if(options != NULL)
+        dec->options = *options;
+    else
+        PNGdecoder_options_init(&dec->options);
+    dec->result = PNGDECODER_IN_PROGRESS;
+
+    *result = dec;
+    return PNGDECODER_OK;
+}
+
+PNGdecoder_result PNGdecoder_decoder_step(PNGdecoder_decoder * dec, uint32_t max_rows, uint32_t max_microseconds){
+    PNGdecoder_memory_stats * outer;
+    PNGdecoder_result result;
+
+    if(dec == NULL)
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    outer = memory_scope_enter(&dec->memory);
+    result = decoder_step(dec, max_rows, max_microseconds);
+    memory_scope_enter(outer);
+    if((result == PNGDECODER_OK) && (dec->png != NULL))
+        dec->png->memory = dec->memory;
+    return result;
+}
+
+static PNGdecoder_result decoder_step(PNGdecoder_decoder * dec, uint32_t max_rows, uint32_t max_microseconds){
+    uint64_t deadline;
+    uint8_t * bytes;
+    PNGdecoder_result result;
+
+    if(dec->result != PNGDECODER_IN_PROGRESS)
+        return dec->result;
+    deadline = (max_microseconds != 0) ? monotonic_ns() + ((uint64_t) max_microseconds * 1000) : 0;
+
+    if((dec->image == NULL) && ((dec->bytes == NULL) || (dec->file != NULL))){
+        result = decoder_read(dec, max_rows, deadline);
+        if((result != PNGDECODER_OK) && (result != PNGDECODER_IN_PROGRESS))
+            dec->result = result;
+        if((result != PNGDECODER_OK) || (max_rows != 0) || (deadline != 0))
+            return (result == PNGDECODER_OK) ? PNGDECODER_IN_PROGRESS : result;     //Parsing gets a step of its own
+    }
+
+    if(dec->image == NULL){
+        //The chunks are checked in one go, a CRC pass over the file
+        bytes = dec->bytes;
+        dec->bytes = NULL;
+        result = parse_bytes(bytes, dec->file_size, &dec->options, &dec->png);
+        if(result != PNGDECODER_OK){
+            dec->png = NULL;
+            dec->result = result;
+            return result;
+        }
+
+        dec->image = (image_decode *) mem_malloc(sizeof(image_decode));
+        if(dec->image == NULL){
+            PNGdecoder_free(dec->png);
+            dec->png = NULL;
+            dec->result = PNGDECODER_MEMORY_ERROR;
+            return PNGDECODER_MEMORY_ERROR;
+        }
+        result = image_decode_begin(dec->png, dec->image);
+        dec->rows_total = dec->image->rows.rows_total;
+        if(result != PNGDECODER_OK)
+            goto end;
+        if((deadline != 0) && (monotonic_ns() >= deadline))
+            return PNGDECODER_IN_PROGRESS;  //Parsing took the whole budget
+    }
+
+    result = row_decoder_step(&dec->image->rows, max_rows, deadline);
+    dec->rows_done = dec->image->rows.rows_done;
+    if(result == PNGDECODER_IN_PROGRESS)
+        return result;
+
+    end:
+    result = image_decode_end(dec->png, dec->image, result);
+    mem_free(dec->image);
+    dec->image = NULL;
+    if(result != PNGDECODER_OK){
+        PNGdecoder_free(dec->png);
+        dec->png = NULL;
+    }
+    dec->result = result;
+    return result;
+}
+
+static PNGdecoder_result decoder_read(PNGdecoder_decoder * dec, uint32_t max_rows, uint64_t deadline){
+    int64_t file_size;
+    uint64_t block;
+
+    if(dec->bytes == NULL){
+        dec->file = fopen(dec->file_name, "rb");
+        if(dec->file == NULL)
+            return PNGDECODER_FILE_OPEN_ERROR;
+        fseeko(dec->file, 0, SEEK_END);
+        file_size = ftello(dec->file);
+        fseeko(dec->file, 0, SEEK_SET);
+        if((file_size < 0) || ((uint64_t) file_size > SIZE_MAX))
+            goto failed;
+        dec->bytes = (uint8_t *) mem_malloc(file_size);
+        if(dec->bytes == NULL){
+            fclose(dec->file);
+            dec->file = NULL;
+            return PNGDECODER_MEMORY_ERROR;
+        }
+        dec->file_size = file_size;
+        dec->bytes_read = 0;
+    }
+
+    do{
+        block = (dec->file_size - dec->bytes_read < step_read_block) ? dec->file_size - dec->bytes_read : step_read_block;
+        if(fread(dec->bytes + dec->bytes_read, 1, block, dec->file) != block)
+            goto failed;
+        dec->bytes_read += block;
+    }while((dec->bytes_read < dec->file_size) && ((deadline != 0) ? (monotonic_ns() < deadline) : (max_rows == 0)));
+
+    if(dec->bytes_read < dec->file_size)
+        return PNGDECODER_IN_PROGRESS;
+    fclose(dec->file);
+    dec->file = NULL;
+    return PNGDECODER_OK;
+
+    failed:
+    fclose(dec->file);
+    dec->file = NULL;
+    mem_free(dec->bytes);
+    dec->bytes = NULL;
+    return PNGDECODER_FILE_OPEN_ERROR;
+}
+
+PNGdecoder_result PNGdecoder_decoder_take(PNGdecoder_decoder * dec, PNGdecoder_PNG ** result){
+    if((dec == NULL) || (result == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(dec->result != PNGDECODER_OK)
+        return dec->result;
+    if(dec->png == NULL)
+        return PNGDECODER_INVALID_ARGUMENT;     //Already taken
+
+    *result = dec->png;
+    dec->png = NULL;
+    return PNGDECODER_OK;
+}
+
+void PNGdecoder_decoder_get_progress(PNGdecoder_decoder * dec, uint64_t * done, uint64_t * total){
+    if(dec == NULL)
+        return;
+
+    if(done != NULL)
+        *done = dec->rows_done;
+    if(total != NULL)
+        *total = dec->rows_total;
+}
+
+void PNGdecoder_decoder_free(PNGdecoder_decoder * dec){
+    if(dec == NULL)
+        return;
+
+    if(dec->image != NULL){
+        image_decode_end(dec->png, dec->image, PNGDECODER_IN_PROGRESS);
+        mem_free(dec->image);
+    }
+    if(dec->file != NULL)
+        fclose(dec->file);
+    mem_free(dec->bytes);
+    PNGdecoder_free(dec->png);
+    mem_free(dec->file_name);
+    mem_free(dec);
+}
+
+PNGdecoder_result PNGdecoder_validate(const char * file_name, uint64_t * offset){
+    validate_state v = { 0 };
+    PNGdecoder_result result;
+    uint64_t error_offset;
+
+    if(file_name == NULL)
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    v.file = fopen(file_name, "rb");
+    if(v.file == NULL)
+        return PNGDECODER_FILE_OPEN_ERROR;
+    v.buffer = (uint8_t *) mem_malloc(validate_buffer_size);
+    if(v.buffer == NULL){
+        fclose(v.file);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    v.data = v.buffer;
+
+    result = validate_stream(&v, &error_offset);
+    fclose(v.file);
+    mem_free(v.buffer);
+
+    if((result != PNGDECODER_OK) && (offset != NULL))
+        *offset = error_offset;
+    return result;
+}
+
+PNGdecoder_result PNGdecoder_validate_memory(const void * data, uint64_t size, uint64_t * offset){
+    validate_state v = { 0 };
+    PNGdecoder_result result;
+    uint64_t error_offset;
+
+    if(data == NULL)
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    v.data = (const uint8_t *) data;
+    v.data_n = size;
+
+    result = validate_stream(&v, &error_offset);
+    if((result != PNGDECODER_OK) && (offset != NULL))
+        *offset = error_offset;
+    return result;
+}
+
+PNGdecoder_result PNGdecoder_hash_pixels(const char * file_name, const PNGdecoder_options * options, uint64_t * hash){
+    PNGdecoder_options hashing;
+    PNGdecoder_PNG * png;
+    PNGdecoder_result result;
+
+    if((file_name == NULL) || (hash == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    if(options != NULL)
+        hashing = *options;
+    else
+        PNGdecoder_options_init(&hashing);
+    hashing.tensor = NULL;
+    hashing.raster_file = NULL;
+    hashing.row_callback = discard_row;
+    hashing.tile_width = 0;
+    hashing.tile_height = 0;
+    hashing.tile_callback = NULL;
+    hashing.pixel_hash = 1;
+
+    result = PNGdecoder_openPNG_ex(file_name, &hashing, &png);
+    if(result != PNGDECODER_OK)
+        return result;
+    result = PNGdecoder_get_pixel_hash(png, hash);
+    PNGdecoder_free(png);
+
+    return result;
+}
+
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static uint32_t swapped_uint32(uint8_t * pointer){
+    uint32_t raw = *((uint32_t *)pointer);
+    return ((raw>>24)&0xff) | ((raw<<8)&0xff0000) | ((raw>>8)&0xff00) | ((raw<<24)&0xff000000);
+}
+
+PNGdecoder_result PNGdecoder_read_file(const char * file_name, uint8_t ** bytes, uint64_t * size){
+    int64_t file_size = 0;
+    uint8_t * data;
+
+    FILE * png_file = fopen(file_name, "rb");
+    if(png_file == NULL)
+        return PNGDECODER_FILE_OPEN_ERROR;
+
+    fseeko(png_file, 0, SEEK_END);
+    file_size = ftello(png_file);
+    fseeko(png_file, 0, SEEK_SET);
+    if((file_size < 0) || ((uint64_t) file_size > SIZE_MAX)){
+        fclose(png_file);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+
+    data = mem_calloc(file_size, 1);
+    if((data == NULL) || (fread(data, 1, file_size, png_file) != (size_t) file_size)){
+        fclose(png_file);
+        mem_free(data);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+    fclose(png_file);
+
+    *bytes = data;
+    *size = file_size;
+    return PNGDECODER_OK;
+}
+
+PNGdecoder_result PNGdecoder_open_bytes(uint8_t * bytes, uint64_t file_size, const PNGdecoder_options * options, PNGdecoder_PNG ** result){
+    PNGdecoder_memory_stats memory = { 0 };
+    PNGdecoder_memory_stats * outer = memory_scope_enter(&memory);
+    PNGdecoder_PNG * png;
+
+    memory_scope_adopt(&memory, bytes);     //Read by the caller, possibly on another thread
+    PNGdecoder_result parsed = parse_bytes(bytes, file_size, options, &png);
+    if(parsed != PNGDECODER_OK){
+        memory_scope_enter(outer);
+        return parsed;
+    }
+
+    PNGdecoder_result decoded = IDATs_to_raster(png);
+    if(decoded != PNGDECODER_OK){
+        PNGdecoder_free(png);
+        memory_scope_enter(outer);
+        return decoded;
+    }
+
+    memory_scope_enter(outer);
+    png->memory = memory;
+    *result = png;
+    return PNGDECODER_OK;
+}
+
+uint64_t PNGdecoder_raster_bytes(PNGdecoder_PNG * png){
+    uint32_t tile_width = png->options.tile_width, tile_height = png->options.tile_height;
+    uint8_t pixel_size;
+
+    if(png->raster == NULL)
+        return 0;
+    pixel_size = raster_pixel_sizes[png->raster_type];
+    if(tile_width == 0)
+        return (uint64_t) png->IHDR->width * png->IHDR->height * pixel_size;
+
+    return (uint64_t) ((png->IHDR->width + tile_width - 1) / tile_width) * ((png->IHDR->height + tile_height - 1) / tile_height) *
+           tile_bytes(tile_width, tile_height, pixel_size);
+}
+
+static PNGdecoder_result parse_bytes(uint8_t * bytes, uint64_t file_size, const PNGdecoder_options * options, PNGdecoder_PNG ** result){
+    uint8_t * current_byte = bytes;
+    if((file_size < 8) || memcmp(current_byte, PNG_magic, 8)){
+        mem_free(bytes);
+        return PNGDECODER_BAD_PNG;
+    }
+
+    current_byte += 8;
+
+    uint32_t chunk_capacity = chunk_block_size;
+    chunk ** chunks = (chunk **)mem_malloc(sizeof(chunk *)*chunk_capacity);
+    uint32_t chunk_n = 0;
+    do{
+        if(chunk_n == chunk_capacity){
+            chunk_capacity *= 2;    //Large images may have hundreds of thousands of IDAT chunks
+            chunks = (chunk **)mem_realloc(chunks, sizeof(chunk *) * chunk_capacity);
+        }
+
+        uint64_t remaining = file_size - (current_byte - bytes);
+        if((remaining < 12) || (swapped_uint32(current_byte) > remaining - 12)){     //Truncated file
+            free_chunks(chunks, chunk_n);
+            mem_free(bytes);
+            return PNGDECODER_BAD_PNG;
+        }
+
+        chunks[chunk_n] = new_chunk(current_byte);
+        current_byte += (12 + chunks[chunk_n++]->length); //length + type + CRC + length
+    }while((current_byte - bytes) < file_size);
+
+    if(memcmp(chunks[0]->type, chunk_types_essential[0], 4)){
+        free_chunks(chunks, chunk_n);
+        mem_free(bytes);
+        return PNGDECODER_MISSING_IHDR;
+    }
+    if(memcmp(chunks[chunk_n - 1]->type, chunk_types_essential[3], 4)){
+        free_chunks(chunks, chunk_n);
+        mem_free(bytes);
+        return PNGDECODER_MISSING_IEND;
+    }
+
+    chunk_IHDR * IHDR = new_chunk_IHDR(chunks[0]);
+
+    PNGdecoder_PNG * png = (PNGdecoder_PNG *) mem_malloc(sizeof(PNGdecoder_PNG));
+    png->file_size = file_size;
+    png->raw_file = bytes;
+    png->chunk_n = chunk_n;
+    png->chunks = chunks;
+    png->IHDR = IHDR;
+    //png->pixel_data = NULL;
+    //png->pixel_data_size = 0;
+    png->PLTE = NULL;
+    png->tRNS = NULL;
+    png->index = NULL;
+    png->raster_struct = NULL;
+    png->raster = NULL;
+    png->raster_type = PNGDECODER_RASTER_INVALID;
+    png->mapping = NULL;
+    memset(&png->memory, 0, sizeof(PNGdecoder_memory_stats));
+    png->budget = 0;
+    png->pixel_hash = 0;
+    png->pixel_hashed = false;
+    png->analyzed = false;
+    png->bands_decoded = 0;
+    if(options != NULL)
+        png->options = *options;
+    else
+        PNGdecoder_options_init(&png->options);
+
+    PNGdecoder_result consistent = check_consistency(png);
+    if(consistent == PNGDECODER_OK)
+        consistent = check_image_size(IHDR);
+    if(consistent != PNGDECODER_OK){
+        PNGdecoder_free(png);
+        return consistent;
+    }
+
+    check_ancillary_chunks(png);
+    consistent = check_limits(png);
+    if(consistent != PNGDECODER_OK){
+        PNGdecoder_free(png);
+        return consistent;
+    }
+    //IDATs_to_pixel_data(png);
+    //png->raster_type = call_raster_method(png);
+
+    *result = png;
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result check_chunk_PLTE(PNGdecoder_PNG * png){
+    uint32_t i;
+    chunk * rawPLTE = NULL;
+    for(i = 0; i < png->chunk_n; i++)
+        if(!memcmp(png->chunks[i]->type, chunk_types_essential[1], 4)) rawPLTE = png->chunks[i];
+
+    if(rawPLTE != NULL){
+        if(rawPLTE->length % 3)
+            return PNGDECODER_INVALID_PLTE;
+
+        uint16_t entries_n = rawPLTE->length / 3;
+        if(entries_n > (2 << (png->IHDR->bit_depth - 1)))
+            return PNGDECODER_INVALID_PLTE;
+
+        chunk_PLTE * PLTE = (chunk_PLTE *) mem_malloc(sizeof(chunk_PLTE));
+        PLTE->entries_n = entries_n;
+        PLTE->entries = (uint8_t *) mem_calloc(entries_n * 3, sizeof(uint8_t));
+        for(i = 0; i < entries_n; i++)
+            memcpy(&PLTE->entries[i*3], &rawPLTE->data[i*3], 3);
+        png->PLTE = PLTE;
+
+        return PNGDECODER_OK;
+    }
+    return PNGDECODER_MISSING_PLTE;
+}
+
+static void check_chunk_tRNS(PNGdecoder_PNG * png){
+    uint32_t i;
+    chunk * raw_tRNS = NULL;
+    chunk_PLTE * PLTE = NULL;
+    chunk_tRNS * tRNS = NULL;
+
+    for(i = 0; i < png->chunk_n; i++)
+        if(!memcmp(png->chunks[i]->type, chunk_types_ancillary[0], 4)) raw_tRNS = png->chunks[i];
+
+    if(raw_tRNS != NULL){
+        switch(png->IHDR->color_type){
+            case 0:
+                break;
+            case 2:
+                break;
+            case 3:
+                PLTE = png->PLTE;
+                if(PLTE == NULL) return;
+
+                uint16_t entries_n = raw_tRNS->length;
+                if(entries_n > PLTE->entries_n) return;
+
+                tRNS = (chunk_tRNS *) mem_malloc(sizeof(chunk_tRNS));
+                tRNS->type = tRNS_INDEXED;
+                tRNS->entries_n = entries_n;
+                tRNS->entries = (uint8_t *) mem_calloc(entries_n, sizeof(uint8_t));
+                memcpy(tRNS->entries, raw_tRNS->data, entries_n);
+
+                png->tRNS = tRNS;
                 return;
                 break;
         }
     }
-    return;
+    return;
+}
+
+//Layout of both index chunks, big endian: the number of bands, then for each band its first row, its number of rows and
+//the offset from the start(length field) of the index chunk to that of the IDAT chunk where the band starts. Every band
+//but the first starts its deflate data on a block boundary with an empty history(full flush), as raw deflate without
+//the zlib header; the first row of a band may still filter against the last row of the previous band. iDOT is written
+//by Apple encoders with two bands; prIX(private, not safe to copy) is ours, with any number of bands
+static void check_chunk_index(PNGdecoder_PNG * png){
+    chunk * raw_index = NULL;
+    chunk_index * index;
+    restart_band * band;
+    uint64_t index_start, chunk_start;
+    uint32_t i, k, bands_n, next_row = 0, next_chunk = 0, offset;
+    uint8_t * entry;
+
+    for(i = 0; (i < png->chunk_n) && (raw_index == NULL); i++)
+        if(!memcmp(png->chunks[i]->type, chunk_types_index[0], 4) || !memcmp(png->chunks[i]->type, chunk_types_index[1], 4))
+            raw_index = png->chunks[i];
+
+    //Adam7 passes are not split in bands
+    if((raw_index == NULL) || png->IHDR->interlace_method || (raw_index->length < 4))
+        return;
+    bands_n = swapped_uint32(raw_index->data);
+    if((bands_n < 2) || (bands_n > index_bands_max) || (raw_index->length != 4 + (bands_n * 12)))
+        return;
+
+    index = (chunk_index *) mem_malloc(sizeof(chunk_index));
+    index->bands_n = bands_n;
+    index->bands = (restart_band *) mem_malloc(bands_n * sizeof(restart_band));
+    index_start = (raw_index->data - png->raw_file) - 8;
+
+    for(k = 0; k < bands_n; k++){
+        entry = raw_index->data + 4 + (k * 12);
+        band = &index->bands[k];
+        band->first_row = swapped_uint32(entry);
+        band->rows = swapped_uint32(entry + 4);
+        offset = swapped_uint32(entry + 8);
+
+        //Bands cover the image in order, each from an IDAT chunk after that of the previous band; the first one from
+        //the first IDAT chunk
+        for(; next_chunk < png->chunk_n; next_chunk++){
+            chunk_start = (png->chunks[next_chunk]->data - png->raw_file) - 8;
+            if((chunk_start == index_start + offset) || ((k == 0) && !memcmp(png->chunks[next_chunk]->type, chunk_types_essential[2], 4)))
+                break;
+        }
+        if((next_chunk == png->chunk_n) || memcmp(png->chunks[next_chunk]->type, chunk_types_essential[2], 4) ||
+           (chunk_start != index_start + offset) || (band->first_row != next_row) || (band->rows == 0) ||
+           (band->rows > png->IHDR->height - next_row)){
+            free_chunk_index(index);
+            return;
+        }
+        band->first_chunk = next_chunk++;
+        next_row += band->rows;
+    }
+    if(next_row != png->IHDR->height){
+        free_chunk_index(index);
+        return;
+    }
+
+    png->index = index;
+}
+
+static PNGdecoder_result check_consistency(PNGdecoder_PNG * png){
+    uint32_t i;
+    for(i = 0; i < png->chunk_n; i++)
+        if(png->chunks[i]->CRC_data != png->chunks[i]->CRC_computed) return PNGDECODER_MISMATCHING_CRC;
+
+    uint32_t IDAT_count = 0;
+    for(i = 0; i < png->chunk_n; i++)
+        if(memcmp(png->chunks[i]->type, chunk_types_essential[2], 4)) IDAT_count++;
+
+    if(IDAT_count == 0) return PNGDECODER_MISSING_IDAT;
+
+    PNGdecoder_result IHDR_result = check_IHDR(png->IHDR);
+    if(IHDR_result != PNGDECODER_OK) return IHDR_result;
+    if(png->IHDR->color_type == 3)
+        return check_chunk_PLTE(png);
+
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result check_IHDR(const chunk_IHDR * IHDR){
+    if((IHDR->width == 0) || (IHDR->height == 0)) return PNGDECODER_INVALID_IHDR;
+    if((IHDR->width > 0x7fffffff) || (IHDR->height > 0x7fffffff)) return PNGDECODER_INVALID_IHDR;
+
+    if(IHDR->compression_method != 0) return PNGDECODER_INVALID_IHDR;
+    if(IHDR->filter_method != 0) return PNGDECODER_INVALID_IHDR;
+    if((IHDR->interlace_method != 0) && (IHDR->interlace_method != 1)) return PNGDECODER_INVALID_IHDR;
+
+    uint8_t ctype = IHDR->color_type;
+    uint8_t bit_depth = IHDR->bit_depth;
+    switch(ctype){
+        case 0:
+            if((bit_depth != 1) && (bit_depth != 2) && (bit_depth != 4) && (bit_depth != 8) && (bit_depth != 16))
+                return PNGDECODER_INVALID_IHDR;
+            break;
+        case 2:
+            if((bit_depth != 8) && (bit_depth != 16))
+                return PNGDECODER_INVALID_IHDR;
+            break;
+        case 3:
+            if((bit_depth != 1) && (bit_depth != 2) && (bit_depth != 4) && (bit_depth != 8))
+                return PNGDECODER_INVALID_IHDR;
+            break;
+        case 4:
+            if((bit_depth != 8) && (bit_depth != 16))
+                return PNGDECODER_INVALID_IHDR;
+            break;
+        case 6:
+            if((bit_depth != 8) && (bit_depth != 16))
+                return PNGDECODER_INVALID_IHDR;
+            break;
+        default:
+            return PNGDECODER_INVALID_IHDR;
+    }
+
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result check_image_size(const chunk_IHDR * IHDR){
+    uint64_t row_bytes = (uint64_t) IHDR->width * sizeof(RGBA16);
+
+    if(row_bytes > row_bytes_max)
+        return PNGDECODER_IMAGE_TOO_LARGE;
+    if((uint64_t) IHDR->height > (SIZE_MAX / row_bytes))
+        return PNGDECODER_IMAGE_TOO_LARGE;
+
+    return PNGDECODER_OK;
+}
+
+static void check_ancillary_chunks(PNGdecoder_PNG * png){
+    check_chunk_tRNS(png);
+    check_chunk_index(png);
+    return;
+}
+
+static void free_chunks(chunk ** chunks, uint32_t chunk_n){
+    uint32_t i;
+    if(chunks != NULL){
+        for(i = 0; i < chunk_n; i++)
+            if(chunks[i] != NULL)
+                mem_free(chunks[i]);
+
+        mem_free(chunks);
+    }
+    return;
+}
+
+static chunk * new_chunk(uint8_t * data){
+    chunk * c = (chunk *) mem_calloc(1, sizeof(chunk));
+    c->length = swapped_uint32(data);
+    memcpy(c->type, &data[4], 4);
+    c->properties[CHUNK_ANCILLARY] = (c->type[0] & 0x20) > 0;
+    c->properties[CHUNK_PRIVATE] = (c->type[1] & 0x20) > 0;
+    c->properties[CHUNK_RESERVED] = (c->type[2] & 0x20) > 0;
+    c->properties[CHUNK_SAFE_TO_COPY] = (c->type[3] & 0x20) > 0;
+    c->data = &data[8];
+    c->CRC_data = *((uint32_t *) (c->data + c->length));
+
+    uint32_t CRC_raw = kernels_get()->crc_update(0xffffffff, &data[4], c->length + 4) ^ 0xffffffff;
+    c->CRC_computed = swapped_uint32((uint8_t *)&CRC_raw);
+
+    return c;
+}
+
+static chunk_IHDR * new_chunk_IHDR(chunk * chunk) {
+    chunk_IHDR * cIHDR = (chunk_IHDR *) mem_calloc(1, sizeof(chunk_IHDR));
+
+    cIHDR->width = swapped_uint32(&chunk->data[0]);
+    cIHDR->height = swapped_uint32(&chunk->data[4]);
+    cIHDR->bit_depth = chunk->data[8];
+    cIHDR->color_type = chunk->data[9];
+    cIHDR->compression_method = chunk->data[10];
+    cIHDR->filter_method = chunk->data[11];
+    cIHDR->interlace_method = chunk->data[12];
+
+    return cIHDR;
+}
+
+static uint32_t IDAT_input_fn(void * user, const uint8_t ** data){
+    IDAT_input * input = (IDAT_input *) user;
+    chunk * c;
+
+    while(input->next_chunk < input->chunk_n){
+        c = input->chunks[input->next_chunk++];
+        if(!memcmp(c->type, input->type, 4) && (c->length > input->skip)){
+            *data = c->data + input->skip;
+            return c->length - input->skip;
+        }
+    }
+
+    return 0;
+}
+
+static uint64_t padded_size(uint8_t pixel_bitsize, uint32_t ncols, uint32_t nrows){
+    uint64_t row_bitsize_raw = 0;
+    uint64_t row_bitsize = 0;
+    uint64_t row_size = 0;
+
+    row_bitsize_raw = (uint64_t) ncols * pixel_bitsize;
+    row_bitsize = row_bitsize_raw + (((row_bitsize_raw % 8) > 0) ? 8 - (row_bitsize_raw % 8) : 0);
+    row_size = row_bitsize / 8;
+
+    return ((nrows * row_size) + nrows);
+}
+
+static void adam7_step_size(uint32_t width, uint32_t height, uint8_t step, uint32_t * ncols, uint32_t * nrows){
+    const uint8_t * a7 = &Adam7[(step - 1) * 4];
+
+    *ncols = (width > a7[0]) ? (width - a7[0] + a7[2] - 1) / a7[2] : 0;
+    *nrows = (height > a7[1]) ? (height - a7[1] + a7[3] - 1) / a7[3] : 0;
+}
+
+static void scatter_row(uint8_t * dest, const uint8_t * pixels, uint32_t n, uint8_t step, uint8_t pixel_size){
+    uint32_t i;
+
+    //Constant sizes let the compiler turn each copy into a single move
+    switch(pixel_size){
+        case 1: for(i = 0; i < n; i++) dest[i * step] = pixels[i]; break;
+        case 2: for(i = 0; i < n; i++) memcpy(dest + (i * step * 2), pixels + (i * 2), 2); break;
+        case 3: for(i = 0; i < n; i++) memcpy(dest + (i * step * 3), pixels + (i * 3), 3); break;
+        case 4: for(i = 0; i < n; i++) memcpy(dest + (i * step * 4), pixels + (i * 4), 4); break;
+        case 6: for(i = 0; i < n; i++) memcpy(dest + (i * step * 6), pixels + (i * 6), 6); break;
+        case 8: for(i = 0; i < n; i++) memcpy(dest + (i * step * 8), pixels + (i * 8), 8); break;
+    }
+}
+
+static uint8_t * raster_sink_target(void * user, uint32_t y){
+    raster_sink_state * state = (raster_sink_state *) user;
+
+    return state->raster + ((uint64_t) y * state->width * state->pixel_size);
+}
+
+static void raster_sink_write(void * user, const uint8_t * pixels, uint32_t n, uint32_t x0, uint8_t x_step, uint32_t y){
+    raster_sink_state * state = (raster_sink_state *) user;
+
+    scatter_row(state->raster + ((((uint64_t) y * state->width) + x0) * state->pixel_size), pixels, n, x_step, state->pixel_size);
+}
+
+static void tensor_sink_write(void * user, const uint8_t * pixels, uint32_t n, uint32_t x0, uint8_t x_step, uint32_t y){
+    tensor_write_row((const tensor_writer *) user, pixels, n, x0, x_step, y);
+}
+
+static void callback_sink_write(void * user, const uint8_t * pixels, uint32_t n, uint32_t x0, uint8_t x_step, uint32_t y){
+    callback_sink_state * state = (callback_sink_state *) user;
+
+    if(state->raster.raster != NULL)
+        raster_sink_write(&state->raster, pixels, n, x0, x_step, y);
+    state->callback(state->user, y, pixels);
+}
+
+static void tile_sink_write(void * user, const uint8_t * pixels, uint32_t n, uint32_t x0, uint8_t x_step, uint32_t y){
+    tile_sink_state * state = (tile_sink_state *) user;
+    uint32_t band = y / state->tile_height;
+    uint32_t tile_row = y % state->tile_height;
+    uint8_t * band_tiles = state->tiles + (state->band_only ? 0 : (uint64_t) band * state->tiles_across * state->tile_bytes);
+    uint8_t * dest;
+    uint32_t i = 0, x, tile_x, count;
+
+    while(i < n){
+        x = x0 + (i * x_step);
+        tile_x = x / state->tile_width;
+        count = ((((tile_x + 1) * state->tile_width) - x) + x_step - 1) / x_step;     //Pixels of the row in this tile
+        if(count > n - i)
+            count = n - i;
+
+        dest = band_tiles + (tile_x * state->tile_bytes) +
+               ((((uint64_t) tile_row * state->tile_width) + (x - (tile_x * state->tile_width))) * state->pixel_size);
+        if(x_step == 1)
+            memcpy(dest, pixels + ((uint64_t) i * state->pixel_size), (uint64_t) count * state->pixel_size);
+        else
+            scatter_row(dest, pixels + ((uint64_t) i * state->pixel_size), count, x_step, state->pixel_size);
+        i += count;
+    }
+
+    if(state->band_only && ((tile_row == state->tile_height - 1) || (y == state->height - 1))){
+        //The band buffer still holds rows of the previous band below the last image row
+        for(tile_x = 0; (tile_row < state->tile_height - 1) && (tile_x < state->tiles_across); tile_x++)
+            memset(band_tiles + (tile_x * state->tile_bytes) + ((uint64_t) (tile_row + 1) * state->tile_width * state->pixel_size), 0,
+                   (uint64_t) (state->tile_height - tile_row - 1) * state->tile_width * state->pixel_size);
+        tile_emit_band(state, band, state->tiles);
+    }
+}
+
+static void tile_emit_band(const tile_sink_state * state, uint32_t band, const uint8_t * tiles){
+    uint32_t tile_x;
+
+    for(tile_x = 0; tile_x < state->tiles_across; tile_x++)
+        state->callback(state->user, tile_x, band, tiles + (tile_x * state->tile_bytes));
+}
+
+static uint64_t tile_bytes(uint32_t tile_width, uint32_t tile_height, uint8_t pixel_size){
+    uint64_t bytes = (uint64_t) tile_width * tile_height * pixel_size;
+
+    return (bytes + tile_alignment - 1) / tile_alignment * tile_alignment;
+}
+
+static void row_format_init(PNGdecoder_PNG * png, row_format * format, PNGdecoder_strip16_modes strip16, bool premultiply){
+    chunk_tRNS * tRNS = png->tRNS;
+    chunk_PLTE * PLTE = png->PLTE;
+    uint8_t bit_depth = png->IHDR->bit_depth;
+    uint16_t i;
+
+    bool simple_transparency = false;
+    if(tRNS != NULL)
+        if(tRNS->type == tRNS_INDEXED)
+            simple_transparency = true;
+
+    format->strip16 = (bit_depth == 16) ? strip16 : PNGDECODER_STRIP16_NONE;
+    format->premultiply = premultiply;
+    format->pixel_bitsize = bit_depth * color_type_channels[png->IHDR->color_type];
+    format->raster_type = raster_type_for(png->IHDR, format->strip16, simple_transparency);
+
+    if(png->IHDR->color_type == 3){
+        for(i = 0; i < 256; i++){
+            if(i < PLTE->entries_n){
+                format->palette[i].R = PLTE->entries[(i * 3)];
+                format->palette[i].G = PLTE->entries[(i * 3) + 1];
+                format->palette[i].B = PLTE->entries[(i * 3) + 2];
+            } else {
+                format->palette[i].R = format->palette[i].G = format->palette[i].B = 0;
+            }
+            format->palette[i].A = (simple_transparency && (i < tRNS->entries_n)) ? tRNS->entries[i] : 0xFF;
+        }
+        if(premultiply && simple_transparency)
+            kernels_get()->premultiply8((uint8_t *) format->palette, 256, 4);     //Once per image instead of once per pixel
+    }
+}
+
+static PNGdecoder_raster_types raster_type_for(const chunk_IHDR * IHDR, PNGdecoder_strip16_modes strip16, bool transparency){
+    bool wide = (IHDR->bit_depth == 16) && (strip16 == PNGDECODER_STRIP16_NONE);
+
+    switch(IHDR->color_type){
+        case 0:
+            return wide ? PNGDECODER_RASTER_GRAYSCALE_16 : PNGDECODER_RASTER_GRAYSCALE_8;
+        case 2:
+            return wide ? PNGDECODER_RASTER_RGB_16 : PNGDECODER_RASTER_RGB_8;
+        case 3:
+            return transparency ? PNGDECODER_RASTER_RGBA_8 : PNGDECODER_RASTER_RGB_8;
+        case 4:
+            return wide ? PNGDECODER_RASTER_GRAYSCALE_16A : PNGDECODER_RASTER_GRAYSCALE_8A;
+        default:
+            return wide ? PNGDECODER_RASTER_RGBA_16 : PNGDECODER_RASTER_RGBA_8;
+    }
+}
+
+static void row_buffers_reserve(row_buffers * buffers, uint32_t row_size, uint32_t width, uint8_t pixel_size){
+    if(buffers->row_capacity < row_size){
+        mem_free(buffers->rows);
+        buffers->rows = (uint8_t *) mem_malloc(2 * row_size);
+        buffers->row_capacity = row_size;
+    }
+    if(buffers->pixel_capacity < width){
+        mem_free(buffers->indices);
+        buffers->indices = (uint8_t *) mem_malloc(width);
+        buffers->pixel_capacity = width;
+        buffers->pixels_size = 0;       //Grows below
+    }
+    if(buffers->pixels_size < (uint64_t) buffers->pixel_capacity * pixel_size){
+        mem_free(buffers->pixels);
+        buffers->pixels_size = (uint64_t) buffers->pixel_capacity * sizeof(PNGdecoder_RGBA16_t);   //Fits any pixel type
+        buffers->pixels = (uint8_t *) mem_malloc(buffers->pixels_size);
+    }
+}
+
+static uint64_t row_buffers_memory(uint32_t row_size, uint32_t width){
+    return memory_block_size(2 * (uint64_t) row_size) + memory_block_size(width) + memory_block_size((uint64_t) width * sizeof(RGBA16));
+}
+
+static uint64_t predict_peak(const memory_shape * shape, const PNGdecoder_options * options){
+    const inflate_backend * backend = inflate_get_backend(selected_inflate_backend);
+    const chunk_IHDR * IHDR = &shape->IHDR;
+    PNGdecoder_strip16_modes strip16;
+    PNGdecoder_raster_types type;
+    uint64_t chunk_capacity = chunk_block_size, peak, tiles_down, tile_size;
+    uint32_t row_size, threads_n;
+    bool transparency, tiled, band_only;
+    long cpus;
+
+    while(chunk_capacity < shape->chunk_n)
+        chunk_capacity *= 2;
+
+    transparency = (IHDR->color_type == 3) && (shape->tRNS_entries != 0);
+    strip16 = options->strip16;
+    if((options->tensor != NULL) && (options->tensor->type == PNGDECODER_TENSOR_U8) && (strip16 == PNGDECODER_STRIP16_NONE))
+        strip16 = PNGDECODER_STRIP16_ROUND;
+    type = raster_type_for(IHDR, (IHDR->bit_depth == 16) ? strip16 : PNGDECODER_STRIP16_NONE, transparency);
+    row_size = padded_size(IHDR->bit_depth * color_type_channels[IHDR->color_type], IHDR->width, 1) - 1;
+    tiled = (options->tile_width != 0) && (options->tile_height != 0);
+    band_only = tiled && (options->tile_callback != NULL) && !IHDR->interlace_method;
+
+    //The file and its chunks, held until the end of the decode
+    peak = memory_block_size(shape->file_size) + memory_block_size(chunk_capacity * sizeof(chunk *)) +
+           (shape->chunk_n * memory_block_size(sizeof(chunk))) + memory_block_size(sizeof(chunk_IHDR)) +
+           memory_block_size(sizeof(PNGdecoder_PNG)) + memory_block_size(sizeof(image_decode));
+    if(IHDR->color_type == 3){
+        peak += memory_block_size(sizeof(chunk_PLTE)) + memory_block_size(shape->PLTE_entries * 3);
+        if(transparency)
+            peak += memory_block_size(sizeof(chunk_tRNS)) + memory_block_size(shape->tRNS_entries);
+    }
+    if(shape->bands_n > 1)
+        peak += memory_block_size(sizeof(chunk_index)) + memory_block_size(shape->bands_n * sizeof(restart_band));
+
+    //The output, as image_decode_begin prepares it
+    if(options->tensor != NULL){
+        peak += memory_block_size(sizeof(tensor_writer));
+    } else if(tiled){
+        tiles_down = (IHDR->height + options->tile_height - 1) / options->tile_height;
+        tile_size = tile_bytes(options->tile_width, options->tile_height, raster_pixel_sizes[type]);
+        peak += memory_block_size((band_only ? 1 : tiles_down) * ((IHDR->width + options->tile_width - 1) / options->tile_width) * tile_size + tile_alignment);
+        if(!band_only)
+            peak += memory_block_size(sizeof(raster_any));
+    } else if(options->raster_file != NULL){
+        peak += memory_block_size(sizeof(sidecar_mapping)) + memory_block_size(sizeof(raster_any));     //The raster is mapped
+    } else if((options->row_callback == NULL) || IHDR->interlace_method){
+        peak += memory_block_size((uint64_t) IHDR->width * IHDR->height * raster_pixel_sizes[type]) + memory_block_size(sizeof(raster_any));
+    }
+
+    //The serial row decoder, prepared even when the bands decode the image
+    peak += row_buffers_memory(row_size, IHDR->width) + backend->stream_memory(row_size + 1);
+
+    //Bands: scratch rows of every band until all are done, a stream and at worst a band of filtered rows per thread
+    threads_n = options->band_threads;
+    if(threads_n == 0){
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_n = (cpus > 0) ? cpus : 1;
+    }
+    if(threads_n > shape->bands_n)
+        threads_n = shape->bands_n;
+    if((shape->bands_n > 1) && (threads_n > 1) && (options->row_callback == NULL) && !band_only)
+        peak += memory_block_size(shape->bands_n * sizeof(band_decode)) + memory_block_size((threads_n - 1) * sizeof(pthread_t)) +
+                (shape->bands_n * row_buffers_memory(row_size, IHDR->width)) +
+                (threads_n * (backend->stream_memory(row_size + 1) + memory_block_size((uint64_t) shape->band_rows_max * (row_size + 1))));
+
+    if(options->pixel_hash && !IHDR->interlace_method)
+        peak += memory_block_size((uint64_t) IHDR->height * sizeof(uint64_t));
+    if(options->analyze || options->auto_compact){
+        peak += memory_block_size(sizeof(pixel_analysis));
+        if((shape->bands_n > 1) && (threads_n > 1) && (options->row_callback == NULL) && !band_only)
+            peak += shape->bands_n * memory_block_size(sizeof(pixel_analysis));
+    }
+
+    return peak;
+}
+
+static void memory_shape_of(PNGdecoder_PNG * png, memory_shape * shape){
+    uint32_t k;
+
+    memset(shape, 0, sizeof(memory_shape));
+    shape->IHDR = *png->IHDR;
+    shape->file_size = png->file_size;
+    shape->chunk_n = png->chunk_n;
+    if(png->PLTE != NULL)
+        shape->PLTE_entries = png->PLTE->entries_n;
+    if(png->tRNS != NULL)
+        shape->tRNS_entries = png->tRNS->entries_n;
+    if(png->index != NULL){
+        shape->bands_n = png->index->bands_n;
+        for(k = 0; k < png->index->bands_n; k++)
+            if(png->index->bands[k].rows > shape->band_rows_max)
+                shape->band_rows_max = png->index->bands[k].rows;
+    }
+}
+
+static PNGdecoder_result check_limits(PNGdecoder_PNG * png){
+    const PNGdecoder_options * options = &png->options;
+    const chunk_IHDR * IHDR = png->IHDR;
+    uint64_t pixels = (uint64_t) IHDR->width * IHDR->height, compressed = 0;
+    PNGdecoder_strip16_modes strip16 = (IHDR->bit_depth == 16) ? options->strip16 : PNGDECODER_STRIP16_NONE;
+    memory_shape shape;
+    uint32_t i;
+
+    if(options->max_pixels && (pixels > options->max_pixels))
+        return PNGDECODER_LIMIT_EXCEEDED;
+    if(options->max_decoded_bytes &&
+       (pixels * raster_pixel_sizes[raster_type_for(IHDR, strip16, (png->tRNS != NULL) && (png->tRNS->type == tRNS_INDEXED))] > options->max_decoded_bytes))
+        return PNGDECODER_LIMIT_EXCEEDED;
+
+    //Deflate reaches about 1032:1, the image data of a bomb is mostly a run of zeros
+    if(options->max_ratio){
+        for(i = 0; i < png->chunk_n; i++)
+            if(!memcmp(png->chunks[i]->type, chunk_types_essential[2], 4))
+                compressed += png->chunks[i]->length;
+        if(image_data_size(IHDR) > compressed * options->max_ratio)
+            return PNGDECODER_LIMIT_EXCEEDED;
+    }
+
+    if(options->max_memory){
+        memory_shape_of(png, &shape);
+        if(predict_peak(&shape, options) > options->max_memory)
+            return PNGDECODER_LIMIT_EXCEEDED;
+    }
+
+    return PNGDECODER_OK;
+}
+
+static uint64_t image_data_size(const chunk_IHDR * IHDR){
+    uint8_t pixel_bitsize = IHDR->bit_depth * color_type_channels[IHDR->color_type];
+    uint32_t ncols, nrows;
+    uint64_t size = 0;
+    uint8_t step;
+
+    if(!IHDR->interlace_method)
+        return padded_size(pixel_bitsize, IHDR->width, IHDR->height);
+
+    for(step = 1; step <= 7; step++){
+        adam7_step_size(IHDR->width, IHDR->height, step, &ncols, &nrows);
+        if(ncols && nrows)
+            size += padded_size(pixel_bitsize, ncols, nrows);
+    }
+    return size;
+}
+
+static void row_buffers_free(row_buffers * buffers){
+    mem_free(buffers->rows);
+    mem_free(buffers->indices);
+    mem_free(buffers->pixels);
+    memset(buffers, 0, sizeof(row_buffers));
+}
+
+static PNGdecoder_result row_decoder_init(row_decoder * rows, PNGdecoder_PNG * png, const IDAT_input * input, uint32_t width, uint32_t height,
+                                          const row_format * format, row_buffers * buffers, const row_sink * sink, bool restart){
+    uint32_t ncols, nrows;
+    uint8_t step;
+
+    memset(rows, 0, sizeof(row_decoder));
+    rows->png = png;
+    rows->input = *input;
+    rows->width = width;
+    rows->height = height;
+    rows->format = format;
+    rows->buffers = buffers;
+    rows->sink = sink;
+    rows->interlaced = png->IHDR->interlace_method;
+    rows->backend = inflate_get_backend(selected_inflate_backend);
+    rows->row_size_max = padded_size(format->pixel_bitsize, width, 1) - 1;
+
+    for(step = 1; step <= (rows->interlaced ? 7 : 1); step++){
+        if(rows->interlaced)
+            adam7_step_size(width, height, step, &ncols, &nrows);
+        else
+            ncols = width, nrows = height;
+        if(ncols != 0)
+            rows->rows_total += nrows;
+    }
+
+    row_buffers_reserve(buffers, rows->row_size_max, width, raster_pixel_sizes[format->raster_type]);
+    rows->previous_row = buffers->rows;
+    rows->current_row = buffers->rows + rows->row_size_max;
+
+    if(restart)
+        rows->stream = rows->backend->stream_new_raw(IDAT_input_fn, &rows->input, rows->row_size_max + 1);
+    else
+        rows->stream = rows->backend->stream_new(IDAT_input_fn, &rows->input, rows->row_size_max + 1);
+    if(rows->stream == NULL)
+        return PNGDECODER_ZLIB_ERROR;
+
+    return PNGDECODER_OK;
+}
+
+static bool row_decoder_next_pass(row_decoder * rows){
+    while(rows->a7_step < (rows->interlaced ? 7 : 1)){
+        rows->a7_step++;
+        if(rows->interlaced)
+            adam7_step_size(rows->width, rows->height, rows->a7_step, &rows->a7_ncols, &rows->a7_nrows);
+        else
+            rows->a7_ncols = rows->width, rows->a7_nrows = rows->height;
+        if((rows->a7_ncols * rows->a7_nrows) == 0)
+            continue;   //Empty steps have no rows nor filter bytes at all
+
+        rows->row_size = padded_size(rows->format->pixel_bitsize, rows->a7_ncols, 1) - 1;
+        memset(rows->previous_row, 0, rows->row_size);
+        rows->row_n = 0;
+        return true;
+    }
+
+    return false;
 }
 
-static PNGdecoder_result check_consistency(PNGdecoder_PNG * png){
-    uint8_t i;
-    for(i = 0; i < png->chunk_n; i++)
-        if(png->chunks[i]->CRC_data != png->chunks[i]->CRC_computed) return PNGDECODER_MISMATCHING_CRC;
+static PNGdecoder_result row_decoder_row(row_decoder * rows){
+    const uint8_t * row = NULL;     //Current filter byte and row, straight from the inflater output window
 
-    uint32_t IDAT_count = 0;
-    for(i = 0; i < png->chunk_n; i++)
-        if(memcmp(png->chunks[i]->type, chunk_types_essential[2], 4)) IDAT_count++;
+    if(rows->backend->stream_read(rows->stream, rows->row_size + 1, &row) != PNGDECODER_OK)
+        return PNGDECODER_ZLIB_ERROR;
 
-    if(IDAT_count == 0) return PNGDECODER_MISSING_IDAT;
-    if((png->IHDR->width == 0) || (png->IHDR->height == 0)) return PNGDECODER_INVALID_IHDR;
+    return row_decoder_expand(rows, row);
+}
 
-    if(png->IHDR->compression_method != 0) return PNGDECODER_INVALID_IHDR;
-    if(png->IHDR->filter_method != 0) return PNGDECODER_INVALID_IHDR;
-    if((png->IHDR->interlace_method != 0) && (png->IHDR->interlace_method != 1)) return PNGDECODER_INVALID_IHDR;
+static PNGdecoder_result row_decoder_expand(row_decoder * rows, const uint8_t * row){
+    const row_format * format = rows->format;
+    const row_sink * sink = rows->sink;
+    uint8_t color_type = rows->png->IHDR->color_type;
+    uint8_t bit_depth = rows->png->IHDR->bit_depth;
+    bool indexed_alpha = (color_type == 3) && (format->raster_type == PNGDECODER_RASTER_RGBA_8);
+    PNGdecoder_strip16_modes strip16 = format->strip16;
+    bool premultiply = format->premultiply;
+
+    const kernel_table * kernels = kernels_get();
+    const uint8_t * a7 = &Adam7[(rows->a7_step - 1) * 4];   //Adam7 row of the current step
+    uint8_t pixel_bytesize = padded_size(format->pixel_bitsize, 1, 1) - 1;   //Pixel size in bytes, padded to 1 for sub-byte cases
+    uint32_t ncols = rows->a7_ncols;
+    uint32_t row_size = rows->row_size;
+    uint8_t * current_row = rows->current_row;
+    uint8_t * indices = rows->buffers->indices;     //Unpacked sub-byte palette indices
+    uint8_t * target;               //In place destination given by the sink
+    uint8_t * out_row;
+    const uint8_t * expanded;
+    uint8_t OP;                     //Filter operation
+
+    OP = row[0];
+    if(OP > 4)
+        return PNGDECODER_INVALID_FILTER;
+    kernels->unfilter[OP](current_row, row + 1, rows->previous_row, row_size, pixel_bytesize);
+
+    //Non interlaced rows expand straight into the sink when it allows it, others into a temporary row; 8 bit rows are
+    //already expanded
+    target = ((!rows->interlaced) && (sink->target != NULL)) ? sink->target(sink->user, rows->row_n) : NULL;
+    out_row = (target != NULL) ? target : rows->buffers->pixels;
+    expanded = out_row;
+
+    if(color_type == 3){
+        if(bit_depth < 8)
+            kernels->unpack_subbyte(indices, current_row, ncols, bit_depth, false);
+        if(!indexed_alpha)
+            kernels->palette_RGB8((RGB8 *) out_row, (bit_depth < 8) ? indices : current_row, ncols, format->palette);
+        else
+            kernels->palette_RGBA8((RGBA8 *) out_row, (bit_depth < 8) ? indices : current_row, ncols, format->palette);
+    } else if(bit_depth < 8){
+        kernels->unpack_subbyte(out_row, current_row, ncols, bit_depth, true);
+    } else if(bit_depth == 8){
+        if((target == NULL) && (!premultiply))
+            expanded = current_row;     //Premultiplying in place would corrupt the previous row of the next unfilter
+        else
+            memcpy(out_row, current_row, row_size);
+    } else if(strip16 == PNGDECODER_STRIP16_NONE){
+        kernels->swap16((G16 *) out_row, current_row, row_size / 2);
+    } else {
+        kernels->strip16(out_row, current_row, row_size / 2, strip16);
+    }
 
-    uint8_t ctype = png->IHDR->color_type;
-    uint8_t bit_depth = png->IHDR->bit_depth;
-    switch(ctype){
-        case 0:
-            if((bit_depth != 1) && (bit_depth != 2) && (bit_depth != 4) && (bit_depth != 8) && (bit_depth != 16))
-                return PNGDECODER_INVALID_IHDR;
-            break;
-        case 2:
-            if((bit_depth != 8) && (bit_depth != 16))
-                return PNGDECODER_INVALID_IHDR;
-            break;
-        case 3:
-            if((bit_depth != 1) && (bit_depth != 2) && (bit_depth != 4) && (bit_depth != 8))
-                return PNGDECODER_INVALID_IHDR;
-            return check_chunk_PLTE(png);
-            break;
-        case 4:
-            if((bit_depth != 8) && (bit_depth != 16))
-                return PNGDECODER_INVALID_IHDR;
-            break;
-        case 6:
-            if((bit_depth != 8) && (bit_depth != 16))
-                return PNGDECODER_INVALID_IHDR;
-            break;
-        default:
-            return PNGDECODER_INVALID_IHDR;
+    if(premultiply && ((color_type == 4) || (color_type == 6))){
+        if(strip16 != PNGDECODER_STRIP16_NONE || (bit_depth == 8))
+            kernels->premultiply8(out_row, ncols, (color_type == 4) ? 2 : 4);
+        else
+            kernels->premultiply16((G16 *) out_row, ncols, (color_type == 4) ? 2 : 4);
+    }
+
+    //Hashed before the sink moves it on, while still in cache
+    if(rows->row_hashes != NULL)
+        rows->row_hashes[rows->row_n] = hash64(expanded, (uint64_t) ncols * raster_pixel_sizes[format->raster_type], 0);
+    if(rows->analysis != NULL)
+        analysis_add_row(rows->analysis, expanded, ncols);
+
+    if(target == NULL){
+        if(!rows->interlaced)
+            sink->write(sink->user, expanded, ncols, 0, 1, rows->row_n);
+        else
+            sink->write(sink->user, expanded, ncols, a7[0], a7[2], a7[1] + (rows->row_n * a7[3]));
     }
 
+    rows->current_row = rows->previous_row;
+    rows->previous_row = current_row;
+    rows->row_n++;
+    rows->rows_done++;
+
     return PNGDECODER_OK;
 }
 
-static void check_ancillary_chunks(PNGdecoder_PNG * png){
-    check_chunk_tRNS(png);
-    return;
-}
+static PNGdecoder_result row_decoder_step(row_decoder * rows, uint32_t max_rows, uint64_t deadline){
+    PNGdecoder_result result;
+    uint32_t done = 0;
 
-static void free_chunks(chunk ** chunks, uint16_t chunk_n){
-    uint8_t i;
-    if(chunks != NULL){
-        for(i = 0; i < chunk_n; i++)
-            if(chunks[i] != NULL)
-                free(chunks[i]);
+    while(true){
+        if(rows->row_n == rows->a7_nrows){
+            if(!row_decoder_next_pass(rows)){
+                //Short or overlong streams are corrupt
+                result = rows->backend->stream_end(rows->stream);
+                return (result == PNGDECODER_OK) ? PNGDECODER_OK : PNGDECODER_ZLIB_ERROR;
+            }
+        }
 
-        free(chunks);
+        //Always at least one row, so that every step makes progress
+        if(((max_rows != 0) && (done == max_rows)) || ((deadline != 0) && (done > 0) && (monotonic_ns() >= deadline)))
+            return PNGDECODER_IN_PROGRESS;
+
+        result = row_decoder_row(rows);
+        if(result != PNGDECODER_OK)
+            return result;
+        done++;
     }
-    return;
 }
 
-static chunk * new_chunk(uint8_t * data){
-    chunk * c = (chunk *) calloc(1, sizeof(chunk));
-    c->length = swapped_uint32(data);
-    memcpy(c->type, &data[4], 4);
-    c->properties[CHUNK_ANCILLARY] = (c->type[0] & 0x20) > 0;
-    c->properties[CHUNK_PRIVATE] = (c->type[1] & 0x20) > 0;
-    c->properties[CHUNK_RESERVED] = (c->type[2] & 0x20) > 0;
-    c->properties[CHUNK_SAFE_TO_COPY] = (c->type[3] & 0x20) > 0;
-    c->data = &data[8];
-    c->CRC_data = *((uint32_t *) (c->data + c->length));
+static void row_decoder_free(row_decoder * rows){
+    if(rows->stream != NULL)
+        rows->backend->stream_free(rows->stream);
+    rows->stream = NULL;
+}
 
-    uint32_t CRC_raw = crc((unsigned char *)&data[4], c->length + 4);
-    c->CRC_computed = swapped_uint32((uint8_t *)&CRC_raw);
+static PNGdecoder_result decode_rows(PNGdecoder_PNG * png, IDAT_input * input, uint32_t width, uint32_t height,
+                                     const row_format * format, row_buffers * buffers, const row_sink * sink){
+    row_decoder rows;
+    PNGdecoder_result result = row_decoder_init(&rows, png, input, width, height, format, buffers, sink, false);
 
-    return c;
+    if(result == PNGDECODER_OK)
+        result = row_decoder_step(&rows, 0, 0);
+    row_decoder_free(&rows);
+
+    return result;
 }
 
-static chunk_IHDR * new_chunk_IHDR(chunk * chunk) {
-    chunk_IHDR * cIHDR = (chunk_IHDR *) calloc(1, sizeof(chunk_IHDR));
+static PNGdecoder_result image_decode_begin(PNGdecoder_PNG * png, image_decode * image){
+    uint32_t width = png->IHDR->width;
+    uint32_t height = png->IHDR->height;
+    PNGdecoder_tensor * tensor = png->options.tensor;
+    PNGdecoder_strip16_modes strip16 = png->options.strip16;
+    IDAT_input input = { png->chunks, png->chunk_n, 0, chunk_types_essential[2], 0 };
+    PNGdecoder_row_callback callback = png->options.row_callback;
+    bool interlaced = png->IHDR->interlace_method;
+    bool tiled = (png->options.tile_width != 0) || (png->options.tile_height != 0);
+    PNGdecoder_result result;
+    sidecar_key key;
+    memory_shape shape;
+
+    memset(image, 0, sizeof(image_decode));
+    if((tensor != NULL) && ((png->options.raster_file != NULL) || (callback != NULL)))
+        return PNGDECODER_INVALID_ARGUMENT;     //One output only
+    if(tiled && ((tensor != NULL) || (png->options.raster_file != NULL) || (callback != NULL)))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if((png->options.tile_width == 0) != (png->options.tile_height == 0))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if((tensor != NULL) && (tensor->type == PNGDECODER_TENSOR_U8) && (strip16 == PNGDECODER_STRIP16_NONE))
+        strip16 = PNGDECODER_STRIP16_ROUND;     //Byte tensors never need the 16 bit samples
+
+    //The whole predicted peak, the file already held included, so the budget bounds what the decodes hold together
+    memory_shape_of(png, &shape);
+    png->budget = predict_peak(&shape, &png->options);
+    if(!memory_budget_acquire(png->budget, png->options.budget_timeout)){
+        png->budget = 0;
+        return PNGDECODER_BUDGET_EXCEEDED;
+    }
 
-    cIHDR->width = swapped_uint32(&chunk->data[0]);
-    cIHDR->height = swapped_uint32(&chunk->data[4]);
-    cIHDR->bit_depth = chunk->data[8];
-    cIHDR->color_type = chunk->data[9];
-    cIHDR->compression_method = chunk->data[10];
-    cIHDR->filter_method = chunk->data[11];
-    cIHDR->interlace_method = chunk->data[12];
+    row_format_init(png, &image->format, strip16, png->options.premultiply);
+
+    if(tensor != NULL){
+        image->writer = (tensor_writer *) mem_malloc(sizeof(tensor_writer));
+        if(image->writer == NULL)
+            return PNGDECODER_MEMORY_ERROR;
+        result = tensor_writer_init(image->writer, tensor, image->format.raster_type, width, height);
+        if(result != PNGDECODER_OK){
+            mem_free(image->writer);
+            image->writer = NULL;
+            return result;
+        }
+        image->sink = (row_sink){ NULL, tensor_sink_write, image->writer };
+    } else if(tiled){
+        result = tiles_begin(png, image);
+        if(result != PNGDECODER_OK)
+            return result;
+    } else {
+        if(png->options.raster_file != NULL){
+            key.source_size = png->file_size;
+            key.source_hash = hash64(png->raw_file, png->file_size, 0);
+            key.options = sidecar_options(&png->options);
+            image->mapping = (sidecar_mapping *) mem_malloc(sizeof(sidecar_mapping));
+            if(image->mapping == NULL)
+                return PNGDECODER_MEMORY_ERROR;
+            result = sidecar_create(png->options.raster_file, &key, image->format.raster_type, width, height, image->mapping);
+            if(result != PNGDECODER_OK){
+                mem_free(image->mapping);
+                image->mapping = NULL;
+                return result;
+            }
+            image->raster = image->mapping->raster;
+        } else if((callback == NULL) || interlaced){
+            image->raster = mem_calloc((uint64_t) height * width, raster_pixel_sizes[image->format.raster_type]);
+            if(image->raster == NULL)
+                return PNGDECODER_MEMORY_ERROR;
+        }
 
-    return cIHDR;
+        if(image->raster != NULL){
+            image->raster_struct = (raster_any *) mem_malloc(sizeof(raster_any));
+            if(image->raster_struct == NULL)
+                return PNGDECODER_MEMORY_ERROR;     //image_decode_end releases the raster or the mapping
+            image->raster_struct->width = width;
+            image->raster_struct->height = height;
+            image->raster_struct->raster = image->raster;
+            image->raster_state = (raster_sink_state){ (uint8_t *) image->raster, width, raster_pixel_sizes[image->format.raster_type] };
+        }
+
+        //Interlaced rows only complete with the last pass, the callback then gets them from the raster
+        if((callback != NULL) && !interlaced){
+            image->callback_state = (callback_sink_state){ image->raster_state, callback, png->options.row_user };
+            image->sink = (row_sink){ NULL, callback_sink_write, &image->callback_state };
+        } else {
+            image->sink = (row_sink){ raster_sink_target, raster_sink_write, &image->raster_state };
+        }
+    }
+
+    //Interlaced rows are only whole once the last pass is done, image_decode_end hashes them
+    if(png->options.pixel_hash && !interlaced){
+        image->row_hashes = (uint64_t *) mem_malloc((uint64_t) height * sizeof(uint64_t));
+        if(image->row_hashes == NULL)
+            return PNGDECODER_MEMORY_ERROR;
+    }
+
+    if(png->options.analyze || png->options.auto_compact){
+        image->analysis = (pixel_analysis *) mem_malloc(sizeof(pixel_analysis));
+        if(image->analysis == NULL)
+            return PNGDECODER_MEMORY_ERROR;
+        analysis_init(image->analysis, image->format.raster_type);
+    }
+
+    result = row_decoder_init(&image->rows, png, &input, width, height, &image->format, &image->buffers, &image->sink, false);
+    image->rows.row_hashes = image->row_hashes;
+    image->rows.analysis = image->analysis;
+    return result;
 }
 
-static uint8_t * concatenateIDAT(chunk ** chunks, uint16_t chunk_n, uint32_t * final_size){
-    uint16_t i;
-    uint8_t * IDATdata = NULL;
-    uint32_t tot_size = 0;
-    for(i = 0; i < chunk_n; i++){
-        if(!memcmp(chunks[i]->type, chunk_types_essential[2], 4))
-            tot_size += chunks[i]->length;
-    }
-    *final_size = tot_size;
-
-    IDATdata = (uint8_t *) malloc(tot_size);
-    uint8_t * current_pos = IDATdata;
-    for(i = 0; i < chunk_n; i++){
-        if(!memcmp(chunks[i]->type, chunk_types_essential[2], 4)){
-            memcpy(current_pos, chunks[i]->data, chunks[i]->length);
-            current_pos += chunks[i]->length;
+static PNGdecoder_result image_decode_end(PNGdecoder_PNG * png, image_decode * image, PNGdecoder_result result){
+    uint64_t stride = (uint64_t) png->IHDR->width * raster_pixel_sizes[image->format.raster_type];
+    const tile_sink_state * tiles = &image->tile_state;
+    bool callback = (png->options.row_callback != NULL) || (png->options.tile_callback != NULL);
+    PNGdecoder_raster_types compact = image->format.raster_type;
+    uint32_t y;
+
+    row_decoder_free(&image->rows);
+    row_buffers_free(&image->buffers);
+    mem_free(image->writer);
+    mem_free(image->band);
+    memory_budget_release(png->budget);
+    png->budget = 0;
+
+    if((result == PNGDECODER_OK) && (image->row_hashes != NULL)){
+        png->pixel_hash = hash64(image->row_hashes, (uint64_t) png->IHDR->height * sizeof(uint64_t), 0);
+        png->pixel_hashed = true;
+    } else if((result == PNGDECODER_OK) && png->options.pixel_hash && (image->raster != NULL) && (tiles->tiles == NULL)){
+        png->pixel_hash = raster_rows_hash(image->raster_state.raster, stride, png->IHDR->height);
+        png->pixel_hashed = true;
+    }
+    mem_free(image->row_hashes);
+    if((result == PNGDECODER_OK) && (image->analysis != NULL)){
+        analysis_result(image->analysis, &png->analysis);
+        png->analyzed = true;
+        compact = analysis_compact_type(image->analysis);
+    }
+    mem_free(image->analysis);
+
+    //Interlaced images went through a whole raster, complete only now
+    if((result == PNGDECODER_OK) && (png->options.row_callback != NULL) && png->IHDR->interlace_method){
+        for(y = 0; y < image->raster_struct->height; y++)
+            png->options.row_callback(png->options.row_user, y, image->raster_state.raster + (y * stride));
+    }
+    if((result == PNGDECODER_OK) && (tiles->callback != NULL) && !tiles->band_only){
+        for(y = 0; y * tiles->tile_height < tiles->height; y++)
+            tile_emit_band(tiles, y, tiles->tiles + ((uint64_t) y * tiles->tiles_across * tiles->tile_bytes));
+    }
+
+    if(image->mapping != NULL){
+        sidecar_finish(png->options.raster_file, image->mapping, result == PNGDECODER_OK);
+        if(result != PNGDECODER_OK){
+            mem_free(image->mapping);
+            mem_free(image->raster_struct);
+            return result;
+        }
+        png->mapping = image->mapping;
+    } else if((result != PNGDECODER_OK) || callback){
+        mem_free(image->raster_struct);     //Only held the rows of an interlaced image for the callback
+        mem_free(image->raster);
+        image->raster_struct = NULL;
+        image->raster = NULL;
+        if(result != PNGDECODER_OK)
+            return result;
+    }
+
+    png->raster_struct = image->raster_struct;
+    png->raster = image->raster;
+    png->raster_type = image->format.raster_type;  //Also set for tensor and callback output, which have no raster
+    if(png->options.auto_compact && (compact != png->raster_type) && (png->raster != NULL) && (png->mapping == NULL) &&
+       (tiles->tiles == NULL))
+        compact_raster(png, compact);
+    release_file(png);
+
+    return PNGDECODER_OK;
+}
+
+static void compact_raster(PNGdecoder_PNG * png, PNGdecoder_raster_types compact){
+    uint64_t stride = (uint64_t) png->IHDR->width * raster_pixel_sizes[compact];
+    uint64_t source_stride = (uint64_t) png->IHDR->width * raster_pixel_sizes[png->raster_type], row_hash;
+    uint8_t * raster = (uint8_t *) png->raster;
+    hash64_state state;
+    void * resized;
+    uint32_t y;
+
+    //Row by row, each compacted row hashed while still in cache rather than in a second pass over the raster
+    hash64_init(&state, 0);
+    for(y = 0; y < png->IHDR->height; y++){
+        analysis_compact(raster + (y * stride), raster + (y * source_stride), png->IHDR->width, png->raster_type, compact);
+        if(png->pixel_hashed){
+            row_hash = hash64(raster + (y * stride), stride, 0);
+            hash64_update(&state, &row_hash, sizeof(row_hash));
         }
     }
+    if(png->pixel_hashed)
+        png->pixel_hash = hash64_digest(&state);
+
+    resized = mem_realloc(png->raster, stride * png->IHDR->height);
+    if(resized != NULL)     //Keeping the larger block is harmless
+        png->raster = resized;
+    ((raster_any *) png->raster_struct)->raster = png->raster;
+    png->raster_type = compact;
+}
+
+static uint64_t raster_rows_hash(const uint8_t * raster, uint64_t stride, uint32_t height){
+    hash64_state state;
+    uint64_t row_hash;
+    uint32_t y;
+
+    hash64_init(&state, 0);
+    for(y = 0; y < height; y++){
+        row_hash = hash64(raster + (y * stride), stride, 0);
+        hash64_update(&state, &row_hash, sizeof(row_hash));
+    }
+
+    return hash64_digest(&state);
+}
+
+static void discard_row(void * user, uint32_t y, const void * row){
+}
+
+static PNGdecoder_result tiles_begin(PNGdecoder_PNG * png, image_decode * image){
+    tile_sink_state * state = &image->tile_state;
+    uint8_t pixel_size = raster_pixel_sizes[image->format.raster_type];
+    uint64_t tiles_down, bytes;
+
+    state->width = png->IHDR->width;
+    state->height = png->IHDR->height;
+    state->pixel_size = pixel_size;
+    state->tile_width = png->options.tile_width;
+    state->tile_height = png->options.tile_height;
+    state->tiles_across = (state->width + state->tile_width - 1) / state->tile_width;
+    state->callback = png->options.tile_callback;
+    state->user = png->options.tile_user;
+    tiles_down = (state->height + state->tile_height - 1) / state->tile_height;
+
+    if((state->tile_width > tile_size_max) || (state->tile_height > tile_size_max))
+        return PNGDECODER_INVALID_ARGUMENT;
+    state->tile_bytes = tile_bytes(state->tile_width, state->tile_height, pixel_size);
+    if((state->tile_bytes > row_bytes_max) || ((state->tiles_across * tiles_down) > (SIZE_MAX / state->tile_bytes)))
+        return PNGDECODER_IMAGE_TOO_LARGE;
+
+    //Interlaced rows only complete with the last pass, the callback then gets every tile from a whole tiled raster
+    state->band_only = (state->callback != NULL) && !png->IHDR->interlace_method;
+    bytes = (state->band_only ? 1 : tiles_down) * state->tiles_across * state->tile_bytes;
+    state->tiles = (uint8_t *) mem_aligned_alloc(tile_alignment, bytes);
+    if(state->tiles == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    memset(state->tiles, 0, bytes);     //Padding of the edge tiles
+
+    if(state->band_only){
+        image->band = state->tiles;
+    } else {
+        image->raster = state->tiles;
+        image->raster_struct = (raster_any *) mem_malloc(sizeof(raster_any));
+        if(image->raster_struct == NULL)
+            return PNGDECODER_MEMORY_ERROR;     //image_decode_end releases the tiles
+        image->raster_struct->width = state->width;
+        image->raster_struct->height = state->height;
+        image->raster_struct->raster = image->raster;
+    }
+    image->sink = (row_sink){ NULL, tile_sink_write, state };
 
-    return IDATdata;
+    return PNGDECODER_OK;
 }
 
-static int8_t zlib_inflate(uint8_t * in, uint32_t in_size, uint8_t * out, uint32_t out_size){
-    z_stream infstream;
+static PNGdecoder_result IDATs_to_raster(PNGdecoder_PNG * png){
+    image_decode * image = (image_decode *) mem_malloc(sizeof(image_decode));
+    PNGdecoder_result result;
 
-    infstream.zalloc = Z_NULL;
-    infstream.zfree = Z_NULL;
-    infstream.opaque = Z_NULL;
-    infstream.avail_in = in_size;
-    infstream.next_in = in;
-    infstream.avail_out = out_size;
-    infstream.next_out = out;
+    if(image == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    result = image_decode_begin(png, image);
 
-    inflateInit(&infstream);
-    int8_t result = inflate(&infstream, Z_NO_FLUSH);
-    inflateEnd(&infstream);
+    //Any failure of the bands, corrupt data as well as an index not matching it, gets the verdict of the serial path
+    if(result == PNGDECODER_OK){
+        if(bands_to_raster(png, image) == PNGDECODER_OK)
+            png->bands_decoded = png->index->bands_n;
+        else
+            result = row_decoder_step(&image->rows, 0, 0);
+    }
+    result = image_decode_end(png, image, result);
+    mem_free(image);
 
     return result;
 }
 
-static uint32_t padded_size(uint8_t pixel_bitsize, uint32_t ncols, uint32_t nrows){
-    uint32_t row_bitsize_raw = 0;
-    uint32_t row_bitsize = 0;
-    uint32_t row_size = 0;
+static PNGdecoder_result bands_to_raster(PNGdecoder_PNG * png, image_decode * image){
+    chunk_index * index = png->index;
+    uint32_t threads_n = png->options.band_threads, started = 0, i;
+    PNGdecoder_result result = PNGDECODER_OK;
+    pthread_t * threads;
+    bands_decode work;
+    long cpus;
 
-    row_bitsize_raw = ncols * pixel_bitsize;
-    row_bitsize = row_bitsize_raw + (((row_bitsize_raw % 8) > 0) ? 8 - (row_bitsize_raw % 8) : 0);
-    row_size = row_bitsize / 8;
+    //Row and tile callbacks take their rows in order
+    if((index == NULL) || (png->options.row_callback != NULL) || image->tile_state.band_only)
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(threads_n == 0){
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_n = (cpus > 0) ? cpus : 1;
+    }
+    if(threads_n > index->bands_n)
+        threads_n = index->bands_n;
+    if(threads_n < 2)
+        return PNGDECODER_INVALID_ARGUMENT;
 
-    return ((nrows * row_size) + nrows);
+    //The calling thread is one of the workers; without memory for the bands the serial path decodes the image
+    work.bands = (band_decode *) mem_calloc(index->bands_n, sizeof(band_decode));
+    threads = (pthread_t *) mem_malloc((threads_n - 1) * sizeof(pthread_t));
+    if((work.bands == NULL) || (threads == NULL)){
+        mem_free(work.bands);
+        mem_free(threads);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    work.png = png;
+    work.image = image;
+    work.next_band = 0;
+    work.memory = memory_scope_current();
+    pthread_mutex_init(&work.lock, NULL);
+    pthread_cond_init(&work.band_done, NULL);
+
+    for(i = 0; i < threads_n - 1; i++)
+        if(pthread_create(&threads[started], NULL, band_worker, &work) == 0)
+            started++;
+    band_worker(&work);
+    for(i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    mem_free(threads);
+
+    for(i = 0; i < index->bands_n; i++){
+        if(work.bands[i].result != PNGDECODER_OK)
+            result = work.bands[i].result;
+        row_buffers_free(&work.bands[i].buffers);
+        if(work.bands[i].analysis != NULL)
+            analysis_merge(image->analysis, work.bands[i].analysis);
+        mem_free(work.bands[i].analysis);
+    }
+    if((result != PNGDECODER_OK) && (image->analysis != NULL))
+        analysis_init(image->analysis, image->format.raster_type);  //The serial path starts over
+    mem_free(work.bands);
+    pthread_cond_destroy(&work.band_done);
+    pthread_mutex_destroy(&work.lock);
+
+    return result;
 }
 
-static uint32_t calc_decoded_size(uint8_t pixel_bitsize, uint32_t width, uint32_t height, uint8_t interlaced){
-    uint32_t i, j, step;
-    uint32_t size = 0;
+static void * band_worker(void * user){
+    bands_decode * work = (bands_decode *) user;
+    uint32_t bands_n = work->png->index->bands_n;
+    PNGdecoder_memory_stats * outer = memory_scope_enter(work->memory);
+    band_decode * band;
+    uint32_t k;
+
+    while(true){
+        pthread_mutex_lock(&work->lock);
+        k = work->next_band++;
+        pthread_mutex_unlock(&work->lock);
+        if(k >= bands_n){
+            memory_scope_enter(outer);
+            return NULL;
+        }
 
-    if(!interlaced){
-        size = padded_size(pixel_bitsize, width, height);
-    } else {
-        for(step = 0; step < 7; step++){
-            i = Adam7[(step * 4)]; while(i < width) i+=Adam7[(step * 4) + 2]; i = (i - Adam7[(step * 4)]) / Adam7[(step * 4) + 2];
-            j = Adam7[(step * 4) + 1]; while(j < height) j+=Adam7[(step * 4) + 3]; j = (j - Adam7[(step * 4) + 1]) / Adam7[(step * 4) + 3];
-            if((i*j) != 0)
-                size += padded_size(pixel_bitsize, i, j);
+        band = &work->bands[k];
+        band->result = band_decode_rows(work, k);
+        row_decoder_free(&band->rows);
+        mem_free(band->filtered);
+        band->filtered = NULL;
+
+        pthread_mutex_lock(&work->lock);
+        band->done = true;
+        pthread_cond_broadcast(&work->band_done);
+        pthread_mutex_unlock(&work->lock);
+    }
+}
+
+static PNGdecoder_result band_decode_rows(bands_decode * work, uint32_t k){
+    PNGdecoder_PNG * png = work->png;
+    image_decode * image = work->image;
+    const restart_band * bands = png->index->bands;
+    uint32_t bands_n = png->index->bands_n;
+    band_decode * band = &work->bands[k];
+    row_decoder * rows = &band->rows;
+    IDAT_input input = { png->chunks, (k + 1 < bands_n) ? bands[k + 1].first_chunk : png->chunk_n, bands[k].first_chunk,
+                         chunk_types_essential[2], 0 };
+    PNGdecoder_result result;
+    const uint8_t * row;
+    uint64_t filtered_size;
+    uint32_t y;
+
+    result = row_decoder_init(rows, png, &input, png->IHDR->width, png->IHDR->height, &image->format, &band->buffers,
+                              &image->sink, k != 0);
+    if(result != PNGDECODER_OK)
+        return result;
+    rows->row_hashes = image->row_hashes;
+    if(image->analysis != NULL){
+        band->analysis = (pixel_analysis *) mem_malloc(sizeof(pixel_analysis));
+        if(band->analysis == NULL)
+            return PNGDECODER_MEMORY_ERROR;
+        analysis_init(band->analysis, image->format.raster_type);
+        rows->analysis = band->analysis;
+    }
+    row_decoder_next_pass(rows);
+    rows->row_n = bands[k].first_row;
+    filtered_size = (uint64_t) rows->row_size + 1;
+
+    for(y = 0; y < bands[k].rows; y++){
+        if(rows->backend->stream_read(rows->stream, rows->row_size + 1, &row) != PNGDECODER_OK)
+            return PNGDECODER_ZLIB_ERROR;
+
+        //Up, Average and Paeth need the last row of the previous band: inflate the rest of the band meanwhile
+        if((y == 0) && (k != 0) && (row[0] >= 2)){
+            band->filtered = (uint8_t *) mem_malloc(bands[k].rows * filtered_size);
+            if(band->filtered == NULL)
+                return PNGDECODER_MEMORY_ERROR;
+        }
+        if(band->filtered != NULL){
+            memcpy(band->filtered + (y * filtered_size), row, filtered_size);
+            continue;
         }
+
+        result = row_decoder_expand(rows, row);
+        if(result != PNGDECODER_OK)
+            return result;
     }
 
-    return size;
+    if(band->filtered != NULL){
+        pthread_mutex_lock(&work->lock);
+        while(!work->bands[k - 1].done)
+            pthread_cond_wait(&work->band_done, &work->lock);
+        result = work->bands[k - 1].result;
+        pthread_mutex_unlock(&work->lock);
+        if(result != PNGDECODER_OK)
+            return result;
+
+        memcpy(rows->previous_row, work->bands[k - 1].rows.previous_row, rows->row_size);
+        for(y = 0; (y < bands[k].rows) && (result == PNGDECODER_OK); y++)
+            result = row_decoder_expand(rows, band->filtered + (y * filtered_size));
+        if(result != PNGDECODER_OK)
+            return result;
+    }
+
+    //The last band ends the deflate data; the zlib checksum is not checked, the CRC of the chunks already was. The others
+    //end at the next restart point, or the index does not match the data
+    if(k == bands_n - 1)
+        return (rows->backend->stream_end(rows->stream) == PNGDECODER_OK) ? PNGDECODER_OK : PNGDECODER_ZLIB_ERROR;
+
+    return (rows->backend->stream_end_flush(rows->stream) == PNGDECODER_OK) ? PNGDECODER_OK : PNGDECODER_ZLIB_ERROR;
 }
 
-static uint32_t adam7_to_raster(uint32_t raster_width, uint32_t raster_height, uint8_t step, uint32_t a7_col, uint32_t a7_row){
-    uint8_t step_adj = step - 1;    //Step in [1, 7]
-    uint32_t i, j;
+static bool validate_fill(validate_state * v){
+    size_t n;
 
-    i = Adam7[(step_adj * 4)] + (a7_col * Adam7[(step_adj * 4) + 2]);
-    j = Adam7[(step_adj * 4) + 1] + (a7_row * Adam7[(step_adj * 4) + 3]);
+    if(v->data_pos < v->data_n)
+        return true;
+    if(v->file == NULL)
+        return false;
 
-    return (raster_width * j) + i;
+    n = fread(v->buffer, 1, validate_buffer_size, v->file);
+    v->data_offset += v->data_n;
+    v->data_n = (uint32_t) n;
+    v->data_pos = 0;
+    return n > 0;
 }
 
-static uint8_t unfilter(uint8_t OP, uint8_t byte, uint16_t left, uint16_t up, uint16_t left_up){    //16 bits for operations
-    switch(OP){
-        case 0:
-            return byte;
-        case 1:
-            return byte + left;
-        case 2:
-            return byte + up;
-        case 3:
-            return byte + (uint8_t) floor((left + up)/2);
-        case 4:
-            return byte + paeth_predictor(left, up, left_up);
+static bool validate_read(validate_state * v, uint8_t * bytes, uint32_t size){
+    uint64_t n;
+
+    while(size > 0){
+        if(!validate_fill(v))
+            return false;
+        n = v->data_n - v->data_pos;
+        if(n > size)
+            n = size;
+        memcpy(bytes, v->data + v->data_pos, n);
+        v->data_pos += n;
+        bytes += n;
+        size -= n;
     }
-    return 0;
-}
 
-static PNGdecoder_raster_types IDATs_to_raster(PNGdecoder_PNG * png){
-    chunk_IHDR * IHDR = png->IHDR;
-    chunk_tRNS * tRNS = png->tRNS;
-    chunk_PLTE * PLTE = png->PLTE;
+    return true;
+}
 
-    bool simple_transparency = false;
-    if(tRNS != NULL)
-        if(tRNS->type == tRNS_INDEXED)
-            simple_transparency = true;
+static uint64_t validate_offset(validate_state * v){
+    return v->data_offset + v->data_pos;
+}
 
-    uint8_t color_type = IHDR->color_type;
-    uint8_t bit_depth = IHDR->bit_depth;
-    uint32_t width = IHDR->width;
-    uint32_t height = IHDR->height;
-    bool interlaced = IHDR->interlace_method;
+static PNGdecoder_result validate_chunk_header(validate_state * v, uint64_t * offset){
+    uint8_t header[8];
+    uint32_t length;
 
-    uint8_t pixel_bitsize = 0;
+    *offset = validate_offset(v);
+    if(!validate_fill(v))
+        return PNGDECODER_MISSING_IEND;
+    if(!validate_read(v, header, 8))
+        return PNGDECODER_BAD_PNG;
 
-    uint8_t * rawIDATs = png->rawIDATs;
-    uint32_t rawIDATs_size = png->rawIDATs_size;
+    length = swapped_uint32(header);
+    if(length > 0x7fffffff)
+        return PNGDECODER_BAD_PNG;
+    memcpy(v->type, &header[4], 4);
+    v->remaining = length;
+    v->crc = kernels_get()->crc_update(0xffffffff, v->type, 4);
+    return PNGDECODER_OK;
+}
 
-    uint8_t * decoded = NULL;
-    uint32_t decoded_size = 0;
+static PNGdecoder_result validate_chunk_data(validate_state * v, uint8_t * bytes, uint32_t size, uint64_t * offset){
+    uint64_t n;
 
-    //Raster choice
-    G8 * raster_g8 = NULL;
-    G16 * raster_g16 = NULL;
-    G8A * raster_g8a = NULL;
-    G16A * raster_g16a = NULL;
-    RGB8 * raster_rgb8 = NULL;
-    RGB16 * raster_rgb16 = NULL;
-    RGBA8 * raster_rgba8 = NULL;
-    RGBA16 * raster_rgba16 = NULL;
-    void * raster = NULL;
-    PNGdecoder_raster_types raster_type = PNGDECODER_RASTER_INVALID;
-    void * raster_struct = NULL;
+    while(size > 0){
+        if(!validate_fill(v)){
+            *offset = validate_offset(v);
+            return PNGDECODER_BAD_PNG;
+        }
+        n = v->data_n - v->data_pos;
+        if(n > size)
+            n = size;
+        v->crc = kernels_get()->crc_update(v->crc, v->data + v->data_pos, n);
+        if(bytes != NULL){
+            memcpy(bytes, v->data + v->data_pos, n);
+            bytes += n;
+        }
+        v->data_pos += n;
+        v->remaining -= n;
+        size -= n;
+    }
 
-    switch(color_type){
-        case 0:
-            pixel_bitsize = bit_depth;
-            raster = calloc(height * width, (bit_depth < 16) ? sizeof(G8) : sizeof(G16));
-            raster_type = (bit_depth < 16) ? PNGDECODER_RASTER_GRAYSCALE_8 : PNGDECODER_RASTER_GRAYSCALE_16;
-
-            raster_struct = malloc((bit_depth < 16) ? sizeof(RASTER_G8) : sizeof(RASTER_G16));
-            if(bit_depth < 16){
-                raster_g8 = (G8 *) raster;
-                ((RASTER_G8 *)raster_struct)->width = width;
-                ((RASTER_G8 *)raster_struct)->height = height;
-                ((RASTER_G8 *)raster_struct)->raster = raster;
-            } else {
-                raster_g16 = (G16 *) raster;
-                ((RASTER_G16 *)raster_struct)->width = width;
-                ((RASTER_G16 *)raster_struct)->height = height;
-                ((RASTER_G16 *)raster_struct)->raster = raster;
-            }
+    return PNGDECODER_OK;
+}
 
-            break;
-        case 2:
-            pixel_bitsize = bit_depth * 3;
-            raster = calloc(height * width, (bit_depth < 16) ? sizeof(RGB8) : sizeof(RGB16));
-            raster_type = (bit_depth < 16) ? PNGDECODER_RASTER_RGB_8 : PNGDECODER_RASTER_RGB_16;
-
-            raster_struct = malloc((bit_depth < 16) ? sizeof(RASTER_RGB8) : sizeof(RASTER_RGB16));
-            if(bit_depth < 16){
-                raster_rgb8 = (RGB8 *) raster;
-                ((RASTER_RGB8 *)raster_struct)->width = width;
-                ((RASTER_RGB8 *)raster_struct)->height = height;
-                ((RASTER_RGB8 *)raster_struct)->raster = raster;
-            } else {
-                raster_rgb16 = (RGB16 *) raster;
-                ((RASTER_RGB16 *)raster_struct)->width = width;
-                ((RASTER_RGB16 *)raster_struct)->height = height;
-                ((RASTER_RGB16 *)raster_struct)->raster = raster;
-            }
+static PNGdecoder_result validate_chunk_end(validate_state * v, uint64_t * offset){
+    uint8_t CRC_data[4];
+    uint32_t CRC_computed = v->crc ^ 0xffffffff;
 
-            break;
-        case 3:
-            pixel_bitsize = bit_depth;
-            raster = calloc(height * width, (!simple_transparency) ? sizeof(RGB8) : sizeof(RGBA8));
-            raster_type = (!simple_transparency) ? PNGDECODER_RASTER_RGB_8 : PNGDECODER_RASTER_RGBA_8;
-
-            raster_struct = malloc((!simple_transparency) ? sizeof(RASTER_RGB8) : sizeof(RASTER_RGBA8));
-            if(!simple_transparency){
-                raster_rgb8 = (RGB8 *) raster;
-                ((RASTER_RGB8 *)raster_struct)->width = width;
-                ((RASTER_RGB8 *)raster_struct)->height = height;
-                ((RASTER_RGB8 *)raster_struct)->raster = raster;
-            } else {
-                raster_rgba8 = (RGBA8 *) raster;
-                ((RASTER_RGBA8 *)raster_struct)->width = width;
-                ((RASTER_RGBA8 *)raster_struct)->height = height;
-                ((RASTER_RGBA8 *)raster_struct)->raster = raster;
-            }
+    *offset = validate_offset(v);
+    if(!validate_read(v, CRC_data, 4))
+        return PNGDECODER_BAD_PNG;
+    if(swapped_uint32(CRC_data) != CRC_computed)
+        return PNGDECODER_MISMATCHING_CRC;
 
-            break;
-        case 4:
-            pixel_bitsize = bit_depth * 2;
-            raster = calloc(height * width, (bit_depth < 16) ? sizeof(G8A) : sizeof(G16A));
-            raster_type = (bit_depth < 16) ? PNGDECODER_RASTER_GRAYSCALE_8A : PNGDECODER_RASTER_GRAYSCALE_16A;
-
-            raster_struct = malloc((bit_depth < 16) ? sizeof(RASTER_G8A) : sizeof(RASTER_G16A));
-            if(bit_depth < 16){
-                raster_g8a = (G8A *) raster;
-                ((RASTER_G8A *)raster_struct)->width = width;
-                ((RASTER_G8A *)raster_struct)->height = height;
-                ((RASTER_G8A *)raster_struct)->raster = raster;
-            } else {
-                raster_g16a = (G16A *) raster;
-                ((RASTER_G16A *)raster_struct)->width = width;
-                ((RASTER_G16A *)raster_struct)->height = height;
-                ((RASTER_G16A *)raster_struct)->raster = raster;
-            }
+    return PNGDECODER_OK;
+}
 
-            break;
-        case 6:
-            pixel_bitsize = bit_depth * 4;
-            raster = calloc(height * width, (bit_depth < 16) ? sizeof(RGBA8) : sizeof(RGBA16));
-            raster_type = (bit_depth < 16) ? PNGDECODER_RASTER_RGBA_8 : PNGDECODER_RASTER_RGBA_16;
-
-            raster_struct = malloc((bit_depth < 16) ? sizeof(RASTER_RGBA8) : sizeof(RASTER_RGBA16));
-            if(bit_depth < 16){
-                raster_rgba8 = (RGBA8 *) raster;
-                ((RASTER_RGBA8 *)raster_struct)->width = width;
-                ((RASTER_RGBA8 *)raster_struct)->height = height;
-                ((RASTER_RGBA8 *)raster_struct)->raster = raster;
-            } else {
-                raster_rgba16 = (RGBA16 *) raster;
-                ((RASTER_RGBA16 *)raster_struct)->width = width;
-                ((RASTER_RGBA16 *)raster_struct)->height = height;
-                ((RASTER_RGBA16 *)raster_struct)->raster = raster;
+static uint32_t validate_IDAT_input(void * user, const uint8_t ** data){
+    validate_state * v = (validate_state *) user;
+    uint64_t n;
+
+    while(v->result == PNGDECODER_OK){
+        if(v->remaining > 0){
+            //The previous segment is consumed by now, the window can move
+            if(!validate_fill(v)){
+                v->error_offset = validate_offset(v);
+                v->result = PNGDECODER_BAD_PNG;
+                return 0;
             }
+            n = v->data_n - v->data_pos;
+            if(n > v->remaining)
+                n = v->remaining;
+            *data = v->data + v->data_pos;
+            v->crc = kernels_get()->crc_update(v->crc, *data, n);
+            v->data_pos += n;
+            v->remaining -= n;
+            return n;
+        }
 
-            break;
+        v->result = validate_chunk_end(v, &v->error_offset);
+        if(v->result == PNGDECODER_OK)
+            v->result = validate_chunk_header(v, &v->error_offset);
+        if((v->result == PNGDECODER_OK) && memcmp(v->type, chunk_types_essential[2], 4)){
+            v->pending = true;
+            return 0;
+        }
     }
 
-    decoded_size = calc_decoded_size(pixel_bitsize, width, height, interlaced);
-    decoded = (uint8_t *) calloc(decoded_size, sizeof(uint8_t));
-
-    int32_t result = zlib_inflate(rawIDATs, rawIDATs_size, decoded, decoded_size);
-    if(result != Z_STREAM_END){
-        free(decoded);
-        free(raster_struct);
-        free(raster);
-        return PNGDECODER_RASTER_INVALID;
-    }
-
-    uint32_t i = 0;                 //Byte index within decoded
-    uint32_t j = 0;                 //Row index between two filter operations
-    uint8_t k = 0;                  //Sub-byte index
-    uint32_t row_n = 0;             //Absolute row count
-    uint32_t col_n = 0;
-    uint32_t raster_pos = 0;
-    uint32_t row_size = 0;          //Row size, mutable if interlaced
-    uint32_t row_size_non_interlaced = padded_size(pixel_bitsize, width, 1) - 1;    //Fixed when not interlaced
-    uint8_t OP = 0;                 //Filter operation
-    uint8_t current_byte = 0;       //Current byte within decoded, to unfilter
-    uint8_t unfiltered_byte = 0;    //Unfiltered
-    uint8_t pixel_byte = 0;         //Pixel value of 1 byte
-    uint8_t byte_mask = ((1 << bit_depth) - 1) << (8 - bit_depth);  //To extract sub-byte values, not used for depths >= 8
-    uint8_t pixel_multiplier = 0xFF / ((1 << bit_depth) - 1);       //Multiplier to scale pixel_bytes of bit_depth < 8 on a [0-255] scale
-    uint8_t pixel_bytesize = padded_size(pixel_bitsize, 1, 1) - 1;  //Pixel size in bytes, padded to 1 for sub-byte cases
-    uint16_t left, up, left_up;     //Element pixel_bytesize to the left of current, above from previous row, above and left
-    left = up = left_up = 0;
-
-    uint8_t * previous_row_buf = (uint8_t *) calloc(row_size_non_interlaced, sizeof(uint8_t));  //Track previous row
-    uint8_t * current_row_buf = (uint8_t *) calloc(row_size_non_interlaced, sizeof(uint8_t));   //Track current row
-
-
-    uint8_t a7_step = 1;                        //Current Adam7 step
-    uint32_t a7_ncols, a7_nrows, a7_row_n = 0;  //For current Adam7 step, number of elements in each row, number of rows, relative row number
-    uint32_t row_size_interlaced = 0;           //For current Adam7 step, row size in bytes
-    a7_ncols = 0; while(a7_ncols < width) a7_ncols+=8; a7_ncols = a7_ncols / 8;
-    a7_nrows = 0; while(a7_nrows < height) a7_nrows+=8; a7_nrows = a7_nrows / 8;
-    row_size_interlaced = padded_size(pixel_bitsize, a7_ncols, 1) - 1;
-
-    //FILE * f = fopen("log", "w");
-    while(i < decoded_size){
-        OP = decoded[i]; //fprintf(f, "i: %d, row_n: %d, OP: %d, a7_ncols: %d, a7_nrows: %d\n", i, row_n, OP, a7_ncols, a7_nrows);
-        row_size = (!interlaced) ? row_size_non_interlaced : row_size_interlaced;
-
-        for(j = i + 1; j < i + row_size + 1; j++){
-            current_byte = decoded[j];
-
-            if((OP == 1) || (OP > 2))
-                left = (j >= i + 1 + pixel_bytesize) ? current_row_buf[j - pixel_bytesize - (i + 1)] : 0;
-            if(OP >= 2){
-                if(!interlaced)
-                    up = (row_n > 0) ? previous_row_buf[j - (i + 1)] : 0;
-                else
-                    up = (a7_row_n > 0) ? previous_row_buf[j - (i + 1)] : 0;
+    return 0;
+}
+
+static PNGdecoder_result validate_image(validate_state * v, const chunk_IHDR * IHDR, uint64_t * offset){
+    const inflate_backend * backend = inflate_get_backend(selected_inflate_backend);
+    inflate_stream * stream;
+    PNGdecoder_result result = PNGDECODER_OK;
+    uint8_t pixel_bitsize = color_type_channels[IHDR->color_type] * IHDR->bit_depth;
+    bool interlaced = IHDR->interlace_method;
+    uint32_t ncols, nrows, row_n, span;
+    uint64_t row_left;
+    const uint8_t * bytes;
+    uint8_t step;
+
+    stream = backend->stream_new(validate_IDAT_input, v, validate_span_max);
+    if(stream == NULL)
+        return PNGDECODER_ZLIB_ERROR;
+
+    for(step = 1; (step <= (interlaced ? 7 : 1)) && (result == PNGDECODER_OK); step++){
+        if(interlaced)
+            adam7_step_size(IHDR->width, IHDR->height, step, &ncols, &nrows);
+        else
+            ncols = IHDR->width, nrows = IHDR->height;
+        if((ncols * nrows) == 0)
+            continue;
+
+        for(row_n = 0; (row_n < nrows) && (result == PNGDECODER_OK); row_n++){
+            row_left = padded_size(pixel_bitsize, ncols, 1);    //Filter byte included
+            span = (row_left < validate_span_max) ? row_left : validate_span_max;
+            if(backend->stream_read(stream, span, &bytes) != PNGDECODER_OK){
+                result = PNGDECODER_ZLIB_ERROR;
+                break;
             }
-            if(OP == 4){
-                if(!interlaced)
-                    left_up = (row_n > 0) && (j >= i + 1 + pixel_bytesize) ? previous_row_buf[j - pixel_bytesize - (i + 1)] : 0;
-                else
-                    left_up = (a7_row_n > 0) && (j >= i + 1 + pixel_bytesize) ? previous_row_buf[j - pixel_bytesize - (i + 1)] : 0;
+            if(bytes[0] > 4){
+                result = PNGDECODER_INVALID_FILTER;
+                break;
             }
-
-            unfiltered_byte = unfilter(OP, current_byte, left, up, left_up);
-            current_row_buf[j - (i + 1)] = unfiltered_byte;
-
-            //fprintf(f, "decoded[%d]: %d => %d\n", j, current_byte, unfiltered_byte);
-
-            if(bit_depth < 8){
-                for(k = 0; k < 8; k+=bit_depth){
-                    pixel_byte = (unfiltered_byte & (byte_mask >> k)) >> ((8 - bit_depth) - k);
-                    col_n = ((j - (i + 1)) * (8 / bit_depth)) + (k/bit_depth);
-
-                    if((!interlaced) && (col_n >= width)) continue;
-                    if(interlaced && (adam7_to_raster(0, 0, a7_step, col_n, a7_row_n) >= width)) continue;
-
-                    if(!interlaced)
-                        raster_pos = (row_n * width) + col_n;
-                    else
-                        raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                    //fprintf(f, "At %d => %d\n", raster_pos, pixel_byte * pixel_multiplier);
-                    if(color_type == 0){    //Sub-byte grayscales
-                        raster_g8[raster_pos] = pixel_byte * pixel_multiplier;
-                    } else {                //Sub-byte indices
-                        if(!simple_transparency){
-                            raster_rgb8[raster_pos].R = PLTE->entries[(pixel_byte * 3)];
-                            raster_rgb8[raster_pos].G = PLTE->entries[(pixel_byte * 3) + 1];
-                            raster_rgb8[raster_pos].B = PLTE->entries[(pixel_byte * 3) + 2];
-                        } else {
-                            raster_rgba8[raster_pos].R = PLTE->entries[(pixel_byte * 3)];
-                            raster_rgba8[raster_pos].G = PLTE->entries[(pixel_byte * 3) + 1];
-                            raster_rgba8[raster_pos].B = PLTE->entries[(pixel_byte * 3) + 2];
-                            if(pixel_byte < tRNS->entries_n)
-                                raster_rgba8[raster_pos].A = tRNS->entries[pixel_byte];
-                            else
-                                raster_rgba8[raster_pos].A = 0xFF;
-                        }
-                    }
-                }
-            } else if(bit_depth == 8){
-                if((color_type == 0) || (color_type == 3)){
-                    col_n = (j - (i + 1));
-                    if(!interlaced)
-                        raster_pos = (row_n * width) + col_n;
-                    else
-                        raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                    if(color_type == 0){
-                        raster_g8[raster_pos] = unfiltered_byte;
-                    } else {
-                        if(!simple_transparency){
-                            raster_rgb8[raster_pos].R = PLTE->entries[(unfiltered_byte * 3)];
-                            raster_rgb8[raster_pos].G = PLTE->entries[(unfiltered_byte * 3) + 1];
-                            raster_rgb8[raster_pos].B = PLTE->entries[(unfiltered_byte * 3) + 2];
-                        } else {
-                            raster_rgba8[raster_pos].R = PLTE->entries[(unfiltered_byte * 3)];
-                            raster_rgba8[raster_pos].G = PLTE->entries[(unfiltered_byte * 3) + 1];
-                            raster_rgba8[raster_pos].B = PLTE->entries[(unfiltered_byte * 3) + 2];
-                            if(unfiltered_byte < tRNS->entries_n)
-                                raster_rgba8[raster_pos].A = tRNS->entries[unfiltered_byte];
-                            else
-                                raster_rgba8[raster_pos].A = 0xFF;
-                        }
-                    }
-                } else if(color_type == 2){
-                    col_n = (j - (i + 1)) / 3;
-                    if(!interlaced)
-                        raster_pos = (row_n * width) + col_n;
-                    else
-                        raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                    switch((j - (i + 1)) % 3){
-                        case 0: raster_rgb8[raster_pos].R = unfiltered_byte; break;
-                        case 1: raster_rgb8[raster_pos].G = unfiltered_byte; break;
-                        case 2: raster_rgb8[raster_pos].B = unfiltered_byte; break;
-                    }
-                } else if(color_type == 4){
-                    col_n = (j - (i + 1)) / 2;
-                    if(!interlaced)
-                        raster_pos = (row_n * width) + col_n;
-                    else
-                        raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                    switch((j - (i + 1)) % 2){
-                        case 0: raster_g8a[raster_pos].level = unfiltered_byte; break;
-                        case 1: raster_g8a[raster_pos].alpha = unfiltered_byte; break;
-                    }
-                } else if(color_type == 6){
-                    col_n = (j - (i + 1)) / 4;
-                    if(!interlaced)
-                        raster_pos = (row_n * width) + col_n;
-                    else
-                        raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                    switch((j - (i + 1)) % 4){
-                        case 0: raster_rgba8[raster_pos].R = unfiltered_byte; break;
-                        case 1: raster_rgba8[raster_pos].G = unfiltered_byte; break;
-                        case 2: raster_rgba8[raster_pos].B = unfiltered_byte; break;
-                        case 3: raster_rgba8[raster_pos].A = unfiltered_byte; break;
-                    }
-                }
-            } else if(bit_depth == 16){
-                switch(color_type){
-                    case 0:
-                        col_n = (j - (i + 1)) / 2;
-                        if(!interlaced)
-                            raster_pos = (row_n * width) + col_n;
-                        else
-                            raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                        switch((j - (i + 1)) % 2){
-                            case 0: raster_g16[raster_pos] = unfiltered_byte * 0x100; break;
-                            case 1: raster_g16[raster_pos] += unfiltered_byte; break;
-                        }
-                        break;
-                    case 2:
-                        col_n = (j - (i + 1)) / 6;
-                        if(!interlaced)
-                            raster_pos = (row_n * width) + col_n;
-                        else
-                            raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                        switch((j - (i + 1)) % 6){
-                            case 0: raster_rgb16[raster_pos].R = unfiltered_byte * 0x100; break;
-                            case 1: raster_rgb16[raster_pos].R += unfiltered_byte; break;
-                            case 2: raster_rgb16[raster_pos].G = unfiltered_byte * 0x100; break;
-                            case 3: raster_rgb16[raster_pos].G += unfiltered_byte; break;
-                            case 4: raster_rgb16[raster_pos].B = unfiltered_byte * 0x100; break;
-                            case 5: raster_rgb16[raster_pos].B += unfiltered_byte; break;
-                        }
-                        break;
-                    case 4:
-                        col_n = (j - (i + 1)) / 4;
-                        if(!interlaced)
-                            raster_pos = (row_n * width) + col_n;
-                        else
-                            raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                        switch((j - (i + 1)) % 4){
-                            case 0: raster_g16a[raster_pos].level = unfiltered_byte * 0x100; break;
-                            case 1: raster_g16a[raster_pos].level += unfiltered_byte; break;
-                            case 2: raster_g16a[raster_pos].alpha = unfiltered_byte * 0x100; break;
-                            case 3: raster_g16a[raster_pos].alpha += unfiltered_byte; break;
-                        }
-                        break;
-                    case 6:
-                        col_n = (j - (i + 1)) / 8;
-                        if(!interlaced)
-                            raster_pos = (row_n * width) + col_n;
-                        else
-                            raster_pos = adam7_to_raster(width, height, a7_step, col_n, a7_row_n);
-
-                        switch((j - (i + 1)) % 8){
-                            case 0: raster_rgba16[raster_pos].R = unfiltered_byte * 0x100; break;
-                            case 1: raster_rgba16[raster_pos].R += unfiltered_byte; break;
-                            case 2: raster_rgba16[raster_pos].G = unfiltered_byte * 0x100; break;
-                            case 3: raster_rgba16[raster_pos].G += unfiltered_byte; break;
-                            case 4: raster_rgba16[raster_pos].B = unfiltered_byte * 0x100; break;
-                            case 5: raster_rgba16[raster_pos].B += unfiltered_byte; break;
-                            case 6: raster_rgba16[raster_pos].A = unfiltered_byte * 0x100; break;
-                            case 7: raster_rgba16[raster_pos].A += unfiltered_byte; break;
-                        }
-                        break;
+            for(row_left -= span; row_left > 0; row_left -= span){
+                span = (row_left < validate_span_max) ? row_left : validate_span_max;
+                if(backend->stream_read(stream, span, &bytes) != PNGDECODER_OK){
+                    result = PNGDECODER_ZLIB_ERROR;
+                    break;
                 }
             }
         }
-        for(j = 0; j < row_size; j++) previous_row_buf[j] = current_row_buf[j];
-
-        i += row_size + 1;
-        row_n += 1;
-        if(interlaced){
-            a7_row_n += 1;
-            if(a7_row_n >= a7_nrows){
-                a7_row_n = 0;
-
-                if(a7_step < 7){
-                    do{
-                        a7_ncols = Adam7[(a7_step * 4)]; while(a7_ncols < width) a7_ncols+=Adam7[(a7_step * 4) + 2]; a7_ncols = (a7_ncols - Adam7[(a7_step * 4)]) / Adam7[(a7_step * 4) + 2];
-                        a7_nrows = Adam7[(a7_step * 4) + 1]; while(a7_nrows < height) a7_nrows+=Adam7[(a7_step * 4) + 3]; a7_nrows = (a7_nrows - Adam7[(a7_step * 4) + 1]) / Adam7[(a7_step * 4) + 3];
-                        row_size_interlaced = padded_size(pixel_bitsize, a7_ncols, 1) - 1;
-                        a7_step++;
-                    }while((a7_ncols*a7_nrows) == 0);
-                }
-            }
+    }
+    if((result == PNGDECODER_OK) && (backend->stream_end(stream) != PNGDECODER_OK))
+        result = PNGDECODER_ZLIB_ERROR;     //Short or overlong stream
+    if((result == PNGDECODER_OK) && ((backend->stream_input_left(stream) > 0) || (!v->pending && (v->remaining > 0))))
+        result = PNGDECODER_ZLIB_ERROR;     //Image data past the end of the stream, in its last IDAT or a later one
+    backend->stream_free(stream);
+
+    //Chunk errors met by the inflate input come first, they made the stream fail
+    if(v->result != PNGDECODER_OK){
+        *offset = v->error_offset;
+        return v->result;
+    }
+    *offset = validate_offset(v);
+    return result;
+}
+
+static PNGdecoder_result validate_stream(validate_state * v, uint64_t * offset){
+    uint8_t magic[8];
+    uint8_t raw_IHDR[13];
+    chunk raw_chunk = { 0 };
+    chunk_IHDR * parsed;
+    chunk_IHDR IHDR;
+    uint32_t chunk_n = 0;
+    bool PLTE_seen = false;
+    bool IDAT_seen = false;
+    bool stream_ended = false;      //The image data ended and only IDAT chunks followed so far
+    PNGdecoder_result result;
+
+    *offset = 0;
+    if(!validate_read(v, magic, 8) || memcmp(magic, PNG_magic, 8))
+        return PNGDECODER_BAD_PNG;
+
+    while(true){
+        if(!v->pending){
+            result = validate_chunk_header(v, offset);
+            if(result != PNGDECODER_OK)
+                return result;
+        } else {
+            *offset = validate_offset(v) - 8;
+        }
+        v->pending = false;
+
+        if(chunk_n++ == 0){
+            if(memcmp(v->type, chunk_types_essential[0], 4))
+                return PNGDECODER_MISSING_IHDR;
+            if(v->remaining != 13)
+                return PNGDECODER_INVALID_IHDR;
+            result = validate_chunk_data(v, raw_IHDR, 13, offset);
+            if(result == PNGDECODER_OK)
+                result = validate_chunk_end(v, offset);
+            if(result != PNGDECODER_OK)
+                return result;
+
+            raw_chunk.data = raw_IHDR;
+            parsed = new_chunk_IHDR(&raw_chunk);
+            IHDR = *parsed;
+            mem_free(parsed);
+            *offset = 16;   //The IHDR data
+            result = check_IHDR(&IHDR);
+            if(result != PNGDECODER_OK)
+                return result;
+            continue;
         }
+
+        stream_ended = stream_ended && !memcmp(v->type, chunk_types_essential[2], 4);
+
+        if(stream_ended){
+            if(v->remaining > 0)
+                return PNGDECODER_ZLIB_ERROR;   //Image data past the end of the compressed stream, empty IDATs pass
+        } else if(!memcmp(v->type, chunk_types_essential[0], 4)){
+            return PNGDECODER_INVALID_IHDR;     //A second IHDR
+        } else if(!memcmp(v->type, chunk_types_essential[1], 4)){
+            //Suggested palette of true color images, required one of indexed images, none for grayscale
+            if((IHDR.color_type == 0) || (IHDR.color_type == 4) || PLTE_seen || IDAT_seen)
+                return PNGDECODER_INVALID_PLTE;
+            if((v->remaining == 0) || (v->remaining % 3) || ((v->remaining / 3) > ((IHDR.color_type == 3) ? (2 << (IHDR.bit_depth - 1)) : 256)))
+                return PNGDECODER_INVALID_PLTE;
+            PLTE_seen = true;
+        } else if(!memcmp(v->type, chunk_types_essential[2], 4)){
+            if(IDAT_seen)
+                return PNGDECODER_BAD_PNG;      //IDAT chunks must be consecutive
+            if((IHDR.color_type == 3) && !PLTE_seen)
+                return PNGDECODER_MISSING_PLTE;
+            IDAT_seen = true;
+
+            result = validate_image(v, &IHDR, offset);
+            if(result != PNGDECODER_OK)
+                return result;
+            if(v->pending)
+                continue;   //The inflate input already checked the last IDAT and read the next header
+            stream_ended = true;
+        } else if(!memcmp(v->type, chunk_types_essential[3], 4)){
+            result = validate_chunk_data(v, NULL, v->remaining, offset);
+            if(result == PNGDECODER_OK)
+                result = validate_chunk_end(v, offset);
+            if(result != PNGDECODER_OK)
+                return result;
+            if(!IDAT_seen)
+                return PNGDECODER_MISSING_IDAT;
+
+            *offset = validate_offset(v);
+            return validate_fill(v) ? PNGDECODER_MISSING_IEND : PNGDECODER_OK;    //Nothing may follow IEND
+        } else if(!(v->type[0] & 0x20)){
+            return PNGDECODER_BAD_PNG;          //Critical chunk unknown to the decoder
+        }
+
+        result = validate_chunk_data(v, NULL, v->remaining, offset);
+        if(result == PNGDECODER_OK)
+            result = validate_chunk_end(v, offset);
+        if(result != PNGDECODER_OK)
+            return result;
+    }
+}
+
+static uint64_t monotonic_ns(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+static void RGBA8_from_samples(const kernel_table * kernels, PNGdecoder_RGBA8_t * out, const void * in, uint32_t n, uint8_t channels){
+    switch(channels){
+        case 1: kernels->G8_to_RGBA8(out, (const uint8_t *) in, n); break;
+        case 2: kernels->G8A_to_RGBA8(out, (const PNGdecoder_grayscale8a_t *) in, n); break;
+        case 3: kernels->RGB8_to_RGBA8(out, (const PNGdecoder_RGB8_t *) in, n); break;
+        case 4: memcpy(out, in, n * sizeof(PNGdecoder_RGBA8_t)); break;
+    }
+}
+
+static PNGdecoder_result animation_composite(PNGdecoder_animation * anim){
+    const apng_frame * frame = &anim->frames[anim->next_frame];
+    IDAT_input input = { anim->png->chunks, frame->end_chunk, frame->first_chunk,
+                         frame->default_image ? chunk_types_essential[2] : chunk_types_APNG[2], frame->default_image ? 0 : 4 };
+    row_sink sink = { NULL, animation_sink_write, anim };
+    uint32_t width = anim->canvas.width;
+    uint32_t j;
+
+    if(anim->last != NULL)
+        animation_dispose(anim, anim->last);
+
+    if(frame->info.dispose_op == PNGDECODER_DISPOSE_PREVIOUS)
+        for(j = 0; j < frame->info.height; j++)
+            memcpy(anim->saved + ((uint64_t) j * frame->info.width),
+                   anim->canvas.raster + (((uint64_t) (frame->info.y_offset + j) * width) + frame->info.x_offset),
+                   frame->info.width * sizeof(RGBA8));
+
+    //A broken frame still counts as shown, so the following ones can be reached
+    anim->current = frame;
+    anim->last = frame;
+    anim->next_frame++;
+
+    return decode_rows(anim->png, &input, frame->info.width, frame->info.height, &anim->format, &anim->buffers, &sink);
+}
+
+static void animation_dispose(PNGdecoder_animation * anim, const apng_frame * frame){
+    RGBA8 * region = anim->canvas.raster + (((uint64_t) frame->info.y_offset * anim->canvas.width) + frame->info.x_offset);
+    uint64_t stride = anim->canvas.width;
+    uint32_t j;
+
+    switch(frame->info.dispose_op){
+        case PNGDECODER_DISPOSE_NONE:
+            break;
+        case PNGDECODER_DISPOSE_PREVIOUS:
+            if(frame != anim->frames){      //On the first frame it acts as BACKGROUND
+                for(j = 0; j < frame->info.height; j++)
+                    memcpy(region + (j * stride), anim->saved + ((uint64_t) j * frame->info.width), frame->info.width * sizeof(RGBA8));
+                break;
+            }
+            //fall through
+        case PNGDECODER_DISPOSE_BACKGROUND:
+            for(j = 0; j < frame->info.height; j++)
+                memset(region + (j * stride), 0, frame->info.width * sizeof(RGBA8));
+            break;
     }
-    //fclose(f);
-    free(previous_row_buf);
-    free(current_row_buf);
-    free(decoded);
+}
 
-    png->raster_struct = raster_struct;
-    png->raster = raster;
+static void animation_sink_write(void * user, const uint8_t * pixels, uint32_t n, uint32_t x0, uint8_t x_step, uint32_t y){
+    PNGdecoder_animation * anim = (PNGdecoder_animation *) user;
+    const apng_frame * frame = anim->current;
+    RGBA8 * dest = anim->canvas.raster + (((uint64_t) (frame->info.y_offset + y) * anim->canvas.width) + frame->info.x_offset + x0);
+    const RGBA8 * src = anim->row;
+    uint32_t i;
 
-    return raster_type;
+    if(anim->format.raster_type == PNGDECODER_RASTER_RGBA_8)
+        src = (const RGBA8 *) pixels;
+    else
+        RGBA8_from_samples(kernels_get(), anim->row, pixels, n, raster_pixel_sizes[anim->format.raster_type]);
+
+    if(frame->info.blend_op == PNGDECODER_BLEND_SOURCE){
+        if(x_step == 1)
+            memcpy(dest, src, n * sizeof(RGBA8));
+        else
+            for(i = 0; i < n; i++)
+                dest[i * x_step] = src[i];
+    } else {
+        for(i = 0; i < n; i++)
+            blend_over(&dest[i * x_step], src[i]);
+    }
 }
 
+static void blend_over(RGBA8 * dest, RGBA8 src){
+    uint32_t src_weight, dest_weight, alpha;    //Alpha scaled by 255
+
+    if(src.A == 0xFF){
+        *dest = src;
+        return;
+    }
+    if(src.A == 0)
+        return;
+
+    src_weight = src.A * 255;
+    dest_weight = dest->A * (255 - src.A);
+    alpha = src_weight + dest_weight;
+
+    dest->R = ((src.R * src_weight) + (dest->R * dest_weight) + (alpha / 2)) / alpha;
+    dest->G = ((src.G * src_weight) + (dest->G * dest_weight) + (alpha / 2)) / alpha;
+    dest->B = ((src.B * src_weight) + (dest->B * dest_weight) + (alpha / 2)) / alpha;
+    dest->A = (alpha + 127) / 255;
+}
 
 static void free_chunk_PLTE(chunk_PLTE * PLTE){
     if(PLTE != NULL){
-        free(PLTE->entries);
-        free(PLTE);
+        mem_free(PLTE->entries);
+        mem_free(PLTE);
     }
     return;
 }
 
+static void free_chunk_index(chunk_index * index){
+    mem_free(index->bands);
+    mem_free(index);
+}
+
 static void free_chunk_tRNS(chunk_tRNS * tRNS){
     if(tRNS != NULL){
-        free(tRNS->entries);
-        free(tRNS);
+        mem_free(tRNS->entries);
+        mem_free(tRNS);
     }
     return;
 }
 
+static void release_file(PNGdecoder_PNG * png){
+    if(PNGdecoder_is_animated(png))
+        return;
+
+    mem_free(png->raw_file);
+    free_chunks(png->chunks, png->chunk_n);
+    png->raw_file = NULL;
+    png->chunks = NULL;
+    png->chunk_n = 0;
+}
+
 static void free_raster(void * raster_struct, void * raster){
     if(raster != NULL)
-        free(raster);
+        mem_free(raster);
     if(raster_struct != NULL)
-        free(raster_struct);
+        mem_free(raster_struct);
 
     return;
 }
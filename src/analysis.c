@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "analysis.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+//Channels of each raster type
+static const uint8_t raster_channels[8] = { 1, 1, 3, 3, 2, 2, 4, 4 };
+
+//Adds a pixel(its bytes, zero extended) to the color set, until it holds more than ANALYSIS_COLORS_MAX
+static void add_color(pixel_analysis *, uint64_t);
+
+//Reads the samples of a pixel, argument 3 set for 16 bit ones
+static inline void read_samples(uint16_t *, const uint8_t *, bool, uint8_t);
+
+
+/*      INTERFACE       */
+
+
+void analysis_init(pixel_analysis * analysis, PNGdecoder_raster_types type){
+    uint8_t c;
+
+    memset(analysis, 0, sizeof(pixel_analysis));
+    analysis->type = type;
+    analysis->channels = raster_channels[type];
+    analysis->wide = (type == PNGDECODER_RASTER_GRAYSCALE_16) || (type == PNGDECODER_RASTER_RGB_16) ||
+                     (type == PNGDECODER_RASTER_GRAYSCALE_16A) || (type == PNGDECODER_RASTER_RGBA_16);
+    analysis->alpha = (analysis->channels == 2) || (analysis->channels == 4);
+    analysis->pixel_size = analysis->channels * (analysis->wide ? 2 : 1);
+    for(c = 0; c < 4; c++)
+        analysis->min[c] = 0xffff;
+    analysis->gray = true;
+    analysis->depth8 = true;
+}
+
+void analysis_add_row(pixel_analysis * analysis, const void * row, uint32_t n){
+    const uint8_t * pixel = (const uint8_t *) row;
+    uint8_t channels = analysis->channels, pixel_size = analysis->pixel_size, c;
+    uint16_t top = analysis->wide ? 0xffff : 0xff;
+    uint16_t samples[4];
+    uint64_t bytes, previous = 0;
+    uint32_t i;
+
+    for(i = 0; i < n; i++, pixel += pixel_size){
+        read_samples(samples, pixel, analysis->wide, channels);
+        for(c = 0; c < channels; c++){
+            if(samples[c] < analysis->min[c])
+                analysis->min[c] = samples[c];
+            if(samples[c] > analysis->max[c])
+                analysis->max[c] = samples[c];
+        }
+        if(analysis->wide){
+            for(c = 0; c < channels; c++)
+                analysis->depth8 &= (samples[c] >> 8) == (samples[c] & 0xff);
+        }
+        if(analysis->alpha && (samples[channels - 1] != 0) && (samples[channels - 1] != top))
+            analysis->partial_alpha = true;
+        if((channels >= 3) && ((samples[0] != samples[1]) || (samples[1] != samples[2])))
+            analysis->gray = false;
+
+        //Runs of a same pixel are looked up once
+        if(analysis->colors_n <= ANALYSIS_COLORS_MAX){
+            bytes = 0;
+            memcpy(&bytes, pixel, pixel_size);
+            if((i == 0) || (bytes != previous))
+                add_color(analysis, bytes);
+            previous = bytes;
+        }
+    }
+}
+
+void analysis_merge(pixel_analysis * analysis, const pixel_analysis * other){
+    uint32_t k;
+    uint8_t c;
+
+    for(c = 0; c < analysis->channels; c++){
+        if(other->min[c] < analysis->min[c])
+            analysis->min[c] = other->min[c];
+        if(other->max[c] > analysis->max[c])
+            analysis->max[c] = other->max[c];
+    }
+    analysis->partial_alpha |= other->partial_alpha;
+    analysis->gray &= other->gray;
+    analysis->depth8 &= other->depth8;
+
+    if(other->colors_n > ANALYSIS_COLORS_MAX)
+        analysis->colors_n = ANALYSIS_COLORS_MAX + 1;
+    for(k = 0; (k < ANALYSIS_COLOR_SLOTS) && (analysis->colors_n <= ANALYSIS_COLORS_MAX); k++)
+        if(other->used[k])
+            add_color(analysis, other->colors[k]);
+}
+
+void analysis_result(const pixel_analysis * analysis, PNGdecoder_analysis * result){
+    uint16_t top = analysis->wide ? 0xffff : 0xff;
+
+    memset(result, 0, sizeof(PNGdecoder_analysis));
+    result->opaque = !analysis->alpha || (analysis->min[analysis->channels - 1] == top);
+    result->partial_alpha = analysis->partial_alpha;
+    result->gray = analysis->gray;
+    result->depth8 = analysis->depth8;
+    result->channels = analysis->channels;
+    memcpy(result->min, analysis->min, analysis->channels * sizeof(uint16_t));
+    memcpy(result->max, analysis->max, analysis->channels * sizeof(uint16_t));
+    result->colors = (analysis->colors_n <= ANALYSIS_COLORS_MAX) ? analysis->colors_n : 0;
+}
+
+PNGdecoder_raster_types analysis_compact_type(const pixel_analysis * analysis){
+    uint16_t top = analysis->wide ? 0xffff : 0xff;
+    bool alpha = analysis->alpha && (analysis->min[analysis->channels - 1] != top);
+    bool color = (analysis->channels >= 3) && !analysis->gray;
+    bool wide = analysis->wide && !analysis->depth8;
+
+    if(alpha)
+        return color ? (wide ? PNGDECODER_RASTER_RGBA_16 : PNGDECODER_RASTER_RGBA_8) :
+                       (wide ? PNGDECODER_RASTER_GRAYSCALE_16A : PNGDECODER_RASTER_GRAYSCALE_8A);
+    return color ? (wide ? PNGDECODER_RASTER_RGB_16 : PNGDECODER_RASTER_RGB_8) :
+                   (wide ? PNGDECODER_RASTER_GRAYSCALE_16 : PNGDECODER_RASTER_GRAYSCALE_8);
+}
+
+void analysis_compact(void * output, const void * input, uint64_t n, PNGdecoder_raster_types type, PNGdecoder_raster_types compact){
+    uint8_t channels = raster_channels[type], out_channels = raster_channels[compact], c;
+    bool wide = (type == PNGDECODER_RASTER_GRAYSCALE_16) || (type == PNGDECODER_RASTER_RGB_16) ||
+                (type == PNGDECODER_RASTER_GRAYSCALE_16A) || (type == PNGDECODER_RASTER_RGBA_16);
+    bool out_wide = (compact == PNGDECODER_RASTER_GRAYSCALE_16) || (compact == PNGDECODER_RASTER_RGB_16) ||
+                    (compact == PNGDECODER_RASTER_GRAYSCALE_16A) || (compact == PNGDECODER_RASTER_RGBA_16);
+    bool out_alpha = (out_channels == 2) || (out_channels == 4);
+    uint8_t out_colors = out_channels - (out_alpha ? 1 : 0);
+    uint8_t pixel_size = channels * (wide ? 2 : 1), out_size = out_channels * (out_wide ? 2 : 1);
+    const uint8_t * in = (const uint8_t *) input;
+    uint8_t * out = (uint8_t *) output;
+    uint16_t samples[4], picked[4];
+    uint64_t i;
+
+    if((compact == type) && (output == input))
+        return;
+
+    //A pixel is read whole before its output lands, never past it since the output pixels are no larger
+    for(i = 0; i < n; i++, in += pixel_size, out += out_size){
+        read_samples(samples, in, wide, channels);
+        for(c = 0; c < out_colors; c++)
+            picked[c] = samples[c];     //Gray is the red channel, all three being equal
+        if(out_alpha)
+            picked[out_colors] = samples[channels - 1];
+
+        if(out_wide){
+            memcpy(out, picked, out_channels * sizeof(uint16_t));
+        } else {
+            for(c = 0; c < out_channels; c++)
+                out[c] = (uint8_t) picked[c];   //8 bit samples scaled by 257 keep their low byte
+        }
+    }
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static void add_color(pixel_analysis * analysis, uint64_t bytes){
+    uint32_t slot = (uint32_t) ((bytes * 0x9E3779B97F4A7C15ULL) >> 55) & (ANALYSIS_COLOR_SLOTS - 1);
+
+    while(analysis->used[slot]){
+        if(analysis->colors[slot] == bytes)
+            return;
+        slot = (slot + 1) & (ANALYSIS_COLOR_SLOTS - 1);
+    }
+    analysis->colors_n++;
+    if(analysis->colors_n > ANALYSIS_COLORS_MAX)
+        return;     //Too many to be worth tracking, the set stays as it is
+    analysis->used[slot] = 1;
+    analysis->colors[slot] = bytes;
+}
+
+static inline void read_samples(uint16_t * samples, const uint8_t * pixel, bool wide, uint8_t channels){
+    uint8_t c;
+
+    if(wide){
+        memcpy(samples, pixel, channels * sizeof(uint16_t));
+    } else {
+        for(c = 0; c < channels; c++)
+            samples[c] = pixel[c];
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef PNGdecoder_ANALYSIS_H
+#define PNGdecoder_ANALYSIS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      PIXEL ANALYSIS      */
+
+//Accumulates what a decode can tell about its pixels(alpha, grayscale, sample range, unique colors) from the expanded
+//rows as they go by, in any order, so that interlaced passes and bands only need merging; and shrinks a raster to the
+//narrowest type holding the same pixels
+
+
+#define ANALYSIS_COLORS_MAX 256
+#define ANALYSIS_COLOR_SLOTS 512    //Of the color set, a power of two, twice the colors tracked
+
+typedef struct _pixel_analysis {
+    PNGdecoder_raster_types type;   //Of the expanded rows
+    uint8_t channels;
+    uint8_t pixel_size;
+    bool wide;                      //Native 16 bit samples
+    bool alpha;                     //The last channel is alpha
+    uint16_t min[4];
+    uint16_t max[4];
+    bool partial_alpha;
+    bool gray;
+    bool depth8;
+    uint32_t colors_n;              //Unique pixels so far, past ANALYSIS_COLORS_MAX no longer tracked
+    uint64_t colors[ANALYSIS_COLOR_SLOTS];  //Open addressing set of the unique pixels, their bytes
+    uint8_t used[ANALYSIS_COLOR_SLOTS];
+} pixel_analysis;
+
+
+//Argument 1: analysis, Argument 2: raster type of the rows it will be given
+void analysis_init(pixel_analysis *, PNGdecoder_raster_types);
+
+//Argument 1: analysis, Argument 2: expanded pixels, Argument 3: number of pixels
+void analysis_add_row(pixel_analysis *, const void *, uint32_t);
+
+//Adds what the second analysis(of the same raster type) saw to the first
+void analysis_merge(pixel_analysis *, const pixel_analysis *);
+
+void analysis_result(const pixel_analysis *, PNGdecoder_analysis *);
+
+//Narrowest raster type holding exactly the pixels analysed: without alpha if opaque, grayscale if gray, 8 bit if
+//every 16 bit sample is an 8 bit one
+PNGdecoder_raster_types analysis_compact_type(const pixel_analysis *);
+
+//Converts pixels to the type given by analysis_compact_type, front to back; the output may start at the input or
+//before it, in place when the output pixels get no further than the input ones
+//Argument 1: output, Argument 2: input, Argument 3: number of pixels, Argument 4: raster type, Argument 5: compact type
+void analysis_compact(void *, const void *, uint64_t, PNGdecoder_raster_types, PNGdecoder_raster_types);
+
+#endif // PNGdecoder_ANALYSIS_H
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define PNGdecoder_IMPORT
+#include <PNGdecoder/PNGdecoder.h>
+
+#include "memory.h"
+#include "decoder.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+typedef struct _atlas_entry {
+    uint8_t * bytes;            //Whole file, until handed over to the decoder
+    uint64_t size;
+    uint32_t width;             //Of the image, from its IHDR
+    uint32_t height;
+    uint32_t slot_width;        //Image, extrusion on both sides and padding after it
+    uint32_t slot_height;
+    uint32_t x;                 //Of the slot, in the packing area
+    uint32_t y;
+} atlas_entry;
+
+typedef struct _skyline_segment {
+    uint32_t x;
+    uint32_t width;
+    uint64_t y;                 //Bottom of the free space above the span
+} skyline_segment;              //Packed slots reach y over the columns [x, x + width)
+
+typedef struct _atlas_job {
+    const char ** file_names;
+    uint32_t n;
+    atlas_entry * entries;
+    PNGdecoder_options options;
+    PNGdecoder_atlas_config config;
+    PNGdecoder_RGBA8_t * pixels;    //The atlas, NULL while the files are read
+    uint32_t width;
+    uint32_t height;
+    pthread_mutex_t lock;
+    uint32_t next;              //Next file for the workers
+    uint32_t failed;            //Lowest failed file, n if none
+    PNGdecoder_result result;   //Of the failed file
+} atlas_job;                    //Reads every file, then once packed decodes every file into its slot
+
+static const uint8_t png_signature[8] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+
+//Runs atlas_worker on the given number of threads, the calling one included; false if the threads cannot be allocated
+static bool atlas_run(atlas_job *, uint32_t);
+//Takes files in order until none is left or one fails: reads them while the atlas is not allocated, then decodes them
+static void * atlas_worker(void *);
+//Reads the given file and the image size from its IHDR
+static PNGdecoder_result atlas_read(atlas_job *, uint32_t);
+//Decodes the given file straight into its slot, through a U8 RGBA tensor window of the atlas, and extrudes its edges
+static PNGdecoder_result atlas_decode(atlas_job *, uint32_t);
+//Repeats the edge pixels of the image at the given place(arguments 2 and 3) and size(arguments 4 and 5) outwards
+static void atlas_extrude(atlas_job *, uint32_t, uint32_t, uint32_t, uint32_t);
+static void atlas_fail(atlas_job *, uint32_t, PNGdecoder_result);
+
+//Places the slots of the entries in the given order in an area of the given width, each one at the lowest place
+//the skyline leaves it, leftmost first; returns the height used, UINT64_MAX if a slot is wider than the area
+//Argument 1: entries, Argument 2: number of entries, Argument 3: width, Argument 4: skyline, room for n + 1 segments
+static uint64_t skyline_pack(atlas_entry **, uint32_t, uint32_t, skyline_segment *);
+//Tallest slots first, then widest, then in file order
+static int compare_slots(const void *, const void *);
+
+static uint32_t read_uint32(const uint8_t *);
+//Smallest power of two not below the given value, up to 2^31
+static uint32_t round_power_of_two(uint32_t);
+
+
+/*      INTERFACE       */
+
+
+void PNGdecoder_atlas_config_init(PNGdecoder_atlas_config * config){
+    config->max_width = 4096;
+    config->max_height = 4096;
+    config->padding = 0;
+    config->extrude = 0;
+    config->power_of_two = 0;
+    config->threads = 0;
+}
+
+PNGdecoder_result PNGdecoder_decode_atlas(const char ** file_names, uint32_t n, const PNGdecoder_options * options,
+                                          const PNGdecoder_atlas_config * config, PNGdecoder_raster_RGBA8_t ** result,
+                                          PNGdecoder_atlas_rect * rects, uint32_t * failed){
+    PNGdecoder_raster_RGBA8_t * atlas;
+    PNGdecoder_result status = PNGDECODER_OK;
+    atlas_entry ** order = NULL;
+    skyline_segment * skyline = NULL;
+    uint64_t area = 0, packed;
+    uint32_t threads_n, width, max_width, max_height, widest = 0, x, y, i;
+    long cpus;
+    atlas_job job;
+
+    if((file_names == NULL) || (n == 0) || (result == NULL) || (rects == NULL) || ((options != NULL) && (options->tensor != NULL)))
+        return PNGDECODER_INVALID_ARGUMENT;     //The slots are the tensors of the decodes
+
+    memset(&job, 0, sizeof(atlas_job));
+    job.file_names = file_names;
+    job.n = n;
+    job.failed = n;
+    if(options != NULL)
+        job.options = *options;
+    else
+        PNGdecoder_options_init(&job.options);
+    if(config != NULL)
+        job.config = *config;
+    else
+        PNGdecoder_atlas_config_init(&job.config);
+
+    max_width = job.config.max_width;
+    max_height = job.config.max_height;
+    if(job.config.power_of_two){
+        max_width = (max_width > 1) ? round_power_of_two((max_width / 2) + 1) : max_width;    //Largest power of two within the limits
+        max_height = (max_height > 1) ? round_power_of_two((max_height / 2) + 1) : max_height;
+    }
+    if((max_width <= job.config.padding) || (max_height <= job.config.padding) || (max_width > (UINT32_MAX / sizeof(PNGdecoder_RGBA8_t))))
+        return PNGDECODER_INVALID_ARGUMENT;
+    job.config.max_width = max_width;
+    job.config.max_height = max_height;
+
+    threads_n = job.config.threads;
+    if(threads_n == 0){
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_n = (cpus > 0) ? cpus : 1;
+    }
+    if(threads_n > n)
+        threads_n = n;
+
+    pthread_mutex_init(&job.lock, NULL);
+    job.entries = (atlas_entry *) mem_calloc(n, sizeof(atlas_entry));
+    if(job.entries == NULL){
+        status = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+
+    //Every image size first, the packer needs them all
+    if(!atlas_run(&job, threads_n)){
+        status = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+    if(job.failed < n){
+        status = job.result;
+        goto end;
+    }
+
+    order = (atlas_entry **) mem_malloc(n * sizeof(atlas_entry *));
+    skyline = (skyline_segment *) mem_malloc((n + 1) * sizeof(skyline_segment));
+    if((order == NULL) || (skyline == NULL)){
+        status = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+    for(i = 0; i < n; i++){
+        order[i] = &job.entries[i];
+        area += (uint64_t) job.entries[i].slot_width * job.entries[i].slot_height;
+        if(job.entries[i].slot_width > widest)
+            widest = job.entries[i].slot_width;
+    }
+    qsort(order, n, sizeof(atlas_entry *), compare_slots);
+
+    //About square to begin with, wider while too tall
+    width = (uint32_t) ceil(sqrt((double) area));
+    if(width < widest)
+        width = widest;
+    width = ((uint64_t) width + job.config.padding < max_width) ? width + job.config.padding : max_width;
+    if(job.config.power_of_two)
+        width = round_power_of_two(width);
+    while(true){
+        packed = skyline_pack(order, n, width - job.config.padding, skyline);
+        if((packed != UINT64_MAX) && (packed + job.config.padding <= max_height))
+            break;
+        if(width == max_width){
+            status = PNGDECODER_IMAGE_TOO_LARGE;
+            goto end;
+        }
+        width = ((uint64_t) width * 2 < max_width) ? width * 2 : max_width;
+    }
+    job.width = width;
+    job.height = packed + job.config.padding;
+    if(job.config.power_of_two)
+        job.height = round_power_of_two(job.height);
+
+    //Transparent where no image goes
+    job.pixels = (PNGdecoder_RGBA8_t *) mem_calloc((uint64_t) job.width * job.height, sizeof(PNGdecoder_RGBA8_t));
+    if(job.pixels == NULL){
+        status = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+    job.next = 0;
+    if(!atlas_run(&job, threads_n)){
+        mem_free(job.pixels);
+        status = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+    if(job.failed < n){
+        mem_free(job.pixels);
+        status = job.result;
+        goto end;
+    }
+
+    for(i = 0; i < n; i++){
+        x = job.config.padding + job.entries[i].x + job.config.extrude;
+        y = job.config.padding + job.entries[i].y + job.config.extrude;
+        rects[i].x = x;
+        rects[i].y = y;
+        rects[i].width = job.entries[i].width;
+        rects[i].height = job.entries[i].height;
+        rects[i].u0 = (float) x / job.width;
+        rects[i].v0 = (float) y / job.height;
+        rects[i].u1 = (float) (x + job.entries[i].width) / job.width;
+        rects[i].v1 = (float) (y + job.entries[i].height) / job.height;
+    }
+
+    atlas = (PNGdecoder_raster_RGBA8_t *) mem_malloc(sizeof(PNGdecoder_raster_RGBA8_t));
+    if(atlas == NULL){
+        mem_free(job.pixels);
+        status = PNGDECODER_MEMORY_ERROR;
+        goto end;
+    }
+    atlas->width = job.width;
+    atlas->height = job.height;
+    atlas->raster = job.pixels;
+    *result = atlas;
+
+    end:
+    if((job.failed < n) && (failed != NULL))
+        *failed = job.failed;
+    for(i = 0; (job.entries != NULL) && (i < n); i++)
+        mem_free(job.entries[i].bytes);     //Files never handed to a decoder
+    mem_free(job.entries);
+    mem_free(order);
+    mem_free(skyline);
+    pthread_mutex_destroy(&job.lock);
+
+    return status;
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static bool atlas_run(atlas_job * job, uint32_t threads_n){
+    pthread_t * threads = (pthread_t *) mem_malloc(threads_n * sizeof(pthread_t));
+    uint32_t started = 0, i;
+
+    if(threads == NULL)
+        return false;
+    for(i = 0; i < threads_n - 1; i++)
+        if(pthread_create(&threads[started], NULL, atlas_worker, job) == 0)
+            started++;
+    atlas_worker(job);
+    for(i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    mem_free(threads);
+
+    return true;
+}
+
+static void * atlas_worker(void * user){
+    atlas_job * job = (atlas_job *) user;
+    PNGdecoder_result result;
+    uint32_t i;
+    bool stop;
+
+    while(true){
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        stop = (i >= job->n) || (job->failed < job->n);
+        pthread_mutex_unlock(&job->lock);
+        if(stop)
+            return NULL;
+
+        result = (job->pixels == NULL) ? atlas_read(job, i) : atlas_decode(job, i);
+        if(result != PNGDECODER_OK)
+            atlas_fail(job, i, result);
+    }
+}
+
+static PNGdecoder_result atlas_read(atlas_job * job, uint32_t i){
+    atlas_entry * entry = &job->entries[i];
+    uint64_t border = (2 * (uint64_t) job->config.extrude) + job->config.padding;
+    PNGdecoder_result result;
+
+    result = PNGdecoder_read_file(job->file_names[i], &entry->bytes, &entry->size);
+    if(result != PNGDECODER_OK)
+        return result;
+
+    if((entry->size < 33) || memcmp(entry->bytes, png_signature, 8))
+        return PNGDECODER_BAD_PNG;
+    if((read_uint32(entry->bytes + 8) != 13) || memcmp(entry->bytes + 12, "IHDR", 4))
+        return PNGDECODER_MISSING_IHDR;
+    entry->width = read_uint32(entry->bytes + 16);
+    entry->height = read_uint32(entry->bytes + 20);
+    if((entry->width == 0) || (entry->height == 0))
+        return PNGDECODER_INVALID_IHDR;     //The rest of the IHDR is checked by the decode
+
+    if((entry->width + border + job->config.padding > job->config.max_width) ||
+       (entry->height + border + job->config.padding > job->config.max_height))
+        return PNGDECODER_IMAGE_TOO_LARGE;
+    entry->slot_width = entry->width + border;
+    entry->slot_height = entry->height + border;
+
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result atlas_decode(atlas_job * job, uint32_t i){
+    atlas_entry * entry = &job->entries[i];
+    uint32_t x = job->config.padding + entry->x + job->config.extrude;
+    uint32_t y = job->config.padding + entry->y + job->config.extrude;
+    PNGdecoder_options options = job->options;
+    PNGdecoder_PNG * png = NULL;
+    PNGdecoder_tensor slot;
+    PNGdecoder_result result;
+    uint8_t * bytes;
+
+    PNGdecoder_tensor_init(&slot);
+    slot.data = job->pixels + ((uint64_t) y * job->width) + x;
+    slot.type = PNGDECODER_TENSOR_U8;
+    slot.planar = 0;
+    slot.channels = 4;
+    slot.width = entry->width;
+    slot.height = entry->height;
+    slot.row_stride = job->width * sizeof(PNGdecoder_RGBA8_t);
+    options.tensor = &slot;
+
+    bytes = entry->bytes;
+    entry->bytes = NULL;            //The decoder frees them
+    result = PNGdecoder_open_bytes(bytes, entry->size, &options, &png);
+    if(result != PNGDECODER_OK)
+        return result;
+    PNGdecoder_free(png);
+
+    atlas_extrude(job, x, y, entry->width, entry->height);
+    return PNGDECODER_OK;
+}
+
+static void atlas_extrude(atlas_job * job, uint32_t x, uint32_t y, uint32_t width, uint32_t height){
+    uint32_t extrude = job->config.extrude, j, k;
+    uint64_t stride = job->width;
+    PNGdecoder_RGBA8_t * row;
+
+    if(extrude == 0)
+        return;
+
+    for(j = 0; j < height; j++){
+        row = job->pixels + ((y + j) * stride) + x;
+        for(k = 1; k <= extrude; k++){
+            row[-(int64_t) k] = row[0];
+            row[width - 1 + k] = row[width - 1];
+        }
+    }
+
+    //Whole extruded rows, corners included
+    for(k = 1; k <= extrude; k++){
+        row = job->pixels + (y * stride) + x - extrude;
+        memcpy(row - (k * stride), row, (width + (2 * (uint64_t) extrude)) * sizeof(PNGdecoder_RGBA8_t));
+        row += (height - 1) * stride;
+        memcpy(row + (k * stride), row, (width + (2 * (uint64_t) extrude)) * sizeof(PNGdecoder_RGBA8_t));
+    }
+}
+
+static void atlas_fail(atlas_job * job, uint32_t i, PNGdecoder_result result){
+    pthread_mutex_lock(&job->lock);
+    if(i < job->failed){
+        job->failed = i;
+        job->result = result;
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static uint64_t skyline_pack(atlas_entry ** order, uint32_t n, uint32_t width, skyline_segment * skyline){
+    uint32_t segments = 1, best = 0, end, i, s, k;
+    uint64_t height = 0, best_top, y;
+    atlas_entry * entry;
+
+    skyline[0] = (skyline_segment){ 0, width, 0 };
+    for(i = 0; i < n; i++){
+        entry = order[i];
+
+        //Slots start at the left end of a segment, resting on the highest segment they span
+        best_top = UINT64_MAX;
+        for(s = 0; (s < segments) && ((uint64_t) skyline[s].x + entry->slot_width <= width); s++){
+            end = skyline[s].x + entry->slot_width;
+            y = 0;
+            for(k = s; (k < segments) && (skyline[k].x < end); k++)
+                if(skyline[k].y > y)
+                    y = skyline[k].y;
+            if(y + entry->slot_height < best_top){
+                best_top = y + entry->slot_height;
+                best = s;
+            }
+        }
+        if(best_top == UINT64_MAX)
+            return UINT64_MAX;
+
+        entry->x = skyline[best].x;
+        entry->y = best_top - entry->slot_height;
+        if(best_top > height)
+            height = best_top;
+
+        //The slot covers segments best to k - 1 and may cut into segment k
+        end = entry->x + entry->slot_width;
+        for(k = best; (k < segments) && (skyline[k].x + skyline[k].width <= end); k++);
+        if((k < segments) && (skyline[k].x < end)){
+            skyline[k].width -= end - skyline[k].x;
+            skyline[k].x = end;
+        }
+        memmove(&skyline[best + 1], &skyline[k], (segments - k) * sizeof(skyline_segment));
+        segments = segments + 1 - (k - best);
+        skyline[best] = (skyline_segment){ entry->x, entry->slot_width, best_top };
+
+        //Neighbours at the same height merge, so wider slots can rest on them
+        if((best + 1 < segments) && (skyline[best + 1].y == best_top)){
+            skyline[best].width += skyline[best + 1].width;
+            memmove(&skyline[best + 1], &skyline[best + 2], (segments - best - 2) * sizeof(skyline_segment));
+            segments--;
+        }
+        if((best > 0) && (skyline[best - 1].y == best_top)){
+            skyline[best - 1].width += skyline[best].width;
+            memmove(&skyline[best], &skyline[best + 1], (segments - best - 1) * sizeof(skyline_segment));
+            segments--;
+        }
+    }
+
+    return height;
+}
+
+static int compare_slots(const void * a, const void * b){
+    const atlas_entry * first = *(atlas_entry * const *) a;
+    const atlas_entry * second = *(atlas_entry * const *) b;
+
+    if(first->slot_height != second->slot_height)
+        return (first->slot_height > second->slot_height) ? -1 : 1;
+    if(first->slot_width != second->slot_width)
+        return (first->slot_width > second->slot_width) ? -1 : 1;
+    return (first < second) ? -1 : (first > second);
+}
+
+static uint32_t read_uint32(const uint8_t * bytes){
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+static uint32_t round_power_of_two(uint32_t value){
+    uint32_t power = 1;
+
+    while((power < value) && (power < 0x80000000u))
+        power *= 2;
+    return power;
+}
@@ -0,0 +1,469 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define PNGdecoder_IMPORT
+#include <PNGdecoder/PNGdecoder.h>
+
+#include "decoder.h"
+#include "hash.h"
+#include "memory.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+typedef struct _cache_key {
+    char * path;            //NULL for images keyed by content
+    uint64_t content;       //Content hash, unused for paths
+    uint64_t size;          //File size
+    int64_t mtime;          //Modification time in nanoseconds, path keys only
+    uint64_t inode;
+    uint64_t device;
+} cache_key;                //Identity of a decoded image: path + mtime + size, or content hash + size
+
+typedef struct _cache_entry {
+    cache_key key;
+    uint64_t key_hash;
+    PNGdecoder_PNG * png;           //NULL while pending
+    uint64_t bytes;                 //Charged against the budget
+    uint32_t refs;                  //Handles given out and not released, plus threads waiting for the decode
+    bool referenced;                //CLOCK bit, set on every hit
+    bool pending;                   //Being decoded by the thread which missed
+    bool resident;                  //In the table and the CLOCK ring
+    PNGdecoder_result result;       //Of the decode, for coalesced waiters
+    struct _cache_entry * key_next;     //Bucket chain by key
+    struct _cache_entry * png_next;     //Bucket chain by png pointer, to release handles
+    struct _cache_entry * clock_prev;
+    struct _cache_entry * clock_next;
+} cache_entry;
+
+struct _PNGdecoder_cache {
+    pthread_mutex_t lock;
+    pthread_cond_t decoded;         //Broadcast whenever a pending decode completes
+    PNGdecoder_options options;
+    uint64_t budget;
+    cache_entry ** key_buckets;
+    cache_entry ** png_buckets;
+    uint32_t bucket_n;              //Power of 2
+    uint32_t entry_n;               //Entries in the table, pending ones included
+    cache_entry * hand;             //CLOCK hand, NULL when no entry is resident
+    uint32_t resident_n;
+    PNGdecoder_cache_stats stats;
+};
+
+static const uint32_t initial_buckets = 64;
+
+
+//Hash of a key, combining the path with its file identity or the content hash with the size
+static uint64_t key_hash(const cache_key *);
+static bool key_equal(const cache_key *, const cache_key *);
+static uint32_t pointer_hash(const void *, uint32_t);
+
+//Finds the entry of the given key, NULL if missing
+static cache_entry * find_key(PNGdecoder_cache *, const cache_key *, uint64_t);
+//Finds the entry holding the given png, NULL if the png does not come from the cache
+static cache_entry * find_png(PNGdecoder_cache *, const PNGdecoder_PNG *);
+
+//Table membership; entries are in the key index from the miss on, in the png index and the ring once decoded
+static void table_insert(PNGdecoder_cache *, cache_entry *);
+static void table_grow(PNGdecoder_cache *);
+static void table_remove(PNGdecoder_cache *, cache_entry *);
+static void ring_insert(PNGdecoder_cache *, cache_entry *);
+
+//Runs the CLOCK hand until the resident bytes fit the budget; entries with outstanding handles are never evicted,
+//so the budget can be exceeded while they are all held
+static void evict(PNGdecoder_cache *);
+static void entry_free(cache_entry *);
+
+//Looks the key up, decoding on a miss(one thread per key, others wait for it); takes ownership of the key path
+//Argument 3: file name, or NULL; Arguments 4 and 5: file bytes and size when keyed by content
+static PNGdecoder_result cache_open(PNGdecoder_cache *, cache_key *, const char *, const void *, uint64_t, PNGdecoder_PNG **);
+
+//Bytes held by a decoded image: its raster plus the file kept for chunk access
+static uint64_t png_bytes(PNGdecoder_PNG *, uint64_t);
+
+
+/*      INTERFACE       */
+
+
+PNGdecoder_result PNGdecoder_cache_new(uint64_t budget, const PNGdecoder_options * options, PNGdecoder_cache ** result){
+    PNGdecoder_cache * cache;
+
+    if((result == NULL) || ((options != NULL) && ((options->tensor != NULL) || (options->raster_file != NULL) || (options->row_callback != NULL) ||
+                                               (options->tile_callback != NULL))))
+        return PNGDECODER_INVALID_ARGUMENT;     //Tensor and callback decodes have no raster to share
+
+    cache = (PNGdecoder_cache *) mem_calloc(1, sizeof(PNGdecoder_cache));
+    if(cache == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    cache->bucket_n = initial_buckets;
+    cache->key_buckets = (cache_entry **) mem_calloc(cache->bucket_n, sizeof(cache_entry *));
+    cache->png_buckets = (cache_entry **) mem_calloc(cache->bucket_n, sizeof(cache_entry *));
+    if((cache->key_buckets == NULL) || (cache->png_buckets == NULL)){
+        mem_free(cache->key_buckets);
+        mem_free(cache->png_buckets);
+        mem_free(cache);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->decoded, NULL);
+    if(options != NULL)
+        cache->options = *options;
+    else
+        PNGdecoder_options_init(&cache->options);
+    cache->budget = budget;
+
+    *result = cache;
+    return PNGDECODER_OK;
+}
+
+PNGdecoder_result PNGdecoder_cache_open(PNGdecoder_cache * cache, const char * file_name, PNGdecoder_PNG ** result){
+    struct stat info;
+    cache_key key;
+    size_t length;
+
+    if((cache == NULL) || (file_name == NULL) || (result == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(stat(file_name, &info))
+        return PNGDECODER_FILE_OPEN_ERROR;
+
+    memset(&key, 0, sizeof(key));
+    length = strlen(file_name) + 1;
+    key.path = (char *) mem_malloc(length);     //Released with mem_free, so not strdup
+    if(key.path == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    memcpy(key.path, file_name, length);
+    key.size = info.st_size;
+    key.mtime = ((int64_t) info.st_mtim.tv_sec * 1000000000) + info.st_mtim.tv_nsec;
+    key.inode = info.st_ino;
+    key.device = info.st_dev;
+
+    return cache_open(cache, &key, file_name, NULL, 0, result);
+}
+
+PNGdecoder_result PNGdecoder_cache_open_memory(PNGdecoder_cache * cache, const void * data, uint64_t size, PNGdecoder_PNG ** result){
+    cache_key key;
+
+    if((cache == NULL) || (data == NULL) || (result == NULL))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    memset(&key, 0, sizeof(key));
+    key.content = hash64(data, size, 0);
+    key.size = size;
+
+    return cache_open(cache, &key, NULL, data, size, result);
+}
+
+void PNGdecoder_cache_retain(PNGdecoder_cache * cache, PNGdecoder_PNG * png){
+    cache_entry * entry;
+
+    if((cache == NULL) || (png == NULL))
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = find_png(cache, png);
+    if(entry != NULL)
+        entry->refs++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void PNGdecoder_cache_release(PNGdecoder_cache * cache, PNGdecoder_PNG * png){
+    cache_entry * entry;
+
+    if((cache == NULL) || (png == NULL))
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = find_png(cache, png);
+    if((entry != NULL) && (entry->refs > 0)){
+        entry->refs--;
+        if((entry->refs == 0) && (cache->stats.bytes > cache->budget))
+            evict(cache);       //Catches up with evictions skipped while the entry was held
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void PNGdecoder_cache_get_stats(PNGdecoder_cache * cache, PNGdecoder_cache_stats * stats){
+    if((cache == NULL) || (stats == NULL))
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void PNGdecoder_cache_free(PNGdecoder_cache * cache){
+    cache_entry * entry, * next;
+    uint32_t i;
+
+    if(cache == NULL)
+        return;
+
+    for(i = 0; i < cache->bucket_n; i++)
+        for(entry = cache->key_buckets[i]; entry != NULL; entry = next){
+            next = entry->key_next;
+            entry_free(entry);
+        }
+
+    mem_free(cache->key_buckets);
+    mem_free(cache->png_buckets);
+    pthread_cond_destroy(&cache->decoded);
+    pthread_mutex_destroy(&cache->lock);
+    mem_free(cache);
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static PNGdecoder_result cache_open(PNGdecoder_cache * cache, cache_key * key, const char * file_name, const void * data,
+                                    uint64_t size, PNGdecoder_PNG ** result){
+    uint64_t hash = key_hash(key);
+    cache_entry * entry;
+    PNGdecoder_PNG * png = NULL;
+    PNGdecoder_result decoded;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = find_key(cache, key, hash);
+    if(entry != NULL){
+        mem_free(key->path);
+        entry->refs++;
+        if(entry->pending){
+            cache->stats.coalesced++;
+            while(entry->pending)
+                pthread_cond_wait(&cache->decoded, &cache->lock);
+        } else {
+            cache->stats.hits++;
+        }
+        entry->referenced = true;
+
+        decoded = entry->result;
+        if(decoded == PNGDECODER_OK){
+            *result = entry->png;
+        } else if(--entry->refs == 0){
+            entry_free(entry);      //Failed decode, already out of the table, last waiter frees it
+        }
+        pthread_mutex_unlock(&cache->lock);
+        return decoded;
+    }
+
+    //Miss: publish a pending entry so concurrent requests for the key wait for this decode instead of repeating it
+    cache->stats.misses++;
+    entry = (cache_entry *) mem_calloc(1, sizeof(cache_entry));
+    if(entry == NULL){
+        pthread_mutex_unlock(&cache->lock);
+        mem_free(key->path);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    entry->key = *key;
+    entry->key_hash = hash;
+    entry->refs = 1;
+    entry->pending = true;
+    table_insert(cache, entry);
+    pthread_mutex_unlock(&cache->lock);
+
+    if(file_name != NULL)
+        decoded = PNGdecoder_openPNG_ex(file_name, &cache->options, &png);
+    else
+        decoded = PNGdecoder_openPNG_memory(data, size, &cache->options, &png);
+
+    pthread_mutex_lock(&cache->lock);
+    entry->pending = false;
+    entry->result = decoded;
+    if(decoded == PNGDECODER_OK){
+        entry->png = png;
+        entry->bytes = png_bytes(png, key->size);
+        entry->referenced = true;
+        ring_insert(cache, entry);
+        cache->stats.bytes += entry->bytes;
+        evict(cache);
+        *result = png;
+    } else {
+        cache->stats.failures++;
+        table_remove(cache, entry);
+        if(--entry->refs == 0)
+            entry_free(entry);
+    }
+    pthread_cond_broadcast(&cache->decoded);
+    pthread_mutex_unlock(&cache->lock);
+
+    return decoded;
+}
+
+static void evict(PNGdecoder_cache * cache){
+    cache_entry * entry;
+    uint64_t steps = 2 * (uint64_t) cache->resident_n;   //Enough to clear every CLOCK bit and come back
+
+    while((cache->stats.bytes > cache->budget) && (cache->hand != NULL) && (steps-- > 0)){
+        entry = cache->hand;
+        cache->hand = entry->clock_next;
+        if(entry->refs > 0)
+            continue;
+        if(entry->referenced){
+            entry->referenced = false;
+            continue;
+        }
+
+        table_remove(cache, entry);
+        cache->stats.evictions++;
+        entry_free(entry);
+    }
+}
+
+static void table_insert(PNGdecoder_cache * cache, cache_entry * entry){
+    uint32_t b;
+
+    if(cache->entry_n >= cache->bucket_n)
+        table_grow(cache);
+
+    b = entry->key_hash & (cache->bucket_n - 1);
+    entry->key_next = cache->key_buckets[b];
+    cache->key_buckets[b] = entry;
+    cache->entry_n++;
+}
+
+static void ring_insert(PNGdecoder_cache * cache, cache_entry * entry){
+    uint32_t b = pointer_hash(entry->png, cache->bucket_n);
+
+    entry->png_next = cache->png_buckets[b];
+    cache->png_buckets[b] = entry;
+
+    //Just behind the hand, the last place it reaches
+    if(cache->hand == NULL){
+        entry->clock_prev = entry->clock_next = entry;
+        cache->hand = entry;
+    } else {
+        entry->clock_next = cache->hand;
+        entry->clock_prev = cache->hand->clock_prev;
+        entry->clock_prev->clock_next = entry;
+        cache->hand->clock_prev = entry;
+    }
+    entry->resident = true;
+    cache->resident_n++;
+}
+
+static void table_grow(PNGdecoder_cache * cache){
+    uint32_t bucket_n = cache->bucket_n * 2;
+    cache_entry ** key_buckets = (cache_entry **) mem_calloc(bucket_n, sizeof(cache_entry *));
+    cache_entry ** png_buckets = (cache_entry **) mem_calloc(bucket_n, sizeof(cache_entry *));
+    cache_entry * entry, * next;
+    uint32_t i, b;
+
+    if((key_buckets == NULL) || (png_buckets == NULL)){
+        mem_free(key_buckets);      //Keeps the current table, with longer chains
+        mem_free(png_buckets);
+        return;
+    }
+
+    for(i = 0; i < cache->bucket_n; i++){
+        for(entry = cache->key_buckets[i]; entry != NULL; entry = next){
+            next = entry->key_next;
+            b = entry->key_hash & (bucket_n - 1);
+            entry->key_next = key_buckets[b];
+            key_buckets[b] = entry;
+        }
+        for(entry = cache->png_buckets[i]; entry != NULL; entry = next){
+            next = entry->png_next;
+            b = pointer_hash(entry->png, bucket_n);
+            entry->png_next = png_buckets[b];
+            png_buckets[b] = entry;
+        }
+    }
+
+    mem_free(cache->key_buckets);
+    mem_free(cache->png_buckets);
+    cache->key_buckets = key_buckets;
+    cache->png_buckets = png_buckets;
+    cache->bucket_n = bucket_n;
+}
+
+static void table_remove(PNGdecoder_cache * cache, cache_entry * entry){
+    cache_entry ** link;
+
+    for(link = &cache->key_buckets[entry->key_hash & (cache->bucket_n - 1)]; *link != NULL; link = &(*link)->key_next)
+        if(*link == entry){
+            *link = entry->key_next;
+            break;
+        }
+    cache->entry_n--;
+
+    if(!entry->resident)
+        return;
+
+    for(link = &cache->png_buckets[pointer_hash(entry->png, cache->bucket_n)]; *link != NULL; link = &(*link)->png_next)
+        if(*link == entry){
+            *link = entry->png_next;
+            break;
+        }
+
+    if(entry->clock_next == entry){
+        cache->hand = NULL;
+    } else {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if(cache->hand == entry)
+            cache->hand = entry->clock_next;
+    }
+    entry->resident = false;
+    cache->resident_n--;
+    cache->stats.bytes -= entry->bytes;
+}
+
+static cache_entry * find_key(PNGdecoder_cache * cache, const cache_key * key, uint64_t hash){
+    cache_entry * entry;
+
+    for(entry = cache->key_buckets[hash & (cache->bucket_n - 1)]; entry != NULL; entry = entry->key_next)
+        if((entry->key_hash == hash) && key_equal(&entry->key, key))
+            return entry;
+
+    return NULL;
+}
+
+static cache_entry * find_png(PNGdecoder_cache * cache, const PNGdecoder_PNG * png){
+    cache_entry * entry;
+
+    for(entry = cache->png_buckets[pointer_hash(png, cache->bucket_n)]; entry != NULL; entry = entry->png_next)
+        if(entry->png == png)
+            return entry;
+
+    return NULL;
+}
+
+static void entry_free(cache_entry * entry){
+    PNGdecoder_free(entry->png);
+    mem_free(entry->key.path);
+    mem_free(entry);
+}
+
+static uint64_t key_hash(const cache_key * key){
+    uint64_t identity[4] = { key->size, (uint64_t) key->mtime, key->inode, key->device };
+
+    if(key->path == NULL)
+        return key->content ^ (key->size * 0x9E3779B97F4A7C15ULL);
+
+    return hash64(key->path, strlen(key->path), hash64(identity, sizeof(identity), 0));
+}
+
+static bool key_equal(const cache_key * a, const cache_key * b){
+    if((a->path == NULL) != (b->path == NULL))
+        return false;
+    if(a->path == NULL)
+        return (a->content == b->content) && (a->size == b->size);
+
+    return (a->size == b->size) && (a->mtime == b->mtime) && (a->inode == b->inode) && (a->device == b->device) &&
+           !strcmp(a->path, b->path);
+}
+
+static uint32_t pointer_hash(const void * pointer, uint32_t bucket_n){
+    return (uint32_t)((((uintptr_t) pointer) * 0x9E3779B97F4A7C15ULL) >> 32) & (bucket_n - 1);
+}
+
+static uint64_t png_bytes(PNGdecoder_PNG * png, uint64_t file_size){
+    //Only animated images keep their file once decoded
+    return PNGdecoder_raster_bytes(png) + (PNGdecoder_is_animated(png) ? file_size : 0);
+}
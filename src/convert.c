@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+#include <PNGdecoder/PNGdecoder.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <search.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+//Batch converts PNG files to PAM, PPM/PGM or raw rasters on a pool of worker threads, keeping the raster type of each
+//image(bit depth, channels; palette and sub-byte images come out as 8 bit RGB(A) or gray); inputs are files,
+//directories(their png files, recursively) or, with - or no input at all, a list of file names on stdin, one per line
+
+typedef enum {
+  FORMAT_PAM,                   //Every raster type, 16 bit samples big endian
+  FORMAT_PPM,                   //PPM for color, PGM for gray, alpha dropped
+  FORMAT_RAW                    //The raster as decoded, native 16 bit samples, no header
+} output_format;
+
+const char * format_names[3] = { "pam", "ppm", "raw" };
+
+const uint8_t pixel_sizes[8] = { 1, 2, 3, 6, 2, 4, 4, 8 };
+const uint8_t channel_counts[8] = { 1, 1, 3, 3, 2, 2, 4, 4 };
+const char * tuple_types[8] = { "GRAYSCALE", "GRAYSCALE", "RGB", "RGB", "GRAYSCALE_ALPHA", "GRAYSCALE_ALPHA", "RGB_ALPHA", "RGB_ALPHA" };
+
+typedef struct {
+  char * path;
+  size_t relative;              //Offset in path of the part kept under the output dir: past the directory given as
+                                //input for the files found in it, the file name otherwise
+  int directory;                //Found as a directory by lstat, symbolic links are not followed
+} input_path;
+
+typedef struct {
+  //Inputs, walked under the lock: arguments, then stdin; directories expand into pending
+  char ** args;
+  int args_n;
+  int next_arg;
+  int read_stdin;
+  input_path * pending;         //Stack of paths found in directories, popped in name order
+  size_t pending_n;
+  size_t pending_capacity;
+  uint64_t next_sequence;       //Of the next input handed out
+
+  //Output
+  output_format format;
+  const char * output_dir;      //NULL to write next to each input
+  void * outputs;               //tsearch tree of the output names handed out so far, without their extension
+  int to_stdout;                //Images streamed to stdout in input order
+  uint64_t next_write;          //Sequence of the next image to write to stdout
+  pthread_cond_t written;       //Broadcast after each image written to stdout
+
+  PNGdecoder_options options;
+  int quiet;
+  pthread_mutex_t lock;
+
+  //Totals, under the lock
+  uint64_t files;
+  uint64_t failed;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t pixels;
+} converter;
+
+void usage(const char * name) {
+  printf("Usage: %s [--format pam|ppm|raw] [--threads <n>] [--band-threads <n>] [--output-dir <dir> | --stdout]\n"
+         "       [--strip16] [--quiet] [<file or directory>...] [-]\n"
+         "  inputs: files, directories(their png files, recursively), - or nothing for file names on stdin\n"
+         "  --format: pam(default) keeps every raster type, ppm writes gray as PGM and drops alpha, raw writes the\n"
+         "            raster bytes as decoded(native endian 16 bit samples)\n"
+         "  --threads: files decoded at once, 0(default) for one per online CPU\n"
+         "  --band-threads: threads per file for images with a restart index, 1 by default with several workers\n"
+         "  --output-dir: writes <dir>/<name>.<format> instead of next to each input, files found in directories\n"
+         "                under their path relative to the directory given\n"
+         "  --stdout: streams the images to stdout, in input order\n"
+         "  --strip16: 16 bit images come out as 8 bit ones\n", name);
+}
+
+double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+int compare_names(const void * a, const void * b){
+  return strcmp(((const input_path *) a)->path, ((const input_path *) b)->path);
+}
+
+int compare_stems(const void * a, const void * b){
+  return strcmp((const char *) a, (const char *) b);
+}
+
+//Counts a failed input and prints why, unless quiet. Called under the lock, see report_error otherwise
+void report_error_locked(converter * c, const char * input, const char * message){
+  c->failed++;
+  if(!c->quiet)
+    fprintf(stderr, "%s: %s\n", input, message);
+}
+
+//0 if the stack can't grow, the path is then left to the caller
+int push_pending(converter * c, input_path path){
+  input_path * grown;
+  size_t capacity;
+
+  if(c->pending_n == c->pending_capacity){
+    capacity = c->pending_capacity ? c->pending_capacity * 2 : 256;
+    grown = (input_path *) realloc(c->pending, capacity * sizeof(input_path));
+    if(grown == NULL)
+      return 0;
+    c->pending = grown;
+    c->pending_capacity = capacity;
+  }
+  c->pending[c->pending_n++] = path;
+  return 1;
+}
+
+//Pushes the png files and subdirectories of a directory, so that they pop in name order; the entries are checked with
+//lstat, so that a symbolic link to a directory is neither descended into nor able to loop back. Entries that find no
+//memory fail alone. Called under the lock
+void expand_directory(converter * c, const char * directory, size_t relative){
+  input_path * entries = NULL, * grown;
+  size_t entries_n = 0, capacity = 0, length, i;
+  struct dirent * entry;
+  struct stat info;
+  DIR * dir = opendir(directory);
+  char * path;
+
+  if(dir == NULL){
+    fprintf(stderr, "%s: can't open directory\n", directory);
+    return;
+  }
+  while((entry = readdir(dir)) != NULL){
+    if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      continue;
+    length = strlen(entry->d_name);
+    path = (char *) malloc(strlen(directory) + length + 2);
+    if(path == NULL){
+      report_error_locked(c, directory, "out of memory");
+      continue;
+    }
+    sprintf(path, "%s/%s", directory, entry->d_name);
+    if((lstat(path, &info) != 0) || (!S_ISDIR(info.st_mode) && ((length < 4) || strcasecmp(entry->d_name + length - 4, ".png")))){
+      free(path);
+      continue;
+    }
+    if(entries_n == capacity){
+      grown = (input_path *) realloc(entries, (capacity ? capacity * 2 : 64) * sizeof(input_path));
+      if(grown == NULL){
+        report_error_locked(c, path, "out of memory");
+        free(path);
+        continue;
+      }
+      entries = grown;
+      capacity = capacity ? capacity * 2 : 64;
+    }
+    entries[entries_n++] = (input_path){ path, relative, S_ISDIR(info.st_mode) };
+  }
+  closedir(dir);
+
+  qsort(entries, entries_n, sizeof(input_path), compare_names);
+  for(i = entries_n; i > 0; i--)
+    if(!push_pending(c, entries[i - 1])){
+      report_error_locked(c, entries[i - 1].path, "out of memory");
+      free(entries[i - 1].path);
+    }
+  free(entries);
+}
+
+//<output dir>/<part of the input path kept under it> or <input>, without .png and the extension of the format
+static char * output_stem(converter * c, const input_path * input){
+  const char * name = c->output_dir ? input->path + input->relative : input->path;
+  size_t base = strlen(name), length;
+  char * path;
+
+  if((base >= 4) && !strcasecmp(name + base - 4, ".png"))
+    base -= 4;
+  length = (c->output_dir ? strlen(c->output_dir) + 1 : 0) + base + 1;
+  path = (char *) malloc(length);
+  if(path == NULL)
+    return NULL;
+  if(c->output_dir)
+    snprintf(path, length, "%s/%.*s", c->output_dir, (int) base, name);
+  else
+    snprintf(path, length, "%.*s", (int) base, name);
+  return path;
+}
+
+//Next file to convert, its sequence number and its output name without extension(NULL when an earlier input already
+//has it, the file is then not converted; not set with --stdout); NULL once the inputs are exhausted. Called under the lock
+char * next_input(converter * c, uint64_t * sequence, char ** stem){
+  input_path input;
+  struct stat info;
+  char * path, ** claimed;
+  const char * name;
+  size_t length;
+  ssize_t read;
+
+  while(1){
+    if(c->pending_n > 0){
+      input = c->pending[--c->pending_n];
+      if(input.directory){
+        expand_directory(c, input.path, input.relative);
+        free(input.path);
+        continue;
+      }
+    } else {
+      if(c->next_arg < c->args_n){
+        path = strdup(c->args[c->next_arg]);
+        if(path == NULL){
+          report_error_locked(c, c->args[c->next_arg++], "out of memory");
+          continue;
+        }
+        c->next_arg++;
+      } else if(c->read_stdin){
+        path = NULL;
+        length = 0;
+        read = getline(&path, &length, stdin);
+        if(read < 0){
+          free(path);
+          c->read_stdin = 0;
+          continue;
+        }
+        while((read > 0) && ((path[read - 1] == '\n') || (path[read - 1] == '\r')))
+          path[--read] = '\0';
+        if(read == 0){
+          free(path);
+          continue;
+        }
+      } else {
+        return NULL;
+      }
+
+      //Directories given as inputs are followed even through a symbolic link, the files in them keep their path below
+      if((stat(path, &info) == 0) && S_ISDIR(info.st_mode)){
+        expand_directory(c, path, strlen(path) + 1);
+        free(path);
+        continue;
+      }
+      name = strrchr(path, '/');
+      input = (input_path){ path, name ? (size_t) (name + 1 - path) : 0, 0 };
+    }
+
+    if(!c->to_stdout){
+      *stem = output_stem(c, &input);
+      claimed = (*stem != NULL) ? (char **) tsearch(*stem, &c->outputs, compare_stems) : NULL;
+      if(claimed == NULL){
+        report_error_locked(c, input.path, "out of memory");
+        free(*stem);
+        free(input.path);
+        continue;
+      }
+      if(*claimed != *stem){
+        free(*stem);
+        *stem = NULL;
+      }
+    }
+    *sequence = c->next_sequence++;
+    return input.path;
+  }
+}
+
+//Creates the missing directories of an output path below the output dir
+static void make_directories(converter * c, char * path){
+  char * slash = path + strlen(c->output_dir) + 1;
+
+  while((slash = strchr(slash, '/')) != NULL){
+    *slash = '\0';
+    if((mkdir(path, 0777) != 0) && (errno != EEXIST))
+      fprintf(stderr, "%s: can't create directory\n", path);
+    *slash++ = '/';
+  }
+}
+
+//Writes the header of the format, if any, for the given raster type(PGM for gray with ppm); returns its size in bytes
+size_t write_header(FILE * file, output_format format, PNGdecoder_raster_types type, uint32_t width, uint32_t height){
+  int wide = pixel_sizes[type] != channel_counts[type];
+  int color = channel_counts[type] >= 3;
+
+  switch(format){
+    case FORMAT_PAM:
+      return fprintf(file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL %u\nTUPLTYPE %s\nENDHDR\n", width, height,
+                     channel_counts[type], wide ? 65535 : 255, tuple_types[type]);
+    case FORMAT_PPM:
+      return fprintf(file, "%s\n%u %u\n%u\n", color ? "P6" : "P5", width, height, wide ? 65535 : 255);
+    case FORMAT_RAW:
+      break;
+  }
+  return 0;
+}
+
+//Writes the pixels of a raster, rows converted into the scratch row when the format needs it(big endian samples,
+//alpha dropped); returns the bytes written, 0 on a write error
+uint64_t write_image(FILE * file, output_format format, PNGdecoder_raster_types type, uint32_t width, uint32_t height,
+                     const uint8_t * raster, uint8_t * row){
+  uint8_t pixel_size = pixel_sizes[type], channels = channel_counts[type];
+  int wide = pixel_size != channels;
+  int alpha = (channels == 2) || (channels == 4);
+  uint8_t out_channels = ((format == FORMAT_PPM) && alpha) ? channels - 1 : channels;
+  uint8_t sample_size = wide ? 2 : 1;
+  uint64_t stride = (uint64_t) width * pixel_size, out_stride = (uint64_t) width * out_channels * sample_size, total;
+  uint32_t x, y, k;
+  uint16_t sample;
+
+  total = write_header(file, format, type, width, height);
+
+  //Bytes as decoded: the whole raster at once
+  if((format == FORMAT_RAW) || (!wide && (out_channels == channels))){
+    if(fwrite(raster, 1, stride * height, file) != stride * height)
+      return 0;
+    return total + (stride * height);
+  }
+
+  for(y = 0; y < height; y++){
+    const uint8_t * in = raster + (y * stride);
+    uint8_t * out = row;
+    for(x = 0; x < width; x++){
+      for(k = 0; k < out_channels; k++){
+        if(wide){
+          memcpy(&sample, in + (k * 2), 2);
+          *out++ = sample >> 8;
+          *out++ = sample & 0xff;
+        } else {
+          *out++ = in[k];
+        }
+      }
+      in += pixel_size;
+    }
+    if(fwrite(row, 1, out_stride, file) != out_stride)
+      return 0;
+  }
+  return total + (out_stride * height);
+}
+
+//<output stem>.<extension of the format for the raster type>
+static char * output_name(converter * c, const char * stem, PNGdecoder_raster_types type){
+  const char * extension = format_names[c->format];
+  size_t length;
+  char * path;
+
+  if((c->format == FORMAT_PPM) && (channel_counts[type] < 3))
+    extension = "pgm";
+  length = strlen(stem) + strlen(extension) + 2;
+  path = (char *) malloc(length);
+  if(path == NULL)
+    return NULL;
+  snprintf(path, length, "%s.%s", stem, extension);
+  return path;
+}
+
+void report_error(converter * c, const char * input, const char * message){
+  pthread_mutex_lock(&c->lock);
+  report_error_locked(c, input, message);
+  pthread_mutex_unlock(&c->lock);
+}
+
+void * worker(void * user){
+  converter * c = (converter *) user;
+  uint8_t * row = NULL, * grown;
+  size_t row_capacity = 0;
+  uint64_t sequence, written, size;
+  struct stat info;
+  char * input, * output, * stem = NULL;
+  PNGdecoder_PNG * png;
+  PNGdecoder_result result;
+  FILE * file;
+
+  while(1){
+    pthread_mutex_lock(&c->lock);
+    input = next_input(c, &sequence, &stem);
+    pthread_mutex_unlock(&c->lock);
+    if(input == NULL)
+      break;
+    if(!c->to_stdout && (stem == NULL)){
+      report_error(c, input, "same output file as an earlier input, skipped");
+      free(input);
+      continue;
+    }
+
+    png = NULL;
+    size = (stat(input, &info) == 0) ? info.st_size : 0;
+    result = PNGdecoder_openPNG_ex(input, &c->options, &png);
+
+    const PNGdecoder_raster_grayscale8_t * raster = (result == PNGDECODER_OK) ? PNGdecoder_get_raster(png) : NULL;
+    PNGdecoder_raster_types type = (result == PNGDECODER_OK) ? PNGdecoder_get_raster_type(png) : PNGDECODER_RASTER_INVALID;
+    if(raster != NULL){
+      size_t needed = (size_t) raster->width * pixel_sizes[type];
+      if(needed > row_capacity){
+        grown = (uint8_t *) realloc(row, needed);
+        if(grown != NULL){
+          row = grown;
+          row_capacity = needed;
+        } else {
+          PNGdecoder_free(png);     //Fails as the decode would have, still taking its turn on stdout
+          png = NULL;
+          raster = NULL;
+          result = PNGDECODER_MEMORY_ERROR;
+        }
+      }
+    }
+
+    //Images, or the lack of them, take their turn on stdout
+    written = 0;
+    if(c->to_stdout){
+      pthread_mutex_lock(&c->lock);
+      while(c->next_write != sequence)
+        pthread_cond_wait(&c->written, &c->lock);
+      if(raster != NULL)
+        written = write_image(stdout, c->format, type, raster->width, raster->height, raster->raster, row);
+      c->next_write++;
+      pthread_cond_broadcast(&c->written);
+      pthread_mutex_unlock(&c->lock);
+      if((raster != NULL) && (written == 0))
+        report_error(c, "stdout", "write error");
+    } else if((raster != NULL) && ((output = output_name(c, stem, type)) == NULL)){
+      report_error(c, input, "out of memory");
+    } else if(raster != NULL){
+      if(c->output_dir)
+        make_directories(c, output);
+      file = fopen(output, "wb");
+      if(file == NULL){
+        report_error(c, output, "can't create file");
+      } else {
+        written = write_image(file, c->format, type, raster->width, raster->height, raster->raster, row);
+        if((fclose(file) != 0) || (written == 0)){
+          written = 0;
+          remove(output);
+          report_error(c, output, "write error");
+        }
+      }
+      free(output);
+    }
+
+    if(result != PNGDECODER_OK){
+      report_error(c, input, PNGdecoder_strerror(result));
+    } else {
+      pthread_mutex_lock(&c->lock);
+      if(written != 0){
+        c->files++;
+        c->bytes_in += size;
+        c->bytes_out += written;
+        c->pixels += (uint64_t) raster->width * raster->height;
+      }
+      pthread_mutex_unlock(&c->lock);
+      PNGdecoder_free(png);
+    }
+    free(input);
+  }
+
+  free(row);
+  return NULL;
+}
+
+int main(int argc, char * argv[]){
+  converter c;
+  memset(&c, 0, sizeof(converter));
+  PNGdecoder_options_init(&c.options);
+  c.format = FORMAT_PAM;
+  long threads_n = 0, band_threads = -1, f, i;
+
+  c.args = (char **) malloc(argc * sizeof(char *));
+  if(c.args == NULL){
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "--format") && (i + 1 < argc)){
+      for(f = 0; (f < 3) && strcmp(argv[i + 1], format_names[f]); f++);
+      if(f == 3){
+        usage(argv[0]);
+        return -1;
+      }
+      c.format = (output_format) f;
+      i++;
+    } else if(!strcmp(argv[i], "--threads") && (i + 1 < argc)){
+      threads_n = strtol(argv[++i], NULL, 10);
+    } else if(!strcmp(argv[i], "--band-threads") && (i + 1 < argc)){
+      band_threads = strtol(argv[++i], NULL, 10);
+    } else if(!strcmp(argv[i], "--output-dir") && (i + 1 < argc)){
+      c.output_dir = argv[++i];
+    } else if(!strcmp(argv[i], "--stdout")){
+      c.to_stdout = 1;
+    } else if(!strcmp(argv[i], "--strip16")){
+      c.options.strip16 = PNGDECODER_STRIP16_ROUND;
+    } else if(!strcmp(argv[i], "--quiet")){
+      c.quiet = 1;
+    } else if(!strcmp(argv[i], "-")){
+      c.read_stdin = 1;
+    } else if(argv[i][0] == '-'){
+      usage(argv[0]);
+      return -1;
+    } else {
+      c.args[c.args_n++] = argv[i];
+    }
+  }
+  if(c.args_n == 0)
+    c.read_stdin = 1;
+  if(c.to_stdout && (c.output_dir != NULL)){
+    usage(argv[0]);
+    return -1;
+  }
+  if((c.output_dir != NULL) && (mkdir(c.output_dir, 0777) != 0) && (errno != EEXIST)){
+    fprintf(stderr, "%s: can't create directory\n", c.output_dir);
+    return -1;
+  }
+
+  if(threads_n <= 0){
+    threads_n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads_n <= 0)
+      threads_n = 1;
+  }
+  //Files already keep every CPU busy, bands would only compete with them
+  c.options.band_threads = (band_threads >= 0) ? band_threads : ((threads_n > 1) ? 1 : 0);
+
+  pthread_mutex_init(&c.lock, NULL);
+  pthread_cond_init(&c.written, NULL);
+  if(c.to_stdout)
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+  double start = now_seconds();
+  pthread_t * threads = (pthread_t *) malloc(threads_n * sizeof(pthread_t));
+  long started = 0;
+  for(i = 0; (threads != NULL) && (i < threads_n); i++){
+    if(pthread_create(&threads[started], NULL, worker, &c) == 0)
+      started++;
+  }
+  if(started == 0)
+    worker(&c);     //No thread handles or no thread started: the batch still runs, on this one
+  for(i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  if(c.to_stdout)
+    fflush(stdout);
+  double seconds = now_seconds() - start;
+
+  fprintf(stderr, "%llu files converted, %llu failed, %.2f s, %ld threads: %.1f files/s, %.1f MP/s, %.1f MB/s in, %.1f MB/s out\n",
+          (unsigned long long) c.files, (unsigned long long) c.failed, seconds, started ? started : 1, c.files / seconds,
+          c.pixels / (seconds * 1e6), c.bytes_in / (seconds * 1e6), c.bytes_out / (seconds * 1e6));
+
+  free(threads);
+  free(c.pending);
+  tdestroy(c.outputs, free);
+  free(c.args);
+  pthread_cond_destroy(&c.written);
+  pthread_mutex_destroy(&c.lock);
+  return c.failed ? 1 : 0;
+}
@@ -0,0 +1,26 @@
+#ifndef PNGdecoder_DECODER_H
+#define PNGdecoder_DECODER_H
+
+#include <stdint.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      DECODER INTERNALS       */
+
+//Whole file decoding shared by the batch loader, the sprite atlas and the cache; hidden, so the shared library does not
+//export them
+
+
+//Reads a whole file into a new buffer
+//Argument 1: file name, Argument 2: result bytes, Argument 3: result size
+__attribute__((visibility("hidden"))) PNGdecoder_result PNGdecoder_read_file(const char *, uint8_t **, uint64_t *);
+
+//Parses and decodes a whole PNG file held in memory, taking ownership of the bytes
+//Argument 1: file bytes(malloc'd), Argument 2: size, Argument 3: options, Argument 4: result
+__attribute__((visibility("hidden"))) PNGdecoder_result PNGdecoder_open_bytes(uint8_t *, uint64_t, const PNGdecoder_options *,
+                                                                             PNGdecoder_PNG **);
+
+//Bytes of the raster the png holds, the padding of tiled rasters included; 0 without a raster
+__attribute__((visibility("hidden"))) uint64_t PNGdecoder_raster_bytes(PNGdecoder_PNG *);
+
+#endif // PNGdecoder_DECODER_H
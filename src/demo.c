@@ -3,6 +3,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_surface.h>
@@ -10,10 +14,37 @@
 #include <SDL2/SDL_pixels.h>
 #include <SDL2/SDL_rect.h>
 #include <SDL2/SDL_video.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_events.h>
 
 const int SCREEN_WIDTH = 1024;
 const int SCREEN_HEIGHT = 800;
 
+//Decoded images kept around the current one: itself, the next and the previous
+#define CACHE_SLOTS 3
+
+typedef struct {
+  int32_t index;                //Image in the list, -1 for a free slot
+  SDL_Surface * surface;        //NULL if the decode failed
+  PNGdecoder_result result;
+  double ms;                    //Decode time, from the file name to the pixels in the surface
+  uint64_t file_size;
+} cache_slot;
+
+typedef struct {
+  char ** files;
+  int32_t files_n;
+  int32_t current;              //Image shown, the worker decodes around it
+  cache_slot slots[CACHE_SLOTS];
+  uint8_t quit;
+  SDL_mutex * lock;
+  SDL_cond * wake;              //Signaled when current changes or on quit
+  uint32_t done_event;          //Pushed by the worker after each decode
+  double total_ms;              //Over every decode, for the average throughput
+  uint64_t total_pixels;
+} viewer;
+
 void terminate(int32_t code) {
   SDL_Quit();
   exit(code);
@@ -66,14 +97,268 @@ void fit_to_screen(SDL_Rect * rect, SDL_Surface * screen_surface, SDL_Surface *
   }
 }
 
+int compare_names(const void * a, const void * b){
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+//Lists the png files of the directory of path(or of path itself, if a directory) in name order; current is set to
+//path when it is a file
+char ** list_files(const char * path, int32_t * files_n, int32_t * current){
+  struct stat info;
+  char * directory;
+  char ** files = NULL;
+  int32_t n = 0, capacity = 0, i;
+  struct dirent * entry;
+  DIR * dir;
+  size_t length;
+
+  *current = 0;
+  if(stat(path, &info) != 0)
+    return NULL;
+
+  directory = strdup(path);
+  if(!S_ISDIR(info.st_mode)){
+    char * slash = strrchr(directory, '/');
+    if(slash != NULL)
+      *slash = '\0';
+    else
+      strcpy(directory, ".");
+  }
+
+  dir = opendir(directory);
+  if(dir == NULL){
+    //Unreadable directory, the file alone
+    free(directory);
+    files = (char **) malloc(sizeof(char *));
+    files[0] = strdup(path);
+    *files_n = 1;
+    return files;
+  }
+  while((entry = readdir(dir)) != NULL){
+    length = strlen(entry->d_name);
+    if((length < 4) || (strcasecmp(entry->d_name + length - 4, ".png") != 0))
+      continue;
+    if(n == capacity){
+      capacity = capacity ? capacity * 2 : 64;
+      files = (char **) realloc(files, capacity * sizeof(char *));
+    }
+    files[n] = (char *) malloc(strlen(directory) + length + 2);
+    sprintf(files[n], "%s/%s", directory, entry->d_name);
+    n++;
+  }
+  closedir(dir);
+  qsort(files, n, sizeof(char *), compare_names);
+
+  if(!S_ISDIR(info.st_mode)){
+    const char * name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    for(i = 0; i < n; i++){
+      if(strcmp(strrchr(files[i], '/') + 1, name) == 0)
+        *current = i;
+    }
+  }
+
+  free(directory);
+  *files_n = n;
+  return files;
+}
+
+//Reads the size from the IHDR, which always comes first
+PNGdecoder_result read_size(const char * file_name, uint32_t * width, uint32_t * height, uint64_t * file_size){
+  uint8_t header[24];
+  FILE * file = fopen(file_name, "rb");
+
+  if(file == NULL)
+    return PNGDECODER_FILE_OPEN_ERROR;
+  if(fread(header, 1, sizeof(header), file) != sizeof(header)){
+    fclose(file);
+    return PNGDECODER_BAD_PNG;
+  }
+  fseek(file, 0, SEEK_END);
+  *file_size = ftell(file);
+  fclose(file);
+
+  *width = ((uint32_t) header[16] << 24) | ((uint32_t) header[17] << 16) | ((uint32_t) header[18] << 8) | header[19];
+  *height = ((uint32_t) header[20] << 24) | ((uint32_t) header[21] << 16) | ((uint32_t) header[22] << 8) | header[23];
+  return ((*width != 0) && (*height != 0)) ? PNGDECODER_OK : PNGDECODER_INVALID_IHDR;
+}
+
+//Decodes straight into the memory of a new RGBA32 surface(R, G, B, A in byte order whatever the endianness), the rows
+//written at the surface pitch through a U8 interleaved tensor; band threads decode images with a restart index
+void decode(const char * file_name, cache_slot * slot){
+  PNGdecoder_options options;
+  PNGdecoder_tensor tensor;
+  PNGdecoder_PNG * png = NULL;
+  uint32_t width, height;
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  slot->surface = NULL;
+  slot->file_size = 0;
+  slot->result = read_size(file_name, &width, &height, &slot->file_size);
+  if(slot->result != PNGDECODER_OK)
+    return;
+
+  slot->surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+  if(slot->surface == NULL){
+    slot->result = PNGDECODER_IMAGE_TOO_LARGE;
+    return;
+  }
+
+  PNGdecoder_tensor_init(&tensor);
+  tensor.data = slot->surface->pixels;
+  tensor.type = PNGDECODER_TENSOR_U8;
+  tensor.planar = 0;
+  tensor.channels = 4;
+  tensor.width = width;
+  tensor.height = height;
+  tensor.row_stride = slot->surface->pitch;
+  PNGdecoder_options_init(&options);
+  options.tensor = &tensor;
+
+  slot->result = PNGdecoder_openPNG_ex(file_name, &options, &png);
+  slot->ms = (double) (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+  if(slot->result != PNGDECODER_OK){
+    SDL_FreeSurface(slot->surface);
+    slot->surface = NULL;
+    return;
+  }
+  PNGdecoder_free(png);
+}
+
+cache_slot * find_slot(viewer * v, int32_t index){
+  int32_t k;
+
+  for(k = 0; k < CACHE_SLOTS; k++){
+    if(v->slots[k].index == index)
+      return &v->slots[k];
+  }
+  return NULL;
+}
+
+int near_current(viewer * v, int32_t index){
+  return (index >= v->current - 1) && (index <= v->current + 1);
+}
+
+//Decodes the current image first, then the next and the previous ones, then waits for current to move
+int worker(void * user){
+  viewer * v = (viewer *) user;
+  const int32_t order[CACHE_SLOTS] = { 0, 1, -1 };
+  cache_slot decoded, * slot;
+  int32_t index, k;
+  SDL_Event event;
+
+  SDL_LockMutex(v->lock);
+  while(!v->quit){
+    index = -1;
+    for(k = 0; k < CACHE_SLOTS; k++){
+      int32_t candidate = v->current + order[k];
+      if((candidate >= 0) && (candidate < v->files_n) && (find_slot(v, candidate) == NULL)){
+        index = candidate;
+        break;
+      }
+    }
+    if(index < 0){
+      SDL_CondWait(v->wake, v->lock);
+      continue;
+    }
+
+    SDL_UnlockMutex(v->lock);
+    decoded.index = index;
+    decode(v->files[index], &decoded);
+    SDL_LockMutex(v->lock);
+
+    if(decoded.result == PNGDECODER_OK){
+      v->total_ms += decoded.ms;
+      v->total_pixels += (uint64_t) decoded.surface->w * decoded.surface->h;
+    }
+
+    //The slot of an image no longer around current, the user may have moved on meanwhile
+    slot = NULL;
+    for(k = 0; k < CACHE_SLOTS; k++){
+      if((v->slots[k].index < 0) || !near_current(v, v->slots[k].index)){
+        slot = &v->slots[k];
+        break;
+      }
+    }
+    if((slot == NULL) || !near_current(v, index)){
+      SDL_FreeSurface(decoded.surface);
+      continue;
+    }
+    SDL_FreeSurface(slot->surface);
+    *slot = decoded;
+
+    SDL_zero(event);
+    event.type = v->done_event;
+    SDL_PushEvent(&event);
+  }
+  SDL_UnlockMutex(v->lock);
+
+  return 0;
+}
+
+//Title with the decode latency and throughput of the current image, and the average throughput so far
+void update_title(SDL_Window * window, viewer * v, cache_slot * slot){
+  char title[512];
+  const char * name = strrchr(v->files[v->current], '/') ? strrchr(v->files[v->current], '/') + 1 : v->files[v->current];
+
+  if(slot == NULL){
+    snprintf(title, sizeof(title), "PNGdecoder demo - %s (%d/%d) - decoding...", name, v->current + 1, v->files_n);
+  } else if(slot->result != PNGDECODER_OK){
+    snprintf(title, sizeof(title), "PNGdecoder demo - %s (%d/%d) - %s", name, v->current + 1, v->files_n, PNGdecoder_strerror(slot->result));
+  } else {
+    double pixels = (double) slot->surface->w * slot->surface->h;
+    snprintf(title, sizeof(title), "PNGdecoder demo - %s (%d/%d) %dx%d - %.2f ms, %.1f MP/s, %.1f MB/s - average %.1f MP/s",
+             name, v->current + 1, v->files_n, slot->surface->w, slot->surface->h, slot->ms, pixels / (slot->ms * 1000.0),
+             slot->file_size / (slot->ms * 1000.0), v->total_pixels / (v->total_ms * 1000.0));
+  }
+  SDL_SetWindowTitle(window, title);
+}
+
+void draw(SDL_Window * window, viewer * v, SDL_Surface * basic_tr_back_surface){
+  SDL_Surface * screen_surface = SDL_GetWindowSurface(window);
+  SDL_Rect blit_rect;
+  cache_slot * slot;
+
+  update_background(screen_surface, basic_tr_back_surface);
+
+  SDL_LockMutex(v->lock);
+  slot = find_slot(v, v->current);
+  if((slot != NULL) && (slot->surface != NULL)){
+    fit_to_screen(&blit_rect, screen_surface, slot->surface);
+    SDL_BlitScaled(slot->surface, NULL, screen_surface, &blit_rect);
+  }
+  update_title(window, v, slot);
+  SDL_UnlockMutex(v->lock);
+
+  SDL_UpdateWindowSurface(window);
+}
+
+void move_to(viewer * v, int32_t index){
+  if((index < 0) || (index >= v->files_n))
+    return;
+
+  SDL_LockMutex(v->lock);
+  v->current = index;
+  SDL_CondSignal(v->wake);
+  SDL_UnlockMutex(v->lock);
+}
+
 int main(int argc, char * argv[]){
   if(argc < 2){
-    printf("Usage: %s <filename>\n", argv[0]);
+    printf("Usage: %s <file or directory>\n", argv[0]);
+    printf("Left/Right, Page Up/Down, Home/End to browse the png files of the directory, Escape to quit\n");
     return -1;
   }
 
-  const char * filename = argv[1];
-  
+  viewer v;
+  memset(&v, 0, sizeof(viewer));
+  v.files = list_files(argv[1], &v.files_n, &v.current);
+  if(v.files_n == 0){
+    printf("No png files in %s\n", argv[1]);
+    return -3;
+  }
+  for(int32_t k = 0; k < CACHE_SLOTS; k++)
+    v.slots[k].index = -1;
+
   if(SDL_Init(SDL_INIT_VIDEO) < 0) {
     printf("Error initializing SDL: %s\n", SDL_GetError());
     return -2;
@@ -86,63 +371,68 @@ int main(int argc, char * argv[]){
     printf("Can't create window: %s\n", SDL_GetError()); terminate(-2);
   }
 
-  PNGdecoder_PNG * png = NULL;
-  PNGdecoder_result result = PNGdecoder_openPNG(filename, &png);
-
-  if(result != PNGDECODER_OK){
-    printf("Can't open %s: %s\n", filename, PNGdecoder_strerror(result));
-    terminate(-3);
-  }
-
-  PNGdecoder_raster_RGBA8_t * raster = PNGdecoder_as_RGBA8(png);
-
-  SDL_Surface * png_surface = SDL_CreateRGBSurface(SDL_SWSURFACE, raster->width, raster->height, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
-  
-  uint32_t * current_pixel = (uint32_t *) png_surface->pixels;
-  uint32_t i, j;
-  for(i = 0; i < raster->height; i++){
-    for(j = 0; j < raster->width; j++){
-      *current_pixel = SDL_MapRGBA(png_surface->format, raster->raster[i*raster->width + j].R,
-          raster->raster[i*raster->width + j].G, raster->raster[i*raster->width + j].B, raster->raster[i*raster->width + j].A);
-      current_pixel++;
-    }
-  }
-
-  PNGdecoder_raster_free(raster, PNGDECODER_RASTER_RGBA_8);
-  PNGdecoder_free(png);
+  v.lock = SDL_CreateMutex();
+  v.wake = SDL_CreateCond();
+  v.done_event = SDL_RegisterEvents(1);
+  SDL_Thread * thread = SDL_CreateThread(worker, "prefetch", &v);
 
-  SDL_Surface * screen_surface = SDL_GetWindowSurface(window);
   SDL_Surface * basic_tr_back_surface = create_transparency_surface(5);
- 
+
   SDL_Event e;
   uint8_t quit = 0;
-  SDL_Rect blit_rect;
-  fit_to_screen(&blit_rect, screen_surface, png_surface);
 
+  draw(window, &v, basic_tr_back_surface);
   while(!quit){
-    while(SDL_PollEvent(&e)){
-
-      if(e.type == SDL_QUIT)
-        quit = 1;
-
-      if(e.type == SDL_WINDOWEVENT){
-        if(e.window.event == SDL_WINDOWEVENT_EXPOSED){
-          screen_surface = SDL_GetWindowSurface(window);
-          update_background(screen_surface, basic_tr_back_surface);
-          fit_to_screen(&blit_rect, screen_surface, png_surface);
-          
-          //SDL_BlitSurface(png_surface, NULL, screen_surface, NULL);
-          SDL_BlitScaled(png_surface, NULL, screen_surface, &blit_rect);
-          SDL_UpdateWindowSurface(window);
-        }
-      }
+    //Decodes never block the window, the worker posts an event for each one done
+    if(!SDL_WaitEvent(&e))
+      continue;
 
+    if(e.type == SDL_QUIT)
+      quit = 1;
+
+    if(e.type == v.done_event)
+      draw(window, &v, basic_tr_back_surface);
+
+    if(e.type == SDL_WINDOWEVENT){
+      if((e.window.event == SDL_WINDOWEVENT_EXPOSED) || (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+        draw(window, &v, basic_tr_back_surface);
     }
 
-    SDL_Delay(1000/30);
+    if(e.type == SDL_KEYDOWN){
+      switch(e.key.keysym.sym){
+        case SDLK_RIGHT: case SDLK_SPACE: case SDLK_PAGEDOWN:
+          move_to(&v, v.current + 1);
+          break;
+        case SDLK_LEFT: case SDLK_BACKSPACE: case SDLK_PAGEUP:
+          move_to(&v, v.current - 1);
+          break;
+        case SDLK_HOME:
+          move_to(&v, 0);
+          break;
+        case SDLK_END:
+          move_to(&v, v.files_n - 1);
+          break;
+        case SDLK_ESCAPE: case SDLK_q:
+          quit = 1;
+          break;
+      }
+      draw(window, &v, basic_tr_back_surface);
+    }
   }
 
-  SDL_FreeSurface(png_surface);
+  SDL_LockMutex(v.lock);
+  v.quit = 1;
+  SDL_CondSignal(v.wake);
+  SDL_UnlockMutex(v.lock);
+  SDL_WaitThread(thread, NULL);
+
+  for(int32_t k = 0; k < CACHE_SLOTS; k++)
+    SDL_FreeSurface(v.slots[k].surface);
+  for(int32_t k = 0; k < v.files_n; k++)
+    free(v.files[k]);
+  free(v.files);
+  SDL_DestroyCond(v.wake);
+  SDL_DestroyMutex(v.lock);
   SDL_FreeSurface(basic_tr_back_surface);
   SDL_DestroyWindow(window);
   terminate(0);
@@ -0,0 +1,536 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+#include <zlib.h>
+#endif // PNGDECODER_WITHOUT_ZLIB
+
+#define PNGdecoder_IMPORT
+#include <PNGdecoder/PNGdecoder.h>
+
+#include "kernels.h"
+#include "memory.h"
+
+//Encoder shaped for the decoder: 8 and 16 bit rasters written as they are, per row filter strategies, and the image
+//data optionally split in bands compressed independently(each one ends with a full flush, so that the next starts on
+//a block boundary with an empty history) recorded in a prIX restart index, see check_chunk_index in PNGdecoder.c
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+typedef struct _byte_buffer {
+    uint8_t * data;
+    uint64_t size;
+    uint64_t capacity;
+} byte_buffer;              //Growing output
+
+typedef struct _encoder {
+    PNGdecoder_encode_options options;
+    uint32_t width;
+    uint32_t height;
+    uint8_t color_type;
+    uint8_t pixel_size;             //Bytes per pixel, also the distance of the Sub, Average and Paeth filters
+    bool wide;                      //16 bit samples, native in the raster and big endian in the file
+    uint32_t row_size;              //Without the filter byte
+    uint8_t * previous_row;         //Big endian, zeros before the first row
+    uint8_t * current_row;
+    uint8_t * filtered[5];          //Filter byte and filtered row, for each filter type
+    uint32_t band_rows;
+    uint32_t bands_n;
+    uint64_t * band_starts;         //Offset in the image data of the first byte of each band
+    byte_buffer data;               //zlib stream of the image data
+    uint32_t adler;                 //Stored mode, running checksum of the rows
+    uint8_t * stored;               //Stored mode, pending block
+    uint32_t stored_n;
+#ifndef PNGDECODER_WITHOUT_ZLIB
+    z_stream z;
+#endif // PNGDECODER_WITHOUT_ZLIB
+} encoder;
+
+static const uint8_t PNG_magic[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+static const uint8_t raster_color_types[8] = { 0, 0, 2, 2, 4, 4, 6, 6 };       //Color type written for each raster type
+static const uint8_t raster_pixel_sizes[8] = { 1, 2, 3, 6, 2, 4, 4, 8 };
+static const uint32_t bands_max = 1024;             //Largest restart index the decoder uses
+static const uint32_t stored_block_max = 65535;     //Largest stored deflate block
+static const uint32_t IDAT_size_default = 1 << 20;
+static const uint32_t deflate_chunk = 1 << 16;      //Output room added for each deflate call
+
+
+//Appends bytes, false if out of memory
+static bool buffer_append(byte_buffer *, const void *, uint64_t);
+//Makes room for at least the given number of bytes past the end
+static bool buffer_reserve(byte_buffer *, uint64_t);
+
+static void store_uint32(uint8_t *, uint32_t);
+static uint32_t adler32_update(uint32_t, const uint8_t *, uint32_t);
+
+//Writes the current row filtered with the given filter type into the matching filtered row
+static void filter_row(encoder *, uint8_t);
+//Picks and computes the filter of the current row, the first row of every band but the first one never depends on the
+//row above; returns the filtered row(filter byte first)
+static const uint8_t * choose_filter(encoder *, bool);
+//Sum of the filtered bytes taken as signed, the usual estimate of how well a row compresses
+static uint64_t filter_cost(const uint8_t *, uint32_t);
+
+//Image data output: compresses the given bytes; ends a band(full flush) or the whole stream
+static bool stream_begin(encoder *);
+static bool stream_write(encoder *, const uint8_t *, uint32_t);
+static bool stream_end_band(encoder *, bool);
+static void stream_free(encoder *);
+//Stored mode: emits the pending block
+static bool stored_emit(encoder *, bool);
+
+//Writes a whole chunk, CRC computed
+static bool write_chunk(FILE *, const char *, const uint8_t *, uint32_t);
+//Writes the PNG file from the compressed image data
+static PNGdecoder_result write_file(encoder *, const char *);
+
+
+/*      INTERFACE       */
+
+
+void PNGdecoder_encode_options_init(PNGdecoder_encode_options * options){
+    if(options == NULL)
+        return;
+
+    options->filter = PNGDECODER_FILTER_ADAPTIVE;
+    options->level = 6;
+    options->band_rows = 0;
+    options->IDAT_size = 0;
+}
+
+PNGdecoder_result PNGdecoder_encode(const char * file_name, const void * raster_struct, PNGdecoder_raster_types type,
+                                    const PNGdecoder_encode_options * options){
+    const PNGdecoder_raster_grayscale8_t * raster = (const PNGdecoder_raster_grayscale8_t *) raster_struct;   //Same layout for every type
+    const kernel_table * kernels = kernels_get();
+    PNGdecoder_result result = PNGDECODER_OK;
+    const uint8_t * pixels, * filtered;
+    uint64_t row_bytes;
+    uint8_t * swap;
+    uint32_t y;
+    uint8_t i;
+    bool allocated;
+    encoder enc;
+
+    if((file_name == NULL) || (raster == NULL) || (raster->raster == NULL) ||
+       (type < PNGDECODER_RASTER_GRAYSCALE_8) || (type > PNGDECODER_RASTER_RGBA_16))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    memset(&enc, 0, sizeof(encoder));
+    if(options != NULL)
+        enc.options = *options;
+    else
+        PNGdecoder_encode_options_init(&enc.options);
+    if(enc.options.IDAT_size == 0)
+        enc.options.IDAT_size = IDAT_size_default;
+    if((enc.options.level > 9) || (enc.options.filter > PNGDECODER_FILTER_FAST) || (enc.options.IDAT_size > 0x7fffffff))
+        return PNGDECODER_INVALID_ARGUMENT;
+#ifdef PNGDECODER_WITHOUT_ZLIB
+    if(enc.options.level != 0)
+        return PNGDECODER_INVALID_ARGUMENT;     //Only stored blocks without zlib
+#endif // PNGDECODER_WITHOUT_ZLIB
+
+    enc.width = raster->width;
+    enc.height = raster->height;
+    if((enc.width == 0) || (enc.height == 0) || (enc.width > 0x7fffffff) || (enc.height > 0x7fffffff))
+        return PNGDECODER_INVALID_ARGUMENT;
+    enc.color_type = raster_color_types[type];
+    enc.pixel_size = raster_pixel_sizes[type];
+    enc.wide = (type == PNGDECODER_RASTER_GRAYSCALE_16) || (type == PNGDECODER_RASTER_RGB_16) ||
+               (type == PNGDECODER_RASTER_GRAYSCALE_16A) || (type == PNGDECODER_RASTER_RGBA_16);
+    row_bytes = (uint64_t) enc.width * enc.pixel_size;
+    if(row_bytes >= 0x7fffffff)
+        return PNGDECODER_IMAGE_TOO_LARGE;      //Filtered rows, filter byte included, as the decoder bounds them
+    enc.row_size = row_bytes;
+
+    enc.band_rows = ((enc.options.band_rows == 0) || (enc.options.band_rows > enc.height)) ? enc.height : enc.options.band_rows;
+    if((enc.height + enc.band_rows - 1) / enc.band_rows > bands_max)
+        enc.band_rows = (enc.height + bands_max - 1) / bands_max;
+    enc.bands_n = (enc.height + enc.band_rows - 1) / enc.band_rows;
+
+    enc.previous_row = (uint8_t *) mem_calloc(enc.row_size, 1);
+    enc.current_row = (uint8_t *) mem_malloc(enc.row_size);
+    enc.band_starts = (uint64_t *) mem_malloc(enc.bands_n * sizeof(uint64_t));
+    allocated = (enc.previous_row != NULL) && (enc.current_row != NULL) && (enc.band_starts != NULL);
+    for(i = 0; i < 5; i++){
+        enc.filtered[i] = (uint8_t *) mem_malloc((uint64_t) enc.row_size + 1);
+        allocated = allocated && (enc.filtered[i] != NULL);
+    }
+    if(!allocated){
+        result = PNGDECODER_MEMORY_ERROR;
+        goto done;
+    }
+    if(!stream_begin(&enc)){
+        result = PNGDECODER_ZLIB_ERROR;
+        goto done;
+    }
+
+    for(y = 0; (y < enc.height) && (result == PNGDECODER_OK); y++){
+        if((y % enc.band_rows) == 0)
+            enc.band_starts[y / enc.band_rows] = (y == 0) ? 0 : enc.data.size;  //Past the flush ending the previous band
+
+        pixels = raster->raster + ((uint64_t) y * enc.row_size);
+        if(enc.wide)
+            kernels->swap16((uint16_t *) enc.current_row, pixels, enc.row_size / 2);     //Its own inverse, back to big endian
+        else
+            memcpy(enc.current_row, pixels, enc.row_size);
+
+        filtered = choose_filter(&enc, (y >= enc.band_rows) && ((y % enc.band_rows) == 0));
+        if(!stream_write(&enc, filtered, enc.row_size + 1))
+            result = PNGDECODER_ZLIB_ERROR;
+        else if((((y + 1) % enc.band_rows) == 0) || (y + 1 == enc.height))
+            if(!stream_end_band(&enc, y + 1 == enc.height))
+                result = PNGDECODER_ZLIB_ERROR;
+
+        swap = enc.previous_row;
+        enc.previous_row = enc.current_row;
+        enc.current_row = swap;
+    }
+
+    if(result == PNGDECODER_OK)
+        result = write_file(&enc, file_name);
+
+done:
+    stream_free(&enc);
+    mem_free(enc.previous_row);
+    mem_free(enc.current_row);
+    for(i = 0; i < 5; i++)
+        mem_free(enc.filtered[i]);
+    mem_free(enc.band_starts);
+    mem_free(enc.data.data);
+
+    return result;
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static bool buffer_reserve(byte_buffer * buffer, uint64_t size){
+    uint64_t capacity = (buffer->capacity != 0) ? buffer->capacity : deflate_chunk;
+    uint8_t * data;
+
+    if(buffer->size + size <= buffer->capacity)
+        return true;
+    while(capacity < buffer->size + size)
+        capacity *= 2;
+    data = (uint8_t *) mem_realloc(buffer->data, capacity);
+    if(data == NULL)
+        return false;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool buffer_append(byte_buffer * buffer, const void * bytes, uint64_t size){
+    if(!buffer_reserve(buffer, size))
+        return false;
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+    return true;
+}
+
+static void store_uint32(uint8_t * bytes, uint32_t value){
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t * buf, uint32_t len){
+    uint32_t a = adler & 0xFFFF, b = adler >> 16, n;
+
+    while(len > 0){
+        n = (len < 5552) ? len : 5552;      //Largest run before the sums can overflow 32 bits
+        len -= n;
+        while(n--){
+            a += *buf++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+static void filter_row(encoder * enc, uint8_t type){
+    const uint8_t * row = enc->current_row;
+    const uint8_t * up = enc->previous_row;
+    uint8_t * out = enc->filtered[type] + 1;
+    uint32_t n = enc->row_size, bpp = enc->pixel_size, i;
+    int16_t a, b, c, p, pa, pb, pc;
+
+    enc->filtered[type][0] = type;
+    switch(type){
+        case 0:
+            memcpy(out, row, n);
+            break;
+        case 1:
+            for(i = 0; i < n; i++)
+                out[i] = row[i] - ((i >= bpp) ? row[i - bpp] : 0);
+            break;
+        case 2:
+            for(i = 0; i < n; i++)
+                out[i] = row[i] - up[i];
+            break;
+        case 3:
+            for(i = 0; i < n; i++)
+                out[i] = row[i] - ((((i >= bpp) ? row[i - bpp] : 0) + up[i]) >> 1);
+            break;
+        case 4:
+            for(i = 0; i < n; i++){
+                a = (i >= bpp) ? row[i - bpp] : 0;
+                b = up[i];
+                c = (i >= bpp) ? up[i - bpp] : 0;
+                p = a + b - c;
+                pa = abs(p - a);
+                pb = abs(p - b);
+                pc = abs(p - c);
+                out[i] = row[i] - (((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c));
+            }
+            break;
+    }
+}
+
+static const uint8_t * choose_filter(encoder * enc, bool band_start){
+    PNGdecoder_filter_strategies strategy = enc->options.filter;
+    uint8_t candidates, type, best = 0;
+    uint64_t cost, best_cost = UINT64_MAX;
+
+    if(strategy == PNGDECODER_FILTER_ADAPTIVE)
+        candidates = 0x1F;
+    else if(strategy == PNGDECODER_FILTER_FAST)
+        candidates = (1 << 0) | (1 << 2);       //None and Up, the cheapest to unfilter
+    else
+        candidates = 1 << strategy;
+
+    //A band restarts from None or Sub so that it unfilters without the last row of the previous band: Up falls back
+    //to None, Average and Paeth to Sub
+    if(band_start){
+        candidates &= (1 << 0) | (1 << 1);
+        if(candidates == 0)
+            candidates = ((strategy == PNGDECODER_FILTER_UP) || (strategy == PNGDECODER_FILTER_FAST)) ? (1 << 0) : (1 << 1);
+    }
+
+    for(type = 0; type < 5; type++){
+        if(!(candidates & (1 << type)))
+            continue;
+        filter_row(enc, type);
+        if(candidates == (1 << type))
+            return enc->filtered[type];
+        cost = filter_cost(enc->filtered[type] + 1, enc->row_size);
+        if(cost < best_cost){
+            best_cost = cost;
+            best = type;
+        }
+    }
+
+    return enc->filtered[best];
+}
+
+static uint64_t filter_cost(const uint8_t * row, uint32_t n){
+    uint64_t cost = 0;
+    uint32_t i;
+
+    for(i = 0; i < n; i++)
+        cost += abs((int8_t) row[i]);
+
+    return cost;
+}
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+//Runs deflate until it has taken every input byte, and for Z_FINISH until the stream is complete
+static bool deflate_run(encoder * enc, int flush){
+    int result;
+
+    do{
+        if(!buffer_reserve(&enc->data, deflate_chunk))
+            return false;
+        enc->z.next_out = enc->data.data + enc->data.size;
+        enc->z.avail_out = deflate_chunk;
+        result = deflate(&enc->z, flush);
+        enc->data.size += deflate_chunk - enc->z.avail_out;
+        if(result == Z_STREAM_ERROR)
+            return false;
+    }while((enc->z.avail_out == 0) || ((flush == Z_FINISH) && (result != Z_STREAM_END)));
+
+    return true;
+}
+#endif // PNGDECODER_WITHOUT_ZLIB
+
+static bool stream_begin(encoder * enc){
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };   //Deflate, 32K window, no dictionary
+
+    if(enc->options.level == 0){
+        enc->adler = 1;
+        enc->stored = (uint8_t *) mem_malloc(stored_block_max);
+        return (enc->stored != NULL) && buffer_append(&enc->data, zlib_header, 2);
+    }
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+    enc->z.zalloc = mem_zlib_alloc;
+    enc->z.zfree = mem_zlib_free;
+    return deflateInit(&enc->z, enc->options.level) == Z_OK;
+#else
+    return false;
+#endif // PNGDECODER_WITHOUT_ZLIB
+}
+
+static bool stream_write(encoder * enc, const uint8_t * bytes, uint32_t size){
+    uint32_t n;
+
+    if(enc->options.level == 0){
+        enc->adler = adler32_update(enc->adler, bytes, size);
+        while(size > 0){
+            n = stored_block_max - enc->stored_n;
+            if(n > size)
+                n = size;
+            memcpy(enc->stored + enc->stored_n, bytes, n);
+            enc->stored_n += n;
+            bytes += n;
+            size -= n;
+            if((enc->stored_n == stored_block_max) && !stored_emit(enc, false))
+                return false;
+        }
+        return true;
+    }
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+    enc->z.next_in = (Bytef *) bytes;
+    enc->z.avail_in = size;
+    return deflate_run(enc, Z_NO_FLUSH);
+#else
+    return false;
+#endif // PNGDECODER_WITHOUT_ZLIB
+}
+
+static bool stream_end_band(encoder * enc, bool last){
+    uint8_t trailer[4];
+
+    //Stored blocks are byte aligned and carry no history: a band only has to end with its block
+    if(enc->options.level == 0){
+        if(last){
+            store_uint32(trailer, enc->adler);
+            return stored_emit(enc, true) && buffer_append(&enc->data, trailer, 4);
+        }
+        return (enc->stored_n == 0) || stored_emit(enc, false);
+    }
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+    enc->z.next_in = NULL;
+    enc->z.avail_in = 0;
+    return deflate_run(enc, last ? Z_FINISH : Z_FULL_FLUSH);
+#else
+    return false;
+#endif // PNGDECODER_WITHOUT_ZLIB
+}
+
+static void stream_free(encoder * enc){
+    if(enc->options.level == 0){
+        mem_free(enc->stored);
+        enc->stored = NULL;
+        return;
+    }
+#ifndef PNGDECODER_WITHOUT_ZLIB
+    deflateEnd(&enc->z);
+#endif // PNGDECODER_WITHOUT_ZLIB
+}
+
+static bool stored_emit(encoder * enc, bool final){
+    uint8_t header[5];
+
+    header[0] = final ? 1 : 0;      //BFINAL, BTYPE 00, padding to the byte boundary
+    header[1] = enc->stored_n & 0xFF;
+    header[2] = enc->stored_n >> 8;
+    header[3] = ~header[1];
+    header[4] = ~header[2];
+    if(!buffer_append(&enc->data, header, 5) || !buffer_append(&enc->data, enc->stored, enc->stored_n))
+        return false;
+
+    enc->stored_n = 0;
+    return true;
+}
+
+static bool write_chunk(FILE * file, const char * type, const uint8_t * data, uint32_t size){
+    const kernel_table * kernels = kernels_get();
+    uint8_t bytes[4];
+    uint32_t crc;
+
+    crc = kernels->crc_update(0xffffffff, (const uint8_t *) type, 4);
+    if(size > 0)
+        crc = kernels->crc_update(crc, data, size);
+    crc ^= 0xffffffff;
+
+    store_uint32(bytes, size);
+    if((fwrite(bytes, 1, 4, file) != 4) || (fwrite(type, 1, 4, file) != 4) || ((size > 0) && (fwrite(data, 1, size, file) != size)))
+        return false;
+    store_uint32(bytes, crc);
+    return fwrite(bytes, 1, 4, file) == 4;
+}
+
+static PNGdecoder_result write_file(encoder * enc, const char * file_name){
+    uint64_t IDAT_size = enc->options.IDAT_size, start, end, size, offset;
+    uint8_t IHDR[13], * index = NULL;
+    uint32_t index_size = 4 + (enc->bands_n * 12), k;
+    bool written;
+    FILE * file;
+
+    store_uint32(IHDR, enc->width);
+    store_uint32(IHDR + 4, enc->height);
+    IHDR[8] = enc->wide ? 16 : 8;
+    IHDR[9] = enc->color_type;
+    IHDR[10] = IHDR[11] = IHDR[12] = 0;     //Deflate, adaptive filtering, no interlacing
+
+    if(enc->bands_n > 1){
+        index = (uint8_t *) mem_malloc(index_size);
+        if(index == NULL)
+            return PNGDECODER_MEMORY_ERROR;
+    }
+
+    file = fopen(file_name, "wb");
+    if(file == NULL){
+        mem_free(index);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+    written = (fwrite(PNG_magic, 1, 8, file) == 8) && write_chunk(file, "IHDR", IHDR, 13);
+
+    //Offsets count from the start of the index chunk, which comes right before the first IDAT chunk
+    if(written && (index != NULL)){
+        store_uint32(index, enc->bands_n);
+        offset = 12 + index_size;
+        for(k = 0; written && (k < enc->bands_n); k++){
+            start = enc->band_starts[k];
+            end = (k + 1 < enc->bands_n) ? enc->band_starts[k + 1] : enc->data.size;
+            store_uint32(index + 4 + (k * 12), k * enc->band_rows);
+            store_uint32(index + 8 + (k * 12), (k + 1 < enc->bands_n) ? enc->band_rows : enc->height - (k * enc->band_rows));
+            store_uint32(index + 12 + (k * 12), offset);
+            offset += (end - start) + (12 * ((end - start + IDAT_size - 1) / IDAT_size));
+            written = (offset <= UINT32_MAX);
+        }
+        written = written && write_chunk(file, "prIX", index, index_size);
+    }
+    mem_free(index);
+
+    //Each band starts its own IDAT chunk
+    for(k = 0; written && (k < enc->bands_n); k++){
+        start = enc->band_starts[k];
+        end = (k + 1 < enc->bands_n) ? enc->band_starts[k + 1] : enc->data.size;
+        for(; written && (start < end); start += size){
+            size = ((end - start) < IDAT_size) ? end - start : IDAT_size;
+            written = write_chunk(file, "IDAT", enc->data.data + start, size);
+        }
+    }
+
+    written = written && write_chunk(file, "IEND", NULL, 0);
+    if((fclose(file) != 0) || !written){
+        remove(file_name);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+
+    return PNGDECODER_OK;
+}
@@ -0,0 +1,110 @@
+#include <PNGdecoder/PNGdecoder.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+//Encoder round trip: synthetic rasters of every raster type and a few sizes, written with every filter strategy,
+//stored and compressed, in a single band and in bands, then decoded and compared with the source pixel by pixel.
+//Prints the failing cases and exits with the number of failures
+
+const char * filter_names[7] = { "none", "sub", "up", "average", "paeth", "adaptive", "fast" };
+
+const char * type_names[8] = { "gray8", "gray16", "rgb8", "rgb16", "gray8a", "gray16a", "rgba8", "rgba16" };
+
+const uint8_t pixel_sizes[8] = { 1, 2, 3, 6, 2, 4, 4, 8 };
+
+const uint32_t sizes[][2] = { { 1, 1 }, { 1, 9 }, { 17, 1 }, { 37, 29 }, { 130, 67 } };
+
+const uint8_t levels[2] = { 0, 6 };
+
+//Rows per band, 0 for a single band; 5 leaves a shorter last band on every size above
+const uint32_t band_rows[3] = { 0, 1, 5 };
+
+//Smooth gradients on the left half, noise on the right one, so that every filter type sees both
+void fill(uint8_t * bytes, uint32_t width, uint32_t height, uint8_t pixel_size, uint32_t seed) {
+  uint32_t x, y, c, state = seed * 2654435761u + 1;
+  for(y = 0; y < height; y++)
+    for(x = 0; x < width; x++)
+      for(c = 0; c < pixel_size; c++){
+        state = state * 1664525u + 1013904223u;
+        *bytes++ = (x < width / 2) ? (uint8_t)(x * 3 + y * 5 + c * 40) : (uint8_t)(state >> 24);
+      }
+}
+
+//Writes the raster with the options, decodes it back on two threads and compares; 1 on success. Files of several bands
+//must decode through them: the serial fallback would hide a wrong restart index or a broken band decoder
+int round_trip(const char * filename, const PNGdecoder_raster_grayscale8_t * source, PNGdecoder_raster_types type,
+               const PNGdecoder_encode_options * options) {
+  PNGdecoder_PNG * png = NULL;
+  PNGdecoder_options decode_options;
+  uint32_t bands = options->band_rows ? (source->height + options->band_rows - 1) / options->band_rows : 1;
+  PNGdecoder_result result = PNGdecoder_encode(filename, source, type, options);
+  if(result != PNGDECODER_OK){
+    printf("  encoding: %s\n", PNGdecoder_strerror(result));
+    return 0;
+  }
+  PNGdecoder_options_init(&decode_options);
+  decode_options.band_threads = 2;
+  result = PNGdecoder_openPNG_ex(filename, &decode_options, &png);
+  if(result != PNGDECODER_OK){
+    printf("  decoding: %s\n", PNGdecoder_strerror(result));
+    return 0;
+  }
+  if(PNGdecoder_get_bands_decoded(png) != ((bands > 1) ? bands : 0)){
+    printf("  decoded %u of %u bands concurrently\n", PNGdecoder_get_bands_decoded(png), bands);
+    PNGdecoder_free(png);
+    return 0;
+  }
+
+  const PNGdecoder_raster_grayscale8_t * decoded = PNGdecoder_get_raster(png);
+  int same = (PNGdecoder_get_raster_type(png) == type) && (decoded->width == source->width) && (decoded->height == source->height) &&
+             !memcmp(decoded->raster, source->raster, (size_t) source->width * source->height * pixel_sizes[type]);
+  if(!same)
+    printf("  decoded pixels differ\n");
+
+  PNGdecoder_free(png);
+  return same;
+}
+
+int main(int argc, char * argv[]){
+  const char * filename = (argc > 1) ? argv[1] : "encodetest.png";
+  PNGdecoder_encode_options options;
+  PNGdecoder_raster_grayscale8_t source;
+  uint32_t s, t, f, l, b, cases = 0, failures = 0;
+
+  for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+    for(t = 0; t < 8; t++){
+      source.width = sizes[s][0];
+      source.height = sizes[s][1];
+      source.raster = (uint8_t *) malloc((size_t) source.width * source.height * pixel_sizes[t]);
+      if(source.raster == NULL){
+        printf("Out of memory\n");
+        return -1;
+      }
+      fill(source.raster, source.width, source.height, pixel_sizes[t], s * 8 + t);
+
+      for(f = 0; f < 7; f++)
+        for(l = 0; l < 2; l++)
+          for(b = 0; b < 3; b++){
+            PNGdecoder_encode_options_init(&options);
+            options.filter = (PNGdecoder_filter_strategies) f;
+            options.level = levels[l];
+            options.band_rows = band_rows[b];
+            options.IDAT_size = b ? 64 : 0;     //Bands spread over several IDAT chunks too
+            cases++;
+            if(!round_trip(filename, &source, (PNGdecoder_raster_types) t, &options)){
+              printf("Failed: %ux%u %s, filter %s, level %u, band rows %u\n", source.width, source.height,
+                     type_names[t], filter_names[f], levels[l], band_rows[b]);
+              failures++;
+            }
+          }
+      free(source.raster);
+    }
+  }
+
+  remove(filename);
+  printf("%u of %u round trips failed\n", failures, cases);
+  return failures;
+}
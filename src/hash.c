@@ -0,0 +1,176 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "hash.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, uint8_t r){
+    return (x << r) | (x >> (64 - r));
+}
+
+//Little endian loads, whatever the alignment
+static inline uint64_t read64(const uint8_t * p){
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t * p){
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input){
+    acc += input * prime2;
+    acc = rotl64(acc, 31);
+    return acc * prime1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t value){
+    acc ^= round64(0, value);
+    return (acc * prime1) + prime4;
+}
+
+//Hash of the stripes, once there was at least one
+static uint64_t converge64(uint64_t, uint64_t, uint64_t, uint64_t);
+
+//Mixes in the length and the tail of less than 32 bytes(arguments 3, 4), then avalanches
+//Argument 1: hash so far, Argument 2: total size in bytes
+static uint64_t finalize64(uint64_t, uint64_t, const uint8_t *, const uint8_t *);
+
+
+/*      INTERFACE       */
+
+
+uint64_t hash64(const void * data, size_t size, uint64_t seed){
+    const uint8_t * p = (const uint8_t *) data;
+    const uint8_t * end = p + size;
+    uint64_t h, v1, v2, v3, v4;
+
+    if(size >= 32){
+        v1 = seed + prime1 + prime2;
+        v2 = seed + prime2;
+        v3 = seed;
+        v4 = seed - prime1;
+        do{
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        }while(p + 32 <= end);
+        h = converge64(v1, v2, v3, v4);
+    } else {
+        h = seed + prime5;
+    }
+
+    return finalize64(h, (uint64_t) size, p, end);
+}
+
+void hash64_init(hash64_state * state, uint64_t seed){
+    state->v[0] = seed + prime1 + prime2;
+    state->v[1] = seed + prime2;
+    state->v[2] = seed;
+    state->v[3] = seed - prime1;
+    state->seed = seed;
+    state->size = 0;
+    state->buffered = 0;
+}
+
+void hash64_update(hash64_state * state, const void * data, size_t size){
+    const uint8_t * p = (const uint8_t *) data;
+    const uint8_t * end = p + size;
+    uint32_t take;
+
+    state->size += size;
+
+    if(state->buffered > 0){
+        take = 32 - state->buffered;
+        if(take > size)
+            take = (uint32_t) size;
+        memcpy(state->buffer + state->buffered, p, take);
+        state->buffered += take;
+        p += take;
+        if(state->buffered < 32)
+            return;
+        state->v[0] = round64(state->v[0], read64(state->buffer));
+        state->v[1] = round64(state->v[1], read64(state->buffer + 8));
+        state->v[2] = round64(state->v[2], read64(state->buffer + 16));
+        state->v[3] = round64(state->v[3], read64(state->buffer + 24));
+        state->buffered = 0;
+    }
+
+    for(; p + 32 <= end; p += 32){
+        state->v[0] = round64(state->v[0], read64(p));
+        state->v[1] = round64(state->v[1], read64(p + 8));
+        state->v[2] = round64(state->v[2], read64(p + 16));
+        state->v[3] = round64(state->v[3], read64(p + 24));
+    }
+
+    memcpy(state->buffer, p, end - p);
+    state->buffered = (uint32_t) (end - p);
+}
+
+uint64_t hash64_digest(const hash64_state * state){
+    uint64_t h;
+
+    if(state->size >= 32)
+        h = converge64(state->v[0], state->v[1], state->v[2], state->v[3]);
+    else
+        h = state->seed + prime5;
+
+    return finalize64(h, state->size, state->buffer, state->buffer + state->buffered);
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static uint64_t converge64(uint64_t v1, uint64_t v2, uint64_t v3, uint64_t v4){
+    uint64_t h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+
+    h = merge64(h, v1);
+    h = merge64(h, v2);
+    h = merge64(h, v3);
+    return merge64(h, v4);
+}
+
+static uint64_t finalize64(uint64_t h, uint64_t size, const uint8_t * p, const uint8_t * end){
+    h += size;
+
+    for(; p + 8 <= end; p += 8)
+        h = (rotl64(h ^ round64(0, read64(p)), 27) * prime1) + prime4;
+    if(p + 4 <= end){
+        h = (rotl64(h ^ ((uint64_t) read32(p) * prime1), 23) * prime2) + prime3;
+        p += 4;
+    }
+    for(; p < end; p++)
+        h = rotl64(h ^ (*p * prime5), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    return h;
+}
@@ -0,0 +1,32 @@
+#ifndef PNGdecoder_HASH_H
+#define PNGdecoder_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*      CONTENT HASH        */
+
+//XXH64, a fast non cryptographic 64 bit hash, used to key decoded images by their content
+
+
+//Hashes the given bytes
+//Argument 1: data, Argument 2: size in bytes, Argument 3: seed
+uint64_t hash64(const void *, size_t, uint64_t);
+
+//State of a hash fed in pieces, which gives the hash64 of their concatenation
+typedef struct _hash64_state {
+    uint64_t v[4];          //Accumulators of the 32 byte stripes
+    uint64_t seed;
+    uint64_t size;          //Bytes fed so far
+    uint8_t buffer[32];     //Bytes of the incomplete stripe
+    uint32_t buffered;
+} hash64_state;
+
+//Argument 1: state, Argument 2: seed
+void hash64_init(hash64_state *, uint64_t);
+//Argument 1: state, Argument 2: data, Argument 3: size in bytes
+void hash64_update(hash64_state *, const void *, size_t);
+//Hash of the bytes fed so far, the state can still be fed afterwards
+uint64_t hash64_digest(const hash64_state *);
+
+#endif // PNGdecoder_HASH_H
@@ -0,0 +1,1051 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+#include <zlib.h>
+#endif // PNGDECODER_WITHOUT_ZLIB
+
+#include "inflate.h"
+#include "memory.h"
+
+//  --> https://www.rfc-editor.org/rfc/rfc1950 (zlib wrapper)
+//  --> https://www.rfc-editor.org/rfc/rfc1951 (deflate)
+
+
+/*      COMMON DECLARATIONS/DEFINITIONS         */
+
+
+#define HISTORY_SIZE 32768          //Maximum deflate distance, the window always keeps as much behind the write position
+#define MAX_MATCH 258
+
+//Size of the output window of a stream whose largest requested span is the given argument: enough to hold the history
+//plus two spans, so that a slide always leaves room for at least one whole span and decoding keeps a long run ahead
+static uint32_t window_size_for(uint32_t max_span){
+    uint32_t span = (max_span > HISTORY_SIZE) ? max_span : HISTORY_SIZE;
+    return HISTORY_SIZE + (2 * span);
+}
+
+uint32_t inflate_memory_input_fn(void * user, const uint8_t ** data){
+    inflate_memory_input * input = (inflate_memory_input *) user;
+    uint32_t size = input->size;
+
+    *data = input->data;
+    input->size = 0;
+    return size;
+}
+
+
+/*      ZLIB BACKEND        */
+
+#ifndef PNGDECODER_WITHOUT_ZLIB
+
+#define ZLIB_STATE_MAX 8192         //Upper bound of the inflate state zlib allocates
+
+typedef struct _zlib_stream {
+    z_stream z;
+    inflate_input_fn input;
+    void * user;
+    bool input_done;
+    bool ended;             //Z_STREAM_END seen
+
+    uint8_t * window;
+    uint32_t window_size;
+    uint32_t read_pos;      //First byte not yet handed to the caller
+    uint32_t write_pos;     //First byte not yet written by zlib
+} zlib_stream;
+
+//Negative window bits select raw deflate data
+static inflate_stream * zlib_stream_open(inflate_input_fn input, void * user, uint32_t max_span, int window_bits){
+    zlib_stream * s = (zlib_stream *) mem_calloc(1, sizeof(zlib_stream));
+    if(s == NULL)
+        return NULL;
+
+    s->input = input;
+    s->user = user;
+    s->window_size = window_size_for(max_span);
+    s->window = (uint8_t *) mem_malloc(s->window_size);
+    s->z.zalloc = mem_zlib_alloc;
+    s->z.zfree = mem_zlib_free;
+    if((s->window == NULL) || (inflateInit2(&s->z, window_bits) != Z_OK)){
+        mem_free(s->window);
+        mem_free(s);
+        return NULL;
+    }
+
+    return (inflate_stream *) s;
+}
+
+static inflate_stream * zlib_stream_new(inflate_input_fn input, void * user, uint32_t max_span){
+    return zlib_stream_open(input, user, max_span, MAX_WBITS);
+}
+
+static inflate_stream * zlib_stream_new_raw(inflate_input_fn input, void * user, uint32_t max_span){
+    return zlib_stream_open(input, user, max_span, -MAX_WBITS);
+}
+
+//Runs zlib until at least the given number of unread bytes sits in the window
+static PNGdecoder_result zlib_fill(zlib_stream * s, uint32_t wanted){
+    const uint8_t * segment;
+    uint32_t segment_size;
+    int result;
+
+    if(s->window_size - s->read_pos < wanted){
+        memmove(s->window, s->window + s->read_pos, s->write_pos - s->read_pos);
+        s->write_pos -= s->read_pos;
+        s->read_pos = 0;
+    }
+
+    while((s->write_pos - s->read_pos) < wanted){
+        if(s->ended)
+            return PNGDECODER_ZLIB_ERROR;   //Not enough data in the stream
+
+        if((s->z.avail_in == 0) && !s->input_done){
+            segment_size = s->input(s->user, &segment);
+            if(segment_size == 0){
+                s->input_done = true;
+            } else {
+                s->z.next_in = (Bytef *) segment;
+                s->z.avail_in = segment_size;
+            }
+        }
+
+        s->z.next_out = s->window + s->write_pos;
+        s->z.avail_out = s->window_size - s->write_pos;
+        result = inflate(&s->z, Z_NO_FLUSH);
+        s->write_pos = s->window_size - s->z.avail_out;
+
+        if(result == Z_STREAM_END)
+            s->ended = true;
+        else if((result == Z_BUF_ERROR) && s->input_done && (s->z.avail_in == 0))
+            return PNGDECODER_ZLIB_ERROR;   //Truncated stream
+        else if((result != Z_OK) && (result != Z_BUF_ERROR))
+            return PNGDECODER_ZLIB_ERROR;
+    }
+
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result zlib_stream_read(inflate_stream * stream, uint32_t size, const uint8_t ** span){
+    zlib_stream * s = (zlib_stream *) stream;
+
+    PNGdecoder_result result = zlib_fill(s, size);
+    if(result != PNGDECODER_OK)
+        return result;
+
+    *span = s->window + s->read_pos;
+    s->read_pos += size;
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result zlib_stream_end(inflate_stream * stream){
+    zlib_stream * s = (zlib_stream *) stream;
+
+    if(s->write_pos != s->read_pos)
+        return PNGDECODER_ZLIB_ERROR;       //Too much data
+
+    //Anything zlib still produces is extra data, one byte is enough to tell
+    s->read_pos = s->write_pos = 0;
+    PNGdecoder_result result = zlib_fill(s, 1);
+    if((result == PNGDECODER_OK) || !s->ended || (s->write_pos != 0))
+        return PNGDECODER_ZLIB_ERROR;
+
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result zlib_stream_end_flush(inflate_stream * stream){
+    zlib_stream * s = (zlib_stream *) stream;
+    const uint8_t * segment;
+    uint32_t segment_size;
+    uint8_t extra;
+    int result;
+
+    if((s->write_pos != s->read_pos) || s->ended)
+        return PNGDECODER_ZLIB_ERROR;
+
+    //Block by block, with room for a single byte: producing it means data past the cut
+    while(true){
+        if((s->z.avail_in == 0) && !s->input_done){
+            segment_size = s->input(s->user, &segment);
+            if(segment_size == 0){
+                s->input_done = true;
+            } else {
+                s->z.next_in = (Bytef *) segment;
+                s->z.avail_in = segment_size;
+            }
+        }
+        if((s->z.avail_in == 0) && s->input_done)
+            return ((s->z.data_type & 128) && !(s->z.data_type & 64)) ? PNGDECODER_OK : PNGDECODER_ZLIB_ERROR;
+
+        s->z.next_out = &extra;
+        s->z.avail_out = 1;
+        result = inflate(&s->z, Z_BLOCK);
+        if((s->z.avail_out == 0) || ((result != Z_OK) && (result != Z_BUF_ERROR)))
+            return PNGDECODER_ZLIB_ERROR;   //More data, a final block or a corrupt one
+        if((result == Z_BUF_ERROR) && (s->z.avail_in > 0))
+            return PNGDECODER_ZLIB_ERROR;
+    }
+}
+
+static uint64_t zlib_stream_input_left(inflate_stream * stream){
+    return ((zlib_stream *) stream)->z.avail_in;
+}
+
+static void zlib_stream_free(inflate_stream * stream){
+    zlib_stream * s = (zlib_stream *) stream;
+    if(s == NULL)
+        return;
+
+    inflateEnd(&s->z);
+    mem_free(s->window);
+    mem_free(s);
+}
+
+//zlib also allocates its inflate state and its own 32 KiB history window
+static uint64_t zlib_stream_memory(uint32_t max_span){
+    return memory_block_size(sizeof(zlib_stream)) + memory_block_size(window_size_for(max_span)) +
+           memory_block_size(ZLIB_STATE_MAX) + memory_block_size(1 << MAX_WBITS);
+}
+
+static const inflate_backend zlib_backend = {
+    "zlib",
+    zlib_stream_new,
+    zlib_stream_new_raw,
+    zlib_stream_read,
+    zlib_stream_end,
+    zlib_stream_end_flush,
+    zlib_stream_input_left,
+    zlib_stream_free,
+    zlib_stream_memory
+};
+
+#endif // PNGDECODER_WITHOUT_ZLIB
+
+
+/*      BUILT-IN BACKEND        */
+
+//Huffman decoding goes through wide lookup tables indexed by the next bits of the stream(deflate codes are stored
+//LSB first, so the tables are indexed by bit-reversed codes); codes longer than the primary table width continue
+//into a subtable. Each 32 bit entry packs: code length to consume(bits 0-4), kind(bits 5-7), number of extra bits
+//or subtable index bits(bits 8-12), literal/base value or subtable offset(bits 16-31)
+
+#define LITLEN_TABLE_BITS 11
+#define DIST_TABLE_BITS 8
+#define CODELEN_TABLE_BITS 7
+
+#define LITLEN_SYMBOLS 288
+#define DIST_SYMBOLS 32
+#define CODELEN_SYMBOLS 19
+
+//Primary table plus one subtable for each symbol in the worst case, each subtable spanning up to 15 bit codes
+#define LITLEN_TABLE_SIZE ((1 << LITLEN_TABLE_BITS) + (LITLEN_SYMBOLS << (15 - LITLEN_TABLE_BITS)))
+#define DIST_TABLE_SIZE ((1 << DIST_TABLE_BITS) + (DIST_SYMBOLS << (15 - DIST_TABLE_BITS)))
+#define CODELEN_TABLE_SIZE (1 << CODELEN_TABLE_BITS)
+
+#define KIND_LITERAL 0
+#define KIND_LENGTH 1       //Length for the literal/length alphabet, distance for the distance one
+#define KIND_END 2
+#define KIND_SUBTABLE 3
+#define KIND_INVALID 4
+
+#define ENTRY(value, extra, kind) (((uint32_t)(value) << 16) | ((uint32_t)(extra) << 8) | ((uint32_t)(kind) << 5))
+#define ENTRY_BITS(e) ((e) & 0x1F)
+#define ENTRY_KIND(e) (((e) >> 5) & 0x07)
+#define ENTRY_EXTRA(e) (((e) >> 8) & 0x1F)
+#define ENTRY_VALUE(e) ((e) >> 16)
+
+//Output room the fast loop needs ahead of the write position: a full match plus the overshoot of its word copies
+#define FAST_OUT_MARGIN (MAX_MATCH + 32)
+
+typedef enum {
+    STATE_ZLIB_HEADER,
+    STATE_BLOCK_HEADER,
+    STATE_STORED,
+    STATE_HUFFMAN,
+    STATE_TRAILER,
+    STATE_DONE,
+    STATE_ERROR
+} builtin_states;
+
+typedef struct _builtin_stream {
+    builtin_states state;
+    bool final_block;
+    bool fixed_tables;      //Fixed Huffman tables currently loaded
+    bool raw;               //No zlib header nor trailer
+    bool cut;               //Input exhausted at a block boundary before the final block, see stream_end_flush
+
+    //Bit reader, bits are consumed from the LSB of bitbuf; bytes above bitcount may already hold the next input
+    //bytes, refills OR the same bytes in place so they never need clearing
+    uint64_t bitbuf;
+    uint32_t bitcount;
+    const uint8_t * next;
+    const uint8_t * end;
+    inflate_input_fn input;
+    void * user;
+    bool input_done;
+    uint32_t overrun;       //Zero bytes appended past the end of the input, an error once they get consumed
+
+    uint32_t stored_left;   //Bytes left in the current stored block
+    uint32_t copy_len;      //Match left to copy when the output filled up mid-match
+    uint32_t copy_dist;
+    uint32_t adler;
+
+    uint8_t * window;
+    uint32_t window_size;
+    uint32_t read_pos;
+    uint32_t write_pos;
+
+    uint32_t litlen_table[LITLEN_TABLE_SIZE];
+    uint32_t dist_table[DIST_TABLE_SIZE];
+    uint32_t codelen_table[CODELEN_TABLE_SIZE];
+} builtin_stream;
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t codelen_order[CODELEN_SYMBOLS] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef enum {
+    ALPHABET_LITLEN,
+    ALPHABET_DIST,
+    ALPHABET_CODELEN
+} alphabets;
+
+static uint32_t symbol_entry(alphabets alphabet, uint16_t symbol){
+    switch(alphabet){
+        case ALPHABET_LITLEN:
+            if(symbol < 256)
+                return ENTRY(symbol, 0, KIND_LITERAL);
+            if(symbol == 256)
+                return ENTRY(0, 0, KIND_END);
+            if(symbol < 286)
+                return ENTRY(length_base[symbol - 257], length_extra[symbol - 257], KIND_LENGTH);
+            break;
+        case ALPHABET_DIST:
+            if(symbol < 30)
+                return ENTRY(dist_base[symbol], dist_extra[symbol], KIND_LENGTH);
+            break;
+        case ALPHABET_CODELEN:
+            return ENTRY(symbol, 0, KIND_LITERAL);
+    }
+    return ENTRY(0, 0, KIND_INVALID);
+}
+
+//Builds the lookup table of a canonical Huffman code from its code lengths, returns false for over-subscribed codes
+//and for incomplete ones, except the single code and empty code cases RFC 1951 allows
+//Argument 1: table, Argument 2: primary table bits, Argument 3: code lengths, Argument 4: number of symbols, Argument 5: alphabet
+static bool build_table(uint32_t * table, uint8_t table_bits, const uint8_t * lengths, uint16_t symbols_n, alphabets alphabet){
+    uint16_t count[16] = {0};
+    uint16_t offsets[16];
+    uint16_t next_code[16];
+    uint16_t sorted[LITLEN_SYMBOLS];
+    uint8_t sub_length[1 << LITLEN_TABLE_BITS];     //Longest code sharing each primary prefix
+    uint16_t sub_start[1 << LITLEN_TABLE_BITS];
+    uint32_t table_size = 1 << table_bits;
+    uint32_t i, next_sub, code, reversed, prefix, entry;
+    uint16_t symbol;
+    uint8_t length, max_length = 0;
+    uint16_t codes_n = 0;
+    int32_t left = 1;
+
+    for(i = 0; i < symbols_n; i++)
+        count[lengths[i]]++;
+    count[0] = 0;
+
+    for(length = 1; length <= 15; length++){
+        left = (left << 1) - count[length];
+        if(left < 0)
+            return false;
+        if(count[length])
+            max_length = length;
+    }
+    if((left > 0) && ((alphabet == ALPHABET_CODELEN) || (max_length > 1)))
+        return false;
+
+    offsets[1] = 0;
+    for(length = 1; length < 15; length++)
+        offsets[length + 1] = offsets[length] + count[length];
+    for(i = 0; i < symbols_n; i++)
+        if(lengths[i]){
+            sorted[offsets[lengths[i]]++] = i;
+            codes_n++;
+        }
+
+    code = 0;
+    next_code[0] = 0;
+    for(length = 1; length <= 15; length++){
+        code = (code + count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+
+    for(i = 0; i < table_size; i++){
+        table[i] = ENTRY(0, 0, KIND_INVALID);
+        sub_length[i] = 0;
+    }
+
+    //First pass over the long codes: size the subtable hanging from each primary prefix
+    for(i = 0; i < symbols_n; i++){
+        length = lengths[i];
+        if(length <= table_bits)
+            continue;
+
+        code = next_code[length]; reversed = 0;
+        for(prefix = 0; prefix < length; prefix++) reversed |= ((code >> prefix) & 1) << (length - 1 - prefix);
+        prefix = reversed & (table_size - 1);
+        if(length > sub_length[prefix])
+            sub_length[prefix] = length;
+        next_code[length]++;
+    }
+
+    next_sub = table_size;
+    for(i = 0; i < table_size; i++)
+        if(sub_length[i]){
+            sub_start[i] = next_sub;
+            table[i] = ENTRY(next_sub, sub_length[i] - table_bits, KIND_SUBTABLE) | table_bits;
+            for(code = 0; code < (1u << (sub_length[i] - table_bits)); code++)
+                table[next_sub + code] = ENTRY(0, 0, KIND_INVALID);
+            next_sub += 1 << (sub_length[i] - table_bits);
+        }
+
+    //Second pass, in canonical order: replicate every code over all the entries it prefixes
+    code = 0;
+    for(length = 1; length <= 15; length++){
+        code = (code + count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+    for(i = 0; i < codes_n; i++){
+        symbol = sorted[i];
+        length = lengths[symbol];
+        code = next_code[length]++;
+        reversed = 0;
+        for(prefix = 0; prefix < length; prefix++) reversed |= ((code >> prefix) & 1) << (length - 1 - prefix);
+
+        if(length <= table_bits){
+            entry = symbol_entry(alphabet, symbol) | length;
+            for(code = reversed; code < table_size; code += 1 << length)
+                table[code] = entry;
+        } else {
+            prefix = reversed & (table_size - 1);
+            entry = symbol_entry(alphabet, symbol) | (length - table_bits);
+            for(code = reversed >> table_bits; code < (1u << (sub_length[prefix] - table_bits)); code += 1 << (length - table_bits))
+                table[sub_start[prefix] + code] = entry;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t * buf, uint32_t len){
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    uint32_t n;
+
+    while(len > 0){
+        n = (len < 5552) ? len : 5552;     //Largest n keeping b below 2^32 before the modulo
+        len -= n;
+        while(n >= 4){
+            a += buf[0]; b += a;
+            a += buf[1]; b += a;
+            a += buf[2]; b += a;
+            a += buf[3]; b += a;
+            buf += 4; n -= 4;
+        }
+        while(n--){
+            a += *buf++; b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+static uint64_t load_le64(const uint8_t * p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+//Tops the bit buffer up to at least 56 bits, pulling new input segments as needed and appending zero bytes past
+//the end of the input
+static void refill_slow(builtin_stream * s){
+    uint32_t size;
+
+    while(s->bitcount < 56){
+        if(s->next == s->end){
+            if(!s->input_done){
+                size = s->input(s->user, &s->next);
+                if(size > 0){
+                    s->end = s->next + size;
+                    continue;
+                }
+                s->next = s->end = NULL;
+                s->input_done = true;
+            }
+            s->overrun++;
+            s->bitcount += 8;
+            continue;
+        }
+        s->bitbuf |= (uint64_t)(*s->next++) << s->bitcount;
+        s->bitcount += 8;
+    }
+}
+
+static uint32_t getbits(builtin_stream * s, uint8_t n){
+    uint32_t v;
+
+    if(s->bitcount < n)
+        refill_slow(s);
+    v = (uint32_t)(s->bitbuf & ((1ull << n) - 1));
+    s->bitbuf >>= n;
+    s->bitcount -= n;
+    return v;
+}
+
+//True once bits past the end of the input have been consumed
+static bool truncated(builtin_stream * s){
+    return s->bitcount < (8 * s->overrun);
+}
+
+//Whether only the padding bits of the last input byte are left, pulling the next segment if the current one is done
+static bool input_exhausted(builtin_stream * s){
+    uint32_t size;
+
+    if((s->next == s->end) && !s->input_done){
+        size = s->input(s->user, &s->next);
+        if(size > 0){
+            s->end = s->next + size;
+            return false;
+        }
+        s->next = s->end = NULL;
+        s->input_done = true;
+    }
+
+    return (s->next == s->end) && (s->bitcount < (8 * (s->overrun + 1)));
+}
+
+static void load_fixed_tables(builtin_stream * s){
+    uint8_t lengths[LITLEN_SYMBOLS];
+    uint32_t i;
+
+    for(i = 0; i < 144; i++) lengths[i] = 8;
+    for(; i < 256; i++) lengths[i] = 9;
+    for(; i < 280; i++) lengths[i] = 7;
+    for(; i < 288; i++) lengths[i] = 8;
+    build_table(s->litlen_table, LITLEN_TABLE_BITS, lengths, LITLEN_SYMBOLS, ALPHABET_LITLEN);
+
+    for(i = 0; i < DIST_SYMBOLS; i++) lengths[i] = 5;
+    build_table(s->dist_table, DIST_TABLE_BITS, lengths, DIST_SYMBOLS, ALPHABET_DIST);
+
+    s->fixed_tables = true;
+}
+
+static bool load_dynamic_tables(builtin_stream * s){
+    uint8_t lengths[LITLEN_SYMBOLS + DIST_SYMBOLS];
+    uint8_t codelen_lengths[CODELEN_SYMBOLS] = {0};
+    uint32_t litlen_n, dist_n, codelen_n, i, entry, repeat;
+    uint8_t value;
+
+    s->fixed_tables = false;
+    litlen_n = getbits(s, 5) + 257;
+    dist_n = getbits(s, 5) + 1;
+    codelen_n = getbits(s, 4) + 4;
+    if((litlen_n > 286) || (dist_n > 30))
+        return false;
+
+    for(i = 0; i < codelen_n; i++)
+        codelen_lengths[codelen_order[i]] = getbits(s, 3);
+    if(!build_table(s->codelen_table, CODELEN_TABLE_BITS, codelen_lengths, CODELEN_SYMBOLS, ALPHABET_CODELEN))
+        return false;
+
+    i = 0;
+    while(i < litlen_n + dist_n){
+        if(s->bitcount < 16)
+            refill_slow(s);
+        entry = s->codelen_table[s->bitbuf & (CODELEN_TABLE_SIZE - 1)];
+        s->bitbuf >>= ENTRY_BITS(entry);
+        s->bitcount -= ENTRY_BITS(entry);
+        if(ENTRY_KIND(entry) != KIND_LITERAL)
+            return false;
+
+        value = ENTRY_VALUE(entry);
+        if(value < 16){
+            lengths[i++] = value;
+            continue;
+        }
+
+        if(value == 16){
+            if(i == 0)
+                return false;
+            value = lengths[i - 1];
+            repeat = 3 + getbits(s, 2);
+        } else {
+            value = 0;
+            repeat = (ENTRY_VALUE(entry) == 17) ? 3 + getbits(s, 3) : 11 + getbits(s, 7);
+        }
+        if(i + repeat > litlen_n + dist_n)
+            return false;
+        while(repeat--)
+            lengths[i++] = value;
+    }
+    if(truncated(s) || (lengths[256] == 0))
+        return false;
+
+    return build_table(s->litlen_table, LITLEN_TABLE_BITS, lengths, litlen_n, ALPHABET_LITLEN) &&
+           build_table(s->dist_table, DIST_TABLE_BITS, &lengths[litlen_n], dist_n, ALPHABET_DIST);
+}
+
+//Copies a match whose source overlaps its destination when the distance is shorter than the length
+static uint8_t * copy_match_fast(uint8_t * out, uint32_t length, uint32_t distance){
+    const uint8_t * src = out - distance;
+    uint8_t * end = out + length;
+
+    if(distance >= 8){
+        do{
+            memcpy(out, src, 8);
+            out += 8; src += 8;
+        }while(out < end);
+    } else if(distance == 1){
+        memset(out, *src, length);
+    } else {
+        do{
+            *out++ = *src++;
+        }while(out < end);
+    }
+
+    return end;
+}
+
+//Decodes literal/length symbols until the end of the block or until out is within FAST_OUT_MARGIN of out_end or the
+//input segment within 8 bytes of its end; several literals are decoded per refill
+static uint8_t * decode_huffman_fast(builtin_stream * s, uint8_t * out_base, uint8_t * out, uint8_t * out_end){
+    const uint32_t * litlen = s->litlen_table;
+    const uint32_t * dist = s->dist_table;
+    uint64_t bitbuf = s->bitbuf;
+    uint32_t bitcount = s->bitcount;
+    const uint8_t * next = s->next;
+    uint32_t entry, length, distance, n;
+
+    if((next == NULL) || (out_end - out < FAST_OUT_MARGIN))
+        return out;
+    out_end -= FAST_OUT_MARGIN;
+
+    while((out < out_end) && (s->end - next >= 8)){
+        n = (63 - bitcount) >> 3;
+        bitbuf |= load_le64(next) << bitcount;
+        next += n;
+        bitcount += n << 3;
+
+        entry = litlen[bitbuf & ((1 << LITLEN_TABLE_BITS) - 1)];
+        if(ENTRY_KIND(entry) == KIND_LITERAL){
+            bitbuf >>= ENTRY_BITS(entry); bitcount -= ENTRY_BITS(entry);
+            *out++ = ENTRY_VALUE(entry);
+
+            entry = litlen[bitbuf & ((1 << LITLEN_TABLE_BITS) - 1)];
+            if(ENTRY_KIND(entry) != KIND_LITERAL)
+                continue;
+            bitbuf >>= ENTRY_BITS(entry); bitcount -= ENTRY_BITS(entry);
+            *out++ = ENTRY_VALUE(entry);
+
+            entry = litlen[bitbuf & ((1 << LITLEN_TABLE_BITS) - 1)];
+            if(ENTRY_KIND(entry) != KIND_LITERAL)
+                continue;
+            bitbuf >>= ENTRY_BITS(entry); bitcount -= ENTRY_BITS(entry);
+            *out++ = ENTRY_VALUE(entry);
+            continue;
+        }
+
+        if(ENTRY_KIND(entry) == KIND_SUBTABLE){
+            bitbuf >>= LITLEN_TABLE_BITS; bitcount -= LITLEN_TABLE_BITS;
+            entry = litlen[ENTRY_VALUE(entry) + (bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1))];
+        }
+        bitbuf >>= ENTRY_BITS(entry); bitcount -= ENTRY_BITS(entry);
+
+        if(ENTRY_KIND(entry) == KIND_LITERAL){
+            *out++ = ENTRY_VALUE(entry);
+            continue;
+        }
+        if(ENTRY_KIND(entry) == KIND_END){
+            s->state = STATE_BLOCK_HEADER;
+            break;
+        }
+        if(ENTRY_KIND(entry) != KIND_LENGTH){
+            s->state = STATE_ERROR;
+            break;
+        }
+
+        length = ENTRY_VALUE(entry) + (uint32_t)(bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1));
+        bitbuf >>= ENTRY_EXTRA(entry); bitcount -= ENTRY_EXTRA(entry);
+
+        entry = dist[bitbuf & ((1 << DIST_TABLE_BITS) - 1)];
+        if(ENTRY_KIND(entry) == KIND_SUBTABLE){
+            bitbuf >>= DIST_TABLE_BITS; bitcount -= DIST_TABLE_BITS;
+            entry = dist[ENTRY_VALUE(entry) + (bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1))];
+        }
+        bitbuf >>= ENTRY_BITS(entry); bitcount -= ENTRY_BITS(entry);
+        if(ENTRY_KIND(entry) != KIND_LENGTH){
+            s->state = STATE_ERROR;
+            break;
+        }
+        distance = ENTRY_VALUE(entry) + (uint32_t)(bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1));
+        bitbuf >>= ENTRY_EXTRA(entry); bitcount -= ENTRY_EXTRA(entry);
+
+        if(distance > (uint32_t)(out - out_base)){
+            s->state = STATE_ERROR;
+            break;
+        }
+        out = copy_match_fast(out, length, distance);
+    }
+
+    s->bitbuf = bitbuf;
+    s->bitcount = bitcount;
+    s->next = next;
+    return out;
+}
+
+//Decodes a single literal/length symbol with full input checks; matches that do not fit are left in
+//copy_len/copy_dist. With a full output only an end of block symbol is consumed, otherwise *blocked is set
+static uint8_t * decode_huffman_slow(builtin_stream * s, uint8_t * out_base, uint8_t * out, uint8_t * out_end, bool * blocked){
+    uint32_t entry, length, distance;
+    uint8_t consumed = 0;
+
+    refill_slow(s);
+    entry = s->litlen_table[s->bitbuf & ((1 << LITLEN_TABLE_BITS) - 1)];
+    if(ENTRY_KIND(entry) == KIND_SUBTABLE){
+        consumed = LITLEN_TABLE_BITS;
+        entry = s->litlen_table[ENTRY_VALUE(entry) + ((s->bitbuf >> LITLEN_TABLE_BITS) & ((1u << ENTRY_EXTRA(entry)) - 1))];
+    }
+    consumed += ENTRY_BITS(entry);
+
+    if((out == out_end) && (ENTRY_KIND(entry) != KIND_END)){
+        *blocked = true;
+        return out;
+    }
+    s->bitbuf >>= consumed; s->bitcount -= consumed;
+
+    switch(ENTRY_KIND(entry)){
+        case KIND_LITERAL:
+            *out++ = ENTRY_VALUE(entry);
+            break;
+        case KIND_END:
+            s->state = STATE_BLOCK_HEADER;
+            break;
+        case KIND_LENGTH:
+            length = ENTRY_VALUE(entry) + getbits(s, ENTRY_EXTRA(entry));
+
+            refill_slow(s);
+            entry = s->dist_table[s->bitbuf & ((1 << DIST_TABLE_BITS) - 1)];
+            if(ENTRY_KIND(entry) == KIND_SUBTABLE){
+                s->bitbuf >>= DIST_TABLE_BITS; s->bitcount -= DIST_TABLE_BITS;
+                entry = s->dist_table[ENTRY_VALUE(entry) + (s->bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1))];
+            }
+            s->bitbuf >>= ENTRY_BITS(entry); s->bitcount -= ENTRY_BITS(entry);
+            if(ENTRY_KIND(entry) != KIND_LENGTH){
+                s->state = STATE_ERROR;
+                break;
+            }
+            distance = ENTRY_VALUE(entry) + getbits(s, ENTRY_EXTRA(entry));
+            if(distance > (uint32_t)(out - out_base)){
+                s->state = STATE_ERROR;
+                break;
+            }
+
+            s->copy_len = length;
+            s->copy_dist = distance;
+            while(s->copy_len && (out < out_end)){
+                *out = *(out - distance);
+                out++;
+                s->copy_len--;
+            }
+            break;
+        default:
+            s->state = STATE_ERROR;
+    }
+
+    if(truncated(s))
+        s->state = STATE_ERROR;
+    return out;
+}
+
+//Runs the decoder writing at buf[*pos] up to buf[limit], everything before *pos in buf is history for matches
+//Returns once the output is full, the stream is complete or an error is found
+static void builtin_run(builtin_stream * s, uint8_t * buf, uint32_t * pos, uint32_t limit){
+    uint8_t * out = buf + *pos;
+    uint8_t * out_end = buf + limit;
+    uint8_t * out_start = out;
+    uint32_t header, n;
+    bool blocked = false;
+
+    while((s->state != STATE_DONE) && (s->state != STATE_ERROR)){
+        switch(s->state){
+            case STATE_ZLIB_HEADER:
+                header = getbits(s, 8) << 8;
+                header |= getbits(s, 8);
+                if(((header >> 8) & 0x0F) != 8 || (header >> 12) > 7 || (header % 31) != 0 || (header & 0x20) || truncated(s)){
+                    s->state = STATE_ERROR;
+                    break;
+                }
+                s->state = STATE_BLOCK_HEADER;
+                break;
+
+            case STATE_BLOCK_HEADER:
+                if(s->final_block){
+                    s->state = s->raw ? STATE_DONE : STATE_TRAILER;
+                    break;
+                }
+                //Decoding runs ahead of the reads, so a stream cut at a restart point stops here rather than failing
+                if(input_exhausted(s)){
+                    s->cut = true;
+                    s->state = STATE_DONE;
+                    break;
+                }
+                s->final_block = getbits(s, 1);
+                switch(getbits(s, 2)){
+                    case 0:
+                        getbits(s, s->bitcount & 7);
+                        n = getbits(s, 16);
+                        if((n ^ getbits(s, 16)) != 0xFFFF){
+                            s->state = STATE_ERROR;
+                            break;
+                        }
+                        s->stored_left = n;
+                        s->state = STATE_STORED;
+                        break;
+                    case 1:
+                        if(!s->fixed_tables)
+                            load_fixed_tables(s);
+                        s->state = STATE_HUFFMAN;
+                        break;
+                    case 2:
+                        s->state = load_dynamic_tables(s) ? STATE_HUFFMAN : STATE_ERROR;
+                        break;
+                    default:
+                        s->state = STATE_ERROR;
+                }
+                if(truncated(s))
+                    s->state = STATE_ERROR;
+                break;
+
+            case STATE_STORED:
+                if(s->stored_left == 0){
+                    s->state = STATE_BLOCK_HEADER;
+                    break;
+                }
+                if(out == out_end)
+                    goto suspend;
+
+                //Whole bytes still in the bit buffer first, then straight from the input
+                while(s->stored_left && (out < out_end) && (s->bitcount >= 8)){
+                    if(s->bitcount <= 8 * s->overrun){
+                        s->state = STATE_ERROR;
+                        goto suspend;
+                    }
+                    *out++ = (uint8_t) s->bitbuf;
+                    s->bitbuf >>= 8;
+                    s->bitcount -= 8;
+                    s->stored_left--;
+                }
+                if(s->bitcount == 0)
+                    s->bitbuf = 0;
+                while(s->stored_left && (out < out_end)){
+                    if(s->next == s->end){
+                        if(s->input_done || (n = s->input(s->user, &s->next)) == 0){
+                            s->input_done = true;
+                            s->state = STATE_ERROR;
+                            goto suspend;
+                        }
+                        s->end = s->next + n;
+                    }
+                    n = s->end - s->next;
+                    if(n > s->stored_left) n = s->stored_left;
+                    if(n > (uint32_t)(out_end - out)) n = out_end - out;
+                    memcpy(out, s->next, n);
+                    out += n; s->next += n; s->stored_left -= n;
+                }
+                break;
+
+            case STATE_HUFFMAN:
+                if(s->copy_len){
+                    while(s->copy_len && (out < out_end)){
+                        *out = *(out - s->copy_dist);
+                        out++;
+                        s->copy_len--;
+                    }
+                    if(s->copy_len)
+                        goto suspend;
+                }
+                out = decode_huffman_fast(s, buf, out, out_end);
+                if(s->state != STATE_HUFFMAN)
+                    break;
+                out = decode_huffman_slow(s, buf, out, out_end, &blocked);
+                if(blocked)
+                    goto suspend;
+                break;
+
+            case STATE_TRAILER:
+                s->adler = adler32_update(s->adler, out_start, out - out_start);
+                out_start = out;
+                getbits(s, s->bitcount & 7);
+                header = getbits(s, 8) << 24;
+                header |= getbits(s, 8) << 16;
+                header |= getbits(s, 8) << 8;
+                header |= getbits(s, 8);
+                s->state = ((header == s->adler) && !truncated(s)) ? STATE_DONE : STATE_ERROR;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+suspend:
+    s->adler = adler32_update(s->adler, out_start, out - out_start);
+    *pos = out - buf;
+}
+
+static inflate_stream * builtin_stream_new(inflate_input_fn input, void * user, uint32_t max_span){
+    builtin_stream * s = (builtin_stream *) mem_malloc(sizeof(builtin_stream));
+    if(s == NULL)
+        return NULL;
+
+    memset(s, 0, offsetof(builtin_stream, litlen_table));
+    s->state = STATE_ZLIB_HEADER;
+    s->input = input;
+    s->user = user;
+    s->adler = 1;
+    s->window_size = window_size_for(max_span) + FAST_OUT_MARGIN;
+    s->window = (uint8_t *) mem_malloc(s->window_size);
+    if(s->window == NULL){
+        mem_free(s);
+        return NULL;
+    }
+
+    return (inflate_stream *) s;
+}
+
+static inflate_stream * builtin_stream_new_raw(inflate_input_fn input, void * user, uint32_t max_span){
+    builtin_stream * s = (builtin_stream *) builtin_stream_new(input, user, max_span);
+    if(s == NULL)
+        return NULL;
+
+    s->state = STATE_BLOCK_HEADER;
+    s->raw = true;
+    return (inflate_stream *) s;
+}
+
+static PNGdecoder_result builtin_stream_read(inflate_stream * stream, uint32_t size, const uint8_t ** span){
+    builtin_stream * s = (builtin_stream *) stream;
+    uint32_t keep_from;
+
+    while((s->write_pos - s->read_pos) < size){
+        if(s->state == STATE_DONE || s->state == STATE_ERROR)
+            return PNGDECODER_ZLIB_ERROR;
+
+        //Slide the window once decoding gets close to its end, keeping the history and the unread bytes
+        if(s->window_size - s->write_pos < size + FAST_OUT_MARGIN){
+            keep_from = (s->write_pos > HISTORY_SIZE) ? s->write_pos - HISTORY_SIZE : 0;
+            if(keep_from > s->read_pos)
+                keep_from = s->read_pos;
+            memmove(s->window, s->window + keep_from, s->write_pos - keep_from);
+            s->write_pos -= keep_from;
+            s->read_pos -= keep_from;
+        }
+
+        builtin_run(s, s->window, &s->write_pos, s->window_size);
+    }
+
+    *span = s->window + s->read_pos;
+    s->read_pos += size;
+    return PNGDECODER_OK;
+}
+
+static PNGdecoder_result builtin_stream_end(inflate_stream * stream){
+    builtin_stream * s = (builtin_stream *) stream;
+
+    if(s->write_pos != s->read_pos)
+        return PNGDECODER_ZLIB_ERROR;
+
+    //With no room left any further literal or match means extra data
+    builtin_run(s, s->window, &s->write_pos, s->write_pos);
+
+    return ((s->state == STATE_DONE) && !s->cut) ? PNGDECODER_OK : PNGDECODER_ZLIB_ERROR;
+}
+
+static PNGdecoder_result builtin_stream_end_flush(inflate_stream * stream){
+    builtin_stream * s = (builtin_stream *) stream;
+
+    if(s->write_pos != s->read_pos)
+        return PNGDECODER_ZLIB_ERROR;
+
+    //With no room left any further literal or match means data past the cut
+    builtin_run(s, s->window, &s->write_pos, s->write_pos);
+
+    return ((s->state == STATE_DONE) && s->cut) ? PNGDECODER_OK : PNGDECODER_ZLIB_ERROR;
+}
+
+static uint64_t builtin_stream_input_left(inflate_stream * stream){
+    builtin_stream * s = (builtin_stream *) stream;
+    uint64_t buffered = s->bitcount / 8;    //Whole bytes read ahead into the bit buffer, zeros past the input excluded
+
+    buffered = (buffered > s->overrun) ? buffered - s->overrun : 0;
+    return buffered + (uint64_t)(s->end - s->next);
+}
+
+static void builtin_stream_free(inflate_stream * stream){
+    builtin_stream * s = (builtin_stream *) stream;
+    if(s == NULL)
+        return;
+
+    mem_free(s->window);
+    mem_free(s);
+}
+
+static uint64_t builtin_stream_memory(uint32_t max_span){
+    return memory_block_size(sizeof(builtin_stream)) + memory_block_size(window_size_for(max_span) + FAST_OUT_MARGIN);
+}
+
+static const inflate_backend builtin_backend = {
+    "builtin",
+    builtin_stream_new,
+    builtin_stream_new_raw,
+    builtin_stream_read,
+    builtin_stream_end,
+    builtin_stream_end_flush,
+    builtin_stream_input_left,
+    builtin_stream_free,
+    builtin_stream_memory
+};
+
+
+/*      BACKEND SELECTION       */
+
+
+const inflate_backend * inflate_get_backend(PNGdecoder_inflate_backends id){
+    switch(id){
+#ifndef PNGDECODER_WITHOUT_ZLIB
+        case PNGDECODER_INFLATE_ZLIB:
+            return &zlib_backend;
+#endif // PNGDECODER_WITHOUT_ZLIB
+        case PNGDECODER_INFLATE_BUILTIN:
+            return &builtin_backend;
+        default:
+            return NULL;
+    }
+}
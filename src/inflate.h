@@ -0,0 +1,67 @@
+#ifndef PNGdecoder_INFLATE_H
+#define PNGdecoder_INFLATE_H
+
+#include <stdint.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      INFLATE BACKEND INTERFACE       */
+
+//Every backend decodes a zlib stream(RFC 1950 wrapper + RFC 1951 deflate data) pulled from the caller through
+//an input callback and exposes the inflated bytes as contiguous spans, so that the unfilter stage can consume
+//each row straight from the backend output window without an intermediate full-image buffer
+
+
+typedef struct _inflate_stream inflate_stream;     //Opaque, owned by the backend which created it
+
+//Input callback: writes in the second argument a pointer to the next segment of compressed data and returns its
+//size, 0 once the input is exhausted; segments must stay valid until the next call, backends consume them in order
+//Argument 1: user pointer given to stream_new
+typedef uint32_t (*inflate_input_fn)(void *, const uint8_t **);
+
+typedef struct _inflate_backend {
+    const char * name;
+
+    //Allocates a stream reading from the given callback and user pointer(arguments 1 and 2), argument 3 is the
+    //largest span that will ever be requested through stream_read
+    inflate_stream * (*stream_new)(inflate_input_fn, void *, uint32_t);
+
+    //As stream_new, for raw deflate data(no zlib header nor checksum) starting at a block boundary with an empty history,
+    //a restart point left by an encoder full flush; stream_end then only checks that the final block ends there
+    inflate_stream * (*stream_new_raw)(inflate_input_fn, void *, uint32_t);
+
+    //Inflates until the number of bytes given as argument 2 is available and writes a pointer to them in
+    //argument 3; the span stays valid until the next call; fails if the stream is corrupt or ends early
+    PNGdecoder_result (*stream_read)(inflate_stream *, uint32_t, const uint8_t **);
+
+    //Checks that the stream ends exactly where the caller stopped reading and that its checksum is valid
+    PNGdecoder_result (*stream_end)(inflate_stream *);
+
+    //As stream_end, for a stream cut at a restart point left by an encoder full flush(a band that is not the last one):
+    //checks that nothing more inflates, that the input is exhausted at a block boundary and that no final block was seen
+    PNGdecoder_result (*stream_end_flush)(inflate_stream *);
+
+    //Input bytes pulled from the callback but lying past the end of the stream, once stream_end succeeded; decoders
+    //tolerate them, the validator does not
+    uint64_t (*stream_input_left)(inflate_stream *);
+
+    void (*stream_free)(inflate_stream *);
+
+    //Heap bytes of a stream created for the given largest span, an upper bound, for memory predictions
+    uint64_t (*stream_memory)(uint32_t);
+} inflate_backend;
+
+
+//Returns the backend implementing the given identifier, NULL if unknown or not compiled in
+const inflate_backend * inflate_get_backend(PNGdecoder_inflate_backends);
+
+//Single contiguous input segment, for callers holding the whole zlib stream in memory
+typedef struct _inflate_memory_input {
+    const uint8_t * data;
+    uint32_t size;
+} inflate_memory_input;
+
+//inflate_input_fn over an inflate_memory_input, hands out its segment once
+uint32_t inflate_memory_input_fn(void *, const uint8_t **);
+
+#endif // PNGdecoder_INFLATE_H
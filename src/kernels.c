@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "kernels.h"
+
+
+/*      LIBPNG UTILS        */
+
+extern unsigned long crc_table[256];
+extern void make_crc_table(void);
+extern uint8_t paeth_predictor(uint8_t, uint8_t, uint8_t);
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+static const char * cpu_level_names[PNGDECODER_CPU_LEVELS_COUNT] = {
+    "scalar",
+    "sse2",
+    "sse4",
+    "avx2"
+};          //Accepted values of the PNGDECODER_CPU environment variable
+
+static kernel_table tables[PNGDECODER_CPU_LEVELS_COUNT];
+static PNGdecoder_cpu_levels supported_level = PNGDECODER_CPU_SCALAR;
+static const kernel_table * bound_table = NULL;
+
+static uint32_t crc_slices[8][256];     //Slice-by-8 tables, crc_slices[0] is the libpng table
+static uint8_t subbyte_luts[2][3][256][8];  //[scaled][log2(bit depth)][packed byte] -> unpacked samples
+
+
+/*      SCALAR KERNELS      */
+
+
+static uint32_t crc_update_scalar(uint32_t c, const uint8_t * buf, uint32_t len){
+    uint32_t lo, hi;
+
+    while(len && ((uintptr_t)buf & 7)){
+        c = crc_slices[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+        len--;
+    }
+    while(len >= 8){
+        memcpy(&lo, buf, 4);
+        memcpy(&hi, buf + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= c;
+        c = crc_slices[7][lo & 0xFF] ^ crc_slices[6][(lo >> 8) & 0xFF] ^ crc_slices[5][(lo >> 16) & 0xFF] ^ crc_slices[4][lo >> 24] ^
+            crc_slices[3][hi & 0xFF] ^ crc_slices[2][(hi >> 8) & 0xFF] ^ crc_slices[1][(hi >> 16) & 0xFF] ^ crc_slices[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while(len--)
+        c = crc_slices[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+
+    return c;
+}
+
+static void unfilter_none_scalar(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    memcpy(out, in, len);
+}
+
+static void unfilter_sub_scalar(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    uint32_t i;
+
+    for(i = 0; (i < bpp) && (i < len); i++)
+        out[i] = in[i];
+    for(; i < len; i++)
+        out[i] = in[i] + out[i - bpp];
+}
+
+static void unfilter_up_scalar(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    uint32_t i;
+
+    for(i = 0; i < len; i++)
+        out[i] = in[i] + prev[i];
+}
+
+static void unfilter_avg_scalar(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    uint32_t i;
+
+    for(i = 0; (i < bpp) && (i < len); i++)
+        out[i] = in[i] + (prev[i] >> 1);
+    for(; i < len; i++)
+        out[i] = in[i] + ((out[i - bpp] + prev[i]) >> 1);
+}
+
+static void unfilter_paeth_scalar(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    uint32_t i;
+
+    for(i = 0; (i < bpp) && (i < len); i++)
+        out[i] = in[i] + prev[i];       //Left and left up are 0, Paeth picks up
+    for(; i < len; i++)
+        out[i] = in[i] + paeth_predictor(out[i - bpp], prev[i], prev[i - bpp]);
+}
+
+static void unpack_subbyte_scalar(uint8_t * out, const uint8_t * in, uint32_t n, uint8_t bit_depth, bool scale){
+    uint8_t per_byte = 8 / bit_depth;
+    const uint8_t (*lut)[8] = subbyte_luts[scale][(bit_depth == 1) ? 0 : (bit_depth == 2) ? 1 : 2];
+
+    while(n >= per_byte){
+        memcpy(out, lut[*in++], per_byte);
+        out += per_byte;
+        n -= per_byte;
+    }
+    if(n)
+        memcpy(out, lut[*in], n);
+}
+
+static void palette_RGB8_scalar(PNGdecoder_RGB8_t * out, const uint8_t * indices, uint32_t n, const PNGdecoder_RGBA8_t * palette){
+    uint32_t i;
+
+    for(i = 0; i < n; i++){
+        out[i].R = palette[indices[i]].R;
+        out[i].G = palette[indices[i]].G;
+        out[i].B = palette[indices[i]].B;
+    }
+}
+
+static void palette_RGBA8_scalar(PNGdecoder_RGBA8_t * out, const uint8_t * indices, uint32_t n, const PNGdecoder_RGBA8_t * palette){
+    uint32_t i;
+
+    for(i = 0; i < n; i++)
+        out[i] = palette[indices[i]];
+}
+
+static void swap16_scalar(uint16_t * out, const uint8_t * in, uint32_t n){
+    uint32_t i;
+
+    for(i = 0; i < n; i++)
+        out[i] = (in[(i * 2)] << 8) | in[(i * 2) + 1];
+}
+
+static void strip16_scalar(uint8_t * out, const uint8_t * in, uint32_t n, PNGdecoder_strip16_modes mode){
+    uint32_t i;
+
+    if(mode == PNGDECODER_STRIP16_HIGH_BYTE){
+        for(i = 0; i < n; i++)
+            out[i] = in[(i * 2)];
+    } else {
+        for(i = 0; i < n; i++)
+            out[i] = ((((in[(i * 2)] << 8) | in[(i * 2) + 1]) * 255) + 32895) >> 16;    //Exact rounding of x / 257
+    }
+}
+
+static void premultiply8_scalar(uint8_t * pixels, uint32_t n, uint8_t channels){
+    uint32_t i, t;
+    uint8_t c, alpha;
+
+    for(i = 0; i < n; i++, pixels += channels){
+        alpha = pixels[channels - 1];
+        for(c = 0; c < channels - 1; c++){
+            t = (pixels[c] * alpha) + 128;
+            pixels[c] = (t + (t >> 8)) >> 8;        //Exact round(x * alpha / 255)
+        }
+    }
+}
+
+static void premultiply16_scalar(uint16_t * pixels, uint32_t n, uint8_t channels){
+    uint32_t i, t;
+    uint8_t c;
+    uint16_t alpha;
+
+    for(i = 0; i < n; i++, pixels += channels){
+        alpha = pixels[channels - 1];
+        for(c = 0; c < channels - 1; c++){
+            t = ((uint32_t) pixels[c] * alpha) + 32768;
+            pixels[c] = (t + (t >> 16)) >> 16;      //Exact round(x * alpha / 65535)
+        }
+    }
+}
+
+static void G8_to_RGBA8_scalar(PNGdecoder_RGBA8_t * out, const uint8_t * in, uint32_t n){
+    uint32_t i;
+
+    for(i = 0; i < n; i++){
+        out[i].R = out[i].G = out[i].B = in[i];
+        out[i].A = 0xFF;
+    }
+}
+
+static void G8A_to_RGBA8_scalar(PNGdecoder_RGBA8_t * out, const PNGdecoder_grayscale8a_t * in, uint32_t n){
+    uint32_t i;
+
+    for(i = 0; i < n; i++){
+        out[i].R = out[i].G = out[i].B = in[i].level;
+        out[i].A = in[i].alpha;
+    }
+}
+
+static void RGB8_to_RGBA8_scalar(PNGdecoder_RGBA8_t * out, const PNGdecoder_RGB8_t * in, uint32_t n){
+    uint32_t i;
+
+    for(i = 0; i < n; i++){
+        out[i].R = in[i].R;
+        out[i].G = in[i].G;
+        out[i].B = in[i].B;
+        out[i].A = 0xFF;
+    }
+}
+
+
+/*      TABLES AND DISPATCH       */
+
+
+static void make_luts(void){
+    uint32_t i, j, k;
+    uint8_t depth, sample;
+
+    make_crc_table();
+    for(i = 0; i < 256; i++)
+        crc_slices[0][i] = crc_table[i];
+    for(i = 0; i < 256; i++)
+        for(j = 1; j < 8; j++)
+            crc_slices[j][i] = crc_slices[0][crc_slices[j - 1][i] & 0xFF] ^ (crc_slices[j - 1][i] >> 8);
+
+    for(k = 0; k < 3; k++){
+        depth = 1 << k;
+        for(i = 0; i < 256; i++)
+            for(j = 0; j < 8u / depth; j++){
+                sample = (i >> (8 - depth - (j * depth))) & ((1 << depth) - 1);
+                subbyte_luts[0][k][i][j] = sample;
+                subbyte_luts[1][k][i][j] = sample * (0xFF / ((1 << depth) - 1));
+            }
+    }
+}
+
+static PNGdecoder_cpu_levels detect_level(void){
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+        return PNGDECODER_CPU_AVX2;
+    if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3"))
+        return PNGDECODER_CPU_SSE4;
+    return PNGDECODER_CPU_SSE2;
+#else
+    return PNGDECODER_CPU_SCALAR;
+#endif
+}
+
+//Runs once per process, before main when loaded as a shared object
+__attribute__((constructor)) static void kernels_init(void){
+    PNGdecoder_cpu_levels level;
+    const char * forced = getenv("PNGDECODER_CPU");
+    uint8_t i;
+
+    if(bound_table != NULL)
+        return;
+
+    make_luts();
+
+    tables[PNGDECODER_CPU_SCALAR] = (kernel_table){
+        PNGDECODER_CPU_SCALAR,
+        crc_update_scalar,
+        { unfilter_none_scalar, unfilter_sub_scalar, unfilter_up_scalar, unfilter_avg_scalar, unfilter_paeth_scalar },
+        unpack_subbyte_scalar,
+        palette_RGB8_scalar,
+        palette_RGBA8_scalar,
+        swap16_scalar,
+        strip16_scalar,
+        premultiply8_scalar,
+        premultiply16_scalar,
+        G8_to_RGBA8_scalar,
+        G8A_to_RGBA8_scalar,
+        RGB8_to_RGBA8_scalar
+    };
+
+    supported_level = detect_level();
+    for(level = PNGDECODER_CPU_SCALAR + 1; level <= supported_level; level++){
+        tables[level] = tables[level - 1];
+        tables[level].level = level;
+#if defined(__x86_64__)
+        kernels_x86_init(&tables[level], level);
+#endif
+    }
+
+    level = supported_level;
+    if(forced != NULL)
+        for(i = 0; i < PNGDECODER_CPU_LEVELS_COUNT; i++)
+            if(!strcmp(forced, cpu_level_names[i]) && (i < level))
+                level = i;
+
+    bound_table = &tables[level];
+}
+
+const kernel_table * kernels_get(void){
+    if(bound_table == NULL)
+        kernels_init();
+
+    return bound_table;
+}
+
+const kernel_table * kernels_get_level(PNGdecoder_cpu_levels level){
+    kernels_get();
+    if((level < 0) || (level > supported_level))
+        return NULL;
+
+    return &tables[level];
+}
+
+PNGdecoder_cpu_levels PNGdecoder_get_cpu_level(void){
+    return kernels_get()->level;
+}
@@ -0,0 +1,71 @@
+#ifndef PNGdecoder_KERNELS_H
+#define PNGdecoder_KERNELS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      HOT KERNELS DISPATCH TABLE      */
+
+//One table per CPU level, bound once per process from the detected features(or from the PNGDECODER_CPU environment
+//variable, clamped to what the CPU supports); every level only fills in the kernels it improves and inherits the others
+//from the level below
+
+
+typedef void (*unfilter_fn)(uint8_t *, const uint8_t *, const uint8_t *, uint32_t, uint8_t);
+
+typedef struct _kernel_table {
+    PNGdecoder_cpu_levels level;
+
+    //Updates a CRC register(not inverted, as update_crc) over a buffer
+    //Argument 1: register, Argument 2: buffer, Argument 3: buffer size
+    uint32_t (*crc_update)(uint32_t, const uint8_t *, uint32_t);
+
+    //Unfilters a row, indexed by filter type
+    //Argument 1: output row, Argument 2: filtered row(without the filter byte), Argument 3: previous unfiltered row, all
+    //zeros for the first row of an image or Adam7 step, Argument 4: row size in bytes, Argument 5: bytes per pixel(1 for
+    //sub-byte depths)
+    unfilter_fn unfilter[5];
+
+    //Unpacks sub-byte samples into one byte each, optionally scaled to [0, 255]
+    //Argument 1: output, Argument 2: packed row, Argument 3: number of samples, Argument 4: bit depth(1, 2, 4),
+    //Argument 5: scale(grayscale) or keep as is(palette indices)
+    void (*unpack_subbyte)(uint8_t *, const uint8_t *, uint32_t, uint8_t, bool);
+
+    //Looks palette indices up into pixels, the palette always has 256 entries
+    //Argument 1: output pixels, Argument 2: indices, Argument 3: number of pixels, Argument 4: palette
+    void (*palette_RGB8)(PNGdecoder_RGB8_t *, const uint8_t *, uint32_t, const PNGdecoder_RGBA8_t *);
+    void (*palette_RGBA8)(PNGdecoder_RGBA8_t *, const uint8_t *, uint32_t, const PNGdecoder_RGBA8_t *);
+
+    //Converts big endian 16 bit samples to native ones
+    //Argument 1: output samples, Argument 2: big endian row, Argument 3: number of samples
+    void (*swap16)(uint16_t *, const uint8_t *, uint32_t);
+
+    //Reduces big endian 16 bit samples to 8 bits, Argument 4: PNGDECODER_STRIP16_HIGH_BYTE or PNGDECODER_STRIP16_ROUND,
+    //other arguments as swap16
+    void (*strip16)(uint8_t *, const uint8_t *, uint32_t, PNGdecoder_strip16_modes);
+
+    //Premultiplies color by alpha in place, rounding exactly(x * alpha / max to the nearest integer)
+    //Argument 1: pixels, Argument 2: number of pixels, Argument 3: samples per pixel, 2(grayscale + alpha) or 4(RGBA)
+    void (*premultiply8)(uint8_t *, uint32_t, uint8_t);
+    void (*premultiply16)(uint16_t *, uint32_t, uint8_t);
+
+    //Format conversions to RGBA8, Argument 1: output pixels, Argument 2: input pixels, Argument 3: number of pixels
+    void (*G8_to_RGBA8)(PNGdecoder_RGBA8_t *, const uint8_t *, uint32_t);
+    void (*G8A_to_RGBA8)(PNGdecoder_RGBA8_t *, const PNGdecoder_grayscale8a_t *, uint32_t);
+    void (*RGB8_to_RGBA8)(PNGdecoder_RGBA8_t *, const PNGdecoder_RGB8_t *, uint32_t);
+} kernel_table;
+
+
+//Returns the table bound for this process
+const kernel_table * kernels_get(void);
+
+//Returns the table of the given level, NULL if the CPU or the build does not support it; used to compare levels
+const kernel_table * kernels_get_level(PNGdecoder_cpu_levels);
+
+//Overrides the kernels a level above scalar improves, defined in kernels_x86.c
+//Argument 1: table, already holding a copy of the level below, Argument 2: its level
+void kernels_x86_init(kernel_table *, PNGdecoder_cpu_levels);
+
+#endif // PNGdecoder_KERNELS_H
@@ -0,0 +1,480 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "kernels.h"
+
+//Every function carries its own target attribute, so this file builds with the baseline x86-64 flags and the wider
+//instructions only run once kernels.c has checked the CPU supports them
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+//  --> https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/fast-crc-computation-generic-polynomials-pclmulqdq-paper.pdf
+//  --> libpng, intel/filter_sse2_intrinsics.c
+
+
+/*      SSE2        */
+
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_SSE4 __attribute__((target("ssse3,sse4.1,pclmul")))
+#define TARGET_AVX2 __attribute__((target("avx2,ssse3,sse4.1,pclmul")))
+
+#define ALWAYS_INLINE __attribute__((always_inline))
+
+//Loads/stores a single pixel of 3, 4, 6 or 8 bytes into the low lanes; always inlined with a constant size, so the
+//copies turn into plain moves. Pixels of 3 and 6 bytes move 4 and 8 bytes, spilling into the next pixel which is
+//overwritten right after, except for the last one of the row
+TARGET_SSE2 static inline ALWAYS_INLINE __m128i load_pixel(const uint8_t * p, uint8_t bpp, bool last){
+    uint32_t narrow;
+    uint64_t wide = 0;
+
+    if(last && ((bpp == 3) || (bpp == 6))){
+        memcpy(&wide, p, bpp);
+        return _mm_cvtsi64_si128((int64_t) wide);
+    }
+    if(bpp <= 4){
+        memcpy(&narrow, p, 4);
+        return _mm_cvtsi32_si128((int32_t) narrow);
+    }
+    memcpy(&wide, p, 8);
+    return _mm_cvtsi64_si128((int64_t) wide);
+}
+
+TARGET_SSE2 static inline ALWAYS_INLINE void store_pixel(uint8_t * p, __m128i v, uint8_t bpp, bool last){
+    uint64_t raw = (uint64_t) _mm_cvtsi128_si64(v);
+
+    if(last && ((bpp == 3) || (bpp == 6)))
+        memcpy(p, &raw, bpp);
+    else
+        memcpy(p, &raw, (bpp <= 4) ? 4 : 8);
+}
+
+TARGET_SSE2 static inline __m128i abs_i16(__m128i x){
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+TARGET_SSE2 static inline __m128i if_then_else(__m128i c, __m128i t, __m128i e){
+    return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+}
+
+TARGET_SSE2 static void unfilter_up_sse2(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    uint32_t i = 0;
+
+    for(; i + 16 <= len; i += 16)
+        _mm_storeu_si128((__m128i *)(out + i), _mm_add_epi8(_mm_loadu_si128((const __m128i *)(in + i)), _mm_loadu_si128((const __m128i *)(prev + i))));
+    for(; i < len; i++)
+        out[i] = in[i] + prev[i];
+}
+
+//Sub, Avg and Paeth are serial from pixel to pixel, vectors only span the bytes of one pixel; pixels of 1 or 2 bytes
+//gain nothing and stay scalar
+
+TARGET_SSE2 static inline ALWAYS_INLINE void sub_sse2(uint8_t * out, const uint8_t * in, uint32_t len, uint8_t bpp){
+    __m128i d = _mm_setzero_si128();
+    uint32_t i;
+    bool last;
+
+    for(i = 0; i < len; i += bpp){
+        last = (i + bpp) == len;
+        d = _mm_add_epi8(load_pixel(in + i, bpp, last), d);
+        store_pixel(out + i, d, bpp, last);
+    }
+}
+
+TARGET_SSE2 static inline ALWAYS_INLINE void avg_sse2(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    __m128i a, b, avg, d = _mm_setzero_si128();
+    uint32_t i;
+    bool last;
+
+    for(i = 0; i < len; i += bpp){
+        last = (i + bpp) == len;
+        b = load_pixel(prev + i, bpp, last);
+        a = d;
+        //PNG wants a truncating average, _mm_avg_epu8 rounds up: subtract the rounding bit back
+        avg = _mm_avg_epu8(a, b);
+        avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+        d = _mm_add_epi8(load_pixel(in + i, bpp, last), avg);
+        store_pixel(out + i, d, bpp, last);
+    }
+}
+
+TARGET_SSE2 static inline ALWAYS_INLINE void paeth_sse2(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a, b = zero, c, d = zero, pa, pb, pc, smallest, nearest;
+    uint32_t i;
+    bool last;
+
+    //16 bit lanes: a = left, b = up, c = left up, d = current; the first pixel has a = c = 0
+    for(i = 0; i < len; i += bpp){
+        last = (i + bpp) == len;
+        c = b;
+        b = _mm_unpacklo_epi8(load_pixel(prev + i, bpp, last), zero);
+        a = d;
+        d = _mm_unpacklo_epi8(load_pixel(in + i, bpp, last), zero);
+
+        pa = _mm_sub_epi16(b, c);       //p - a = b - c
+        pb = _mm_sub_epi16(a, c);       //p - b = a - c
+        pc = _mm_add_epi16(pa, pb);     //p - c
+        pa = abs_i16(pa);
+        pb = abs_i16(pb);
+        pc = abs_i16(pc);
+
+        smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        nearest = if_then_else(_mm_cmpeq_epi16(smallest, pa), a, if_then_else(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+        d = _mm_add_epi8(d, nearest);   //Bytewise, wraps modulo 256 and leaves the high byte of each lane at 0
+        store_pixel(out + i, _mm_packus_epi16(d, d), bpp, last);
+    }
+}
+
+//Instantiates a kernel per pixel size, other sizes(or rows not made of whole pixels) go to the scalar one
+#define UNFILTER_BY_BPP(name, body, filter, ...)                                                                \
+    TARGET_SSE2 static void name(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){   \
+        if((bpp >= 3) && (len % bpp == 0)){                                                                 \
+            switch(bpp){                                                                                    \
+                case 3: body(__VA_ARGS__, len, 3); return;                                                  \
+                case 4: body(__VA_ARGS__, len, 4); return;                                                  \
+                case 6: body(__VA_ARGS__, len, 6); return;                                                  \
+                case 8: body(__VA_ARGS__, len, 8); return;                                                  \
+            }                                                                                               \
+        }                                                                                                   \
+        kernels_get_level(PNGDECODER_CPU_SCALAR)->unfilter[filter](out, in, prev, len, bpp);               \
+    }
+
+UNFILTER_BY_BPP(unfilter_sub_sse2, sub_sse2, 1, out, in)
+UNFILTER_BY_BPP(unfilter_avg_sse2, avg_sse2, 3, out, in, prev)
+UNFILTER_BY_BPP(unfilter_paeth_sse2, paeth_sse2, 4, out, in, prev)
+
+TARGET_SSE2 static inline __m128i bswap_epi16_sse2(__m128i x){
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+//round(v / 257) without leaving 16 bit lanes: ((v + 128) - ((v + 128) >> 8)) >> 8, with (v + 128) >> 8 computed as
+//((v >> 1) + 64) >> 7 so that no intermediate value overflows
+TARGET_SSE2 static inline __m128i round16_to_8_sse2(__m128i v){
+    __m128i q = _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(v, 1), _mm_set1_epi16(64)), 7);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(v, q), _mm_set1_epi16(128)), 8);
+}
+
+TARGET_SSE2 static void swap16_sse2(uint16_t * out, const uint8_t * in, uint32_t n){
+    uint32_t i = 0;
+
+    for(; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i), bswap_epi16_sse2(_mm_loadu_si128((const __m128i *)(in + (i * 2)))));
+    for(; i < n; i++)
+        out[i] = (in[(i * 2)] << 8) | in[(i * 2) + 1];
+}
+
+TARGET_SSE2 static void strip16_sse2(uint8_t * out, const uint8_t * in, uint32_t n, PNGdecoder_strip16_modes mode){
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    __m128i x0, x1;
+    uint32_t i = 0;
+
+    for(; i + 16 <= n; i += 16){
+        x0 = _mm_loadu_si128((const __m128i *)(in + (i * 2)));
+        x1 = _mm_loadu_si128((const __m128i *)(in + (i * 2) + 16));
+        if(mode == PNGDECODER_STRIP16_HIGH_BYTE){
+            x0 = _mm_and_si128(x0, low_bytes);      //Big endian: the high byte sits in the low half of each lane
+            x1 = _mm_and_si128(x1, low_bytes);
+        } else {
+            x0 = round16_to_8_sse2(bswap_epi16_sse2(x0));
+            x1 = round16_to_8_sse2(bswap_epi16_sse2(x1));
+        }
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(x0, x1));
+    }
+    if(i < n)
+        kernels_get_level(PNGDECODER_CPU_SCALAR)->strip16(out + i, in + (i * 2), n - i, mode);
+}
+
+//Two RGBA or four grayscale + alpha pixels per 64 bits, widened to 16 bit lanes; the alpha lanes are multiplied by 255
+//so that they come out unchanged
+TARGET_SSE2 static void premultiply8_sse2(uint8_t * pixels, uint32_t n, uint8_t channels){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_lanes = (channels == 4) ? _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1) : _mm_setr_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+    const __m128i opaque = _mm_and_si128(alpha_lanes, _mm_set1_epi16(255));
+    __m128i x, lo, hi, alpha_lo, alpha_hi;
+    uint32_t i = 0, samples = n * channels;
+
+    for(; i + 16 <= samples; i += 16){
+        x = _mm_loadu_si128((const __m128i *)(pixels + i));
+        lo = _mm_unpacklo_epi8(x, zero);
+        hi = _mm_unpackhi_epi8(x, zero);
+        if(channels == 4){
+            alpha_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+            alpha_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+        } else {
+            alpha_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xF5), 0xF5);
+            alpha_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xF5), 0xF5);
+        }
+        alpha_lo = _mm_or_si128(_mm_andnot_si128(alpha_lanes, alpha_lo), opaque);
+        alpha_hi = _mm_or_si128(_mm_andnot_si128(alpha_lanes, alpha_hi), opaque);
+
+        //t = x * alpha + 128, (t + (t >> 8)) >> 8, all within 16 bits
+        lo = _mm_add_epi16(_mm_mullo_epi16(lo, alpha_lo), _mm_set1_epi16(128));
+        hi = _mm_add_epi16(_mm_mullo_epi16(hi, alpha_hi), _mm_set1_epi16(128));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)(pixels + i), _mm_packus_epi16(lo, hi));
+    }
+    if(i < samples)
+        kernels_get_level(PNGDECODER_CPU_SCALAR)->premultiply8(pixels + i, (samples - i) / channels, channels);
+}
+
+
+/*      SSSE3, SSE4.1, PCLMUL        */
+
+
+//Folds 64 bytes per iteration with carry-less multiplications, then reduces to 32 bits with Barrett reduction;
+//buffers shorter than 64 bytes and the tail below 16 bytes go through the scalar table
+TARGET_SSE4 static uint32_t crc_update_pclmul(uint32_t crc, const uint8_t * buf, uint32_t len){
+    static const uint64_t __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t __attribute__((aligned(16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t __attribute__((aligned(16))) poly[] = { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+    const kernel_table * scalar = kernels_get_level(PNGDECODER_CPU_SCALAR);
+
+    if(len < 64)
+        return scalar->crc_update(crc, buf, len);
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i *) k1k2);
+    buf += 64;
+    len -= 64;
+
+    while(len >= 64){
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+
+    //Fold the 4 lanes into one
+    x0 = _mm_load_si128((const __m128i *) k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while(len >= 16){
+        x2 = _mm_loadu_si128((const __m128i *) buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    //128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    //Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i *) poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    crc = (uint32_t) _mm_extract_epi32(x1, 1);
+
+    return len ? scalar->crc_update(crc, buf, len) : crc;
+}
+
+TARGET_SSE4 static void swap16_ssse3(uint16_t * out, const uint8_t * in, uint32_t n){
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    uint32_t i = 0;
+
+    for(; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + (i * 2))), swap));
+    for(; i < n; i++)
+        out[i] = (in[(i * 2)] << 8) | in[(i * 2) + 1];
+}
+
+TARGET_SSE4 static void G8_to_RGBA8_ssse3(PNGdecoder_RGBA8_t * out, const uint8_t * in, uint32_t n){
+    const __m128i alpha = _mm_set1_epi32((int32_t) 0xFF000000);
+    const __m128i spread0 = _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1);
+    const __m128i spread1 = _mm_setr_epi8(4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1);
+    const __m128i spread2 = _mm_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1);
+    const __m128i spread3 = _mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+    __m128i g;
+    uint32_t i = 0;
+
+    for(; i + 16 <= n; i += 16){
+        g = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_shuffle_epi8(g, spread0), alpha));
+        _mm_storeu_si128((__m128i *)(out + i + 4), _mm_or_si128(_mm_shuffle_epi8(g, spread1), alpha));
+        _mm_storeu_si128((__m128i *)(out + i + 8), _mm_or_si128(_mm_shuffle_epi8(g, spread2), alpha));
+        _mm_storeu_si128((__m128i *)(out + i + 12), _mm_or_si128(_mm_shuffle_epi8(g, spread3), alpha));
+    }
+    for(; i < n; i++){
+        out[i].R = out[i].G = out[i].B = in[i];
+        out[i].A = 0xFF;
+    }
+}
+
+TARGET_SSE4 static void G8A_to_RGBA8_ssse3(PNGdecoder_RGBA8_t * out, const PNGdecoder_grayscale8a_t * in, uint32_t n){
+    const __m128i spread0 = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+    const __m128i spread1 = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+    __m128i ga;
+    uint32_t i = 0;
+
+    for(; i + 8 <= n; i += 8){
+        ga = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(ga, spread0));
+        _mm_storeu_si128((__m128i *)(out + i + 4), _mm_shuffle_epi8(ga, spread1));
+    }
+    for(; i < n; i++){
+        out[i].R = out[i].G = out[i].B = in[i].level;
+        out[i].A = in[i].alpha;
+    }
+}
+
+TARGET_SSE4 static void RGB8_to_RGBA8_ssse3(PNGdecoder_RGBA8_t * out, const PNGdecoder_RGB8_t * in, uint32_t n){
+    const __m128i alpha = _mm_set1_epi32((int32_t) 0xFF000000);
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    uint32_t i = 0;
+
+    //16 byte loads of 12 byte groups: stop while a whole vector is still readable
+    for(; i + 6 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), spread), alpha));
+    for(; i < n; i++){
+        out[i].R = in[i].R;
+        out[i].G = in[i].G;
+        out[i].B = in[i].B;
+        out[i].A = 0xFF;
+    }
+}
+
+
+/*      AVX2        */
+
+
+TARGET_AVX2 static void unfilter_up_avx2(uint8_t * out, const uint8_t * in, const uint8_t * prev, uint32_t len, uint8_t bpp){
+    uint32_t i = 0;
+
+    for(; i + 32 <= len; i += 32)
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(in + i)), _mm256_loadu_si256((const __m256i *)(prev + i))));
+    for(; i < len; i++)
+        out[i] = in[i] + prev[i];
+}
+
+TARGET_AVX2 static void swap16_avx2(uint16_t * out, const uint8_t * in, uint32_t n){
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    uint32_t i = 0;
+
+    for(; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + (i * 2))), swap));
+    for(; i < n; i++)
+        out[i] = (in[(i * 2)] << 8) | in[(i * 2) + 1];
+}
+
+TARGET_AVX2 static void strip16_avx2(uint8_t * out, const uint8_t * in, uint32_t n, PNGdecoder_strip16_modes mode){
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    __m256i x0, x1, q0, q1;
+    uint32_t i = 0;
+
+    for(; i + 32 <= n; i += 32){
+        x0 = _mm256_loadu_si256((const __m256i *)(in + (i * 2)));
+        x1 = _mm256_loadu_si256((const __m256i *)(in + (i * 2) + 32));
+        if(mode == PNGDECODER_STRIP16_HIGH_BYTE){
+            x0 = _mm256_and_si256(x0, low_bytes);
+            x1 = _mm256_and_si256(x1, low_bytes);
+        } else {
+            //Same rounding as round16_to_8_sse2
+            x0 = _mm256_shuffle_epi8(x0, swap);
+            x1 = _mm256_shuffle_epi8(x1, swap);
+            q0 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_srli_epi16(x0, 1), _mm256_set1_epi16(64)), 7);
+            q1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_srli_epi16(x1, 1), _mm256_set1_epi16(64)), 7);
+            x0 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_sub_epi16(x0, q0), _mm256_set1_epi16(128)), 8);
+            x1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_sub_epi16(x1, q1), _mm256_set1_epi16(128)), 8);
+        }
+        //packus works within 128 bit lanes, put the quarters back in order
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(x0, x1), 0xD8));
+    }
+    if(i < n)
+        kernels_get_level(PNGDECODER_CPU_SSE2)->strip16(out + i, in + (i * 2), n - i, mode);
+}
+
+TARGET_AVX2 static void palette_RGBA8_avx2(PNGdecoder_RGBA8_t * out, const uint8_t * indices, uint32_t n, const PNGdecoder_RGBA8_t * palette){
+    uint32_t i = 0;
+    __m256i idx;
+
+    for(; i + 8 <= n; i += 8){
+        idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices + i)));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_i32gather_epi32((const int *) palette, idx, 4));
+    }
+    for(; i < n; i++)
+        out[i] = palette[indices[i]];
+}
+
+
+/*      LEVEL BINDING       */
+
+
+void kernels_x86_init(kernel_table * table, PNGdecoder_cpu_levels level){
+    switch(level){
+        case PNGDECODER_CPU_SSE2:
+            table->unfilter[1] = unfilter_sub_sse2;
+            table->unfilter[2] = unfilter_up_sse2;
+            table->unfilter[3] = unfilter_avg_sse2;
+            table->unfilter[4] = unfilter_paeth_sse2;
+            table->swap16 = swap16_sse2;
+            table->strip16 = strip16_sse2;
+            table->premultiply8 = premultiply8_sse2;
+            break;
+        case PNGDECODER_CPU_SSE4:
+            table->crc_update = crc_update_pclmul;
+            table->swap16 = swap16_ssse3;
+            table->G8_to_RGBA8 = G8_to_RGBA8_ssse3;
+            table->G8A_to_RGBA8 = G8A_to_RGBA8_ssse3;
+            table->RGB8_to_RGBA8 = RGB8_to_RGBA8_ssse3;
+            break;
+        case PNGDECODER_CPU_AVX2:
+            table->unfilter[2] = unfilter_up_avx2;
+            table->palette_RGBA8 = palette_RGBA8_avx2;
+            table->swap16 = swap16_avx2;
+            table->strip16 = strip16_avx2;
+            break;
+        default:
+            break;
+    }
+}
+
+#endif // __x86_64__ && __GNUC__
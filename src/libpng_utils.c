@@ -26,6 +26,7 @@ void make_crc_table(void){
         }
         crc_table[n] = c;
     }
+    crc_table_computed = 1;
 }
 
 unsigned long update_crc(unsigned long crc, unsigned char *buf, int len){
@@ -0,0 +1,569 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define PNGdecoder_IMPORT
+#include <PNGdecoder/PNGdecoder.h>
+
+#include "memory.h"
+#include "decoder.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+typedef struct _load_job {
+    uint32_t index;
+    uint8_t * bytes;            //Whole file, handed over to the decoder
+    uint64_t size;
+    PNGdecoder_result result;   //Of the read
+} load_job;
+
+typedef struct _job_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    load_job * jobs;            //Ring
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    bool closed;                //No more pushes, poppers drain and stop
+} job_queue;                    //Files read and waiting for a decoder
+
+typedef struct _batch {
+    const char ** file_names;
+    uint32_t n;
+    PNGdecoder_options options;
+    PNGdecoder_batch_callback callback;
+    void * user;
+    job_queue queue;
+    uint32_t next_file;         //Next file for the pread workers, atomic
+} batch;
+
+typedef struct _uring {
+    int fd;
+    void * sq_ring;
+    void * cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe * sqes;
+    size_t sqes_size;
+    uint32_t * sq_head;
+    uint32_t * sq_tail;
+    uint32_t * sq_array;
+    uint32_t sq_mask;
+    uint32_t * cq_head;
+    uint32_t * cq_tail;
+    struct io_uring_cqe * cqes;
+    uint32_t cq_mask;
+    uint32_t queued;            //SQEs written since the last submission
+} uring;                        //Raw io_uring rings, without liburing
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_OPENING,
+    SLOT_READING,
+    SLOT_STOPPED                //Its last SQE completed after io_uring_enter failed, left to a blocking read
+} slot_states;
+
+typedef struct _uring_slot {
+    slot_states state;
+    uint32_t index;
+    int fd;
+    uint8_t * bytes;
+    uint64_t size;
+    uint64_t done;
+} uring_slot;                   //One file in flight on the io_uring path
+
+static const uint32_t uring_read_max = 1 << 30;     //Read SQE lengths are 32 bit, larger files take several
+
+
+//False when the job slots cannot be allocated, nothing is then left to destroy
+static bool queue_init(job_queue *, uint32_t);
+static void queue_destroy(job_queue *);
+//Blocks while the queue is full
+static void queue_push(job_queue *, load_job);
+//Blocks while the queue is empty, false once it is closed and drained
+static bool queue_pop(job_queue *, load_job *);
+static void queue_close(job_queue *);
+
+static void * decode_worker(void *);
+static void * pread_worker(void *);
+
+//Reads a whole file with blocking calls
+static load_job read_file_blocking(const char *, uint32_t);
+
+//Sets the rings up, false if io_uring or its open and read operations are not available
+static bool uring_init(uring *, uint32_t);
+static void uring_free(uring *);
+static struct io_uring_sqe * uring_sqe(uring *);
+//Submits the queued SQEs and waits for at least one completion
+static bool uring_submit_wait(uring *);
+//After a failed io_uring_enter, waits for the SQEs still owned by the kernel so that no read lands in a freed buffer,
+//closing the files they opened; false if the ring cannot be entered any more, the slots still in flight keep theirs
+static bool uring_drain(uring *, uring_slot *, uint32_t);
+//Reads through io_uring, queue depth files in flight, pushing each one as soon as it is complete
+static void uring_read_all(batch *, uring *, uint32_t);
+
+
+/*      INTERFACE       */
+
+
+void PNGdecoder_loader_config_init(PNGdecoder_loader_config * config){
+    config->queue_depth = 32;
+    config->decode_threads = 0;
+    config->io_mode = PNGDECODER_IO_AUTO;
+}
+
+PNGdecoder_result PNGdecoder_load_batch(const char ** file_names, uint32_t n, const PNGdecoder_options * options,
+                                        const PNGdecoder_loader_config * config, PNGdecoder_batch_callback callback, void * user){
+    PNGdecoder_loader_config defaults;
+    pthread_t * decoders, * readers = NULL;
+    uint32_t decode_n, depth, started, i;
+    long cpus;
+    bool use_uring = false;
+    uring ring;
+    batch b;
+
+    if((file_names == NULL) || (callback == NULL) || ((options != NULL) && ((options->tensor != NULL) || (options->raster_file != NULL) || (options->row_callback != NULL))))
+        return PNGDECODER_INVALID_ARGUMENT;     //A tensor would be shared by every file
+    if(config == NULL){
+        PNGdecoder_loader_config_init(&defaults);
+        config = &defaults;
+    }
+    if(n == 0)
+        return PNGDECODER_OK;
+
+    depth = (config->queue_depth != 0) ? config->queue_depth : 1;
+    decode_n = config->decode_threads;
+    if(decode_n == 0){
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        decode_n = (cpus > 0) ? cpus : 1;
+    }
+
+    if(config->io_mode != PNGDECODER_IO_THREADS)
+        use_uring = uring_init(&ring, depth);
+    if(!use_uring && (config->io_mode == PNGDECODER_IO_URING))
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    b.file_names = file_names;
+    b.n = n;
+    if(options != NULL)
+        b.options = *options;
+    else
+        PNGdecoder_options_init(&b.options);
+    b.callback = callback;
+    b.user = user;
+    b.next_file = 0;
+    if(!queue_init(&b.queue, depth + decode_n)){     //Reads stay ahead of the decoders without buffering the whole batch
+        if(use_uring)
+            uring_free(&ring);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+
+    //Fewer threads than asked for still get through the batch, none at all fails it before anything is read
+    decoders = (pthread_t *) mem_malloc(decode_n * sizeof(pthread_t));
+    for(started = 0; (decoders != NULL) && (started < decode_n); started++)
+        if(pthread_create(&decoders[started], NULL, decode_worker, &b))
+            break;
+    if(started == 0){
+        if(use_uring)
+            uring_free(&ring);
+        mem_free(decoders);
+        queue_destroy(&b.queue);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    decode_n = started;
+
+    if(use_uring){
+        uring_read_all(&b, &ring, depth);
+        uring_free(&ring);
+    } else {
+        readers = (pthread_t *) mem_malloc(depth * sizeof(pthread_t));
+        for(started = 0; (readers != NULL) && (started < depth); started++)
+            if(pthread_create(&readers[started], NULL, pread_worker, &b))
+                break;
+        if(started == 0)
+            pread_worker(&b);       //Reads on the calling thread
+        for(i = 0; i < started; i++)
+            pthread_join(readers[i], NULL);
+        mem_free(readers);
+    }
+
+    queue_close(&b.queue);
+    for(i = 0; i < decode_n; i++)
+        pthread_join(decoders[i], NULL);
+    mem_free(decoders);
+    queue_destroy(&b.queue);
+
+    return PNGDECODER_OK;
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static void * decode_worker(void * user){
+    batch * b = (batch *) user;
+    PNGdecoder_PNG * png;
+    PNGdecoder_result result;
+    load_job job;
+
+    while(queue_pop(&b->queue, &job)){
+        png = NULL;
+        result = job.result;
+        if(result == PNGDECODER_OK)
+            result = PNGdecoder_open_bytes(job.bytes, job.size, &b->options, &png);
+        b->callback(b->user, job.index, result, (result == PNGDECODER_OK) ? png : NULL);
+    }
+
+    return NULL;
+}
+
+static void * pread_worker(void * user){
+    batch * b = (batch *) user;
+    uint32_t index;
+
+    while((index = __atomic_fetch_add(&b->next_file, 1, __ATOMIC_RELAXED)) < b->n)
+        queue_push(&b->queue, read_file_blocking(b->file_names[index], index));
+
+    return NULL;
+}
+
+static load_job read_file_blocking(const char * file_name, uint32_t index){
+    load_job job = { index, NULL, 0, PNGDECODER_FILE_OPEN_ERROR };
+    struct stat info;
+    uint64_t done = 0;
+    ssize_t got;
+    int fd;
+
+    fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return job;
+    if(fstat(fd, &info) || (info.st_size < 8) || ((uint64_t) info.st_size > SIZE_MAX)){
+        close(fd);
+        return job;
+    }
+
+    job.bytes = (uint8_t *) mem_malloc(info.st_size);
+    if(job.bytes == NULL){
+        close(fd);
+        job.result = PNGDECODER_MEMORY_ERROR;
+        return job;
+    }
+    while(done < (uint64_t) info.st_size){
+        got = pread(fd, job.bytes + done, info.st_size - done, done);
+        if((got < 0) && (errno == EINTR))
+            continue;
+        if(got <= 0)
+            break;
+        done += got;
+    }
+    close(fd);
+
+    if(done != (uint64_t) info.st_size){
+        mem_free(job.bytes);
+        job.bytes = NULL;
+        return job;
+    }
+    job.size = info.st_size;
+    job.result = PNGDECODER_OK;
+    return job;
+}
+
+static void uring_read_all(batch * b, uring * ring, uint32_t depth){
+    uring_slot * slots = (uring_slot *) mem_calloc(depth, sizeof(uring_slot));
+    struct io_uring_sqe * sqe;
+    struct io_uring_cqe * cqe;
+    load_job job;
+    uring_slot * slot;
+    struct stat info;
+    uint32_t next = 0, finished = 0, head, i;
+    int32_t res;
+
+    if(slots == NULL)
+        depth = 0;      //Everything goes through blocking reads below
+
+    while((finished < b->n) && (depth > 0)){
+        //Every free slot opens the next file
+        for(i = 0; (i < depth) && (next < b->n); i++){
+            if(slots[i].state != SLOT_FREE)
+                continue;
+            slots[i].state = SLOT_OPENING;
+            slots[i].index = next++;
+            sqe = uring_sqe(ring);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t) b->file_names[slots[i].index];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = i;
+        }
+
+        if(!uring_submit_wait(ring))
+            break;
+
+        for(head = __atomic_load_n(ring->cq_head, __ATOMIC_RELAXED); head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE); head++){
+            cqe = &ring->cqes[head & ring->cq_mask];
+            slot = &slots[cqe->user_data];
+            res = cqe->res;
+            job = (load_job){ slot->index, NULL, 0, PNGDECODER_FILE_OPEN_ERROR };
+
+            if(slot->state == SLOT_OPENING){
+                if(res < 0)
+                    goto done;
+                slot->fd = res;
+                if(fstat(slot->fd, &info) || (info.st_size < 8) || ((uint64_t) info.st_size > SIZE_MAX)){
+                    close(slot->fd);
+                    goto done;
+                }
+                slot->state = SLOT_READING;
+                slot->size = info.st_size;
+                slot->done = 0;
+                slot->bytes = (uint8_t *) mem_malloc(slot->size);
+                if(slot->bytes == NULL){
+                    close(slot->fd);
+                    job.result = PNGDECODER_MEMORY_ERROR;
+                    goto done;
+                }
+            } else {
+                if(res <= 0){
+                    if(res == -EINTR || res == -EAGAIN)
+                        res = 0;        //Retried below
+                    else {
+                        close(slot->fd);
+                        mem_free(slot->bytes);
+                        goto done;
+                    }
+                }
+                slot->done += res;
+                if(slot->done == slot->size){
+                    close(slot->fd);
+                    job.bytes = slot->bytes;
+                    job.size = slot->size;
+                    job.result = PNGDECODER_OK;
+                    goto done;
+                }
+            }
+
+            //Reads the rest, short reads continue where they stopped
+            sqe = uring_sqe(ring);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = slot->fd;
+            sqe->addr = (uintptr_t)(slot->bytes + slot->done);
+            sqe->len = ((slot->size - slot->done) < uring_read_max) ? slot->size - slot->done : uring_read_max;
+            sqe->off = slot->done;
+            sqe->user_data = cqe->user_data;
+            continue;
+
+            done:
+            slot->state = SLOT_FREE;
+            slot->bytes = NULL;
+            finished++;
+            queue_push(&b->queue, job);     //Decoded as soon as a decoder is free
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    //Only if io_uring_enter failed: whatever is left goes through blocking reads, once the kernel is done with it
+    if(depth > 0)
+        uring_drain(ring, slots, depth);
+    for(i = 0; i < depth; i++)
+        if(slots[i].state != SLOT_FREE){
+            if(slots[i].state == SLOT_READING)
+                close(slots[i].fd);     //Still in flight: the read holds its own reference, the buffer is leaked
+            else
+                mem_free(slots[i].bytes);
+            queue_push(&b->queue, read_file_blocking(b->file_names[slots[i].index], slots[i].index));
+        }
+    for(; next < b->n; next++)
+        queue_push(&b->queue, read_file_blocking(b->file_names[next], next));
+
+    mem_free(slots);
+}
+
+static bool uring_init(uring * ring, uint32_t depth){
+    struct io_uring_params params;
+    struct io_uring_probe * probe;
+    size_t probe_size = sizeof(struct io_uring_probe) + (256 * sizeof(struct io_uring_probe_op));
+    bool supported;
+
+    memset(ring, 0, sizeof(uring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2 * depth;      //One completion in flight per slot, with margin
+    ring->fd = syscall(__NR_io_uring_setup, depth, &params);
+    if(ring->fd < 0)
+        return false;
+
+    probe = (struct io_uring_probe *) mem_calloc(1, probe_size);
+    supported = (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0) &&
+                (probe->last_op >= IORING_OP_READ) &&
+                (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    mem_free(probe);
+    if(!supported){
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    ring->cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if((ring->sq_ring == MAP_FAILED) || (ring->cq_ring == MAP_FAILED) || (ring->sqes == MAP_FAILED)){
+        if(ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        if(ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+        if(ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sq_head = (uint32_t *)((uint8_t *) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (uint32_t *)((uint8_t *) ring->sq_ring + params.sq_off.tail);
+    ring->sq_array = (uint32_t *)((uint8_t *) ring->sq_ring + params.sq_off.array);
+    ring->sq_mask = *(uint32_t *)((uint8_t *) ring->sq_ring + params.sq_off.ring_mask);
+    ring->cq_head = (uint32_t *)((uint8_t *) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (uint32_t *)((uint8_t *) ring->cq_ring + params.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *)((uint8_t *) ring->cq_ring + params.cq_off.cqes);
+    ring->cq_mask = *(uint32_t *)((uint8_t *) ring->cq_ring + params.cq_off.ring_mask);
+
+    return true;
+}
+
+static void uring_free(uring * ring){
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sqes, ring->sqes_size);
+    close(ring->fd);
+}
+
+static struct io_uring_sqe * uring_sqe(uring * ring){
+    uint32_t tail = *ring->sq_tail + ring->queued;
+    uint32_t index = tail & ring->sq_mask;
+    struct io_uring_sqe * sqe = &ring->sqes[index];
+
+    //At most one SQE per slot is pending and the ring has a slot per queue depth entry, so it never overflows
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->queued++;
+    return sqe;
+}
+
+static bool uring_submit_wait(uring * ring){
+    uint32_t submitted = ring->queued;
+    long entered;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+    ring->queued = 0;
+    do{
+        entered = syscall(__NR_io_uring_enter, ring->fd, submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(entered < 0){
+            if((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY))
+                continue;
+            return false;
+        }
+        submitted -= ((uint32_t) entered < submitted) ? (uint32_t) entered : submitted;
+    }while(submitted > 0);
+
+    return true;
+}
+
+static bool uring_drain(uring * ring, uring_slot * slots, uint32_t depth){
+    struct io_uring_cqe * cqe;
+    uring_slot * slot;
+    uint32_t in_flight = 0, unsubmitted, head, i;
+    long entered;
+
+    //Every slot opening or reading owns exactly one SQE, submitted or not
+    for(i = 0; i < depth; i++)
+        if(slots[i].state != SLOT_FREE)
+            in_flight++;
+
+    while(in_flight > 0){
+        unsubmitted = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        entered = syscall(__NR_io_uring_enter, ring->fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if((entered < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+            return false;
+
+        for(head = __atomic_load_n(ring->cq_head, __ATOMIC_RELAXED); head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE); head++){
+            cqe = &ring->cqes[head & ring->cq_mask];
+            slot = &slots[cqe->user_data];
+            if(slot->state == SLOT_OPENING){
+                if(cqe->res >= 0)
+                    close(cqe->res);
+            } else {
+                close(slot->fd);
+            }
+            slot->state = SLOT_STOPPED;
+            in_flight--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+static bool queue_init(job_queue * queue, uint32_t capacity){
+    queue->jobs = (load_job *) mem_malloc((uint64_t) capacity * sizeof(load_job));
+    if(queue->jobs == NULL)
+        return false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    return true;
+}
+
+static void queue_destroy(job_queue * queue){
+    mem_free(queue->jobs);
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+static void queue_push(job_queue * queue, load_job job){
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->capacity)
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static bool queue_pop(job_queue * queue, load_job * job){
+    pthread_mutex_lock(&queue->lock);
+    while((queue->count == 0) && !queue->closed)
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    if(queue->count == 0){
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    *job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+static void queue_close(job_queue * queue){
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <time.h>
+#include <pthread.h>
+
+#define PNGdecoder_IMPORT
+#include <PNGdecoder/PNGdecoder.h>
+
+#include "memory.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+static __thread PNGdecoder_memory_stats thread_stats;       //Allocations of the calling thread, only it writes them
+static __thread PNGdecoder_memory_stats * thread_scope;     //Decode the calling thread works for, NULL for none
+
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t budget_released = PTHREAD_COND_INITIALIZER;     //Signaled when reservations or the budget change
+static uint64_t budget;                                     //Process budget, 0 for none
+static uint64_t budget_reserved;                            //Bytes reserved by the decodes in progress
+
+static const uint64_t block_overhead = 8;                   //Size field of a heap block
+static const uint64_t block_granularity = 16;
+static const uint64_t mapped_threshold = 128 * 1024;        //Default threshold of glibc, larger blocks are mapped
+static const uint64_t page_size = 4096;
+
+//Counts a new block of the given usable size(argument 1), a freed one if negative, against the calling thread and its
+//scope; account_scope only against the given scope
+static void account(int64_t, bool);
+static void account_scope(PNGdecoder_memory_stats *, int64_t, bool);
+
+
+/*      INTERFACE       */
+
+
+void * mem_malloc(size_t size){
+    void * block = malloc(size);
+
+    if(block != NULL)
+        account(malloc_usable_size(block), true);
+    return block;
+}
+
+void * mem_calloc(size_t n, size_t size){
+    void * block = calloc(n, size);
+
+    if(block != NULL)
+        account(malloc_usable_size(block), true);
+    return block;
+}
+
+void * mem_realloc(void * block, size_t size){
+    int64_t before = (block != NULL) ? (int64_t) malloc_usable_size(block) : 0;
+    void * resized = realloc(block, size);
+
+    if(resized == NULL)
+        return NULL;        //Still holding the old block, or freed it for a size of 0
+    account(-before, false);
+    account(malloc_usable_size(resized), true);
+    return resized;
+}
+
+void * mem_aligned_alloc(size_t alignment, size_t size){
+    void * block = aligned_alloc(alignment, size);
+
+    if(block != NULL)
+        account(malloc_usable_size(block), true);
+    return block;
+}
+
+void mem_free(void * block){
+    if(block == NULL)
+        return;
+
+    account(-(int64_t) malloc_usable_size(block), false);
+    free(block);
+}
+
+void * mem_zlib_alloc(void * opaque, unsigned int items, unsigned int size){
+    return mem_calloc(items, size);
+}
+
+void mem_zlib_free(void * opaque, void * block){
+    mem_free(block);
+}
+
+PNGdecoder_memory_stats * memory_scope_enter(PNGdecoder_memory_stats * scope){
+    PNGdecoder_memory_stats * previous = thread_scope;
+
+    thread_scope = scope;
+    return previous;
+}
+
+PNGdecoder_memory_stats * memory_scope_current(void){
+    return thread_scope;
+}
+
+void memory_scope_adopt(PNGdecoder_memory_stats * scope, const void * block){
+    if((scope != NULL) && (block != NULL))
+        account_scope(scope, malloc_usable_size((void *) block), true);
+}
+
+bool memory_budget_acquire(uint64_t bytes, uint32_t timeout){
+    struct timespec deadline;
+    bool acquired = true;
+
+    if(timeout != PNGDECODER_WAIT_FOREVER){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&budget_lock);
+    while((budget != 0) && (budget_reserved + bytes > budget)){
+        if((bytes > budget) || (timeout == 0)){
+            acquired = false;
+            break;
+        }
+        if(timeout == PNGDECODER_WAIT_FOREVER)
+            pthread_cond_wait(&budget_released, &budget_lock);
+        else if(pthread_cond_timedwait(&budget_released, &budget_lock, &deadline) != 0){
+            acquired = (budget == 0) || (budget_reserved + bytes <= budget);
+            break;
+        }
+    }
+    if(acquired)
+        budget_reserved += bytes;
+    pthread_mutex_unlock(&budget_lock);
+
+    return acquired;
+}
+
+void memory_budget_release(uint64_t bytes){
+    pthread_mutex_lock(&budget_lock);
+    budget_reserved -= bytes;
+    pthread_cond_broadcast(&budget_released);
+    pthread_mutex_unlock(&budget_lock);
+}
+
+uint64_t memory_block_size(uint64_t size){
+    uint64_t chunk = (size + block_overhead + block_granularity - 1) / block_granularity * block_granularity;
+
+    if(chunk >= mapped_threshold)
+        return ((chunk + block_overhead + page_size - 1) / page_size * page_size) - (2 * block_overhead);
+    if(chunk < (2 * block_granularity))
+        chunk = 2 * block_granularity;
+
+    return chunk + block_granularity - block_overhead;   //Free blocks less than a minimum block too large are handed out whole
+}
+
+void PNGdecoder_set_memory_budget(uint64_t bytes){
+    pthread_mutex_lock(&budget_lock);
+    budget = bytes;
+    pthread_cond_broadcast(&budget_released);
+    pthread_mutex_unlock(&budget_lock);
+}
+
+void PNGdecoder_get_memory_budget(uint64_t * bytes, uint64_t * reserved){
+    pthread_mutex_lock(&budget_lock);
+    if(bytes != NULL)
+        *bytes = budget;
+    if(reserved != NULL)
+        *reserved = budget_reserved;
+    pthread_mutex_unlock(&budget_lock);
+}
+
+void PNGdecoder_get_thread_memory_stats(PNGdecoder_memory_stats * stats){
+    if(stats != NULL)
+        *stats = thread_stats;
+}
+
+void PNGdecoder_reset_thread_memory_stats(void){
+    thread_stats.peak = thread_stats.current;
+    thread_stats.total = 0;
+    thread_stats.allocations = 0;
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static void account(int64_t bytes, bool allocation){
+    thread_stats.current += bytes;
+    if(thread_stats.current > thread_stats.peak)
+        thread_stats.peak = thread_stats.current;
+    if(allocation){
+        thread_stats.total += bytes;
+        thread_stats.allocations++;
+    }
+
+    if(thread_scope != NULL)
+        account_scope(thread_scope, bytes, allocation);
+}
+
+static void account_scope(PNGdecoder_memory_stats * scope, int64_t bytes, bool allocation){
+    int64_t current, peak;
+
+    current = __atomic_add_fetch(&scope->current, bytes, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&scope->peak, __ATOMIC_RELAXED);
+    while((current > peak) && !__atomic_compare_exchange_n(&scope->peak, &peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if(allocation){
+        __atomic_fetch_add(&scope->total, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&scope->allocations, 1, __ATOMIC_RELAXED);
+    }
+}
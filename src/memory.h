@@ -0,0 +1,45 @@
+#ifndef PNGdecoder_MEMORY_H
+#define PNGdecoder_MEMORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      ALLOCATION ACCOUNTING       */
+
+//Every heap allocation of the library goes through these: they count the usable size the allocator reports for each
+//block against the calling thread and against the scope it works for(a decode), so frees need no size and blocks
+//handed to the caller can still be released with free()
+
+
+void * mem_malloc(size_t);
+void * mem_calloc(size_t, size_t);
+void * mem_realloc(void *, size_t);
+//Argument 1: alignment, a power of two, Argument 2: size, a multiple of it
+void * mem_aligned_alloc(size_t, size_t);
+void mem_free(void *);
+
+//zlib allocation functions(alloc_func, free_func), for the zalloc and zfree fields of z_stream
+void * mem_zlib_alloc(void *, unsigned int, unsigned int);
+void mem_zlib_free(void *, void *);
+
+//Makes the calling thread also count its allocations and frees in the given scope(NULL for none), whose fields are
+//updated atomically so that the threads of a decode can share it; returns the previous scope, to restore afterwards
+PNGdecoder_memory_stats * memory_scope_enter(PNGdecoder_memory_stats *);
+PNGdecoder_memory_stats * memory_scope_current(void);
+
+//Counts a block allocated outside the scope(the file bytes of a decode, read by another thread) as allocated in it
+void memory_scope_adopt(PNGdecoder_memory_stats *, const void *);
+
+//Reserves bytes of the process budget(see PNGdecoder_set_memory_budget), waiting up to the given milliseconds or
+//PNGDECODER_WAIT_FOREVER for other decodes to release enough; false if they exceed the whole budget or the wait times
+//out. Without a budget it only counts them
+bool memory_budget_acquire(uint64_t, uint32_t);
+void memory_budget_release(uint64_t);
+
+//Usable size the allocator gives a request of the given bytes, an upper bound, for predictions
+uint64_t memory_block_size(uint64_t);
+
+#endif // PNGdecoder_MEMORY_H
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <PNGdecoder/PNGdecoder.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "kernels.h"
+
+//Times the hot kernels one at a time over synthetic rows, every CPU level next to the scalar reference(a level only
+//appears for the kernels it replaces), then PNGdecoder_as_RGBA8 on an image of the same rows through the bound level.
+//Each sample is a number of back to back calls; samples follow the warmup ones, on a pinned CPU
+
+typedef struct _bench_data {
+  uint32_t width;
+  uint8_t bpp;
+  uint32_t row_size;                //width * bpp, the input of every kernel
+  uint8_t * row;
+  uint8_t * previous;
+  uint8_t * out;                    //Room for 8 output bytes per input byte
+  PNGdecoder_RGBA8_t palette[256];
+} bench_data;
+
+typedef struct _bench_kernel {
+  const char * name;
+  size_t slot;                      //Offset of the kernel in kernel_table
+  void (*run)(const kernel_table *, bench_data *);
+} bench_kernel;
+
+typedef struct _bench_settings {
+  uint32_t samples;
+  uint32_t warmup;
+  uint32_t calls;                   //Per sample
+  const char * only;                //Kernel name filter, NULL for all
+} bench_settings;
+
+static const char * level_names[PNGDECODER_CPU_LEVELS_COUNT] = { "scalar", "sse2", "sse4", "avx2" };
+
+static volatile uint32_t crc_sink;
+
+static void run_crc(const kernel_table * t, bench_data * d) { crc_sink = t->crc_update(crc_sink, d->row, d->row_size); }
+static void run_unfilter_none(const kernel_table * t, bench_data * d) { t->unfilter[0](d->out, d->row, d->previous, d->row_size, d->bpp); }
+static void run_unfilter_sub(const kernel_table * t, bench_data * d) { t->unfilter[1](d->out, d->row, d->previous, d->row_size, d->bpp); }
+static void run_unfilter_up(const kernel_table * t, bench_data * d) { t->unfilter[2](d->out, d->row, d->previous, d->row_size, d->bpp); }
+static void run_unfilter_avg(const kernel_table * t, bench_data * d) { t->unfilter[3](d->out, d->row, d->previous, d->row_size, d->bpp); }
+static void run_unfilter_paeth(const kernel_table * t, bench_data * d) { t->unfilter[4](d->out, d->row, d->previous, d->row_size, d->bpp); }
+static void run_unpack1(const kernel_table * t, bench_data * d) { t->unpack_subbyte(d->out, d->row, d->row_size * 8, 1, true); }
+static void run_unpack2(const kernel_table * t, bench_data * d) { t->unpack_subbyte(d->out, d->row, d->row_size * 4, 2, true); }
+static void run_unpack4(const kernel_table * t, bench_data * d) { t->unpack_subbyte(d->out, d->row, d->row_size * 2, 4, true); }
+static void run_palette_RGB8(const kernel_table * t, bench_data * d) { t->palette_RGB8((PNGdecoder_RGB8_t *) d->out, d->row, d->row_size, d->palette); }
+static void run_palette_RGBA8(const kernel_table * t, bench_data * d) { t->palette_RGBA8((PNGdecoder_RGBA8_t *) d->out, d->row, d->row_size, d->palette); }
+static void run_swap16(const kernel_table * t, bench_data * d) { t->swap16((uint16_t *) d->out, d->row, d->row_size / 2); }
+static void run_strip16_high(const kernel_table * t, bench_data * d) { t->strip16(d->out, d->row, d->row_size / 2, PNGDECODER_STRIP16_HIGH_BYTE); }
+static void run_strip16_round(const kernel_table * t, bench_data * d) { t->strip16(d->out, d->row, d->row_size / 2, PNGDECODER_STRIP16_ROUND); }
+static void run_premultiply8(const kernel_table * t, bench_data * d) { t->premultiply8(d->out, d->row_size / 4, 4); }
+static void run_premultiply16(const kernel_table * t, bench_data * d) { t->premultiply16((uint16_t *) d->out, d->row_size / 8, 4); }
+static void run_G8_to_RGBA8(const kernel_table * t, bench_data * d) { t->G8_to_RGBA8((PNGdecoder_RGBA8_t *) d->out, d->row, d->row_size); }
+static void run_G8A_to_RGBA8(const kernel_table * t, bench_data * d) { t->G8A_to_RGBA8((PNGdecoder_RGBA8_t *) d->out, (const PNGdecoder_grayscale8a_t *) d->row, d->row_size / 2); }
+static void run_RGB8_to_RGBA8(const kernel_table * t, bench_data * d) { t->RGB8_to_RGBA8((PNGdecoder_RGBA8_t *) d->out, (const PNGdecoder_RGB8_t *) d->row, d->row_size / 3); }
+
+#define SLOT(field) offsetof(kernel_table, field)
+#define UNFILTER_SLOT(i) (offsetof(kernel_table, unfilter) + ((i) * sizeof(unfilter_fn)))
+
+static const bench_kernel kernels[] = {
+  { "crc_update", SLOT(crc_update), run_crc },
+  { "unfilter_none", UNFILTER_SLOT(0), run_unfilter_none },
+  { "unfilter_sub", UNFILTER_SLOT(1), run_unfilter_sub },
+  { "unfilter_up", UNFILTER_SLOT(2), run_unfilter_up },
+  { "unfilter_avg", UNFILTER_SLOT(3), run_unfilter_avg },
+  { "unfilter_paeth", UNFILTER_SLOT(4), run_unfilter_paeth },
+  { "unpack_subbyte_1", SLOT(unpack_subbyte), run_unpack1 },
+  { "unpack_subbyte_2", SLOT(unpack_subbyte), run_unpack2 },
+  { "unpack_subbyte_4", SLOT(unpack_subbyte), run_unpack4 },
+  { "palette_RGB8", SLOT(palette_RGB8), run_palette_RGB8 },
+  { "palette_RGBA8", SLOT(palette_RGBA8), run_palette_RGBA8 },
+  { "swap16", SLOT(swap16), run_swap16 },
+  { "strip16_high_byte", SLOT(strip16), run_strip16_high },
+  { "strip16_round", SLOT(strip16), run_strip16_round },
+  { "premultiply8", SLOT(premultiply8), run_premultiply8 },
+  { "premultiply16", SLOT(premultiply16), run_premultiply16 },
+  { "G8_to_RGBA8", SLOT(G8_to_RGBA8), run_G8_to_RGBA8 },
+  { "G8A_to_RGBA8", SLOT(G8A_to_RGBA8), run_G8A_to_RGBA8 },
+  { "RGB8_to_RGBA8", SLOT(RGB8_to_RGBA8), run_RGB8_to_RGBA8 }
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+//Time stamp counter, serialized so that the measured calls cannot move across it
+static uint64_t now_cycles(void) {
+#ifdef HAVE_RDTSC
+  uint64_t t;
+  _mm_lfence();
+  t = __rdtsc();
+  _mm_lfence();
+  return t;
+#else
+  return 0;
+#endif
+}
+
+static int compare_doubles(const void * a, const void * b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+//Prints min, median, p90, mean and relative standard deviation of the cycles per byte, and the median ns per byte
+static void report(const char * name, const char * level, uint64_t bytes, double * cycles, double * ns, uint32_t n) {
+  double mean = 0, variance = 0;
+  uint32_t i;
+
+  for(i = 0; i < n; i++)
+    mean += cycles[i];
+  mean /= n;
+  for(i = 0; i < n; i++)
+    variance += (cycles[i] - mean) * (cycles[i] - mean);
+  qsort(cycles, n, sizeof(double), compare_doubles);
+  qsort(ns, n, sizeof(double), compare_doubles);
+
+#ifdef HAVE_RDTSC
+  printf("%-20s %-7s %10llu %9.3f %9.3f %9.3f %9.3f %7.1f%% %9.4f\n", name, level, (unsigned long long) bytes,
+         cycles[0], cycles[n / 2], cycles[(n * 9) / 10], mean, (mean > 0) ? 100 * sqrt(variance / n) / mean : 0, ns[n / 2]);
+#else
+  printf("%-20s %-7s %10llu %9s %9s %9s %9s %8s %9.4f\n", name, level, (unsigned long long) bytes, "-", "-", "-", "-", "-", ns[n / 2]);
+#endif
+}
+
+static void bench_kernel_level(const bench_kernel * k, const kernel_table * t, bench_data * d, const bench_settings * s) {
+  double * cycles = (double *) malloc(s->samples * sizeof(double));
+  double * ns = (double *) malloc(s->samples * sizeof(double));
+  uint64_t bytes = (uint64_t) d->row_size * s->calls, c0, t0;
+  uint32_t i, j;
+
+  for(i = 0; i < s->warmup + s->samples; i++){
+    t0 = now_ns();
+    c0 = now_cycles();
+    for(j = 0; j < s->calls; j++)
+      k->run(t, d);
+    if(i >= s->warmup){
+      cycles[i - s->warmup] = (double) (now_cycles() - c0) / bytes;
+      ns[i - s->warmup] = (double) (now_ns() - t0) / bytes;
+    }
+  }
+
+  report(k->name, level_names[t->level], d->row_size, cycles, ns, s->samples);
+  free(cycles);
+  free(ns);
+}
+
+//PNGdecoder_as_RGBA8 through the public interface: the rows are written as a stored PNG of the raster type matching the
+//bytes per pixel and decoded once; each call converts the whole raster
+static void bench_as_RGBA8(bench_data * d, const bench_settings * s, uint32_t rows) {
+  static const PNGdecoder_raster_types types[9] = {
+    PNGDECODER_RASTER_INVALID, PNGDECODER_RASTER_GRAYSCALE_8, PNGDECODER_RASTER_GRAYSCALE_8A, PNGDECODER_RASTER_RGB_8,
+    PNGDECODER_RASTER_RGBA_8, PNGDECODER_RASTER_INVALID, PNGDECODER_RASTER_RGB_16, PNGDECODER_RASTER_INVALID, PNGDECODER_RASTER_RGBA_16
+  };
+  PNGdecoder_raster_types type = types[d->bpp];
+  PNGdecoder_raster_grayscale8_t raster = { d->width, rows, NULL };
+  PNGdecoder_encode_options options;
+  PNGdecoder_PNG * png = NULL;
+  char file_name[] = "/tmp/microbench_XXXXXX";
+  double * cycles, * ns;
+  uint64_t bytes = (uint64_t) d->row_size * rows, c0, t0;
+  uint32_t i, y;
+  int fd;
+
+  if(type == PNGDECODER_RASTER_INVALID){
+    printf("%-20s skipped, no raster type of %u bytes per pixel\n", "as_RGBA8", d->bpp);
+    return;
+  }
+  fd = mkstemp(file_name);
+  if(fd < 0)
+    return;
+  close(fd);
+
+  raster.raster = (uint8_t *) malloc(bytes);
+  for(y = 0; y < rows; y++)
+    memcpy(raster.raster + ((uint64_t) y * d->row_size), d->row, d->row_size);
+  PNGdecoder_encode_options_init(&options);
+  options.level = 0;
+  if((PNGdecoder_encode(file_name, &raster, type, &options) != PNGDECODER_OK) || (PNGdecoder_openPNG(file_name, &png) != PNGDECODER_OK)){
+    printf("%-20s failed to prepare the image\n", "as_RGBA8");
+    free(raster.raster);
+    remove(file_name);
+    return;
+  }
+  free(raster.raster);
+  remove(file_name);
+
+  cycles = (double *) malloc(s->samples * sizeof(double));
+  ns = (double *) malloc(s->samples * sizeof(double));
+  for(i = 0; i < s->warmup + s->samples; i++){
+    t0 = now_ns();
+    c0 = now_cycles();
+    PNGdecoder_raster_free(PNGdecoder_as_RGBA8(png), PNGDECODER_RASTER_RGBA_8);
+    if(i >= s->warmup){
+      cycles[i - s->warmup] = (double) (now_cycles() - c0) / bytes;
+      ns[i - s->warmup] = (double) (now_ns() - t0) / bytes;
+    }
+  }
+  report("as_RGBA8", level_names[PNGdecoder_get_cpu_level()], bytes, cycles, ns, s->samples);
+
+  free(cycles);
+  free(ns);
+  PNGdecoder_free(png);
+}
+
+static void usage(const char * name) {
+  printf("Usage: %s [--width <pixels>] [--bpp <1-8>] [--samples <n>] [--warmup <n>] [--calls <n>] [--cpu <n>]\n"
+         "       [--rows <n>] [--kernel <name>]\n"
+         "  Kernels take width * bpp bytes per call, bpp is also the filter distance; --rows sizes the as_RGBA8 image\n", name);
+}
+
+int main(int argc, char * argv[]){
+  bench_settings settings = { 200, 20, 16, NULL };
+  bench_data data;
+  uint32_t width = 4096, rows = 256, i;
+  int bpp = 4, cpu = -1, level;
+  const kernel_table * table, * below;
+  cpu_set_t set;
+
+  for(i = 1; i < (uint32_t) argc; i++){
+    if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--width")) width = strtoul(argv[++i], NULL, 10);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--bpp")) bpp = atoi(argv[++i]);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--samples")) settings.samples = strtoul(argv[++i], NULL, 10);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--warmup")) settings.warmup = strtoul(argv[++i], NULL, 10);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--calls")) settings.calls = strtoul(argv[++i], NULL, 10);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--cpu")) cpu = atoi(argv[++i]);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--rows")) rows = strtoul(argv[++i], NULL, 10);
+    else if((i + 1 < (uint32_t) argc) && !strcmp(argv[i], "--kernel")) settings.only = argv[++i];
+    else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if((width == 0) || (bpp < 1) || (bpp > 8) || (settings.samples == 0) || (settings.calls == 0) || (rows == 0)){
+    usage(argv[0]);
+    return -1;
+  }
+
+  //Pinned to the given CPU, or to the one running now
+  if(cpu < 0)
+    cpu = sched_getcpu();
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if(sched_setaffinity(0, sizeof(set), &set) != 0)
+    printf("Warning: could not pin to CPU %d\n", cpu);
+
+  data.width = width;
+  data.bpp = bpp;
+  data.row_size = width * bpp;
+  data.row = (uint8_t *) malloc(data.row_size);
+  data.previous = (uint8_t *) malloc(data.row_size);
+  data.out = (uint8_t *) malloc((size_t) data.row_size * 8);
+  srand(1);
+  for(i = 0; i < data.row_size; i++){
+    data.row[i] = rand();
+    data.previous[i] = rand();
+  }
+  memcpy(data.out, data.row, data.row_size);
+  for(i = 0; i < 256; i++)
+    data.palette[i] = (PNGdecoder_RGBA8_t){ i, 255 - i, i * 7, 255 };
+
+  printf("CPU %d, row of %u pixels * %d bytes, %u samples of %u calls after %u warmup samples, bound level %s\n",
+         cpu, width, bpp, settings.samples, settings.calls, settings.warmup, level_names[PNGdecoder_get_cpu_level()]);
+  printf("%-20s %-7s %10s %9s %9s %9s %9s %8s %9s\n", "kernel", "level", "bytes", "min c/B", "med c/B", "p90 c/B", "mean c/B", "stddev", "med ns/B");
+
+  for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++){
+    if((settings.only != NULL) && strcmp(settings.only, kernels[i].name))
+      continue;
+    below = NULL;
+    for(level = PNGDECODER_CPU_SCALAR; level < PNGDECODER_CPU_LEVELS_COUNT; level++){
+      table = kernels_get_level((PNGdecoder_cpu_levels) level);
+      if(table == NULL)
+        break;
+      if((below == NULL) || memcmp((const char *) table + kernels[i].slot, (const char *) below + kernels[i].slot, sizeof(void *)))
+        bench_kernel_level(&kernels[i], table, &data, &settings);
+      below = table;
+    }
+  }
+
+  if((settings.only == NULL) || !strcmp(settings.only, "as_RGBA8"))
+    bench_as_RGBA8(&data, &settings, rows);
+
+  free(data.row);
+  free(data.previous);
+  free(data.out);
+  return 0;
+}
@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sidecar.h"
+#include "memory.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+typedef struct _sidecar_header {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t byte_order;        //0x01020304 as the writer stored it, 16 bit samples are in its order
+    int32_t raster_type;
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;             //SIDECAR_LZ4
+    uint32_t options;
+    uint32_t band_rows;         //Rows per compressed band
+    uint64_t stride;            //Bytes per row
+    uint64_t data_offset;       //Pixels, or band table when compressed
+    uint64_t data_size;         //Uncompressed raster bytes
+    uint64_t source_size;
+    uint64_t source_hash;
+} sidecar_header;
+
+typedef struct _sidecar_band {
+    uint64_t offset;
+    uint32_t size;              //Compressed
+    uint32_t rows;
+} sidecar_band;                 //Band table entry, band data follows the table
+
+static const uint8_t sidecar_magic[8] = { 'P', 'N', 'G', 'D', 'R', 'A', 'W', 0x1A };
+static const uint32_t sidecar_version = 1;
+static const uint32_t sidecar_byte_order = 0x01020304;
+static const uint32_t SIDECAR_LZ4 = 1;
+static const uint64_t sidecar_alignment = 4096;    //Pixels start on a page
+static const uint32_t band_bytes = 1 << 16;         //Target uncompressed band size
+
+static const uint8_t pixel_sizes[8] = { 1, 2, 3, 6, 2, 4, 4, 8 };
+
+
+//LZ4 block format, greedy single probe compressor; returns the compressed size, the output must hold lz4_bound bytes,
+//which must fit 32 bits
+static uint64_t lz4_bound(uint64_t);
+static uint32_t lz4_compress(const uint8_t *, uint32_t, uint8_t *);
+//Decompresses exactly the given output size, false on corrupt input
+static bool lz4_decompress(const uint8_t *, uint32_t, uint8_t *, uint32_t);
+
+static bool write_all(FILE *, const void *, uint64_t);
+
+//Fills in everything but the layout(flags, band rows, data offset)
+static void header_init(sidecar_header *, const sidecar_key *, PNGdecoder_raster_types, uint32_t, uint32_t);
+
+
+/*      INTERFACE       */
+
+
+uint32_t sidecar_options(const PNGdecoder_options * options){
+    return (uint32_t) options->strip16 | ((uint32_t) options->premultiply << 8);
+}
+
+PNGdecoder_result sidecar_open(const char * file_name, const sidecar_key * key, sidecar_mapping * result){
+    sidecar_header header;
+    const sidecar_band * bands;
+    struct stat info;
+    uint8_t * base, * raster;
+    uint64_t band_n, i, row = 0;
+    int fd;
+
+    fd = open(file_name, O_RDONLY);
+    if(fd < 0)
+        return PNGDECODER_FILE_OPEN_ERROR;
+    if(fstat(fd, &info) || ((uint64_t) info.st_size < sizeof(sidecar_header))){
+        close(fd);
+        return PNGDECODER_BAD_PNG;
+    }
+    base = (uint8_t *) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return PNGDECODER_FILE_OPEN_ERROR;
+
+    memcpy(&header, base, sizeof(header));
+    if(memcmp(header.magic, sidecar_magic, 8) || (header.version != sidecar_version) ||
+       (header.byte_order != sidecar_byte_order) || (header.raster_type < PNGDECODER_RASTER_GRAYSCALE_8) ||
+       (header.raster_type > PNGDECODER_RASTER_RGBA_16) || (header.width == 0) || (header.height == 0) ||
+       (header.stride != (uint64_t) header.width * pixel_sizes[header.raster_type]) ||
+       (header.height > UINT64_MAX / header.stride) || (header.data_size != header.stride * header.height) ||
+       (header.data_size > SIZE_MAX) || (header.data_offset > (uint64_t) info.st_size))
+        goto stale;
+    if((header.source_size != key->source_size) || (header.source_hash != key->source_hash) || (header.options != key->options))
+        goto stale;
+
+    result->type = header.raster_type;
+    result->width = header.width;
+    result->height = header.height;
+
+    if(!(header.flags & SIDECAR_LZ4)){
+        if((header.data_offset % sidecar_alignment) || (header.data_size > (uint64_t) info.st_size - header.data_offset))
+            goto stale;
+        result->base = base;
+        result->length = info.st_size;
+        result->raster = base + header.data_offset;
+        return PNGDECODER_OK;
+    }
+
+    //Compressed: bands decompress into a private raster, the mapping is not kept; band sizes are 32 bit
+    if((header.band_rows == 0) || (header.data_offset % sizeof(uint64_t)) || (header.band_rows > UINT32_MAX / header.stride))
+        goto stale;
+    band_n = (header.height + header.band_rows - 1) / header.band_rows;
+    if((band_n * sizeof(sidecar_band)) > ((uint64_t) info.st_size - header.data_offset))
+        goto stale;
+    bands = (const sidecar_band *)(base + header.data_offset);
+    raster = (uint8_t *) mem_malloc(header.data_size);
+    if(raster == NULL){
+        munmap(base, info.st_size);
+        return PNGDECODER_MEMORY_ERROR;
+    }
+    for(i = 0; i < band_n; i++){
+        if((bands[i].rows != ((header.height - row < header.band_rows) ? header.height - row : header.band_rows)) ||
+           (bands[i].offset > (uint64_t) info.st_size) || (bands[i].size > (uint64_t) info.st_size - bands[i].offset) ||
+           !lz4_decompress(base + bands[i].offset, bands[i].size, raster + (row * header.stride), bands[i].rows * header.stride)){
+            mem_free(raster);
+            goto stale;
+        }
+        row += bands[i].rows;
+    }
+    munmap(base, info.st_size);
+
+    result->base = NULL;
+    result->length = 0;
+    result->raster = raster;
+    return PNGDECODER_OK;
+
+    stale:
+    munmap(base, info.st_size);
+    return PNGDECODER_BAD_PNG;
+}
+
+void sidecar_close(sidecar_mapping * mapping){
+    if(mapping->base != NULL)
+        munmap(mapping->base, mapping->length);
+    else
+        mem_free(mapping->raster);
+    mapping->base = mapping->raster = NULL;
+}
+
+PNGdecoder_result sidecar_write(const char * file_name, const sidecar_key * key, const void * raster, PNGdecoder_raster_types type,
+                                uint32_t width, uint32_t height, bool compress){
+    static const uint8_t zeros[4096] = { 0 };
+    sidecar_header header;
+    sidecar_band * bands = NULL;
+    uint8_t * packed = NULL;
+    uint64_t band_n = 0, i, row, offset;
+    char * temp_name;
+    bool written, allocated = true;
+    FILE * file;
+
+    header_init(&header, key, type, width, height);
+
+    static uint32_t writes = 0;     //Tells apart temporary files of threads writing the same sidecar
+
+    temp_name = (char *) mem_malloc(strlen(file_name) + 48);
+    if(temp_name == NULL)
+        return PNGDECODER_MEMORY_ERROR;
+    sprintf(temp_name, "%s.%ld.%u.tmp", file_name, (long) getpid(), __atomic_fetch_add(&writes, 1, __ATOMIC_RELAXED));
+    file = fopen(temp_name, "wb");
+    if(file == NULL){
+        mem_free(temp_name);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+
+    if(!compress){
+        header.data_offset = sidecar_alignment;
+        written = write_all(file, &header, sizeof(header)) &&
+                  write_all(file, zeros, sidecar_alignment - sizeof(header)) &&
+                  write_all(file, raster, header.data_size);
+    } else {
+        header.flags = SIDECAR_LZ4;
+        header.band_rows = (header.stride >= band_bytes) ? 1 : band_bytes / header.stride;
+        header.data_offset = sizeof(header);
+        if(lz4_bound((uint64_t) header.band_rows * header.stride) > UINT32_MAX){
+            fclose(file);
+            remove(temp_name);
+            mem_free(temp_name);
+            return PNGDECODER_IMAGE_TOO_LARGE;     //A single row beyond the 32 bit band sizes
+        }
+        band_n = (height + header.band_rows - 1) / header.band_rows;
+        bands = (sidecar_band *) mem_calloc(band_n, sizeof(sidecar_band));
+        packed = (uint8_t *) mem_malloc(lz4_bound((uint64_t) header.band_rows * header.stride));
+        allocated = (bands != NULL) && (packed != NULL);
+
+        //Band table first, filled in and rewritten once the compressed sizes are known
+        written = allocated && write_all(file, &header, sizeof(header)) && write_all(file, bands, band_n * sizeof(sidecar_band));
+        offset = header.data_offset + (band_n * sizeof(sidecar_band));
+        for(i = 0, row = 0; written && (i < band_n); i++){
+            bands[i].rows = (height - row < header.band_rows) ? height - row : header.band_rows;
+            bands[i].offset = offset;
+            bands[i].size = lz4_compress((const uint8_t *) raster + (row * header.stride), bands[i].rows * header.stride, packed);
+            written = write_all(file, packed, bands[i].size);
+            offset += bands[i].size;
+            row += bands[i].rows;
+        }
+        written = written && !fseek(file, header.data_offset, SEEK_SET) && write_all(file, bands, band_n * sizeof(sidecar_band));
+    }
+
+    written = !fclose(file) && written;
+    if(written)
+        written = !rename(temp_name, file_name);
+    if(!written)
+        remove(temp_name);
+
+    mem_free(bands);
+    mem_free(packed);
+    mem_free(temp_name);
+    if(!allocated)
+        return PNGDECODER_MEMORY_ERROR;
+    return written ? PNGDECODER_OK : PNGDECODER_FILE_OPEN_ERROR;
+}
+
+PNGdecoder_result sidecar_create(const char * file_name, const sidecar_key * key, PNGdecoder_raster_types type,
+                                 uint32_t width, uint32_t height, sidecar_mapping * result){
+    sidecar_header header;
+    uint8_t * base;
+    int fd;
+
+    header_init(&header, key, type, width, height);
+    header.data_offset = sidecar_alignment;
+    memset(header.magic, 0, 8);     //Unsigned until the raster is complete
+
+    //Readers still mapping a previous file keep it, the new one gets a new inode
+    unlink(file_name);
+    fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return PNGDECODER_FILE_OPEN_ERROR;
+    if(ftruncate(fd, header.data_offset + header.data_size)){
+        close(fd);
+        unlink(file_name);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+    base = (uint8_t *) mmap(NULL, header.data_offset + header.data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        unlink(file_name);
+        return PNGDECODER_FILE_OPEN_ERROR;
+    }
+    memcpy(base, &header, sizeof(header));
+
+    result->base = base;
+    result->length = header.data_offset + header.data_size;
+    result->raster = base + header.data_offset;
+    result->type = type;
+    result->width = width;
+    result->height = height;
+    return PNGDECODER_OK;
+}
+
+void sidecar_finish(const char * file_name, sidecar_mapping * mapping, bool complete){
+    if(complete){
+        memcpy(mapping->base, sidecar_magic, 8);
+        return;
+    }
+
+    munmap(mapping->base, mapping->length);
+    mapping->base = mapping->raster = NULL;
+    unlink(file_name);
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static bool write_all(FILE * file, const void * data, uint64_t size){
+    return fwrite(data, 1, size, file) == size;
+}
+
+static void header_init(sidecar_header * header, const sidecar_key * key, PNGdecoder_raster_types type, uint32_t width, uint32_t height){
+    memset(header, 0, sizeof(sidecar_header));
+    memcpy(header->magic, sidecar_magic, 8);
+    header->version = sidecar_version;
+    header->byte_order = sidecar_byte_order;
+    header->raster_type = type;
+    header->width = width;
+    header->height = height;
+    header->options = key->options;
+    header->stride = (uint64_t) width * pixel_sizes[type];
+    header->data_size = header->stride * height;
+    header->source_size = key->source_size;
+    header->source_hash = key->source_hash;
+}
+
+static uint64_t lz4_bound(uint64_t size){
+    return size + (size / 255) + 16;
+}
+
+static inline uint32_t read32(const uint8_t * p){
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint8_t * lz4_length(uint8_t * out, uint32_t length){
+    for(; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = length;
+    return out;
+}
+
+static uint8_t * lz4_sequence(uint8_t * out, const uint8_t * literals, uint32_t literal_n, uint32_t offset, uint32_t match_n){
+    uint8_t * token = out++;
+
+    *token = (literal_n >= 15) ? 0xF0 : (literal_n << 4);
+    if(literal_n >= 15)
+        out = lz4_length(out, literal_n - 15);
+    memcpy(out, literals, literal_n);
+    out += literal_n;
+
+    if(match_n == 0)
+        return out;     //Last sequence, literals only
+
+    out[0] = offset & 0xFF;
+    out[1] = offset >> 8;
+    out += 2;
+    match_n -= 4;
+    *token |= (match_n >= 15) ? 0x0F : match_n;
+    if(match_n >= 15)
+        out = lz4_length(out, match_n - 15);
+
+    return out;
+}
+
+static uint32_t lz4_compress(const uint8_t * in, uint32_t size, uint8_t * out){
+    uint32_t table[4096];           //Last position + 1 of each 4 byte hash
+    uint8_t * start = out;
+    uint32_t ip = 0, anchor = 0, ref, length, sequence, h;
+    uint32_t match_limit = (size > 12) ? size - 12 : 0;     //Block format: no match starts in the last 12 bytes
+    uint32_t end_limit = (size > 5) ? size - 5 : 0;         //and the last 5 are literals
+
+    memset(table, 0, sizeof(table));
+    while(ip < match_limit){
+        sequence = read32(in + ip);
+        h = (sequence * 2654435761u) >> 20;
+        ref = table[h];
+        table[h] = ip + 1;
+
+        if((ref != 0) && ((ip - (ref - 1)) <= 0xFFFF) && (read32(in + ref - 1) == sequence)){
+            ref--;
+            for(length = 4; (ip + length < end_limit) && (in[ref + length] == in[ip + length]); length++);
+            out = lz4_sequence(out, in + anchor, ip - anchor, ip - ref, length);
+            ip += length;
+            anchor = ip;
+        } else {
+            ip += 1 + ((ip - anchor) >> 6);     //Skips faster through data that does not compress
+        }
+    }
+    out = lz4_sequence(out, in + anchor, size - anchor, 0, 0);
+
+    return out - start;
+}
+
+static bool lz4_decompress(const uint8_t * in, uint32_t size, uint8_t * out, uint32_t out_size){
+    uint64_t ip = 0, op = 0, length, offset, i;
+    uint8_t token, b;
+
+    while(ip < size){
+        token = in[ip++];
+
+        length = token >> 4;
+        if(length == 15)
+            do{
+                if(ip >= size) return false;
+                b = in[ip++];
+                length += b;
+            }while(b == 255);
+        if((length > size - ip) || (length > out_size - op))
+            return false;
+        memcpy(out + op, in + ip, length);
+        ip += length;
+        op += length;
+
+        if(ip == size)
+            break;      //Last sequence
+
+        if(ip + 2 > size)
+            return false;
+        offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if((offset == 0) || (offset > op))
+            return false;
+
+        length = token & 0x0F;
+        if(length == 15)
+            do{
+                if(ip >= size) return false;
+                b = in[ip++];
+                length += b;
+            }while(b == 255);
+        length += 4;
+        if(length > out_size - op)
+            return false;
+
+        if(offset >= length){
+            memcpy(out + op, out + op - offset, length);
+        } else {
+            for(i = 0; i < length; i++)     //Overlapping, repeats the last offset bytes
+                out[op + i] = out[op + i - offset];
+        }
+        op += length;
+    }
+
+    return op == out_size;
+}
@@ -0,0 +1,59 @@
+#ifndef PNGdecoder_SIDECAR_H
+#define PNGdecoder_SIDECAR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      DECODED RASTER SIDECAR FILES        */
+
+//A sidecar holds the decoded raster of a PNG next to it: a fixed header(sizes, raster type, stride, checksum of the
+//source file and the decode options it was made with) then either the raw pixels at a page aligned offset, mapped
+//as is on later opens, or LZ4 compressed bands of rows decompressed into a new raster
+
+
+typedef struct _sidecar_key {
+    uint64_t source_size;       //PNG file size
+    uint64_t source_hash;       //hash64 of the PNG file
+    uint32_t options;           //Options changing the raster, see sidecar_options
+} sidecar_key;                  //What a sidecar must match to stand for a decode
+
+typedef struct _sidecar_mapping {
+    void * base;                //Whole file mapping, NULL if the raster was decompressed
+    uint64_t length;
+    void * raster;              //Into the mapping, or malloc'd
+    PNGdecoder_raster_types type;
+    uint32_t width;
+    uint32_t height;
+} sidecar_mapping;
+
+
+//Packs the decode options that change the raster
+uint32_t sidecar_options(const PNGdecoder_options *);
+
+//Maps the given sidecar if it is well formed and matches the key, fails otherwise(missing, stale, corrupt, or
+//PNGDECODER_MEMORY_ERROR without memory for a compressed raster)
+//Argument 1: sidecar file name, Argument 2: key, Argument 3: result
+PNGdecoder_result sidecar_open(const char *, const sidecar_key *, sidecar_mapping *);
+
+//Unmaps or frees the raster
+void sidecar_close(sidecar_mapping *);
+
+//Writes a sidecar for the given raster, through a temporary file renamed over the final one so readers never see
+//a partial file
+//Argument 1: sidecar file name, Argument 2: key, Argument 3: raster, Argument 4: raster type, Arguments 5 and 6: width
+//and height, Argument 7: LZ4 compress by bands of rows(PNGDECODER_IMAGE_TOO_LARGE for rows past the 32 bit band sizes)
+PNGdecoder_result sidecar_write(const char *, const sidecar_key *, const void *, PNGdecoder_raster_types, uint32_t, uint32_t, bool);
+
+//Creates an uncompressed sidecar for a raster still to be decoded and maps it writable and shared, so that its pages
+//go to the file rather than to memory; the raster starts zeroed and the sidecar only opens once sidecar_finish marks it
+//complete
+//Argument 1: sidecar file name, Argument 2: key, Argument 3: raster type, Arguments 4 and 5: width and height,
+//Argument 6: result
+PNGdecoder_result sidecar_create(const char *, const sidecar_key *, PNGdecoder_raster_types, uint32_t, uint32_t, sidecar_mapping *);
+
+//Marks a created sidecar complete(argument 3), keeping the mapping, or unmaps and removes it
+void sidecar_finish(const char *, sidecar_mapping *, bool);
+
+#endif // PNGdecoder_SIDECAR_H
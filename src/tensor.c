@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tensor.h"
+
+
+/*      PRIVATE DECLARATIONS/DEFINITIONS        */
+
+
+//Converts to IEEE 754 half precision, rounding to nearest even
+static uint16_t float_to_half(float);
+
+//Channels of each raster type
+static const uint8_t raster_channels[8] = { 1, 1, 3, 3, 2, 2, 4, 4 };
+
+
+/*      INTERFACE       */
+
+
+uint8_t tensor_sample_size(PNGdecoder_tensor_types type){
+    switch(type){
+        case PNGDECODER_TENSOR_U8: return sizeof(uint8_t);
+        case PNGDECODER_TENSOR_F32: return sizeof(float);
+        case PNGDECODER_TENSOR_F16: return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+PNGdecoder_result tensor_writer_init(tensor_writer * writer, const PNGdecoder_tensor * tensor, PNGdecoder_raster_types type,
+                                     uint32_t width, uint32_t height){
+    uint8_t c, channels;
+    uint32_t v;
+    float max;
+
+    if((tensor == NULL) || (tensor->data == NULL) || (type == PNGDECODER_RASTER_INVALID))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(((tensor->width != 0) && (tensor->width != width)) || ((tensor->height != 0) && (tensor->height != height)))
+        return PNGDECODER_INVALID_ARGUMENT;
+    if(tensor_sample_size(tensor->type) == 0)
+        return PNGDECODER_INVALID_ARGUMENT;
+
+    memset(writer, 0, sizeof(tensor_writer));
+    writer->tensor = *tensor;
+    writer->tensor.width = width;
+    writer->tensor.height = height;
+    writer->src_channels = raster_channels[type];
+    writer->src_wide = (type == PNGDECODER_RASTER_GRAYSCALE_16) || (type == PNGDECODER_RASTER_RGB_16) ||
+                       (type == PNGDECODER_RASTER_GRAYSCALE_16A) || (type == PNGDECODER_RASTER_RGBA_16);
+    writer->sample_size = tensor_sample_size(tensor->type);
+
+    channels = (tensor->channels != 0) ? tensor->channels : writer->src_channels;
+    writer->channels = channels;
+    writer->row_stride = tensor->planar ? width : (uint64_t) width * channels;
+    if(tensor->row_stride != 0){
+        if(tensor->row_stride < writer->row_stride)
+            return PNGDECODER_INVALID_ARGUMENT;     //Rows would overlap
+        writer->row_stride = tensor->row_stride;
+    }
+    writer->plane_size = writer->row_stride * height;
+
+    //Grayscale spreads to RGB, missing alpha is opaque, extra alpha is dropped; color cannot go to 1 channel
+    for(c = 0; c < channels; c++){
+        switch(channels){
+            case 1:
+                if(writer->src_channels > 2)
+                    return PNGDECODER_INVALID_ARGUMENT;
+                writer->map[c] = 0;
+                break;
+            case 2:
+                if(writer->src_channels > 2)
+                    return PNGDECODER_INVALID_ARGUMENT;
+                writer->map[c] = (c == 0) ? 0 : ((writer->src_channels == 2) ? 1 : -1);
+                break;
+            case 3:
+                writer->map[c] = (writer->src_channels <= 2) ? 0 : c;
+                break;
+            case 4:
+                if(c < 3)
+                    writer->map[c] = (writer->src_channels <= 2) ? 0 : c;
+                else
+                    writer->map[c] = (writer->src_channels == 2) ? 1 : ((writer->src_channels == 4) ? 3 : -1);
+                break;
+            default:
+                return PNGDECODER_INVALID_ARGUMENT;
+        }
+    }
+
+    //(sample / max - mean) / std folded into a single multiply-add
+    max = writer->src_wide ? 65535.0f : 255.0f;
+    for(c = 0; c < channels; c++){
+        if(tensor->std[c] == 0.0f)
+            return PNGDECODER_INVALID_ARGUMENT;
+        writer->scale[c] = 1.0f / (max * tensor->std[c]);
+        writer->bias[c] = -tensor->mean[c] / tensor->std[c];
+        if(!writer->src_wide)
+            for(v = 0; v < 256; v++){
+                writer->lut_f32[c][v] = ((float) v * writer->scale[c]) + writer->bias[c];
+                writer->lut_f16[c][v] = float_to_half(writer->lut_f32[c][v]);
+            }
+    }
+
+    return PNGDECODER_OK;
+}
+
+void tensor_write_row(const tensor_writer * writer, const void * pixels, uint32_t n, uint32_t x0, uint8_t x_step, uint32_t y){
+    const uint8_t * src8 = (const uint8_t *) pixels;
+    const uint16_t * src16 = (const uint16_t *) pixels;
+    uint8_t c, src_channels = writer->src_channels;
+    int8_t m;
+    uint64_t first, stride;         //In elements
+    uint32_t i;
+    uint8_t * out8;
+    float * out32;
+    uint16_t * out16;
+    float value;
+
+    for(c = 0; c < writer->channels; c++){
+        m = writer->map[c];
+        if(writer->tensor.planar){
+            first = (c * writer->plane_size) + ((uint64_t) y * writer->row_stride) + x0;
+            stride = x_step;
+        } else {
+            first = ((uint64_t) y * writer->row_stride) + ((uint64_t) x0 * writer->channels) + c;
+            stride = (uint64_t) x_step * writer->channels;
+        }
+
+        switch(writer->tensor.type){
+            case PNGDECODER_TENSOR_U8:     //16 bit sources are stripped by the decoder, never seen here
+                out8 = ((uint8_t *) writer->tensor.data) + first;
+                if(m < 0)
+                    for(i = 0; i < n; i++) out8[i * stride] = 0xFF;
+                else
+                    for(i = 0; i < n; i++) out8[i * stride] = src8[(i * src_channels) + m];
+                break;
+            case PNGDECODER_TENSOR_F32:
+                out32 = ((float *) writer->tensor.data) + first;
+                if(m < 0){
+                    value = writer->src_wide ? (65535.0f * writer->scale[c]) + writer->bias[c] : writer->lut_f32[c][0xFF];
+                    for(i = 0; i < n; i++) out32[i * stride] = value;
+                } else if(!writer->src_wide){
+                    for(i = 0; i < n; i++) out32[i * stride] = writer->lut_f32[c][src8[(i * src_channels) + m]];
+                } else {
+                    for(i = 0; i < n; i++) out32[i * stride] = ((float) src16[(i * src_channels) + m] * writer->scale[c]) + writer->bias[c];
+                }
+                break;
+            case PNGDECODER_TENSOR_F16:
+                out16 = ((uint16_t *) writer->tensor.data) + first;
+                if(m < 0){
+                    value = writer->src_wide ? (65535.0f * writer->scale[c]) + writer->bias[c] : writer->lut_f32[c][0xFF];
+                    for(i = 0; i < n; i++) out16[i * stride] = float_to_half(value);
+                } else if(!writer->src_wide){
+                    for(i = 0; i < n; i++) out16[i * stride] = writer->lut_f16[c][src8[(i * src_channels) + m]];
+                } else {
+                    for(i = 0; i < n; i++) out16[i * stride] = float_to_half(((float) src16[(i * src_channels) + m] * writer->scale[c]) + writer->bias[c]);
+                }
+                break;
+        }
+    }
+}
+
+
+/*      PRIVATE FUNCTIONS IMPLEMENTATION        */
+
+
+static uint16_t float_to_half(float f){
+    uint32_t x, sign, mantissa, half, rest, middle, shift;
+    int32_t exponent;
+
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    mantissa = x & 0x7FFFFF;
+    exponent = (int32_t)((x >> 23) & 0xFF);
+
+    if(exponent == 0xFF)                                //Infinity, NaN stays NaN
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+
+    exponent = exponent - 127 + 15;
+    if(exponent >= 0x1F)                                //Too large
+        return sign | 0x7C00;
+
+    if(exponent <= 0){                                  //Subnormal or zero
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        middle = 1u << (shift - 1);
+    } else {
+        half = ((uint32_t) exponent << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1FFF;
+        middle = 0x1000;
+    }
+
+    if((rest > middle) || ((rest == middle) && (half & 1)))
+        half++;                                         //May carry into the exponent, up to infinity, as it should
+
+    return sign | half;
+}
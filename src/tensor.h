@@ -0,0 +1,45 @@
+#ifndef PNGdecoder_TENSOR_H
+#define PNGdecoder_TENSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <PNGdecoder/PNGdecoder.h>
+
+/*      TENSOR OUTPUT       */
+
+//Writes expanded raster rows straight into a caller tensor(PNGdecoder_tensor), converting, normalizing and
+//reordering the samples on the way; everything that does not depend on the pixels is prepared once per image
+
+
+typedef struct _tensor_writer {
+    PNGdecoder_tensor tensor;       //Copy of the caller descriptor, width and height filled in
+    uint8_t channels;               //Output channels
+    uint8_t src_channels;           //Channels of the expanded rows
+    bool src_wide;                  //Expanded rows hold native 16 bit samples
+    int8_t map[4];                  //Source channel of each output channel, -1 for an opaque alpha
+    uint8_t sample_size;            //Output element size in bytes
+    uint64_t row_stride;            //Elements from a row to the next
+    uint64_t plane_size;            //Elements per channel plane
+    float scale[4];                 //out = sample * scale + bias, per output channel
+    float bias[4];
+    float lut_f32[4][256];          //8 bit sources, per output channel
+    uint16_t lut_f16[4][256];
+} tensor_writer;
+
+
+//Checks the tensor against the image and prepares the writer; fails with PNGDECODER_INVALID_ARGUMENT if the sizes
+//differ or the channels cannot be converted(color sources to 1 channel)
+//Argument 1: writer, Argument 2: caller tensor, Argument 3: raster type of the expanded rows, Arguments 4 and 5: image
+//width and height
+PNGdecoder_result tensor_writer_init(tensor_writer *, const PNGdecoder_tensor *, PNGdecoder_raster_types, uint32_t, uint32_t);
+
+//Writes an expanded row, one pixel every x step
+//Argument 1: writer, Argument 2: expanded pixels, Argument 3: number of pixels, Argument 4: column of the first pixel,
+//Argument 5: column step(1 unless interlaced), Argument 6: image row
+void tensor_write_row(const tensor_writer *, const void *, uint32_t, uint32_t, uint8_t, uint32_t);
+
+//Size in bytes of one element of the given tensor type
+uint8_t tensor_sample_size(PNGdecoder_tensor_types);
+
+#endif // PNGdecoder_TENSOR_H
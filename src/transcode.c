@@ -0,0 +1,100 @@
+#include <PNGdecoder/PNGdecoder.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+//Re-encodes PNG files for fast decoding: filter strategy, compression level(0 stores the image data), bands of rows
+//compressed independently with a prIX restart index; palette and sub-byte images are written as 8 bit RGB(A) or gray
+
+const char * filter_names[7] = { "none", "sub", "up", "average", "paeth", "adaptive", "fast" };
+
+const uint8_t pixel_sizes[8] = { 1, 2, 3, 6, 2, 4, 4, 8 };
+
+void usage(const char * name) {
+  printf("Usage: %s [--filter none|sub|up|average|paeth|adaptive|fast] [--level 0-9] [--band-rows <rows>]\n"
+         "       [--idat-size <bytes>] [--verify] <input> <output>\n"
+         "  --verify: decodes the output and compares it with the input\n", name);
+}
+
+//Decodes the written file and compares its raster with the source one
+int verify(const char * filename, PNGdecoder_PNG * source) {
+  PNGdecoder_PNG * png = NULL;
+  PNGdecoder_result result = PNGdecoder_openPNG(filename, &png);
+  if(result != PNGDECODER_OK){
+    printf("Verify: error decoding %s: %s\n", filename, PNGdecoder_strerror(result));
+    return 0;
+  }
+
+  const PNGdecoder_raster_grayscale8_t * expected = PNGdecoder_get_raster(source);
+  const PNGdecoder_raster_grayscale8_t * actual = PNGdecoder_get_raster(png);
+  PNGdecoder_raster_types type = PNGdecoder_get_raster_type(source);
+  int same = (PNGdecoder_get_raster_type(png) == type) && (actual->width == expected->width) && (actual->height == expected->height) &&
+             !memcmp(actual->raster, expected->raster, (size_t) expected->width * expected->height * pixel_sizes[type]);
+  if(!same)
+    printf("Verify: %s does not decode to the input raster\n", filename);
+
+  PNGdecoder_free(png);
+  return same;
+}
+
+int main(int argc, char * argv[]){
+  PNGdecoder_encode_options options;
+  PNGdecoder_encode_options_init(&options);
+  int check = 0, i, f;
+  const char * input = NULL, * output = NULL;
+
+  for(i = 1; i < argc; i++){
+    if(!strcmp(argv[i], "--filter") && (i + 1 < argc)){
+      for(f = 0; (f < 7) && strcmp(argv[i + 1], filter_names[f]); f++);
+      if(f == 7){
+        usage(argv[0]);
+        return -1;
+      }
+      options.filter = (PNGdecoder_filter_strategies) f;
+      i++;
+    } else if(!strcmp(argv[i], "--level") && (i + 1 < argc)){
+      options.level = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "--band-rows") && (i + 1 < argc)){
+      options.band_rows = strtoul(argv[++i], NULL, 10);
+    } else if(!strcmp(argv[i], "--idat-size") && (i + 1 < argc)){
+      options.IDAT_size = strtoul(argv[++i], NULL, 10);
+    } else if(!strcmp(argv[i], "--verify")){
+      check = 1;
+    } else if(input == NULL){
+      input = argv[i];
+    } else if(output == NULL){
+      output = argv[i];
+    } else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if(output == NULL){
+    usage(argv[0]);
+    return -1;
+  }
+
+  PNGdecoder_PNG * png = NULL;
+  PNGdecoder_result result = PNGdecoder_openPNG(input, &png);
+  if(result != PNGDECODER_OK){
+    printf("Error decoding %s: %s\n", input, PNGdecoder_strerror(result));
+    return -2;
+  }
+
+  result = PNGdecoder_encode(output, PNGdecoder_get_raster(png), PNGdecoder_get_raster_type(png), &options);
+  if(result != PNGDECODER_OK){
+    printf("Error encoding %s: %s\n", output, PNGdecoder_strerror(result));
+    PNGdecoder_free(png);
+    return -3;
+  }
+
+  if(check && !verify(output, png)){
+    PNGdecoder_free(png);
+    return -4;
+  }
+
+  PNGdecoder_free(png);
+  return 0;
+}